@@ -0,0 +1,49 @@
+package com.johnsoft.pcalldemo;
+
+import android.os.SystemClock;
+import android.util.Log;
+
+/**
+ * Synthetic call-heavy workload used to compare the agent's call tracing modes
+ * (see pcall/jvmti.sh): run it once per mode and compare the logged times.
+ */
+public final class CallWorkload {
+    private static final String LOG_TAG = "CallWorkload";
+    private static final int ROUNDS = 5;
+
+    private CallWorkload() {
+    }
+
+    public static void start() {
+        new Thread("CallWorkload") {
+            @Override
+            public void run() {
+                for (int round = 0; round < ROUNDS; ++round) {
+                    long start = SystemClock.elapsedRealtimeNanos();
+                    int result = fib(27) + loop(2000000);
+                    long elapsed = SystemClock.elapsedRealtimeNanos() - start;
+                    Log.w(LOG_TAG, "round " + round + ": " + (elapsed / 1000000L)
+                            + " ms (result " + result + ")");
+                }
+            }
+        }.start();
+    }
+
+    // ~630k calls, deep and narrow
+    private static int fib(int n) {
+        return n < 2 ? n : fib(n - 1) + fib(n - 2);
+    }
+
+    // many tiny leaf calls, flat
+    private static int loop(int count) {
+        int sum = 0;
+        for (int i = 0; i < count; ++i) {
+            sum += leaf(i);
+        }
+        return sum;
+    }
+
+    private static int leaf(int value) {
+        return value & 0xff;
+    }
+}
@@ -20,6 +20,13 @@ public class SettingsActivity extends AppCompatActivity {
                 colorIt();
             }
         });
+        v2.setOnLongClickListener(new View.OnLongClickListener() {
+            @Override
+            public boolean onLongClick(View v) {
+                CallWorkload.start();
+                return true;
+            }
+        });
     }
 
     public void setText(final String text) {
@@ -1,7 +1,8 @@
 #!/usr/bin/env bash
 
-if [ $# -ne 1 ]; then
+if [ $# -lt 1 ]; then
     echo "project root path required"
+    echo "usage: jvmti.sh <project root> [agent options, e.g. mode=sample,sample_ms=5]"
     exit
 fi
 cd $1
@@ -24,4 +25,8 @@ adb push $PROJECT_ROOT/pcalla/build/libs/$DEX_NAME /data/local/tmp
 adb shell run-as $PACKAGE cp /data/local/tmp/$SO_NAME ./$SO_NAME
 adb shell run-as $PACKAGE cp /data/local/tmp/$DEX_NAME ./$DEX_NAME
 APP_DATA_PATH=`adb shell run-as $PACKAGE pwd`
-adb shell am attach-agent $PACKAGE $APP_DATA_PATH/$SO_NAME
+if [ -n "$2" ]; then
+    adb shell am attach-agent $PACKAGE $APP_DATA_PATH/$SO_NAME=$2
+else
+    adb shell am attach-agent $PACKAGE $APP_DATA_PATH/$SO_NAME
+fi
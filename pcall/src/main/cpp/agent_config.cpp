@@ -0,0 +1,105 @@
+#include "agent_config.h"
+#include "jvmti_helper.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+namespace profiler {
+
+    static bool ParseInt(const std::string &value, int32_t min, int32_t max, int32_t *out) {
+        char *end = nullptr;
+        long parsed = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || parsed < min || parsed > max) {
+            return false;
+        }
+        *out = static_cast<int32_t>(parsed);
+        return true;
+    }
+
+    static bool ParseMode(const std::string &value, CallTraceMode *out) {
+        if (value == "trace") {
+            *out = kCallTraceMethodEvents;
+        } else if (value == "sample") {
+            *out = kCallTraceSampling;
+        } else if (value == "probe") {
+            *out = kCallTraceProbes;
+        } else if (value == "none") {
+            *out = kCallTraceNone;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    AgentConfig AgentConfig::Parse(const char *options) {
+        AgentConfig config;
+        if (options == nullptr) {
+            return config;
+        }
+
+        std::string remaining(options);
+        while (!remaining.empty()) {
+            size_t comma = remaining.find(',');
+            std::string option = remaining.substr(0, comma);
+            remaining = comma == std::string::npos ? "" : remaining.substr(comma + 1);
+            if (option.empty()) {
+                continue;
+            }
+
+            size_t equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+            bool valid;
+            if (key == "mode") {
+                valid = ParseMode(value, &config.call_trace_mode);
+            } else if (key == "sample_ms") {
+                valid = ParseInt(value, 1, 60000, &config.sample_period_ms);
+            } else if (key == "sample_depth") {
+                valid = ParseInt(value, 1, 1024, &config.sample_max_depth);
+            } else if (key == "sample_budget") {
+                valid = ParseInt(value, 1, 100, &config.sample_budget_percent);
+            } else if (key == "report_ms") {
+                valid = ParseInt(value, 10, 600000, &config.sample_report_ms);
+            } else if (key == "probe_filter") {
+                // '.' separated names are accepted too
+                std::replace(value.begin(), value.end(), '.', '/');
+                config.probe_filter = value;
+                valid = !value.empty();
+            } else if (key == "rule") {
+                config.rules.push_back(value);
+                valid = !value.empty();
+            } else if (key == "rules_file") {
+                config.rules_file = value;
+                valid = !value.empty();
+            } else if (key == "cache_mb") {
+                valid = ParseInt(value, 0, 1024, &config.class_cache_mb);
+            } else if (key == "pretransform") {
+                valid = ParseInt(value, 0, 1, &config.pretransform);
+            } else if (key == "alloc_sample") {
+                valid = ParseInt(value, 1, 1000000, &config.alloc_sample_interval);
+            } else if (key == "heap_graph") {
+                valid = ParseInt(value, 0, 1, &config.heap_graph);
+            } else if (key == "snapshot") {
+                valid = ParseInt(value, 0, 1, &config.snapshot);
+            } else if (key == "monitors") {
+                valid = ParseInt(value, 0, 1, &config.monitors);
+            } else if (key == "gc") {
+                valid = ParseInt(value, 0, 1, &config.gc);
+            } else if (key == "thread_cpu_ms") {
+                valid = ParseInt(value, 0, 600000, &config.thread_cpu_ms);
+            } else if (key == "exceptions") {
+                valid = ParseInt(value, 0, 1, &config.exceptions);
+            } else if (key == "exception_stacks") {
+                valid = ParseInt(value, 0, 1000000, &config.exception_stack_interval);
+            } else {
+                LOGE("AgentConfig: unknown option %s", key.c_str());
+                continue;
+            }
+            if (!valid) {
+                LOGE("AgentConfig: invalid value for %s: %s", key.c_str(), value.c_str());
+            }
+        }
+        return config;
+    }
+
+}  // namespace profiler
@@ -0,0 +1,93 @@
+#ifndef AGENT_CONFIG_H
+#define AGENT_CONFIG_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    enum CallTraceMode {
+        // no call tracing
+        kCallTraceNone,
+        // JVMTI MethodEntry events (forces the interpreter)
+        kCallTraceMethodEvents,
+        // periodic stack sampling from an agent thread
+        kCallTraceSampling,
+        // entry/exit probes injected into the bytecode of matching classes
+        kCallTraceProbes,
+    };
+
+    /**
+     * Agent settings, parsed from the Agent_OnAttach options:
+     *
+     *   am attach-agent <package> <path>/libpcall.so=mode=sample,sample_ms=5
+     *
+     * The options are a comma separated list of key=value pairs:
+     *   mode          : trace (default), sample, probe or none
+     *   sample_ms     : sampling period in milliseconds (default 10)
+     *   sample_depth  : maximum frames captured per stack (default 64)
+     *   sample_budget : maximum share of the agent thread time spent sampling,
+     *                   in percent (default 5)
+     *   report_ms     : how often the sampled stacks, the allocation counts,
+     *                   the monitor wait times and the collection pauses are
+     *                   flushed (default 1000)
+     *   probe_filter  : internal name prefix of the classes instrumented in
+     *                   probe mode (default com/johnsoft/pcalldemo/)
+     *   rule          : an instrumentation rule, with ':' separated fields
+     *                   (see InstrumentationRule), may be repeated
+     *   rules_file    : path of a file with one instrumentation rule per line
+     *   cache_mb      : size budget of the transformed class cache in the
+     *                   app data directory, 0 disables it (default 16)
+     *   pretransform  : 1 (default) to transform the matching classes of the
+     *                   APK on the agent thread before they are loaded, 0 not to
+     *   alloc_sample  : the array sizes of 1 in N allocations are measured at
+     *                   the sites of the alloc rules (default 1, every array)
+     *   heap_graph    : 1 to write the heap reference graph to the app data
+     *                   directory after the startup heap histogram, for
+     *                   pcall-heap; 0 (default) not to
+     *   snapshot      : 1 to write a heap snapshot whenever a pcall-snapshot
+     *                   file shows up in the app data directory, for
+     *                   pcall-snapdiff (see HeapSnapshotTask); 0 (default) not to
+     *   monitors      : 1 to record the monitor wait times from the start, 0
+     *                   (default) to wait for a pcall-monitors file (see
+     *                   MonitorContentionTask)
+     *   gc            : 1 to record the collection pauses and the heap usage
+     *                   around them (see GcTimelineTask); 0 (default) not to
+     *   thread_cpu_ms : period in milliseconds of the per thread CPU time
+     *                   samples (see ThreadCpuSampler), 0 (default) disables them
+     *   exceptions    : 1 to count the exceptions thrown per throw site (see
+     *                   ExceptionHotSpots); 0 (default) not to
+     *   exception_stacks : the stack of 1 in N exceptions of each thread is
+     *                   written to the trace, 0 (default) for none
+     *
+     * Without any rule or rules_file the demo app hooks are installed.
+     *
+     * Unknown keys and malformed values are logged and ignored.
+     */
+    struct AgentConfig {
+        CallTraceMode call_trace_mode = kCallTraceMethodEvents;
+        int32_t sample_period_ms = 10;
+        int32_t sample_max_depth = 64;
+        int32_t sample_budget_percent = 5;
+        int32_t sample_report_ms = 1000;
+        std::string probe_filter = "com/johnsoft/pcalldemo/";
+        std::vector<std::string> rules;
+        std::string rules_file;
+        int32_t class_cache_mb = 16;
+        int32_t pretransform = 1;
+        int32_t alloc_sample_interval = 1;
+        int32_t heap_graph = 0;
+        int32_t snapshot = 0;
+        int32_t monitors = 0;
+        int32_t gc = 0;
+        int32_t thread_cpu_ms = 0;
+        int32_t exceptions = 0;
+        int32_t exception_stack_interval = 0;
+
+        static AgentConfig Parse(const char *options);
+    };
+
+}  // namespace profiler
+
+#endif  // AGENT_CONFIG_H
@@ -0,0 +1,194 @@
+#include "allocation_sites.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // sites listed per report when there is no trace file
+    static const size_t kLoggedSites = 10;
+
+    // Size of the elements of the array type |type|; ART heap references
+    // are 32-bit
+    static uint32_t ComponentSize(const std::string &type) {
+        if (type.size() < 2 || type[0] != '[') {
+            return 0;
+        }
+        switch (type[1]) {
+            case 'Z':
+            case 'B':
+                return 1;
+            case 'C':
+            case 'S':
+                return 2;
+            case 'J':
+            case 'D':
+                return 8;
+            default:
+                return 4;
+        }
+    }
+
+    static uint32_t ClampDelta(uint64_t delta) {
+        return static_cast<uint32_t>(std::min<uint64_t>(delta, std::numeric_limits<uint32_t>::max()));
+    }
+
+    AllocationSites &AllocationSites::Instance() {
+        static AllocationSites *instance = new AllocationSites();
+        return *instance;
+    }
+
+    // value-initialized: every counter starts at 0
+    AllocationSites::AllocationSites() : counters_(new Counters[kMaxSites]()) {}
+
+    uint32_t AllocationSites::InternSite(uint32_t method_id, uint32_t dex_pc, AllocSiteKind kind,
+                                         const std::string &type, uint32_t length) {
+        uint64_t key = (static_cast<uint64_t>(method_id) << 32) | dex_pc;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = site_ids_.find(key);
+        if (it != site_ids_.end()) {
+            return it->second;
+        }
+        if (sites_.size() + 1 >= kMaxSites) {
+            return 0;
+        }
+        Site site;
+        site.method_id = method_id;
+        site.dex_pc = dex_pc;
+        site.kind = kind;
+        site.component_size = ComponentSize(type);
+        site.length = length;
+        site.type = type;
+        sites_.push_back(site);
+        uint32_t site_id = static_cast<uint32_t>(sites_.size());
+        site_ids_.emplace(key, site_id);
+        return site_id;
+    }
+
+    void AllocationSites::RecordArray(uint32_t site_id, int32_t length) {
+        // a new thread samples its first allocation
+        static thread_local uint32_t countdown = 1;
+        if (site_id >= kMaxSites) {
+            return;
+        }
+        Counters &counters = counters_[site_id];
+        counters.count.fetch_add(1, std::memory_order_relaxed);
+        if (--countdown == 0) {
+            countdown = sample_interval_;
+            // the component size is only known to the agent thread, which
+            // scales the element count when it reports
+            if (length > 0) {
+                counters.elements.fetch_add(static_cast<uint64_t>(length) * sample_interval_,
+                                            std::memory_order_relaxed);
+            }
+        }
+    }
+
+    uint32_t AllocationSites::GetSites(uint32_t first, std::vector<Site> *sites) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (first < sites_.size()) {
+            sites->insert(sites->end(), sites_.begin() + first, sites_.end());
+        }
+        return static_cast<uint32_t>(sites_.size());
+    }
+
+    AllocationSites::Totals AllocationSites::GetTotals(const Site &site, uint32_t site_id) const {
+        const Counters &counters = counters_[site_id];
+        Totals totals;
+        totals.count = counters.count.load(std::memory_order_relaxed);
+        switch (site.kind) {
+            case kAllocSiteInstance:
+                totals.bytes = 0;
+                break;
+            case kAllocSiteArray:
+                totals.bytes = counters.elements.load(std::memory_order_relaxed) * site.component_size;
+                break;
+            case kAllocSiteFilledArray:
+                totals.bytes = totals.count * site.length * site.component_size;
+                break;
+        }
+        return totals;
+    }
+
+    int64_t AllocationSiteTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Report();
+        return report_interval_ns_;
+    }
+
+    void AllocationSiteTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Report();
+    }
+
+    void AllocationSiteTask::Report() {
+        AllocationSites &sites = AllocationSites::Instance();
+        size_t known = sites_.size();
+        sites.GetSites(static_cast<uint32_t>(known), &sites_);
+        reported_.resize(sites_.size(), AllocationSites::Totals{0, 0});
+
+        EventPipeline &pipeline = EventPipeline::Instance();
+        SymbolCache &symbols = SymbolCache::Instance();
+        TraceWriter *trace = pipeline.Trace();
+        if (trace != nullptr) {
+            for (size_t i = known; i < sites_.size(); ++i) {
+                const AllocationSites::Site &site = sites_[i];
+                const MethodSymbol *method = symbols.FindProbeMethod(site.method_id);
+                if (method != nullptr) {
+                    pipeline.TraceMethod(*method);
+                }
+                trace->DefineAllocSite(static_cast<uint32_t>(i + 1), site.method_id, site.dex_pc,
+                                       site.type);
+            }
+        }
+
+        std::vector<AllocSiteCount> counts;
+        // (total count, site index) when logging
+        std::vector<std::pair<uint64_t, size_t>> top;
+        for (size_t i = 0; i < sites_.size(); ++i) {
+            AllocationSites::Totals totals = sites.GetTotals(sites_[i], static_cast<uint32_t>(i + 1));
+            AllocationSites::Totals &reported = reported_[i];
+            if (totals.count != reported.count) {
+                AllocSiteCount count = {static_cast<uint32_t>(i + 1),
+                                        ClampDelta(totals.count - reported.count),
+                                        ClampDelta(totals.bytes - reported.bytes)};
+                counts.push_back(count);
+                reported = totals;
+            }
+            if (trace == nullptr && totals.count > 0) {
+                top.push_back(std::make_pair(totals.count, i));
+            }
+        }
+        if (trace != nullptr) {
+            if (!counts.empty()) {
+                trace->AddAllocCounts(MonotonicNanos(), counts);
+            }
+            return;
+        }
+        if (counts.empty()) {
+            return;
+        }
+
+        size_t count = std::min(top.size(), kLoggedSites);
+        std::partial_sort(top.begin(), top.begin() + count, top.end(),
+                          [](const std::pair<uint64_t, size_t> &a,
+                             const std::pair<uint64_t, size_t> &b) {
+                              return a.first > b.first;
+                          });
+        LOGE("AllocationSites: %zu sites", sites_.size());
+        for (size_t i = 0; i < count; ++i) {
+            const AllocationSites::Site &site = sites_[top[i].second];
+            const MethodSymbol *method = symbols.FindProbeMethod(site.method_id);
+            const ClassSymbol *klass = method != nullptr ? symbols.FindClass(method->class_id)
+                                                         : nullptr;
+            LOGE("AllocationSites: %10" PRIu64 " %12" PRIu64 " B  %s %s->%s%s @%u",
+                 top[i].first, reported_[top[i].second].bytes, site.type.c_str(),
+                 klass != nullptr ? klass->signature.c_str() : "<unknown>",
+                 method != nullptr ? method->name.c_str() : "?",
+                 method != nullptr ? method->signature.c_str() : "", site.dex_pc);
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,150 @@
+#ifndef ALLOCATION_SITES_H
+#define ALLOCATION_SITES_H
+
+#include "event_pipeline.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    enum AllocSiteKind : uint8_t {
+        // new-instance, the size is unknown before the object exists
+        kAllocSiteInstance,
+        // new-array, the length is passed to the probe
+        kAllocSiteArray,
+        // filled-new-array[/range], the length is part of the instruction
+        kAllocSiteFilledArray,
+    };
+
+    /**
+     * Counters of the allocation sites instrumented with allocation probes
+     * (see slicer::AllocationSiteProbes).
+     *
+     * A site is one allocating instruction, identified by a compact id
+     * assigned when its class is transformed; the same method and dex pc
+     * keep the same id when the class is retransformed. The counters are a
+     * preallocated array indexed by site id, so a probe only does relaxed
+     * atomic adds: no lock, no allocation and no JVMTI call.
+     *
+     * Every allocation is counted. Sizes are estimated for arrays only, from
+     * the length and the component size (object headers excluded): the
+     * lengths of 1 in |sample_interval| new-array allocations of each
+     * thread are added up, scaled by the interval.
+     */
+    class AllocationSites {
+    public:
+        struct Site {
+            // probe method id (see SymbolCache::InternProbeMethod)
+            uint32_t method_id;
+            uint32_t dex_pc;
+            AllocSiteKind kind;
+            // array component size in bytes, 0 for instances
+            uint32_t component_size;
+            // filled arrays only
+            uint32_t length;
+            // descriptor of the allocated type
+            std::string type;
+        };
+
+        struct Totals {
+            uint64_t count;
+            uint64_t bytes;
+        };
+
+        static AllocationSites &Instance();
+
+        AllocationSites(const AllocationSites &) = delete;
+
+        AllocationSites &operator=(const AllocationSites &) = delete;
+
+        void SetSampleInterval(uint32_t interval) { sample_interval_ = interval; }
+
+        /**
+         * Returns the id of the site at |dex_pc| of the probe method
+         * |method_id|, allocating |type|, interning it the first time.
+         * Returns 0 once the ids are exhausted.
+         */
+        uint32_t InternSite(uint32_t method_id, uint32_t dex_pc, AllocSiteKind kind,
+                            const std::string &type, uint32_t length);
+
+        /**
+         * Instance and filled array probe.
+         */
+        void RecordInstance(uint32_t site_id) {
+            if (site_id < kMaxSites) {
+                counters_[site_id].count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Array probe, called before the array of |length| elements is allocated.
+         */
+        void RecordArray(uint32_t site_id, int32_t length);
+
+        /**
+         * Returns the number of sites and copies the sites from |first| on
+         * to |sites|.
+         */
+        uint32_t GetSites(uint32_t first, std::vector<Site> *sites) const;
+
+        /**
+         * Returns the totals of the site |site_id| since the start, with
+         * the array bytes estimated from the sampled elements.
+         */
+        Totals GetTotals(const Site &site, uint32_t site_id) const;
+
+    private:
+        static const uint32_t kMaxSites = 1 << 16;
+
+        struct Counters {
+            std::atomic<uint64_t> count;
+            // sampled array elements, already scaled by the interval
+            std::atomic<uint64_t> elements;
+        };
+
+        AllocationSites();
+
+        // indexed by site id, [0] is unused
+        const std::unique_ptr<Counters[]> counters_;
+        uint32_t sample_interval_ = 1;
+
+        mutable std::mutex mutex_;
+        // sites_[id - 1] is the site |id|
+        std::vector<Site> sites_;
+        // (method id << 32 | dex pc) -> site id
+        std::map<uint64_t, uint32_t> site_ids_;
+    };
+
+    /**
+     * Reports the allocation counts from the agent thread: the new sites and
+     * the count deltas go to the trace, or the top sites to the log when
+     * there is no trace file.
+     */
+    class AllocationSiteTask : public PeriodicTask {
+    public:
+        explicit AllocationSiteTask(int64_t report_interval_ns)
+                : report_interval_ns_(report_interval_ns) {}
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        void Report();
+
+        const int64_t report_interval_ns_;
+        std::vector<AllocationSites::Site> sites_;
+        // totals as of the last report, per site
+        std::vector<AllocationSites::Totals> reported_;
+    };
+
+}  // namespace profiler
+
+#endif  // ALLOCATION_SITES_H
@@ -0,0 +1,191 @@
+#include "apk_dex_files.h"
+#include "jvmti_helper.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+
+namespace profiler {
+
+    static const uint32_t kEndOfCentralDirSignature = 0x06054b50;
+    static const uint32_t kCentralDirEntrySignature = 0x02014b50;
+    static const uint32_t kLocalHeaderSignature = 0x04034b50;
+    static const size_t kEndOfCentralDirSize = 22;
+    static const size_t kCentralDirEntrySize = 46;
+    static const size_t kLocalHeaderSize = 30;
+    static const size_t kMaxCommentSize = 0xffff;
+    static const uint16_t kMethodStored = 0;
+    static const uint16_t kMethodDeflated = 8;
+
+    static uint16_t Read16(const uint8_t *p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t Read32(const uint8_t *p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    // "classes.dex", "classes2.dex", ...
+    static bool IsDexEntry(const std::string &name) {
+        return name.compare(0, 7, "classes") == 0 && name.size() >= 11 &&
+               name.compare(name.size() - 4, 4, ".dex") == 0 && name.find('/') == std::string::npos;
+    }
+
+    std::vector<std::string> FindMappedApks() {
+        std::vector<std::string> apks;
+        FILE *maps = fopen("/proc/self/maps", "r");
+        if (maps == nullptr) {
+            return apks;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), maps) != nullptr) {
+            const char *path = strchr(line, '/');
+            if (path == nullptr) {
+                continue;
+            }
+            std::string file(path);
+            file.erase(file.find_last_not_of("\n") + 1);
+            if (file.compare(0, 10, "/data/app/") == 0 && file.size() > 4 &&
+                    file.compare(file.size() - 4, 4, ".apk") == 0 &&
+                    std::find(apks.begin(), apks.end(), file) == apks.end()) {
+                apks.push_back(file);
+            }
+        }
+        fclose(maps);
+        return apks;
+    }
+
+    ApkDexFiles::~ApkDexFiles() {
+        if (base_ != nullptr) {
+            munmap(base_, length_);
+        }
+    }
+
+    bool ApkDexFiles::Open(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOGE("ApkDexFiles: can't open %s", path.c_str());
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(kEndOfCentralDirSize)) {
+            void *mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                base_ = static_cast<uint8_t *>(mapped);
+                length_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+        if (base_ == nullptr || !ReadCentralDirectory()) {
+            LOGE("ApkDexFiles: can't read %s", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool ApkDexFiles::ReadCentralDirectory() {
+        // the end of central directory record is followed by a comment of up to 64 KB
+        size_t lowest = length_ > kEndOfCentralDirSize + kMaxCommentSize ?
+                        length_ - kEndOfCentralDirSize - kMaxCommentSize : 0;
+        const uint8_t *eocd = nullptr;
+        for (size_t offset = length_ - kEndOfCentralDirSize + 1; offset-- > lowest;) {
+            if (Read32(base_ + offset) == kEndOfCentralDirSignature) {
+                eocd = base_ + offset;
+                break;
+            }
+        }
+        if (eocd == nullptr) {
+            return false;
+        }
+        uint16_t count = Read16(eocd + 10);
+        uint32_t dir_size = Read32(eocd + 12);
+        uint32_t dir_offset = Read32(eocd + 16);
+        if (static_cast<uint64_t>(dir_offset) + dir_size > length_) {
+            // also the zip64 case, where the fields are 0xffffffff
+            return false;
+        }
+
+        const uint8_t *p = base_ + dir_offset;
+        const uint8_t *end = p + dir_size;
+        for (uint16_t i = 0; i < count; ++i) {
+            if (p + kCentralDirEntrySize > end || Read32(p) != kCentralDirEntrySignature) {
+                return false;
+            }
+            uint16_t name_length = Read16(p + 28);
+            size_t entry_size = kCentralDirEntrySize + name_length + Read16(p + 30) + Read16(p + 32);
+            if (p + entry_size > end) {
+                return false;
+            }
+            Entry entry;
+            entry.name.assign(reinterpret_cast<const char *>(p + kCentralDirEntrySize), name_length);
+            entry.method = Read16(p + 10);
+            entry.compressed_size = Read32(p + 20);
+            entry.size = Read32(p + 24);
+            entry.local_header_offset = Read32(p + 42);
+            if (IsDexEntry(entry.name)) {
+                entries_.push_back(entry);
+            }
+            p += entry_size;
+        }
+        std::sort(entries_.begin(), entries_.end(), [](const Entry &a, const Entry &b) {
+            return a.name < b.name;
+        });
+        return true;
+    }
+
+    const uint8_t *ApkDexFiles::ReadDex(size_t index, size_t *size) {
+        inflated_.clear();
+        inflated_.shrink_to_fit();
+        const Entry &entry = entries_[index];
+        if (static_cast<uint64_t>(entry.local_header_offset) + kLocalHeaderSize > length_) {
+            return nullptr;
+        }
+        const uint8_t *local = base_ + entry.local_header_offset;
+        if (Read32(local) != kLocalHeaderSignature) {
+            return nullptr;
+        }
+        uint64_t data_offset = entry.local_header_offset + kLocalHeaderSize +
+                               Read16(local + 26) + Read16(local + 28);
+        if (data_offset + entry.compressed_size > length_) {
+            return nullptr;
+        }
+        const uint8_t *data = base_ + data_offset;
+
+        if (entry.method == kMethodStored && entry.size == entry.compressed_size) {
+            *size = entry.size;
+            return data;
+        }
+        if (entry.method != kMethodDeflated) {
+            LOGE("ApkDexFiles: %s: unsupported compression %u", entry.name.c_str(), entry.method);
+            return nullptr;
+        }
+
+        inflated_.resize(entry.size);
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        // raw deflate data, no zlib header
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+            return nullptr;
+        }
+        stream.next_in = const_cast<Bytef *>(data);
+        stream.avail_in = entry.compressed_size;
+        stream.next_out = inflated_.data();
+        stream.avail_out = entry.size;
+        int result = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (result != Z_STREAM_END || stream.total_out != entry.size) {
+            LOGE("ApkDexFiles: %s: inflate failed (%d)", entry.name.c_str(), result);
+            inflated_.clear();
+            return nullptr;
+        }
+        *size = entry.size;
+        return inflated_.data();
+    }
+
+}  // namespace profiler
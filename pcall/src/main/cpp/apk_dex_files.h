@@ -0,0 +1,63 @@
+#ifndef APK_DEX_FILES_H
+#define APK_DEX_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Paths of the app APKs (base and splits) mapped by the runtime, from
+     * /proc/self/maps.
+     */
+    std::vector<std::string> FindMappedApks();
+
+    /**
+     * Read-only access to the classes*.dex entries of an APK.
+     *
+     * The file is mapped; stored entries are used in place and deflated
+     * ones are inflated to a buffer owned by the reader. Zip64 archives
+     * are not supported.
+     */
+    class ApkDexFiles {
+    public:
+        ApkDexFiles() = default;
+
+        ~ApkDexFiles();
+
+        ApkDexFiles(const ApkDexFiles &) = delete;
+
+        ApkDexFiles &operator=(const ApkDexFiles &) = delete;
+
+        bool Open(const std::string &path);
+
+        size_t DexCount() const { return entries_.size(); }
+
+        /**
+         * Returns the |index|-th dex file, valid until the next call or the
+         * destruction of the reader, or nullptr if it can't be read.
+         */
+        const uint8_t *ReadDex(size_t index, size_t *size);
+
+    private:
+        struct Entry {
+            std::string name;
+            uint16_t method;
+            uint32_t compressed_size;
+            uint32_t size;
+            uint32_t local_header_offset;
+        };
+
+        bool ReadCentralDirectory();
+
+        uint8_t *base_ = nullptr;
+        size_t length_ = 0;
+        std::vector<Entry> entries_;
+        std::vector<uint8_t> inflated_;
+    };
+
+}  // namespace profiler
+
+#endif  // APK_DEX_FILES_H
@@ -0,0 +1,99 @@
+#include "capability_planner.h"
+#include "jvmti_helper.h"
+
+#include <string.h>
+
+namespace profiler {
+
+    // jvmtiCapabilities is a plain bit field struct, the set operations
+    // work on its bytes
+    static const size_t kCapabilityBytes = sizeof(jvmtiCapabilities);
+
+    static jvmtiCapabilities Minus(const jvmtiCapabilities &a, const jvmtiCapabilities &b) {
+        jvmtiCapabilities result;
+        const uint8_t *pa = reinterpret_cast<const uint8_t *>(&a);
+        const uint8_t *pb = reinterpret_cast<const uint8_t *>(&b);
+        uint8_t *out = reinterpret_cast<uint8_t *>(&result);
+        for (size_t i = 0; i < kCapabilityBytes; ++i) {
+            out[i] = pa[i] & ~pb[i];
+        }
+        return result;
+    }
+
+    static bool IsEmpty(const jvmtiCapabilities &caps) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&caps);
+        for (size_t i = 0; i < kCapabilityBytes; ++i) {
+            if (p[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    jvmtiCapabilities CapabilityPlanner::CapabilitiesFor(uint32_t features) {
+        jvmtiCapabilities caps;
+        memset(&caps, 0, sizeof(caps));
+        if (features & kFeatureClassHooks) {
+            caps.can_retransform_classes = 1;
+        }
+        if (features & kFeatureMethodEvents) {
+            caps.can_generate_method_entry_events = 1;
+        }
+        if (features & kFeatureExceptionEvents) {
+            caps.can_generate_exception_events = 1;
+        }
+        if (features & kFeatureAllocEvents) {
+            caps.can_generate_vm_object_alloc_events = 1;
+        }
+        if (features & kFeatureObjectTags) {
+            caps.can_tag_objects = 1;
+            caps.can_generate_object_free_events = 1;
+        }
+        if (features & kFeatureMonitorEvents) {
+            caps.can_generate_monitor_events = 1;
+        }
+        if (features & kFeatureGcEvents) {
+            caps.can_generate_garbage_collection_events = 1;
+        }
+        if (features & kFeatureThreadCpuTime) {
+            caps.can_get_thread_cpu_time = 1;
+        }
+        return caps;
+    }
+
+    bool CapabilityPlanner::Enable(jvmtiEnv *jvmti, uint32_t features) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jvmtiCapabilities missing = Minus(CapabilitiesFor(features), CapabilitiesFor(enabled_));
+        if (!IsEmpty(missing)) {
+            jvmtiCapabilities potential;
+            if (CheckJvmtiError(jvmti, jvmti->GetPotentialCapabilities(&potential))) {
+                return false;
+            }
+            if (!IsEmpty(Minus(missing, potential))) {
+                LOGE("Capabilities not available for features 0x%x", features);
+                return false;
+            }
+            if (CheckJvmtiError(jvmti, jvmti->AddCapabilities(&missing))) {
+                return false;
+            }
+        }
+        enabled_ |= features;
+        return true;
+    }
+
+    void CapabilityPlanner::Disable(jvmtiEnv *jvmti, uint32_t features) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t remaining = enabled_ & ~features;
+        jvmtiCapabilities unused = Minus(CapabilitiesFor(enabled_), CapabilitiesFor(remaining));
+        if (!IsEmpty(unused)) {
+            CheckJvmtiError(jvmti, jvmti->RelinquishCapabilities(&unused));
+        }
+        enabled_ = remaining;
+    }
+
+    bool CapabilityPlanner::IsEnabled(uint32_t features) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return (enabled_ & features) == features;
+    }
+
+}  // namespace profiler
@@ -0,0 +1,72 @@
+#ifndef CAPABILITY_PLANNER_H
+#define CAPABILITY_PLANNER_H
+
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <mutex>
+
+namespace profiler {
+
+    /**
+     * Agent features, each one needing its own set of JVMTI capabilities.
+     */
+    enum AgentFeature : uint32_t {
+        // ClassFileLoadHook transformations and RetransformClasses
+        kFeatureClassHooks = 1 << 0,
+        // MethodEntry events
+        kFeatureMethodEvents = 1 << 1,
+        // ExceptionCatch events (unwinding of probed frames)
+        kFeatureExceptionEvents = 1 << 2,
+        // VMObjectAlloc events
+        kFeatureAllocEvents = 1 << 3,
+        // object tags, ObjectFree events and heap iteration
+        kFeatureObjectTags = 1 << 4,
+        // stack sampling (GetThreadListStackTraces needs no capability)
+        kFeatureSampling = 1 << 5,
+        // MonitorContendedEnter/Entered and MonitorWait/Waited events
+        kFeatureMonitorEvents = 1 << 6,
+        // GarbageCollectionStart/Finish events
+        kFeatureGcEvents = 1 << 7,
+        // GetThreadCpuTime of other threads
+        kFeatureThreadCpuTime = 1 << 8,
+    };
+
+    /**
+     * Keeps the capabilities of a JVMTI environment to the minimum needed
+     * by the enabled features.
+     *
+     * Some potential capabilities (single step, local variable access,
+     * breakpoints, ...) make ART deoptimize the whole process as soon as
+     * they are added, so the agent never asks for more than the features
+     * in use. Capabilities are added when a feature is enabled and
+     * relinquished when the last feature needing them is disabled.
+     */
+    class CapabilityPlanner {
+    public:
+        /**
+         * Returns the capabilities needed by the |features| mask.
+         */
+        static jvmtiCapabilities CapabilitiesFor(uint32_t features);
+
+        /**
+         * Adds the capabilities missing for |features|. Returns false, and
+         * changes nothing, if the runtime can't provide all of them.
+         */
+        bool Enable(jvmtiEnv *jvmti, uint32_t features);
+
+        /**
+         * Relinquishes the capabilities only needed by |features|.
+         */
+        void Disable(jvmtiEnv *jvmti, uint32_t features);
+
+        bool IsEnabled(uint32_t features) const;
+
+    private:
+        mutable std::mutex mutex_;
+        uint32_t enabled_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // CAPABILITY_PLANNER_H
@@ -0,0 +1,291 @@
+#include "class_image_cache.h"
+#include "clock.h"
+#include "hash.h"
+#include "jvmti_helper.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+namespace profiler {
+
+    // bump whenever the transformations or the dex writer output change
+    static const uint32_t kCacheVersion = 2;
+    static const char kCacheMagic[4] = {'P', 'C', 'C', 'I'};
+    static const char kEntrySuffix[] = ".pcc";
+    static const char kTempSuffix[] = ".tmp";
+
+    static const int64_t kReportPeriodNs = 10 * 1000000000LL;
+
+    struct CacheEntryHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint64_t fingerprint;
+        uint32_t class_data_len;
+        // followed by the class descriptor, then the image
+        uint32_t descriptor_len;
+        uint32_t image_len;
+    };
+
+    // Whether data[0, length) is a dex file whose header signature (the
+    // SHA-1 of the rest of the file) was filled in by the dex tools
+    static bool HasDexSignature(const unsigned char *data, jint length) {
+        static const dex::u1 kNoSignature[dex::kSHA1DigestLen] = {};
+        if (length < static_cast<jint>(sizeof(dex::Header))) {
+            return false;
+        }
+        const dex::Header *header = reinterpret_cast<const dex::Header *>(data);
+        return memcmp(header->magic, "dex\n", 4) == 0 &&
+               header->file_size == static_cast<dex::u4>(length) &&
+               memcmp(header->signature, kNoSignature, sizeof(kNoSignature)) != 0;
+    }
+
+    static bool EndsWith(const char *name, const char *suffix) {
+        size_t length = strlen(name);
+        size_t suffix_length = strlen(suffix);
+        return length >= suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+    }
+
+    struct DirEntry {
+        std::string path;
+        int64_t size;
+        int64_t mtime_ns;
+    };
+
+    // Lists the cache entries of |dir|; leftovers of interrupted stores are
+    // removed if |remove_temps|
+    static std::vector<DirEntry> ListEntries(const std::string &dir, bool remove_temps) {
+        std::vector<DirEntry> entries;
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr) {
+            return entries;
+        }
+        while (struct dirent *e = readdir(d)) {
+            std::string path = dir + "/" + e->d_name;
+            if (EndsWith(e->d_name, kTempSuffix)) {
+                if (remove_temps) {
+                    unlink(path.c_str());
+                }
+                continue;
+            }
+            struct stat st;
+            if (!EndsWith(e->d_name, kEntrySuffix) || stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL +
+                               st.st_mtim.tv_nsec;
+            entries.push_back({path, static_cast<int64_t>(st.st_size), mtime_ns});
+        }
+        closedir(d);
+        return entries;
+    }
+
+    bool ClassImageCache::Open(const std::string &dir, uint64_t fingerprint, int64_t budget_bytes) {
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            LOGE("ClassImageCache: can't create %s: %s", dir.c_str(), strerror(errno));
+            return false;
+        }
+        int64_t total = 0;
+        for (const DirEntry &entry : ListEntries(dir, true)) {
+            total += entry.size;
+        }
+        fingerprint_ = fingerprint;
+        budget_bytes_ = budget_bytes;
+        total_bytes_ = total;
+        dir_ = dir;
+        LOGE("ClassImageCache: %s, %" PRId64 " KB used of %" PRId64 " KB", dir.c_str(),
+             total / 1024, budget_bytes / 1024);
+        return true;
+    }
+
+    uint64_t ClassImageCache::Key(const std::string &descriptor, const unsigned char *class_data,
+                                  jint class_data_len) const {
+        // the hook hands over the whole dex file of the class, identified by
+        // its signature without hashing megabytes on every class load
+        uint64_t data_hash;
+        if (HasDexSignature(class_data, class_data_len)) {
+            const dex::Header *header = reinterpret_cast<const dex::Header *>(class_data);
+            data_hash = Hash64(header->signature, sizeof(header->signature),
+                               fingerprint_ ^ kCacheVersion);
+        } else {
+            data_hash = Hash64(class_data, static_cast<size_t>(class_data_len),
+                               fingerprint_ ^ kCacheVersion);
+        }
+        return Hash64(descriptor.data(), descriptor.size(), data_hash);
+    }
+
+    std::string ClassImageCache::EntryPath(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016" PRIx64 "%s", key, kEntrySuffix);
+        return dir_ + name;
+    }
+
+    bool ClassImageCache::Lookup(const std::string &descriptor, const unsigned char *class_data,
+                                 jint class_data_len, dex::Writer::Allocator *allocator,
+                                 unsigned char **image, jint *image_len) {
+        if (!IsOpen()) {
+            return false;
+        }
+        uint64_t key = Key(descriptor, class_data, class_data_len);
+        int fd = open(EntryPath(key).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool hit = false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > static_cast<off_t>(sizeof(CacheEntryHeader))) {
+            size_t size = static_cast<size_t>(st.st_size);
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                CacheEntryHeader header;
+                memcpy(&header, mapped, sizeof(header));
+                if (memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) == 0 &&
+                        header.version == kCacheVersion && header.key == key &&
+                        header.fingerprint == fingerprint_ &&
+                        header.class_data_len == static_cast<uint32_t>(class_data_len) &&
+                        header.descriptor_len == descriptor.size() &&
+                        sizeof(header) + header.descriptor_len + header.image_len == size &&
+                        memcmp(static_cast<const char *>(mapped) + sizeof(header),
+                               descriptor.data(), descriptor.size()) == 0) {
+                    void *copy = allocator->Allocate(header.image_len);
+                    if (copy != nullptr) {
+                        memcpy(copy, static_cast<const char *>(mapped) + sizeof(header) +
+                                     header.descriptor_len, header.image_len);
+                        *image = static_cast<unsigned char *>(copy);
+                        *image_len = static_cast<jint>(header.image_len);
+                        hit = true;
+                    }
+                }
+                munmap(mapped, size);
+            }
+        }
+        if (hit) {
+            // the file time orders the entries for eviction
+            futimens(fd, nullptr);
+        }
+        close(fd);
+        return hit;
+    }
+
+    void ClassImageCache::Store(const std::string &descriptor, const unsigned char *class_data,
+                                jint class_data_len, const unsigned char *image, jint image_len) {
+        if (!IsOpen()) {
+            return;
+        }
+        CacheEntryHeader header;
+        memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+        header.version = kCacheVersion;
+        header.key = Key(descriptor, class_data, class_data_len);
+        header.fingerprint = fingerprint_;
+        header.class_data_len = static_cast<uint32_t>(class_data_len);
+        header.descriptor_len = static_cast<uint32_t>(descriptor.size());
+        header.image_len = static_cast<uint32_t>(image_len);
+
+        std::string path = EntryPath(header.key);
+        // one temporary file per thread, two threads may load the same class
+        std::string temp_path = path + "." + std::to_string(CurrentThreadId()) + kTempSuffix;
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            store_failures_++;
+            return;
+        }
+        bool written = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                       write(fd, descriptor.data(), descriptor.size()) ==
+                       static_cast<ssize_t>(descriptor.size()) &&
+                       write(fd, image, image_len) == static_cast<ssize_t>(image_len);
+        written = close(fd) == 0 && written;
+        if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+            unlink(temp_path.c_str());
+            store_failures_++;
+            return;
+        }
+        total_bytes_ += static_cast<int64_t>(sizeof(header)) + header.descriptor_len + image_len;
+    }
+
+    void ClassImageCache::RecordHook(ClassHookOutcome outcome, int64_t elapsed_ns) {
+        HookStats &stats = stats_[outcome];
+        stats.count++;
+        stats.total_ns += elapsed_ns;
+        int64_t max = stats.max_ns.load(std::memory_order_relaxed);
+        while (elapsed_ns > max && !stats.max_ns.compare_exchange_weak(max, elapsed_ns)) {
+        }
+    }
+
+    void ClassImageCache::Evict() {
+        if (!IsOpen() || total_bytes_ <= budget_bytes_) {
+            return;
+        }
+        std::vector<DirEntry> entries = ListEntries(dir_, false);
+        std::sort(entries.begin(), entries.end(), [](const DirEntry &a, const DirEntry &b) {
+            return a.mtime_ns < b.mtime_ns;
+        });
+        int64_t total = 0;
+        for (const DirEntry &entry : entries) {
+            total += entry.size;
+        }
+        // trim below the budget so that eviction doesn't run after every store
+        const int64_t target = budget_bytes_ / 4 * 3;
+        for (const DirEntry &entry : entries) {
+            if (total <= target) {
+                break;
+            }
+            if (unlink(entry.path.c_str()) == 0) {
+                total -= entry.size;
+                evicted_++;
+            }
+        }
+        // stores racing with the scan are only counted at the next scan
+        total_bytes_ = total;
+    }
+
+    uint64_t ClassImageCache::HookCount() const {
+        uint64_t count = 0;
+        for (const HookStats &stats : stats_) {
+            count += stats.count;
+        }
+        return count;
+    }
+
+    void ClassImageCache::Report() const {
+        static const char *const kOutcomeNames[] = {"pretransformed", "hit", "miss",
+                                                    "uncached", "failed"};
+        uint64_t hits = stats_[kClassHookCacheHit].count;
+        uint64_t misses = stats_[kClassHookCacheMiss].count;
+        LOGE("ClassImageCache: %" PRIu64 "/%" PRIu64 " hits (%.1f%%), %" PRId64 " KB, "
+             "%" PRIu64 " evicted, %" PRIu64 " failed stores",
+             hits, hits + misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0,
+             total_bytes_.load() / 1024, evicted_.load(), store_failures_.load());
+        for (int i = kClassHookPretransformed; i <= kClassHookFailed; ++i) {
+            const HookStats &stats = stats_[i];
+            uint64_t count = stats.count;
+            if (count > 0) {
+                LOGE("ClassImageCache: %s hooks: %" PRIu64 ", mean %.3f ms, max %.3f ms",
+                     kOutcomeNames[i], count, stats.total_ns / 1e6 / count, stats.max_ns / 1e6);
+            }
+        }
+    }
+
+    int64_t ClassImageCacheTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        cache_->Evict();
+        uint64_t hooks = cache_->HookCount();
+        if (hooks != reported_hooks_) {
+            reported_hooks_ = hooks;
+            cache_->Report();
+        }
+        return kReportPeriodNs;
+    }
+
+    void ClassImageCacheTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        cache_->Report();
+    }
+
+}  // namespace profiler
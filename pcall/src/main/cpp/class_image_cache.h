@@ -0,0 +1,125 @@
+#ifndef CLASS_IMAGE_CACHE_H
+#define CLASS_IMAGE_CACHE_H
+
+#include "event_pipeline.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "slicer/writer.h"
+
+namespace profiler {
+
+    enum ClassHookOutcome {
+        // the image was built ahead of time (see PretransformedImages)
+        kClassHookPretransformed,
+        // the transformed image came from the cache
+        kClassHookCacheHit,
+        // transformed, then stored in the cache
+        kClassHookCacheMiss,
+        // transformed, the result can't be cached (probes, cache disabled)
+        kClassHookUncached,
+        // the slicer produced no image, the class loads unchanged
+        kClassHookFailed,
+    };
+
+    /**
+     * On-disk cache of the class images produced by the ClassFileLoadHook,
+     * so that the classes transformed on every app start, re-attach and
+     * RetransformClasses skip the slicer.
+     *
+     * Entries are keyed by the class descriptor and the original class
+     * data, seeded with the fingerprint of the instrumentation rules, one
+     * file per entry. The class data is the whole dex file of the class:
+     * when it carries a dex signature only the signature is hashed, so a
+     * lookup doesn't cost a pass over the dex. The descriptor is stored in
+     * the entry and compared on lookup.
+     * A hit maps the file and copies the image to the memory handed back
+     * to the runtime. Files are written to a temporary name and renamed,
+     * so a concurrent or interrupted store never leaves a partial entry.
+     *
+     * Lookups and stores may run on any thread. Eviction, least recently
+     * used first (hits refresh the file time), runs on the agent thread
+     * once the total size exceeds the budget.
+     */
+    class ClassImageCache {
+    public:
+        /**
+         * Opens, creating it if needed, the cache directory |dir|. Lookups
+         * and stores do nothing until it succeeds.
+         */
+        bool Open(const std::string &dir, uint64_t fingerprint, int64_t budget_bytes);
+
+        bool IsOpen() const { return !dir_.empty(); }
+
+        /**
+         * Looks up the transformed image of the class |descriptor| of
+         * |class_data|. On a hit the image is copied to memory from
+         * |allocator|.
+         */
+        bool Lookup(const std::string &descriptor, const unsigned char *class_data,
+                    jint class_data_len, dex::Writer::Allocator *allocator,
+                    unsigned char **image, jint *image_len);
+
+        void Store(const std::string &descriptor, const unsigned char *class_data,
+                   jint class_data_len, const unsigned char *image, jint image_len);
+
+        /**
+         * Accounts for one ClassFileLoadHook call which transformed the class.
+         */
+        void RecordHook(ClassHookOutcome outcome, int64_t elapsed_ns);
+
+        /**
+         * Removes the least recently used entries while over the budget.
+         */
+        void Evict();
+
+        /**
+         * Logs the hit ratio and the hook latencies.
+         */
+        void Report() const;
+
+        uint64_t HookCount() const;
+
+    private:
+        struct HookStats {
+            std::atomic<uint64_t> count{0};
+            std::atomic<int64_t> total_ns{0};
+            std::atomic<int64_t> max_ns{0};
+        };
+
+        uint64_t Key(const std::string &descriptor, const unsigned char *class_data,
+                     jint class_data_len) const;
+
+        std::string EntryPath(uint64_t key) const;
+
+        std::string dir_;
+        uint64_t fingerprint_ = 0;
+        int64_t budget_bytes_ = 0;
+        std::atomic<int64_t> total_bytes_{0};
+        std::atomic<uint64_t> store_failures_{0};
+        std::atomic<uint64_t> evicted_{0};
+        HookStats stats_[kClassHookFailed + 1];
+    };
+
+    /**
+     * Agent thread side of the cache: eviction and periodic reports.
+     */
+    class ClassImageCacheTask : public PeriodicTask {
+    public:
+        explicit ClassImageCacheTask(ClassImageCache *cache) : cache_(cache) {}
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        ClassImageCache *const cache_;
+        uint64_t reported_hooks_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // CLASS_IMAGE_CACHE_H
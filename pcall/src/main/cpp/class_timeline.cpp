@@ -0,0 +1,176 @@
+#include "class_timeline.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+#include "trace_writer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // classes listed per report when there is no trace file
+    static const size_t kLoggedClasses = 10;
+    // initializers running nested in one thread, the deeper ones aren't timed
+    static const int kMaxClinitDepth = 32;
+
+    namespace {
+
+        struct ClinitFrame {
+            uint32_t class_id;
+            // Java stack depth of the enter probe, 0 if unknown
+            int32_t frame_depth;
+            int64_t start_ns;
+            // time of the initializers nested in this one
+            int64_t child_ns;
+        };
+
+        struct ClinitStack {
+            int depth;
+            ClinitFrame frames[kMaxClinitDepth];
+        };
+
+    }  // namespace
+
+    // initializers running in the current thread, zero-initialized
+    static thread_local ClinitStack t_clinit_stack;
+
+    static uint32_t ToMicros(int64_t ns) {
+        return static_cast<uint32_t>(std::min<int64_t>(ns / 1000, std::numeric_limits<uint32_t>::max()));
+    }
+
+    static int64_t Total(const ClassTimeline::Times &times) {
+        return times.transform_ns + times.clinit_self_ns;
+    }
+
+    ClassTimeline &ClassTimeline::Instance() {
+        static ClassTimeline *instance = new ClassTimeline();
+        return *instance;
+    }
+
+    // value-initialized: every counter starts at 0
+    ClassTimeline::ClassTimeline() : times_(new Counters[kMaxClasses]()) {}
+
+    uint32_t ClassTimeline::InternClass(const std::string &descriptor) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = ids_.find(descriptor);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        if (descriptors_.size() + 1 >= kMaxClasses) {
+            return 0;
+        }
+        descriptors_.push_back(descriptor);
+        uint32_t id = static_cast<uint32_t>(descriptors_.size());
+        ids_.emplace(descriptor, id);
+        return id;
+    }
+
+    void ClassTimeline::OnClinitEnter(uint32_t class_id, int32_t frame_depth) {
+        ClinitStack &stack = t_clinit_stack;
+        // the initializers running below this one are shallower, the frames
+        // at this depth or deeper were unwound by exceptions
+        while (frame_depth > 0 && stack.depth > 0 && stack.depth <= kMaxClinitDepth &&
+               stack.frames[stack.depth - 1].frame_depth >= frame_depth) {
+            stack.depth--;
+        }
+        if (stack.depth < kMaxClinitDepth) {
+            stack.frames[stack.depth] = {class_id, frame_depth, MonotonicNanos(), 0};
+        }
+        // counted past the limit too, so the exits stay paired
+        stack.depth++;
+    }
+
+    void ClassTimeline::OnClinitExit(uint32_t class_id) {
+        ClinitStack &stack = t_clinit_stack;
+        if (stack.depth > kMaxClinitDepth) {
+            stack.depth--;
+            return;
+        }
+        // the frames above the one of |class_id| are initializers that threw
+        int index = stack.depth - 1;
+        while (index >= 0 && stack.frames[index].class_id != class_id) {
+            --index;
+        }
+        if (index < 0 || class_id == 0 || class_id >= kMaxClasses) {
+            return;
+        }
+        const ClinitFrame &frame = stack.frames[index];
+        int64_t elapsed_ns = MonotonicNanos() - frame.start_ns;
+        Counters &counters = times_[class_id];
+        counters.clinit_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+        counters.clinit_self_ns.fetch_add(elapsed_ns - frame.child_ns, std::memory_order_relaxed);
+        stack.depth = index;
+        if (index > 0) {
+            stack.frames[index - 1].child_ns += elapsed_ns;
+        }
+    }
+
+    uint32_t ClassTimeline::GetClasses(uint32_t first, std::vector<std::string> *descriptors) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = first; i < descriptors_.size(); ++i) {
+            descriptors->push_back(descriptors_[i]);
+        }
+        return static_cast<uint32_t>(descriptors_.size());
+    }
+
+    ClassTimeline::Times ClassTimeline::GetTimes(uint32_t class_id) const {
+        const Counters &counters = times_[class_id];
+        return {counters.transform_ns.load(std::memory_order_relaxed),
+                counters.clinit_ns.load(std::memory_order_relaxed),
+                counters.clinit_self_ns.load(std::memory_order_relaxed)};
+    }
+
+    int64_t ClassTimelineTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Report();
+        return report_interval_ns_;
+    }
+
+    void ClassTimelineTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Report();
+    }
+
+    void ClassTimelineTask::Report() {
+        ClassTimeline &timeline = ClassTimeline::Instance();
+        // descriptors_[i] is the class i + 1
+        timeline.GetClasses(static_cast<uint32_t>(descriptors_.size()), &descriptors_);
+        reported_.resize(descriptors_.size(), ClassTimeline::Times{0, 0, 0});
+
+        std::vector<ClassTimesRow> rows;
+        for (size_t i = 0; i < descriptors_.size(); ++i) {
+            ClassTimeline::Times times = timeline.GetTimes(static_cast<uint32_t>(i + 1));
+            ClassTimeline::Times &reported = reported_[i];
+            if (times.transform_ns == reported.transform_ns && times.clinit_ns == reported.clinit_ns) {
+                continue;
+            }
+            reported = times;
+            rows.push_back({&descriptors_[i], ToMicros(times.transform_ns), ToMicros(times.clinit_ns),
+                            ToMicros(times.clinit_self_ns)});
+        }
+        if (rows.empty()) {
+            return;
+        }
+        TraceWriter *trace = EventPipeline::Instance().Trace();
+        if (trace != nullptr) {
+            trace->AddClassTimes(MonotonicNanos(), rows);
+            return;
+        }
+
+        std::vector<size_t> top;
+        for (size_t i = 0; i < reported_.size(); ++i) {
+            if (Total(reported_[i]) > 0) {
+                top.push_back(i);
+            }
+        }
+        size_t count = std::min(top.size(), kLoggedClasses);
+        std::partial_sort(top.begin(), top.begin() + count, top.end(), [this](size_t a, size_t b) {
+            return Total(reported_[a]) > Total(reported_[b]);
+        });
+        for (size_t i = 0; i < count; ++i) {
+            const ClassTimeline::Times &times = reported_[top[i]];
+            LOGE("ClassTimeline: %8.2f ms transform %.2f ms clinit %.2f ms (self %.2f ms) %s",
+                 Total(times) / 1e6, times.transform_ns / 1e6, times.clinit_ns / 1e6,
+                 times.clinit_self_ns / 1e6, descriptors_[top[i]].c_str());
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,128 @@
+#ifndef CLASS_TIMELINE_H
+#define CLASS_TIMELINE_H
+
+#include "event_pipeline.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Startup cost of the classes the agent instruments: the time spent in
+     * the ClassFileLoadHook for each of them and, for the classes of the
+     * clinit rules, the time spent in their static initializer.
+     *
+     * Classes get a compact id, by descriptor, when they are first
+     * transformed or hooked; the clinit probes (see slicer::CallTraceProbes,
+     * Tracer.clinitEnter/clinitExit) pass that id. The times are
+     * preallocated atomic counters indexed by id, so a probe takes no lock
+     * and allocates nothing. Initializers run nested (one initializer
+     * touching another class), so each thread keeps a small stack of the
+     * running ones: the time of a nested initializer is its own and is
+     * taken out of the self time of the one that triggered it. A frame left
+     * by an exception (its exit probe never ran) is dropped when an outer
+     * initializer exits, or when the next initializer starts at the same
+     * Java stack depth or a shallower one (a top-level initializer which
+     * threw would otherwise stay on the stack for good).
+     *
+     * The load to prepare interval of every class is in the trace already,
+     * from the ClassLoad and ClassPrepare events.
+     */
+    class ClassTimeline {
+    public:
+        struct Times {
+            int64_t transform_ns;
+            // static initializer, nested ones included
+            int64_t clinit_ns;
+            int64_t clinit_self_ns;
+        };
+
+        static ClassTimeline &Instance();
+
+        ClassTimeline(const ClassTimeline &) = delete;
+
+        ClassTimeline &operator=(const ClassTimeline &) = delete;
+
+        /**
+         * Returns the id of the class |descriptor|, interning it the first
+         * time. Returns 0 once the ids are exhausted.
+         */
+        uint32_t InternClass(const std::string &descriptor);
+
+        /**
+         * Accounts for one ClassFileLoadHook call on the class, whatever its
+         * outcome (see ClassHookOutcome).
+         */
+        void RecordTransform(uint32_t class_id, int64_t elapsed_ns) {
+            if (class_id != 0 && class_id < kMaxClasses) {
+                times_[class_id].transform_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * |frame_depth| is the Java stack depth of the probe, 0 if unknown.
+         */
+        void OnClinitEnter(uint32_t class_id, int32_t frame_depth);
+
+        void OnClinitExit(uint32_t class_id);
+
+        /**
+         * Returns the number of classes and copies the descriptors from
+         * |first| on to |descriptors|.
+         */
+        uint32_t GetClasses(uint32_t first, std::vector<std::string> *descriptors) const;
+
+        Times GetTimes(uint32_t class_id) const;
+
+    private:
+        static const uint32_t kMaxClasses = 1 << 14;
+
+        struct Counters {
+            std::atomic<int64_t> transform_ns;
+            std::atomic<int64_t> clinit_ns;
+            std::atomic<int64_t> clinit_self_ns;
+        };
+
+        ClassTimeline();
+
+        // indexed by class id, [0] is unused
+        const std::unique_ptr<Counters[]> times_;
+
+        mutable std::mutex mutex_;
+        // descriptors_[id - 1] is the class |id|
+        std::vector<std::string> descriptors_;
+        std::unordered_map<std::string, uint32_t> ids_;
+    };
+
+    /**
+     * Reports the class times from the agent thread: the classes whose times
+     * changed go to the trace (see kChunkClassTimes), or the most expensive
+     * ones to the log when there is no trace file.
+     */
+    class ClassTimelineTask : public PeriodicTask {
+    public:
+        explicit ClassTimelineTask(int64_t report_interval_ns)
+                : report_interval_ns_(report_interval_ns) {}
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        void Report();
+
+        const int64_t report_interval_ns_;
+        std::vector<std::string> descriptors_;
+        // times as of the last report, per class
+        std::vector<ClassTimeline::Times> reported_;
+    };
+
+}  // namespace profiler
+
+#endif  // CLASS_TIMELINE_H
@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace profiler {
+
+    /**
+     * Monotonic timestamp in nanoseconds. Cheap (vDSO) and async-signal-safe,
+     * so it can be used from any JVMTI callback.
+     */
+    inline int64_t MonotonicNanos() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    /**
+     * Kernel thread id of the caller.
+     */
+    inline int32_t CurrentThreadId() {
+        return static_cast<int32_t>(syscall(__NR_gettid));
+    }
+
+}  // namespace profiler
+
+#endif  // CLOCK_H
@@ -0,0 +1,356 @@
+#include "event_pipeline.h"
+#include "jvmti_helper.h"
+#include "clock.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // per-thread ring capacity (records)
+    static const size_t kThreadBufferCapacity = 4096;
+    // records popped from a single thread buffer per batch
+    static const size_t kDrainBatchSize = 256;
+    // pause between two drain passes
+    static const useconds_t kDrainIntervalUs = 5000;
+    // keep each batched log write below the logd line limit
+    static const size_t kMaxLogBatchSize = 3500;
+    // interval between two symbol cache statistics lines
+    static const int64_t kStatsIntervalNs = 10000000000LL;
+    // interval between two flushes of the trace file
+    static const int64_t kTraceFlushIntervalNs = 1000000000LL;
+
+    static thread_local void *t_thread_buffer = nullptr;
+    // t_thread_buffer of a thread past ThreadEnd, its late events are dropped
+    static char g_retired_marker;
+    static void *const kRetiredBuffer = &g_retired_marker;
+
+    EventPipeline &EventPipeline::Instance() {
+        static EventPipeline *instance = new EventPipeline();
+        return *instance;
+    }
+
+    EventPipeline::ThreadBuffer *EventPipeline::GetThreadBuffer() {
+        if (t_thread_buffer == kRetiredBuffer) {
+            return nullptr;
+        }
+        auto buffer = static_cast<ThreadBuffer *>(t_thread_buffer);
+        if (buffer == nullptr) {
+            // slow path, once per thread
+            buffer = new ThreadBuffer(CurrentThreadId(), kThreadBufferCapacity);
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            buffers_.emplace_back(buffer);
+            t_thread_buffer = buffer;
+        }
+        return buffer;
+    }
+
+    void EventPipeline::Record(EventKind kind, uint64_t id, int64_t arg) {
+        ThreadBuffer *buffer = GetThreadBuffer();
+        if (buffer == nullptr) {
+            return;
+        }
+        EventRecord record;
+        record.timestamp_ns = MonotonicNanos();
+        record.id = id;
+        record.arg = arg;
+        record.thread_id = buffer->thread_id;
+        record.kind = kind;
+        record.flags = 0;
+        buffer->ring.Push(record);
+    }
+
+    bool EventPipeline::OpenTrace(const std::string &path) {
+        if (!trace_.Open(path, MonotonicNanos())) {
+            LOGE("EventPipeline: failed to create trace file %s", path.c_str());
+            return false;
+        }
+        LOGE("EventPipeline: writing trace to %s", path.c_str());
+        return true;
+    }
+
+    void EventPipeline::AddPeriodicTask(std::unique_ptr<PeriodicTask> task) {
+        ScheduledTask scheduled;
+        scheduled.task = std::move(task);
+        scheduled.next_run_ns = 0;
+        tasks_.push_back(std::move(scheduled));
+    }
+
+    void EventPipeline::RetireCurrentThread() {
+        auto buffer = static_cast<ThreadBuffer *>(t_thread_buffer);
+        if (buffer != nullptr && t_thread_buffer != kRetiredBuffer) {
+            buffer->retired.store(true, std::memory_order_release);
+        }
+        // not nullptr, a later event would allocate a buffer never retired
+        t_thread_buffer = kRetiredBuffer;
+    }
+
+    size_t EventPipeline::Drain(jvmtiEnv *jvmti, JNIEnv *jni) {
+        EventRecord batch[kDrainBatchSize];
+        size_t total = 0;
+        uint64_t new_drops = 0;
+
+        // the list is copied so that the lock isn't held while flushing, a
+        // thread recording its first event would wait for the whole pass;
+        // only this thread removes buffers, the copied pointers stay valid
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            drain_list_.clear();
+            for (const std::unique_ptr<ThreadBuffer> &buffer : buffers_) {
+                drain_list_.push_back(buffer.get());
+            }
+        }
+        size_t released = 0;
+        for (ThreadBuffer *buffer : drain_list_) {
+            // sample the retired flag first so that no record pushed
+            // before retirement can be missed by the final pop
+            bool retired = buffer->retired.load(std::memory_order_acquire);
+            // bounded per pass so a busy producer can't starve the others
+            size_t count;
+            for (size_t popped = 0; popped < kThreadBufferCapacity; popped += count) {
+                count = buffer->ring.Pop(batch, kDrainBatchSize);
+                if (count == 0) {
+                    break;
+                }
+                Flush(jvmti, jni, batch, count);
+                total += count;
+            }
+            uint64_t dropped = buffer->ring.Dropped();
+            new_drops += dropped - buffer->reported_drops;
+            buffer->reported_drops = dropped;
+            if (retired && buffer->ring.Empty()) {
+                buffer->released = true;
+                released++;
+            }
+        }
+        if (released > 0) {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                          [](const std::unique_ptr<ThreadBuffer> &buffer) {
+                                              return buffer->released;
+                                          }),
+                           buffers_.end());
+        }
+
+        if (new_drops > 0) {
+            char line[128];
+            snprintf(line, sizeof(line), "EventPipeline: dropped %" PRIu64 " events\n", new_drops);
+            Emit(line);
+        }
+        FlushLog();
+        return total;
+    }
+
+    // Returns the delay until the next task is due
+    int64_t EventPipeline::RunPeriodicTasks(jvmtiEnv *jvmti, JNIEnv *jni) {
+        int64_t now = MonotonicNanos();
+        int64_t next_delay = kDrainIntervalUs * 1000LL;
+        for (ScheduledTask &scheduled : tasks_) {
+            if (now >= scheduled.next_run_ns) {
+                int64_t delay = scheduled.task->Run(jvmti, jni);
+                now = MonotonicNanos();
+                scheduled.next_run_ns = now + delay;
+            }
+            next_delay = std::min(next_delay, scheduled.next_run_ns - now);
+        }
+        return std::max<int64_t>(0, next_delay);
+    }
+
+    void EventPipeline::RunDrainLoop(jvmtiEnv *jvmti, JNIEnv *jni) {
+        SymbolCache &symbols = SymbolCache::Instance();
+        while (running_.load()) {
+            size_t drained = Drain(jvmti, jni);
+            int64_t next_task_delay = RunPeriodicTasks(jvmti, jni);
+            // no symbol handed out by the cache is held past this point
+            symbols.Reclaim();
+            LogSymbolStats();
+            if (trace_.IsOpen() && MonotonicNanos() - last_trace_flush_ns_ >= kTraceFlushIntervalNs) {
+                trace_.Flush();
+                last_trace_flush_ns_ = MonotonicNanos();
+            }
+            if (drained == 0 && next_task_delay > 0) {
+                usleep(static_cast<useconds_t>(next_task_delay / 1000));
+            }
+        }
+        Drain(jvmti, jni);
+        for (ScheduledTask &scheduled : tasks_) {
+            scheduled.task->Finish(jvmti, jni);
+        }
+        trace_.Close();
+    }
+
+    const char *EventPipeline::ClassName(jlong class_id) {
+        const ClassSymbol *symbol = SymbolCache::Instance().FindClass(class_id);
+        return symbol != nullptr ? symbol->signature.c_str() : "<unknown>";
+    }
+
+    void EventPipeline::LogSymbolStats() {
+        int64_t now = MonotonicNanos();
+        if (now - last_stats_ns_ < kStatsIntervalNs) {
+            return;
+        }
+        last_stats_ns_ = now;
+        SymbolCache::Stats stats = SymbolCache::Instance().GetStats();
+        LOGE("SymbolCache: classes %" PRIu64 " hits / %" PRIu64 " misses, "
+             "methods %" PRIu64 " hits / %" PRIu64 " misses, %" PRIu64 " unloaded\n",
+             stats.class_hits, stats.class_misses, stats.method_hits, stats.method_misses,
+             stats.unloaded_classes);
+    }
+
+    // Symbolize a batch of records popped from a single thread buffer
+    void EventPipeline::Flush(jvmtiEnv *jvmti, JNIEnv *jni,
+                              const EventRecord *records, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            const EventRecord &record = records[i];
+            const MethodSymbol *method = nullptr;
+            switch (record.kind) {
+                case kEventMethodEntry:
+                case kEventMethodExit:
+                case kEventSingleStep:
+                case kEventExceptionCatch:
+                    method = SymbolCache::Instance().LookupMethod(
+                            jvmti, jni, reinterpret_cast<jmethodID>(record.id));
+                    if (method == nullptr) {
+                        // the declaring class may have been unloaded meanwhile
+                        continue;
+                    }
+                    break;
+
+                case kEventProbeEntry:
+                case kEventProbeExit:
+                    method = SymbolCache::Instance().FindProbeMethod(
+                            static_cast<uint32_t>(record.id));
+                    if (method == nullptr) {
+                        continue;
+                    }
+                    break;
+
+                case kEventClassLoad:
+                case kEventClassPrepare:
+                case kEventObjectAlloc:
+                    break;
+
+                default:
+                    continue;
+            }
+            if (trace_.IsOpen()) {
+                TraceRecord(record, method);
+            } else {
+                LogRecord(record, method);
+            }
+        }
+    }
+
+    void EventPipeline::TraceClass(jlong class_id) {
+        uint32_t id = static_cast<uint32_t>(class_id);
+        if (trace_.HasClass(id)) {
+            return;
+        }
+        const ClassSymbol *symbol = SymbolCache::Instance().FindClass(class_id);
+        trace_.DefineClass(id, symbol != nullptr ? symbol->signature : "<unknown>");
+    }
+
+    void EventPipeline::TraceMethod(const MethodSymbol &method) {
+        if (!trace_.HasMethod(method.id)) {
+            TraceClass(method.class_id);
+            trace_.DefineMethod(method.id, static_cast<uint32_t>(method.class_id),
+                                method.name, method.signature);
+        }
+    }
+
+    void EventPipeline::TraceRecord(const EventRecord &record, const MethodSymbol *method) {
+        if (method != nullptr) {
+            TraceMethod(*method);
+        }
+        switch (record.kind) {
+            case kEventMethodEntry:
+            case kEventMethodExit:
+            case kEventProbeEntry:
+            case kEventProbeExit:
+                trace_.AddMethodEvent(record.thread_id, record.timestamp_ns, method->id,
+                                      record.kind == kEventMethodExit ||
+                                      record.kind == kEventProbeExit);
+                break;
+
+            case kEventSingleStep:
+            case kEventExceptionCatch:
+                trace_.AddEvent(record.thread_id, record.timestamp_ns,
+                                static_cast<EventKind>(record.kind), method->id,
+                                static_cast<int32_t>(record.arg));
+                break;
+
+            default:
+                TraceClass(static_cast<jlong>(record.id));
+                trace_.AddEvent(record.thread_id, record.timestamp_ns,
+                                static_cast<EventKind>(record.kind),
+                                static_cast<uint32_t>(record.id),
+                                static_cast<int32_t>(record.arg));
+                break;
+        }
+    }
+
+    void EventPipeline::LogRecord(const EventRecord &record, const MethodSymbol *method) {
+        char line[512];
+        switch (record.kind) {
+            case kEventMethodEntry:
+            case kEventMethodExit:
+            case kEventProbeEntry:
+            case kEventProbeExit:
+                snprintf(line, sizeof(line), "%s: [%d] %s->%s%s\n",
+                         record.kind == kEventMethodEntry || record.kind == kEventProbeEntry
+                         ? "OnMethodEntry" : "OnMethodExist",
+                         record.thread_id, ClassName(method->class_id),
+                         method->name.c_str(), method->signature.c_str());
+                break;
+
+            case kEventSingleStep:
+                snprintf(line, sizeof(line), "OnSingleStep: %s->%s%s %" PRId64 "\n",
+                         ClassName(method->class_id), method->name.c_str(),
+                         method->signature.c_str(), record.arg);
+                break;
+
+            case kEventExceptionCatch:
+                snprintf(line, sizeof(line), "OnExceptionCatch: [%d] %s->%s%s %" PRId64 "\n",
+                         record.thread_id, ClassName(method->class_id), method->name.c_str(),
+                         method->signature.c_str(), record.arg);
+                break;
+
+            case kEventClassLoad:
+                snprintf(line, sizeof(line), "OnClassLoad: %s\n",
+                         ClassName(static_cast<jlong>(record.id)));
+                break;
+
+            case kEventClassPrepare:
+                snprintf(line, sizeof(line), "OnClassPrepare: %s\n",
+                         ClassName(static_cast<jlong>(record.id)));
+                break;
+
+            case kEventObjectAlloc:
+                snprintf(line, sizeof(line), "OnVMObjectAlloc: %s (%" PRId64 " bytes)\n",
+                         ClassName(static_cast<jlong>(record.id)), record.arg);
+                break;
+
+            default:
+                return;
+        }
+        Emit(line);
+    }
+
+    void EventPipeline::Emit(const char *line) {
+        log_batch_.append(line);
+        if (log_batch_.size() >= kMaxLogBatchSize) {
+            FlushLog();
+        }
+    }
+
+    void EventPipeline::FlushLog() {
+        if (!log_batch_.empty()) {
+            LOGE("%s", log_batch_.c_str());
+            log_batch_.clear();
+        }
+    }
+
+}  // namespace profiler
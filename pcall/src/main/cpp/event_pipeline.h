@@ -0,0 +1,185 @@
+#ifndef EVENT_PIPELINE_H
+#define EVENT_PIPELINE_H
+
+#include "jvmti.h"
+#include "ring_buffer.h"
+#include "trace_format.h"
+#include "trace_writer.h"
+#include "symbol_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Fixed-size binary record written by the application threads.
+     * The meaning of |id| and |arg| depends on |kind|:
+     *   method events : id = jmethodID, arg = jlocation (single step and
+     *                   exception catch only)
+     *   probe events  : id = probe id (see SymbolCache::InternProbeMethod)
+     *   class events  : id = class id (see SymbolCache::ClassId)
+     *   object alloc  : id = class id, arg = object size
+     */
+    struct EventRecord {
+        int64_t timestamp_ns;
+        uint64_t id;
+        int64_t arg;
+        int32_t thread_id;
+        uint16_t kind;
+        uint16_t flags;
+    };
+
+    static_assert(sizeof(EventRecord) == 32, "EventRecord must stay compact");
+
+    /**
+     * Work run periodically on the agent thread, between two drain passes.
+     */
+    class PeriodicTask {
+    public:
+        virtual ~PeriodicTask() = default;
+
+        /**
+         * Runs the task once; returns the delay in nanoseconds before the
+         * next run.
+         */
+        virtual int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) = 0;
+
+        /**
+         * Called once when the drain loop stops, before the trace is closed.
+         */
+        virtual void Finish(jvmtiEnv *jvmti, JNIEnv *jni) {}
+    };
+
+    /**
+     * Capture path for JVMTI events.
+     *
+     * Every application thread owns a single-producer ring buffer, so recording
+     * an event is a timestamp plus a 32-byte copy with no locks, no JVMTI
+     * allocations and no logging. The agent thread drains all the buffers
+     * periodically, symbolizes the records and streams them to the binary
+     * trace file, or logs them in batches when no trace file could be opened.
+     */
+    class EventPipeline {
+    public:
+        static EventPipeline &Instance();
+
+        EventPipeline(const EventPipeline &) = delete;
+
+        EventPipeline &operator=(const EventPipeline &) = delete;
+
+        /**
+         * Records an event on the calling thread's buffer (producer side).
+         */
+        void Record(EventKind kind, uint64_t id, int64_t arg = 0);
+
+        /**
+         * Streams the drained events to a binary trace file at |path| instead
+         * of the log. Must be called before the agent thread starts draining.
+         */
+        bool OpenTrace(const std::string &path);
+
+        /**
+         * Schedules |task| on the agent thread, first run on the next drain
+         * pass. Must be called before the agent thread starts draining.
+         */
+        void AddPeriodicTask(std::unique_ptr<PeriodicTask> task);
+
+        /**
+         * Returns the trace writer, or nullptr if events are only logged.
+         * Agent thread only.
+         */
+        TraceWriter *Trace() { return trace_.IsOpen() ? &trace_ : nullptr; }
+
+        /**
+         * Defines |method| and its class in the trace if they aren't yet.
+         * Agent thread only, requires an open trace.
+         */
+        void TraceMethod(const MethodSymbol &method);
+
+        /**
+         * Defines the class |class_id| in the trace if it isn't yet.
+         * Agent thread only, requires an open trace.
+         */
+        void TraceClass(jlong class_id);
+
+        /**
+         * Marks the calling thread's buffer as retired; it is released by the
+         * consumer once it has been fully drained. Called from ThreadEnd.
+         */
+        void RetireCurrentThread();
+
+        /**
+         * Drains every thread buffer once and flushes the records.
+         * Must only be called from the agent thread. Returns the number of
+         * records consumed.
+         */
+        size_t Drain(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        /**
+         * Drain loop run by the agent thread until Stop() is called.
+         */
+        void RunDrainLoop(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Stop() { running_.store(false); }
+
+    private:
+        struct ThreadBuffer {
+            explicit ThreadBuffer(int32_t tid, size_t capacity)
+                    : thread_id(tid), ring(capacity) {}
+
+            const int32_t thread_id;
+            SpscRingBuffer<EventRecord> ring;
+            std::atomic<bool> retired{false};
+            // consumer-only
+            uint64_t reported_drops = 0;
+            // retired and drained, removed at the end of the pass
+            bool released = false;
+        };
+
+        EventPipeline() = default;
+
+        ThreadBuffer *GetThreadBuffer();
+
+        void Flush(jvmtiEnv *jvmti, JNIEnv *jni, const EventRecord *records, size_t count);
+
+        void LogRecord(const EventRecord &record, const MethodSymbol *method);
+
+        void TraceRecord(const EventRecord &record, const MethodSymbol *method);
+
+        int64_t RunPeriodicTasks(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Emit(const char *line);
+
+        void FlushLog();
+
+        const char *ClassName(jlong class_id);
+
+        void LogSymbolStats();
+
+        std::mutex buffers_mutex_;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+        std::atomic<bool> running_{true};
+
+        // consumer-only state
+        // buffers_ as of the start of the current drain pass
+        std::vector<ThreadBuffer *> drain_list_;
+        std::string log_batch_;
+        int64_t last_stats_ns_ = 0;
+        TraceWriter trace_;
+        int64_t last_trace_flush_ns_ = 0;
+
+        struct ScheduledTask {
+            std::unique_ptr<PeriodicTask> task;
+            int64_t next_run_ns;
+        };
+        std::vector<ScheduledTask> tasks_;
+    };
+
+}  // namespace profiler
+
+#endif  // EVENT_PIPELINE_H
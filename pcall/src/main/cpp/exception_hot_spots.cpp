@@ -0,0 +1,268 @@
+#include "exception_hot_spots.h"
+#include "clock.h"
+#include "hash.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // sites listed per report when there is no trace file
+    static const size_t kLoggedSites = 10;
+
+    static uint32_t ClampCount(uint64_t count) {
+        return static_cast<uint32_t>(std::min<uint64_t>(count, std::numeric_limits<uint32_t>::max()));
+    }
+
+    ExceptionHotSpots &ExceptionHotSpots::Instance() {
+        static ExceptionHotSpots *instance = new ExceptionHotSpots();
+        return *instance;
+    }
+
+    // value-initialized: every slot and buffer starts free
+    ExceptionHotSpots::ExceptionHotSpots()
+            : slots_(new Slot[kCapacity]()), stacks_(new StackBuffer[kStackPoolSize]()) {}
+
+    void ExceptionHotSpots::OnException(jvmtiEnv *jvmti, JNIEnv *jni, jmethodID method,
+                                        jlocation location, jobject exception) {
+        // classes are tagged when prepared, an untagged one stays 0
+        jlong class_id = 0;
+        jclass klass = jni->GetObjectClass(exception);
+        if (klass != nullptr) {
+            if (jvmti->GetTag(klass, &class_id) != JVMTI_ERROR_NONE) {
+                class_id = 0;
+            }
+            jni->DeleteLocalRef(klass);
+        }
+        size_t slot = FindOrClaim(class_id, method, location);
+        if (slot == kCapacity) {
+            dropped_sites_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        slots_[slot].count.fetch_add(1, std::memory_order_relaxed);
+        if (stack_interval_ != 0) {
+            static thread_local uint32_t countdown = 1;
+            if (--countdown == 0) {
+                countdown = stack_interval_;
+                CaptureStack(jvmti, slot);
+            }
+        }
+    }
+
+    size_t ExceptionHotSpots::FindOrClaim(jlong class_id, jmethodID method, jlocation location) {
+        uint64_t fields[3] = {static_cast<uint64_t>(class_id),
+                              static_cast<uint64_t>(reinterpret_cast<uintptr_t>(method)),
+                              static_cast<uint64_t>(location)};
+        uint64_t key = Hash64(fields, sizeof(fields));
+        if (key == 0) {
+            key = 1;
+        }
+        size_t index = static_cast<size_t>(key) & (kCapacity - 1);
+        for (size_t probe = 0; probe < kMaxProbes; ++probe, index = (index + 1) & (kCapacity - 1)) {
+            Slot &slot = slots_[index];
+            uint64_t current = slot.key.load(std::memory_order_acquire);
+            if (current == 0) {
+                if (slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                    slot.class_id = class_id;
+                    slot.method = method;
+                    slot.location = location;
+                    slot.published.store(true, std::memory_order_release);
+                    return index;
+                }
+                // |current| now holds the key of the thread that won the slot
+            }
+            if (current == key) {
+                return index;
+            }
+        }
+        return kCapacity;
+    }
+
+    void ExceptionHotSpots::CaptureStack(jvmtiEnv *jvmti, size_t slot) {
+        uint32_t index = next_stack_.fetch_add(1, std::memory_order_relaxed) % kStackPoolSize;
+        StackBuffer &buffer = stacks_[index];
+        uint32_t expected = kBufferFree;
+        if (!buffer.state.compare_exchange_strong(expected, kBufferWriting,
+                                                  std::memory_order_acquire)) {
+            dropped_stacks_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        jvmtiFrameInfo frames[kStackDepth];
+        jint frame_count = 0;
+        if (jvmti->GetStackTrace(nullptr, 0, kStackDepth, frames, &frame_count) !=
+            JVMTI_ERROR_NONE) {
+            frame_count = 0;
+        }
+        buffer.stack.slot = slot;
+        buffer.stack.depth = frame_count;
+        for (jint i = 0; i < frame_count; ++i) {
+            buffer.stack.frames[i] = frames[i].method;
+        }
+        buffer.state.store(frame_count > 0 ? kBufferReady : kBufferFree,
+                           std::memory_order_release);
+    }
+
+    bool ExceptionHotSpots::GetSite(size_t slot, Site *site) const {
+        const Slot &s = slots_[slot];
+        if (!s.published.load(std::memory_order_acquire)) {
+            return false;
+        }
+        site->class_id = s.class_id;
+        site->method = s.method;
+        site->location = s.location;
+        site->count = s.count.load(std::memory_order_relaxed);
+        return true;
+    }
+
+    int64_t ExceptionHotSpotTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (!initialized_) {
+            initialized_ = true;
+            enabled_ = Init(jvmti);
+            return report_interval_ns_;
+        }
+        if (enabled_) {
+            Report(jvmti, jni);
+        }
+        return report_interval_ns_;
+    }
+
+    void ExceptionHotSpotTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (enabled_) {
+            Report(jvmti, jni);
+        }
+    }
+
+    bool ExceptionHotSpotTask::Init(jvmtiEnv *jvmti) {
+        if (!capabilities_->Enable(jvmti, kFeatureExceptionEvents)) {
+            LOGE("ExceptionHotSpots: exception events not available");
+            return false;
+        }
+        sites_.resize(ExceptionHotSpots::kCapacity);
+        SetEventNotification(jvmti, JVMTI_ENABLE, JVMTI_EVENT_EXCEPTION);
+        return true;
+    }
+
+    void ExceptionHotSpotTask::Report(jvmtiEnv *jvmti, JNIEnv *jni) {
+        ExceptionHotSpots &hot_spots = ExceptionHotSpots::Instance();
+        uint64_t dropped = hot_spots.DroppedSites();
+        if (dropped != reported_site_drops_) {
+            LOGE("ExceptionHotSpots: %" PRIu64 " exceptions not counted, the table is full",
+                 dropped - reported_site_drops_);
+            reported_site_drops_ = dropped;
+        }
+        dropped = hot_spots.DroppedStacks();
+        if (dropped != reported_stack_drops_) {
+            LOGE("ExceptionHotSpots: %" PRIu64 " stacks not captured", dropped - reported_stack_drops_);
+            reported_stack_drops_ = dropped;
+        }
+
+        std::vector<ExceptionSiteCount> counts;
+        ExceptionHotSpots::Site site;
+        for (size_t slot = 0; slot < sites_.size(); ++slot) {
+            SiteState &state = sites_[slot];
+            if (!hot_spots.GetSite(slot, &site) || site.count == state.reported) {
+                continue;
+            }
+            if (state.id == 0) {
+                Symbolize(jvmti, jni, site, &state);
+            }
+            counts.push_back({state.id, ClampCount(site.count - state.reported)});
+            state.reported = site.count;
+        }
+
+        // a stack whose site isn't symbolized yet (claimed by another thread
+        // and published after the copy) is dropped
+        SymbolCache &symbols = SymbolCache::Instance();
+        EventPipeline &pipeline = EventPipeline::Instance();
+        TraceWriter *trace = pipeline.Trace();
+        std::vector<uint32_t> frames;
+        hot_spots.DrainStacks([&](const ExceptionHotSpots::Stack &stack) {
+            uint32_t site_id = sites_[stack.slot].id;
+            if (site_id == 0 || trace == nullptr) {
+                return;
+            }
+            frames.clear();
+            for (jint i = 0; i < stack.depth; ++i) {
+                const MethodSymbol *method = symbols.LookupMethod(jvmti, jni, stack.frames[i]);
+                if (method != nullptr) {
+                    pipeline.TraceMethod(*method);
+                }
+                frames.push_back(method != nullptr ? method->id : 0);
+            }
+            stacks_[std::make_pair(site_id, frames)]++;
+        });
+
+        if (trace == nullptr) {
+            if (!counts.empty()) {
+                LogTop();
+            }
+            return;
+        }
+        int64_t now = MonotonicNanos();
+        if (!counts.empty()) {
+            trace->AddExceptionCounts(now, counts);
+        }
+        if (!stacks_.empty()) {
+            std::vector<ExceptionStackCount> stack_counts;
+            for (const auto &entry : stacks_) {
+                stack_counts.push_back({entry.first.first, entry.second, &entry.first.second});
+            }
+            trace->AddExceptionStacks(now, stack_counts);
+            stacks_.clear();
+        }
+    }
+
+    void ExceptionHotSpotTask::Symbolize(jvmtiEnv *jvmti, JNIEnv *jni,
+                                         const ExceptionHotSpots::Site &site, SiteState *state) {
+        SymbolCache &symbols = SymbolCache::Instance();
+        EventPipeline &pipeline = EventPipeline::Instance();
+        TraceWriter *trace = pipeline.Trace();
+        // the method of a freed class can't be resolved anymore, its site
+        // stays unnamed
+        const MethodSymbol *method = symbols.LookupMethod(jvmti, jni, site.method);
+        state->id = next_site_id_++;
+        if (trace != nullptr) {
+            if (site.class_id != 0) {
+                pipeline.TraceClass(site.class_id);
+            }
+            if (method != nullptr) {
+                pipeline.TraceMethod(*method);
+            }
+            trace->DefineExceptionSite(state->id, static_cast<uint32_t>(site.class_id),
+                                       method != nullptr ? method->id : 0,
+                                       static_cast<uint32_t>(site.location));
+            return;
+        }
+        const ClassSymbol *exception_class = symbols.FindClass(site.class_id);
+        const ClassSymbol *method_class = method != nullptr ? symbols.FindClass(method->class_id)
+                                                            : nullptr;
+        state->name.append(exception_class != nullptr ? exception_class->signature : "<untagged>")
+                   .append(" at ")
+                   .append(method_class != nullptr ? method_class->signature : "<unknown>")
+                   .append("->").append(method != nullptr ? method->name : "?")
+                   .append(method != nullptr ? method->signature : "")
+                   .append(" @").append(std::to_string(site.location));
+    }
+
+    void ExceptionHotSpotTask::LogTop() {
+        std::vector<const SiteState *> top;
+        for (const SiteState &state : sites_) {
+            if (state.reported > 0) {
+                top.push_back(&state);
+            }
+        }
+        size_t count = std::min(top.size(), kLoggedSites);
+        std::partial_sort(top.begin(), top.begin() + count, top.end(),
+                          [](const SiteState *a, const SiteState *b) {
+                              return a->reported > b->reported;
+                          });
+        LOGE("ExceptionHotSpots: %zu throw sites", top.size());
+        for (size_t i = 0; i < count; ++i) {
+            LOGE("ExceptionHotSpots: %10" PRIu64 "  %s", top[i]->reported, top[i]->name.c_str());
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,188 @@
+#ifndef EXCEPTION_HOT_SPOTS_H
+#define EXCEPTION_HOT_SPOTS_H
+
+#include "capability_planner.h"
+#include "event_pipeline.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Counts the exceptions thrown, from the Exception event, per throw
+     * site: the class of the exception, the throwing method and location.
+     *
+     * Sites live in a fixed open addressing table that any thread inserts
+     * into with a compare-and-swap on the slot key (a hash of the site, two
+     * sites with the same 64-bit hash are merged), so the callback takes no
+     * lock and allocates nothing: a class tag query, a few probes and a
+     * relaxed atomic add. A site's fields are written by the thread that
+     * claimed its slot and published after the key; the agent thread skips
+     * the slots not published yet.
+     *
+     * With a stack interval, the stack of 1 in N exceptions of each thread is
+     * copied to a small pool of preallocated buffers (dropped when they are
+     * all in use) until the agent thread symbolizes it.
+     */
+    class ExceptionHotSpots {
+    public:
+        static const size_t kCapacity = 2048;
+        static const int kStackDepth = 32;
+
+        struct Site {
+            jlong class_id;
+            jmethodID method;
+            jlocation location;
+            uint64_t count;
+        };
+
+        struct Stack {
+            // slot of the site
+            size_t slot;
+            jint depth;
+            jmethodID frames[kStackDepth];
+        };
+
+        static ExceptionHotSpots &Instance();
+
+        ExceptionHotSpots(const ExceptionHotSpots &) = delete;
+
+        ExceptionHotSpots &operator=(const ExceptionHotSpots &) = delete;
+
+        /**
+         * Captures the stack of 1 in |interval| exceptions of each thread, 0
+         * for none. Before the events are enabled.
+         */
+        void SetStackInterval(uint32_t interval) { stack_interval_ = interval; }
+
+        void OnException(jvmtiEnv *jvmti, JNIEnv *jni, jmethodID method, jlocation location,
+                         jobject exception);
+
+        /**
+         * Returns the site in |slot| with its count since the start, false if
+         * the slot holds no published site. Agent thread only.
+         */
+        bool GetSite(size_t slot, Site *site) const;
+
+        /**
+         * Calls |visitor| with every captured stack and releases its buffer.
+         * Agent thread only.
+         */
+        template<typename Visitor>
+        void DrainStacks(Visitor visitor) {
+            for (size_t i = 0; i < kStackPoolSize; ++i) {
+                StackBuffer &buffer = stacks_[i];
+                if (buffer.state.load(std::memory_order_acquire) == kBufferReady) {
+                    visitor(static_cast<const Stack &>(buffer.stack));
+                    buffer.state.store(kBufferFree, std::memory_order_release);
+                }
+            }
+        }
+
+        /**
+         * Exceptions not counted on a full table, and stacks not captured on
+         * a full pool, since the start.
+         */
+        uint64_t DroppedSites() const { return dropped_sites_.load(std::memory_order_relaxed); }
+
+        uint64_t DroppedStacks() const { return dropped_stacks_.load(std::memory_order_relaxed); }
+
+    private:
+        static const size_t kMaxProbes = 64;
+        static const size_t kStackPoolSize = 64;
+
+        enum BufferState : uint32_t {
+            kBufferFree,
+            kBufferWriting,
+            kBufferReady,
+        };
+
+        struct Slot {
+            // hash of the site, 0 while free
+            std::atomic<uint64_t> key;
+            std::atomic<uint64_t> count;
+            // set once the fields below are written
+            std::atomic<bool> published;
+            jlong class_id;
+            jmethodID method;
+            jlocation location;
+        };
+
+        struct StackBuffer {
+            std::atomic<uint32_t> state;
+            Stack stack;
+        };
+
+        ExceptionHotSpots();
+
+        // Returns the slot of the site, claiming it the first time, or
+        // kCapacity if the table is full
+        size_t FindOrClaim(jlong class_id, jmethodID method, jlocation location);
+
+        void CaptureStack(jvmtiEnv *jvmti, size_t slot);
+
+        uint32_t stack_interval_ = 0;
+        const std::unique_ptr<Slot[]> slots_;
+        const std::unique_ptr<StackBuffer[]> stacks_;
+        std::atomic<uint32_t> next_stack_{0};
+        std::atomic<uint64_t> dropped_sites_{0};
+        std::atomic<uint64_t> dropped_stacks_{0};
+    };
+
+    /**
+     * Enables the Exception event and reports the throw sites from the agent
+     * thread: the new sites, the count deltas and the captured stacks go to
+     * the trace (see kChunkExceptionSites), or the sites that threw the most
+     * to the log when there is no trace file.
+     */
+    class ExceptionHotSpotTask : public PeriodicTask {
+    public:
+        ExceptionHotSpotTask(CapabilityPlanner *capabilities, int64_t report_interval_ns)
+                : capabilities_(capabilities), report_interval_ns_(report_interval_ns) {}
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct SiteState {
+            // trace id, 0 until the site is symbolized
+            uint32_t id = 0;
+            uint64_t reported = 0;
+            // exception class and throw site, for the log
+            std::string name;
+        };
+
+        bool Init(jvmtiEnv *jvmti);
+
+        void Report(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Symbolize(jvmtiEnv *jvmti, JNIEnv *jni, const ExceptionHotSpots::Site &site,
+                       SiteState *state);
+
+        void LogTop();
+
+        CapabilityPlanner *const capabilities_;
+        const int64_t report_interval_ns_;
+        bool initialized_ = false;
+        bool enabled_ = false;
+        uint64_t reported_site_drops_ = 0;
+        uint64_t reported_stack_drops_ = 0;
+
+        // indexed by slot
+        std::vector<SiteState> sites_;
+        uint32_t next_site_id_ = 1;
+        // (site id, frame method ids) -> stacks captured since the last report
+        std::map<std::pair<uint32_t, std::vector<uint32_t>>, uint32_t> stacks_;
+    };
+
+}  // namespace profiler
+
+#endif  // EXCEPTION_HOT_SPOTS_H
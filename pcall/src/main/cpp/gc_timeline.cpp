@@ -0,0 +1,179 @@
+#include "gc_timeline.h"
+#include "jvmti_helper.h"
+
+#include <inttypes.h>
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // heap sampling and drain period
+    static const int64_t kSamplePeriodNs = 100000000LL;
+    // run period once the events turned out to be unavailable
+    static const int64_t kIdlePeriodNs = 3600000000000LL;
+    static const size_t kDrainBatchSize = 64;
+
+    GcEvents &GcEvents::Instance() {
+        static GcEvents *instance = new GcEvents();
+        return *instance;
+    }
+
+    GcTimelineTask::GcTimelineTask(CapabilityPlanner *capabilities, int64_t report_interval_ns)
+            : capabilities_(capabilities), report_interval_ns_(report_interval_ns),
+              timeline_(kTimelineSize), samples_(kTimelineSize), windows_(kWindowCount) {}
+
+    int64_t GcTimelineTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (!initialized_) {
+            initialized_ = true;
+            enabled_ = Init(jvmti, jni);
+            next_report_ns_ = MonotonicNanos() + report_interval_ns_;
+        }
+        if (!enabled_) {
+            return kIdlePeriodNs;
+        }
+        Collect(jni);
+        if (MonotonicNanos() >= next_report_ns_) {
+            Report();
+            next_report_ns_ += report_interval_ns_;
+        }
+        return kSamplePeriodNs;
+    }
+
+    void GcTimelineTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (enabled_) {
+            Collect(jni);
+            Report();
+        }
+    }
+
+    bool GcTimelineTask::Init(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (!capabilities_->Enable(jvmti, kFeatureGcEvents)) {
+            LOGE("GcTimeline: garbage collection events not available");
+            return false;
+        }
+        // the pauses are still recorded if the heap usage can't be sampled
+        ScopedLocalRef<jclass> runtime_class(jni, jni->FindClass("java/lang/Runtime"));
+        jmethodID get_runtime = runtime_class.get() != nullptr
+                ? jni->GetStaticMethodID(runtime_class.get(), "getRuntime", "()Ljava/lang/Runtime;")
+                : nullptr;
+        if (get_runtime != nullptr) {
+            total_memory_ = jni->GetMethodID(runtime_class.get(), "totalMemory", "()J");
+            free_memory_ = jni->GetMethodID(runtime_class.get(), "freeMemory", "()J");
+            ScopedLocalRef<jobject> runtime(
+                    jni, jni->CallStaticObjectMethod(runtime_class.get(), get_runtime));
+            if (runtime.get() != nullptr && total_memory_ != nullptr && free_memory_ != nullptr) {
+                runtime_ = jni->NewGlobalRef(runtime.get());
+            }
+        }
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionClear();
+        }
+        if (runtime_ == nullptr) {
+            LOGE("GcTimeline: can't sample the heap usage");
+        }
+        last_heap_kb_ = SampleHeapKb(jni);
+        SetEventNotification(jvmti, JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START);
+        SetEventNotification(jvmti, JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH);
+        return true;
+    }
+
+    uint32_t GcTimelineTask::SampleHeapKb(JNIEnv *jni) {
+        if (runtime_ == nullptr) {
+            return 0;
+        }
+        jlong total = jni->CallLongMethod(runtime_, total_memory_);
+        jlong free = jni->CallLongMethod(runtime_, free_memory_);
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionClear();
+            return 0;
+        }
+        return static_cast<uint32_t>(std::max<jlong>(0, total - free) >> 10);
+    }
+
+    // Moves the pauses to the timeline, sampling the heap once they're
+    // drained so that the sample follows every one of them
+    void GcTimelineTask::Collect(JNIEnv *jni) {
+        GcEvents &events = GcEvents::Instance();
+        GcEvents::Pause batch[kDrainBatchSize];
+        uint64_t first = count_;
+        size_t drained;
+        while ((drained = events.Drain(batch, kDrainBatchSize)) > 0) {
+            for (size_t i = 0; i < drained; ++i) {
+                const GcEvents::Pause &pause = batch[i];
+                GcPause &entry = timeline_[count_ % kTimelineSize];
+                entry.start_ns = pause.start_ns;
+                entry.pause_us = static_cast<uint32_t>(std::min<int64_t>(
+                        pause.duration_ns / 1000, std::numeric_limits<uint32_t>::max()));
+                entry.heap_before_kb = last_heap_kb_;
+                samples_[count_ % kTimelineSize] = sample_count_;
+                count_++;
+                windows_[window_].Add(static_cast<uint64_t>(std::max<int64_t>(0, pause.duration_ns)));
+            }
+        }
+        uint32_t heap_kb = SampleHeapKb(jni);
+        for (uint64_t i = std::max(first, count_ - std::min<uint64_t>(count_, kTimelineSize));
+             i < count_; ++i) {
+            timeline_[i % kTimelineSize].heap_after_kb = heap_kb;
+        }
+        last_heap_kb_ = heap_kb;
+        sample_count_++;
+    }
+
+    void GcTimelineTask::Report() {
+        uint64_t dropped = GcEvents::Instance().Dropped();
+        if (dropped != reported_drops_) {
+            LOGE("GcTimeline: dropped %" PRIu64 " collections", dropped - reported_drops_);
+            reported_drops_ = dropped;
+        }
+        // the oldest entries may have been overwritten since the last report
+        uint64_t first = std::max(reported_, count_ - std::min<uint64_t>(count_, kTimelineSize));
+        if (first < count_) {
+            TraceWriter *trace = EventPipeline::Instance().Trace();
+            if (trace != nullptr) {
+                std::vector<GcPause> pauses;
+                for (uint64_t i = first; i < count_; ++i) {
+                    pauses.push_back(timeline_[i % kTimelineSize]);
+                }
+                trace->AddGcPauses(pauses.data(), pauses.size());
+            } else {
+                LogWindow();
+            }
+            reported_ = count_;
+        }
+        window_ = (window_ + 1) % kWindowCount;
+        windows_[window_].Clear();
+    }
+
+    void GcTimelineTask::LogWindow() {
+        LatencyHistogram rolling;
+        for (const LatencyHistogram &window : windows_) {
+            rolling.Merge(window);
+        }
+        // heap growth between the end of a collection and the start of the
+        // next one, over the entries of the rolling window; the pauses
+        // drained in the same run share their samples, nothing can be told
+        // about the allocations between them
+        int64_t span_ns = report_interval_ns_ * static_cast<int64_t>(kWindowCount);
+        int64_t since_ns = MonotonicNanos() - span_ns;
+        uint64_t allocated_kb = 0;
+        uint64_t first = count_ - std::min<uint64_t>(count_, kTimelineSize);
+        for (uint64_t i = first + 1; i < count_; ++i) {
+            const GcPause &previous = timeline_[(i - 1) % kTimelineSize];
+            const GcPause &pause = timeline_[i % kTimelineSize];
+            if (samples_[i % kTimelineSize] == samples_[(i - 1) % kTimelineSize]) {
+                continue;
+            }
+            if (pause.start_ns >= since_ns && pause.heap_before_kb > previous.heap_after_kb) {
+                allocated_kb += pause.heap_before_kb - previous.heap_after_kb;
+            }
+        }
+        const GcPause &last = timeline_[(count_ - 1) % kTimelineSize];
+        LOGE("GcTimeline: %" PRIu64 " collections in %.0f s, pause p50 %.2f p90 %.2f p99 %.2f "
+             "max %.2f ms, %.2f ms total; heap %u -> %u KB, ~%.1f MB/s allocated",
+             rolling.Count(), span_ns / 1e9, rolling.Percentile(0.5) / 1e6,
+             rolling.Percentile(0.9) / 1e6, rolling.Percentile(0.99) / 1e6, rolling.Max() / 1e6,
+             rolling.Sum() / 1e6, last.heap_before_kb, last.heap_after_kb,
+             allocated_kb / 1024.0 / (span_ns / 1e9));
+    }
+
+}  // namespace profiler
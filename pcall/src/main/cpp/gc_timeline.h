@@ -0,0 +1,132 @@
+#ifndef GC_TIMELINE_H
+#define GC_TIMELINE_H
+
+#include "capability_planner.h"
+#include "clock.h"
+#include "event_pipeline.h"
+#include "jvmti.h"
+#include "latency_histogram.h"
+#include "ring_buffer.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Collection pauses reported by the GarbageCollectionStart/Finish events.
+     *
+     * Those callbacks run while the heap is being collected, where JNI and
+     * most JVMTI functions are forbidden, so they only read the monotonic
+     * clock: Start stores its timestamp in an atomic, Finish pushes the
+     * (start, duration) pair to a ring buffer allocated up front. The runtime
+     * never runs two collections' events at once, which keeps the ring
+     * single-producer even though they come from different threads.
+     */
+    class GcEvents {
+    public:
+        struct Pause {
+            int64_t start_ns;
+            int64_t duration_ns;
+        };
+
+        static GcEvents &Instance();
+
+        GcEvents(const GcEvents &) = delete;
+
+        GcEvents &operator=(const GcEvents &) = delete;
+
+        void OnStart() { start_ns_.store(MonotonicNanos(), std::memory_order_relaxed); }
+
+        void OnFinish() {
+            // 0 when the events were enabled during a collection
+            int64_t start_ns = start_ns_.exchange(0, std::memory_order_relaxed);
+            if (start_ns != 0) {
+                pauses_.Push(Pause{start_ns, MonotonicNanos() - start_ns});
+            }
+        }
+
+        /**
+         * Copies up to |max_count| pauses into |out|. Agent thread only.
+         */
+        size_t Drain(Pause *out, size_t max_count) { return pauses_.Pop(out, max_count); }
+
+        uint64_t Dropped() const { return pauses_.Dropped(); }
+
+    private:
+        // a collection every few ms at worst, drained every 100 ms
+        static const size_t kCapacity = 256;
+
+        GcEvents() : pauses_(kCapacity) {}
+
+        std::atomic<int64_t> start_ns_{0};
+        SpscRingBuffer<Pause> pauses_;
+    };
+
+    /**
+     * Builds the collection timeline on the agent thread: the pauses of
+     * GcEvents with the heap usage sampled (Runtime.totalMemory() -
+     * freeMemory()) on the run before and after each of them, the last
+     * kTimelineSize of them in a fixed ring, and a histogram of the pauses
+     * over the last kWindowCount report intervals.
+     *
+     * heap_before_kb and heap_after_kb are not taken at the pause: they are
+     * the agent thread samples surrounding it, the one of the previous run
+     * and the one taken once the pause is drained, each up to a sample
+     * period (100 ms) away. Every pause drained in the same run gets the
+     * same two samples.
+     *
+     * Every report the new pauses go to the trace (see kChunkGcPauses), or
+     * the rolling histogram and the allocation rate between collections to
+     * the log when there is no trace file.
+     */
+    class GcTimelineTask : public PeriodicTask {
+    public:
+        GcTimelineTask(CapabilityPlanner *capabilities, int64_t report_interval_ns);
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        static const size_t kTimelineSize = 1024;
+        static const size_t kWindowCount = 6;
+
+        bool Init(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        uint32_t SampleHeapKb(JNIEnv *jni);
+
+        void Collect(JNIEnv *jni);
+
+        void Report();
+
+        void LogWindow();
+
+        CapabilityPlanner *const capabilities_;
+        const int64_t report_interval_ns_;
+        bool initialized_ = false;
+        bool enabled_ = false;
+        jobject runtime_ = nullptr;
+        jmethodID total_memory_ = nullptr;
+        jmethodID free_memory_ = nullptr;
+        uint32_t last_heap_kb_ = 0;
+        int64_t next_report_ns_ = 0;
+        uint64_t reported_drops_ = 0;
+
+        // ring of the last collections, timeline_[count_ % kTimelineSize] is next
+        std::vector<GcPause> timeline_;
+        // the run which drained each timeline_ entry
+        std::vector<uint64_t> samples_;
+        uint64_t sample_count_ = 0;
+        uint64_t count_ = 0;
+        // entries from this one on haven't been reported
+        uint64_t reported_ = 0;
+        // pause histograms of the last report intervals, windows_[window_] is current
+        std::vector<LatencyHistogram> windows_;
+        size_t window_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // GC_TIMELINE_H
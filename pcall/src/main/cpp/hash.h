@@ -0,0 +1,53 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace profiler {
+
+    /**
+     * 64-bit MurmurHash64A of data[0, size). Not a cryptographic hash, used
+     * to key cached class images and to fingerprint configurations.
+     */
+    inline uint64_t Hash64(const void *data, size_t size, uint64_t seed = 0) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        uint64_t h = seed ^ (size * m);
+
+        const unsigned char *end = bytes + (size & ~static_cast<size_t>(7));
+        for (; bytes != end; bytes += 8) {
+            uint64_t k;
+            memcpy(&k, bytes, sizeof(k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        uint64_t tail = 0;
+        switch (size & 7) {
+            case 7: tail ^= static_cast<uint64_t>(bytes[6]) << 48;  // fall through
+            case 6: tail ^= static_cast<uint64_t>(bytes[5]) << 40;  // fall through
+            case 5: tail ^= static_cast<uint64_t>(bytes[4]) << 32;  // fall through
+            case 4: tail ^= static_cast<uint64_t>(bytes[3]) << 24;  // fall through
+            case 3: tail ^= static_cast<uint64_t>(bytes[2]) << 16;  // fall through
+            case 2: tail ^= static_cast<uint64_t>(bytes[1]) << 8;   // fall through
+            case 1:
+                tail ^= static_cast<uint64_t>(bytes[0]);
+                h ^= tail;
+                h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
+}  // namespace profiler
+
+#endif  // HASH_H
@@ -0,0 +1,237 @@
+#include "heap_graph.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+#include "slicer/dex_leb128.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // object tags are node ids offset past any class id of the SymbolCache
+    static const jlong kObjectTagBase = 1LL << 40;
+
+    // a pending block is written out once it reaches this size
+    static const size_t kMaxBlockSize = 256 * 1024;
+
+    static void PushFixed(std::vector<uint8_t> &out, uint64_t value, int size) {
+        for (int i = 0; i < size; ++i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    static void PushULeb128(std::vector<uint8_t> &out, uint32_t value) {
+        dex::u1 tmp[5];
+        dex::u1 *end = dex::WriteULeb128(tmp, value);
+        out.insert(out.end(), tmp, end);
+    }
+
+    static void PushSLeb128(std::vector<uint8_t> &out, int32_t value) {
+        dex::u1 tmp[5];
+        dex::u1 *end = dex::WriteSLeb128(tmp, value);
+        out.insert(out.end(), tmp, end);
+    }
+
+    static bool IsClassTag(jlong tag) {
+        return tag > 0 && tag < kObjectTagBase;
+    }
+
+    bool HeapGraphCapture::Capture(jvmtiEnv *jvmti, const std::string &path) {
+        file_ = fopen(path.c_str(), "wb");
+        if (file_ == nullptr) {
+            LOGE("HeapGraphCapture: can't create %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        std::vector<uint8_t> header;
+        PushFixed(header, kHeapGraphMagic, 4);
+        PushFixed(header, kHeapGraphVersion, 2);
+        PushFixed(header, 0, 2);
+        failed_ = fwrite(header.data(), 1, header.size(), file_) != header.size();
+
+        jvmtiHeapCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.heap_reference_callback = OnReference;
+        const int64_t start_ns = MonotonicNanos();
+        jvmtiError error = jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, this);
+        const int64_t walk_ns = MonotonicNanos() - start_ns;
+        FlushNodes();
+        FlushEdges();
+        WriteClasses();
+        CloseFile();
+        // the tags of a partial walk must go too
+        ClearTags(jvmti);
+
+        if (CheckJvmtiError(jvmti, error, "FollowReferences") || failed_) {
+            LOGE("HeapGraphCapture: failed to write %s", path.c_str());
+            unlink(path.c_str());
+            return false;
+        }
+        LOGE("HeapGraphCapture: %u nodes, %" PRIu64 " edges to %s, walked in %.1f ms, "
+             "untagged in %.1f ms", NodeCount(), edge_count_, path.c_str(), walk_ns / 1e6,
+             (MonotonicNanos() - start_ns - walk_ns) / 1e6);
+        return true;
+    }
+
+    jint JNICALL HeapGraphCapture::OnReference(jvmtiHeapReferenceKind reference_kind,
+                                               const jvmtiHeapReferenceInfo *reference_info,
+                                               jlong class_tag, jlong referrer_class_tag,
+                                               jlong size, jlong *tag_ptr,
+                                               jlong *referrer_tag_ptr, jint length,
+                                               void *user_data) {
+        HeapGraphCapture *capture = static_cast<HeapGraphCapture *>(user_data);
+        // the referrer was reached before, or this is a root (node 0)
+        uint32_t from = referrer_tag_ptr != nullptr ? capture->NodeOf(referrer_tag_ptr, 0, 0) : 0;
+        uint32_t to = capture->NodeOf(tag_ptr, class_tag, size);
+        capture->AddEdge(from, to);
+        return capture->failed_ ? JVMTI_VISIT_ABORT : JVMTI_VISIT_OBJECTS;
+    }
+
+    uint32_t HeapGraphCapture::NodeOf(jlong *tag_ptr, jlong class_tag, jlong size) {
+        jlong tag = *tag_ptr;
+        if (tag >= kObjectTagBase) {
+            return static_cast<uint32_t>(tag - kObjectTagBase);
+        }
+        uint32_t *class_node = nullptr;
+        if (IsClassTag(tag)) {
+            size_t class_id = static_cast<size_t>(tag);
+            if (class_id >= class_nodes_.size()) {
+                class_nodes_.resize(class_id + 1);
+            }
+            class_node = &class_nodes_[class_id];
+            if (*class_node != 0) {
+                return *class_node;
+            }
+        }
+
+        uint32_t node = next_node_++;
+        if (class_node != nullptr) {
+            *class_node = node;
+        } else {
+            *tag_ptr = kObjectTagBase + node;
+        }
+        uint32_t class_id = IsClassTag(class_tag) ? static_cast<uint32_t>(class_tag) : 0;
+        if (class_id >= node_classes_.size()) {
+            node_classes_.resize(class_id + 1);
+        }
+        node_classes_[class_id] = true;
+        if (nodes_.empty()) {
+            PushFixed(nodes_, node, 4);
+        }
+        PushFixed(nodes_, class_id, 4);
+        PushFixed(nodes_, static_cast<uint32_t>(size), 4);
+        if (nodes_.size() >= kMaxBlockSize) {
+            FlushNodes();
+        }
+        return node;
+    }
+
+    void HeapGraphCapture::AddEdge(uint32_t from, uint32_t to) {
+        PushSLeb128(edges_, static_cast<int32_t>(from - edges_last_from_));
+        PushULeb128(edges_, to);
+        edges_last_from_ = from;
+        edge_count_++;
+        if (edges_.size() >= kMaxBlockSize) {
+            FlushEdges();
+        }
+    }
+
+    void HeapGraphCapture::FlushNodes() {
+        if (!nodes_.empty()) {
+            WriteBlock(kGraphNodes, nodes_);
+            nodes_.clear();
+        }
+    }
+
+    void HeapGraphCapture::FlushEdges() {
+        if (!edges_.empty()) {
+            WriteBlock(kGraphEdges, edges_);
+            edges_.clear();
+            edges_last_from_ = 0;
+        }
+    }
+
+    void HeapGraphCapture::WriteClasses() {
+        SymbolCache &symbols = SymbolCache::Instance();
+        std::vector<uint8_t> classes;
+        size_t class_count = std::max(node_classes_.size(), class_nodes_.size());
+        for (size_t class_id = 1; class_id < class_count; ++class_id) {
+            bool used = (class_id < node_classes_.size() && node_classes_[class_id]) ||
+                        (class_id < class_nodes_.size() && class_nodes_[class_id] != 0);
+            const ClassSymbol *symbol = used ? symbols.FindClass(class_id) : nullptr;
+            if (symbol != nullptr) {
+                PushULeb128(classes, static_cast<uint32_t>(class_id));
+                PushULeb128(classes, static_cast<uint32_t>(symbol->signature.size()));
+                classes.insert(classes.end(), symbol->signature.begin(), symbol->signature.end());
+            }
+        }
+        WriteBlock(kGraphClasses, classes);
+
+        std::vector<uint8_t> class_nodes;
+        for (size_t class_id = 1; class_id < class_nodes_.size(); ++class_id) {
+            if (class_nodes_[class_id] != 0) {
+                PushULeb128(class_nodes, class_nodes_[class_id]);
+                PushULeb128(class_nodes, static_cast<uint32_t>(class_id));
+            }
+        }
+        WriteBlock(kGraphClassNodes, class_nodes);
+    }
+
+    void HeapGraphCapture::WriteBlock(HeapGraphBlockType type,
+                                      const std::vector<uint8_t> &payload) {
+        if (file_ == nullptr || failed_) {
+            return;
+        }
+        uint8_t header[kHeapGraphBlockHeaderSize];
+        header[0] = type;
+        uint32_t size = static_cast<uint32_t>(payload.size());
+        for (int i = 0; i < 4; ++i) {
+            header[1 + i] = static_cast<uint8_t>(size >> (8 * i));
+        }
+        failed_ = fwrite(header, 1, sizeof(header), file_) != sizeof(header) ||
+                  fwrite(payload.data(), 1, payload.size(), file_) != payload.size();
+    }
+
+    void HeapGraphCapture::CloseFile() {
+        if (file_ != nullptr) {
+            failed_ = fclose(file_) != 0 || failed_;
+            file_ = nullptr;
+        }
+    }
+
+    jint JNICALL HeapGraphCapture::ClearTag(jlong class_tag, jlong size, jlong *tag_ptr,
+                                            jint length, void *user_data) {
+        if (*tag_ptr >= kObjectTagBase) {
+            *tag_ptr = 0;
+        }
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    jint JNICALL HeapGraphCapture::ClearReferenceTag(jvmtiHeapReferenceKind reference_kind,
+                                                     const jvmtiHeapReferenceInfo *reference_info,
+                                                     jlong class_tag, jlong referrer_class_tag,
+                                                     jlong size, jlong *tag_ptr,
+                                                     jlong *referrer_tag_ptr, jint length,
+                                                     void *user_data) {
+        return ClearTag(class_tag, size, tag_ptr, length, user_data);
+    }
+
+    void HeapGraphCapture::ClearTags(jvmtiEnv *jvmti) {
+        jvmtiHeapCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.heap_iteration_callback = ClearTag;
+        if (jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &callbacks,
+                                      nullptr) == JVMTI_ERROR_NONE) {
+            return;
+        }
+        // some runtimes only have FollowReferences, which reaches the same objects
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.heap_reference_callback = ClearReferenceTag;
+        CheckJvmtiError(jvmti, jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, nullptr),
+                        "clearing the heap graph tags");
+    }
+
+}  // namespace profiler
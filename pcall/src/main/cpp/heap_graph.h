@@ -0,0 +1,105 @@
+#ifndef HEAP_GRAPH_H
+#define HEAP_GRAPH_H
+
+#include "heap_graph_format.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Captures the heap reference graph to a file (see heap_graph_format.h)
+     * for the offline dominator and retained size analysis of pcall-heap.
+     *
+     * FollowReferences reports every reference reachable from the roots.
+     * The first time an object is reached it is tagged with its node id,
+     * offset past the class ids of the SymbolCache so that classes keep
+     * their tag (a reached Class object gets its node through a table
+     * indexed by class id instead). Nodes and edges are appended to two
+     * buffers written out as blocks when they fill up, so the agent memory
+     * doesn't grow with the heap; the callback makes no JVMTI call and
+     * doesn't log. The object tags are removed once the graph is written.
+     *
+     * The classes must be tagged beforehand (see HeapHistogram::TagClasses),
+     * objects of untagged classes are attributed to class 0.
+     * Agent thread only.
+     */
+    class HeapGraphCapture {
+    public:
+        HeapGraphCapture() = default;
+
+        ~HeapGraphCapture() { CloseFile(); }
+
+        HeapGraphCapture(const HeapGraphCapture &) = delete;
+
+        HeapGraphCapture &operator=(const HeapGraphCapture &) = delete;
+
+        /**
+         * Writes the graph to |path|. A single JVMTI call during which the
+         * runtime is paused, plus a heap iteration to remove the tags.
+         */
+        bool Capture(jvmtiEnv *jvmti, const std::string &path);
+
+        uint32_t NodeCount() const { return next_node_ - 1; }
+
+        uint64_t EdgeCount() const { return edge_count_; }
+
+    private:
+        static jint JNICALL OnReference(jvmtiHeapReferenceKind reference_kind,
+                                        const jvmtiHeapReferenceInfo *reference_info,
+                                        jlong class_tag, jlong referrer_class_tag, jlong size,
+                                        jlong *tag_ptr, jlong *referrer_tag_ptr, jint length,
+                                        void *user_data);
+
+        static jint JNICALL ClearTag(jlong class_tag, jlong size, jlong *tag_ptr, jint length,
+                                     void *user_data);
+
+        static jint JNICALL ClearReferenceTag(jvmtiHeapReferenceKind reference_kind,
+                                              const jvmtiHeapReferenceInfo *reference_info,
+                                              jlong class_tag, jlong referrer_class_tag,
+                                              jlong size, jlong *tag_ptr, jlong *referrer_tag_ptr,
+                                              jint length, void *user_data);
+
+        /**
+         * Returns the node of the object tagged |*tag_ptr|, creating it (and
+         * tagging the object) the first time it is reached.
+         */
+        uint32_t NodeOf(jlong *tag_ptr, jlong class_tag, jlong size);
+
+        void AddEdge(uint32_t from, uint32_t to);
+
+        void FlushNodes();
+
+        void FlushEdges();
+
+        void WriteClasses();
+
+        void WriteBlock(HeapGraphBlockType type, const std::vector<uint8_t> &payload);
+
+        void CloseFile();
+
+        void ClearTags(jvmtiEnv *jvmti);
+
+        FILE *file_ = nullptr;
+        bool failed_ = false;
+        uint32_t next_node_ = 1;
+        uint64_t edge_count_ = 0;
+
+        // pending blocks
+        std::vector<uint8_t> nodes_;
+        std::vector<uint8_t> edges_;
+        uint32_t edges_last_from_ = 0;
+
+        // node of the Class object of each class id, 0 if not reached
+        std::vector<uint32_t> class_nodes_;
+        // class ids of the nodes, to write their names
+        std::vector<bool> node_classes_;
+    };
+
+}  // namespace profiler
+
+#endif  // HEAP_GRAPH_H
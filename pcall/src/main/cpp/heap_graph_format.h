@@ -0,0 +1,54 @@
+#ifndef HEAP_GRAPH_FORMAT_H
+#define HEAP_GRAPH_FORMAT_H
+
+#include <stdint.h>
+
+/**
+ * Heap reference graph file layout, shared by the agent (HeapGraphCapture)
+ * and the host side analysis (pcall-heap). Same conventions as the trace
+ * format (see trace_format.h): little endian fixed-width integers, LEB128
+ * "uleb"/"sleb" and length-prefixed "string"s.
+ *
+ *   header : u4 magic, u2 version, u2 reserved
+ *   block* : u1 type, u4 payload size, payload
+ *
+ * Block payloads:
+ *
+ *   kGraphNodes      : u4 first_node_id, { u4 class_id, u4 size }*
+ *   kGraphEdges      : { sleb from_delta, uleb to_node_id }*
+ *   kGraphClasses    : { uleb class_id, string signature }*
+ *   kGraphClassNodes : { uleb node_id, uleb class_id }*
+ *
+ * Every object reached from the roots is a node, numbered from 1 in the
+ * order it was first reached; node blocks list them in that order with
+ * the id (tag) of their class and their shallow size. Node 0 is a virtual
+ * root: the edges from it are the heap roots (JNI references, stack locals,
+ * system classes...). An edge is one reference from an object field, array
+ * element, class or loader slot to another object. Within an edges block the
+ * referrer is delta coded against the referrer of the previous edge (the
+ * first one against 0): the references of an object are reported together,
+ * so the delta is mostly 0 and an edge takes about 4 bytes.
+ *
+ * Edges may reference nodes of a later node block. The class names, and the
+ * nodes that are Class objects with the class they stand for, are written
+ * after the last edge. A file missing its last blocks is unusable.
+ */
+
+namespace profiler {
+
+    static const uint32_t kHeapGraphMagic = 0x47484350;  // "PCHG"
+    static const uint16_t kHeapGraphVersion = 1;
+
+    static const uint32_t kHeapGraphHeaderSize = 8;
+    static const uint32_t kHeapGraphBlockHeaderSize = 5;
+
+    enum HeapGraphBlockType : uint8_t {
+        kGraphNodes = 1,
+        kGraphEdges = 2,
+        kGraphClasses = 3,
+        kGraphClassNodes = 4,
+    };
+
+}  // namespace profiler
+
+#endif  // HEAP_GRAPH_FORMAT_H
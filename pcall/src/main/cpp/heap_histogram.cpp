@@ -0,0 +1,137 @@
+#include "heap_histogram.h"
+#include "clock.h"
+#include "event_pipeline.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // classes listed per report when there is no trace file
+    static const size_t kLoggedClasses = 20;
+
+    typedef jvmtiError (*GetHeapName)(jvmtiEnv *, jint, char **);
+
+    void HeapHistogram::Init(jvmtiEnv *jvmti) {
+        iterate_ext_ = reinterpret_cast<IterateThroughHeapExt>(
+                FindExtensionFunction(jvmti, "com.android.art.heap.iterate_through_heap_ext"));
+        GetHeapName get_heap_name = reinterpret_cast<GetHeapName>(
+                FindExtensionFunction(jvmti, "com.android.art.heap.get_heap_name"));
+
+        heap_names_.clear();
+        for (uint32_t heap = 0; heap < kMaxHeaps; ++heap) {
+            char *name = nullptr;
+            if (get_heap_name != nullptr &&
+                    get_heap_name(jvmti, static_cast<jint>(heap), &name) == JVMTI_ERROR_NONE &&
+                    name != nullptr) {
+                heap_names_.push_back(name);
+            } else {
+                heap_names_.push_back("heap" + std::to_string(heap));
+            }
+            Deallocate(jvmti, name);
+        }
+        if (iterate_ext_ == nullptr) {
+            LOGE("HeapHistogram: no heap iteration extension, heaps are not told apart");
+        }
+    }
+
+    void HeapHistogram::TagClasses(jvmtiEnv *jvmti, const jclass *classes, jint count) {
+        SymbolCache &symbols = SymbolCache::Instance();
+        for (jint i = 0; i < count; ++i) {
+            symbols.ClassId(jvmti, classes[i]);
+        }
+    }
+
+    jint JNICALL HeapHistogram::CountObject(jlong class_tag, jlong size, jlong *tag_ptr,
+                                            jint length, void *user_data) {
+        static_cast<HeapHistogram *>(user_data)->Count(class_tag, size, 0);
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    jint JNICALL HeapHistogram::CountObjectExt(jlong class_tag, jlong size, jlong *tag_ptr,
+                                               jint length, void *user_data, jint heap_id) {
+        static_cast<HeapHistogram *>(user_data)->Count(class_tag, size, heap_id);
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    bool HeapHistogram::Collect(jvmtiEnv *jvmti) {
+        // classes tagged during the walk land in row 0
+        class_limit_ = static_cast<uint64_t>(SymbolCache::Instance().ClassTagLimit());
+        counters_.assign(class_limit_ * kMaxHeaps, Counter{0, 0});
+
+        jvmtiHeapCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        const int64_t start_ns = MonotonicNanos();
+        jvmtiError error;
+        if (iterate_ext_ != nullptr) {
+            // the extension calls back with the heap id as an extra argument
+            callbacks.heap_iteration_callback =
+                    reinterpret_cast<jvmtiHeapIterationCallback>(CountObjectExt);
+            error = iterate_ext_(jvmti, 0, nullptr, &callbacks, this);
+        } else {
+            callbacks.heap_iteration_callback = CountObject;
+            error = jvmti->IterateThroughHeap(0, nullptr, &callbacks, this);
+        }
+        walk_ns_ = MonotonicNanos() - start_ns;
+        if (CheckJvmtiError(jvmti, error, "heap walk")) {
+            counters_.clear();
+            return false;
+        }
+
+        total_objects_ = 0;
+        total_bytes_ = 0;
+        for (const Counter &counter : counters_) {
+            total_objects_ += counter.count;
+            total_bytes_ += counter.bytes;
+        }
+        return true;
+    }
+
+    std::vector<HeapClassCount> HeapHistogram::GetCounts() const {
+        std::vector<HeapClassCount> counts;
+        for (size_t i = 0; i < counters_.size(); ++i) {
+            const Counter &counter = counters_[i];
+            if (counter.count != 0) {
+                counts.push_back({static_cast<uint32_t>(i / kMaxHeaps),
+                                  static_cast<uint32_t>(i % kMaxHeaps),
+                                  counter.count, counter.bytes});
+            }
+        }
+        return counts;
+    }
+
+    void HeapHistogram::Report() const {
+        std::vector<HeapClassCount> counts = GetCounts();
+        LOGE("HeapHistogram: %" PRIu64 " objects, %" PRIu64 " KB, %zu classes, "
+             "walked in %.1f ms", total_objects_, total_bytes_ / 1024, counts.size(),
+             walk_ns_ / 1e6);
+
+        EventPipeline &pipeline = EventPipeline::Instance();
+        TraceWriter *trace = pipeline.Trace();
+        if (trace != nullptr) {
+            for (const HeapClassCount &count : counts) {
+                pipeline.TraceClass(count.class_id);
+            }
+            trace->AddHeapHistogram(MonotonicNanos(), heap_names_, counts);
+            return;
+        }
+
+        size_t logged = std::min(counts.size(), kLoggedClasses);
+        std::partial_sort(counts.begin(), counts.begin() + logged, counts.end(),
+                          [](const HeapClassCount &a, const HeapClassCount &b) {
+                              return a.bytes > b.bytes;
+                          });
+        SymbolCache &symbols = SymbolCache::Instance();
+        for (size_t i = 0; i < logged; ++i) {
+            const HeapClassCount &count = counts[i];
+            const ClassSymbol *klass = symbols.FindClass(count.class_id);
+            LOGE("HeapHistogram: %10" PRIu64 " KB %10" PRIu64 "  %s (%s)", count.bytes / 1024,
+                 count.count, klass != nullptr ? klass->signature.c_str() : "<untagged>",
+                 heap_names_[count.heap].c_str());
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,107 @@
+#ifndef HEAP_HISTOGRAM_H
+#define HEAP_HISTOGRAM_H
+
+#include "jvmti.h"
+#include "trace_writer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Live object count and size per class and heap, from one walk of the
+     * whole heap.
+     *
+     * Objects are attributed through the class tags of the SymbolCache, so
+     * the classes must be tagged before the walk: the ones loaded after the
+     * attach are at ClassLoad/ClassPrepare, the others by the caller (see
+     * TagClasses()). The counters are a flat array indexed by class tag and
+     * heap, sized before the walk, so the per-object callback is two adds:
+     * no lookup, no allocation and no logging. Objects of classes tagged
+     * meanwhile, or never, are counted under class id 0.
+     *
+     * The ART iterate_through_heap_ext extension is used when available, as
+     * it reports the heap (image, zygote, app...) of every object; otherwise
+     * the standard IterateThroughHeap counts everything under heap 0.
+     * Agent thread only.
+     */
+    class HeapHistogram {
+    public:
+        // ART heap ids are 0 (default) to 3 (app)
+        static const uint32_t kMaxHeaps = 4;
+
+        /**
+         * Locates the ART heap extensions and the names of the heaps.
+         */
+        void Init(jvmtiEnv *jvmti);
+
+        /**
+         * Tags |count| classes through the SymbolCache.
+         */
+        static void TagClasses(jvmtiEnv *jvmti, const jclass *classes, jint count);
+
+        /**
+         * Walks the heap, replacing the previous counts. A single JVMTI call
+         * during which the runtime is paused.
+         */
+        bool Collect(jvmtiEnv *jvmti);
+
+        /**
+         * Returns the non-empty (class, heap) counters, by class id.
+         */
+        std::vector<HeapClassCount> GetCounts() const;
+
+        const std::vector<std::string> &HeapNames() const { return heap_names_; }
+
+        uint64_t TotalObjects() const { return total_objects_; }
+
+        uint64_t TotalBytes() const { return total_bytes_; }
+
+        int64_t WalkNs() const { return walk_ns_; }
+
+        /**
+         * Writes the histogram to the trace, or logs the largest classes
+         * when there is no trace file.
+         */
+        void Report() const;
+
+    private:
+        struct Counter {
+            uint64_t count;
+            uint64_t bytes;
+        };
+
+        static jint JNICALL CountObject(jlong class_tag, jlong size, jlong *tag_ptr,
+                                        jint length, void *user_data);
+
+        static jint JNICALL CountObjectExt(jlong class_tag, jlong size, jlong *tag_ptr,
+                                           jint length, void *user_data, jint heap_id);
+
+        void Count(jlong class_tag, jlong size, jint heap_id) {
+            uint64_t row = static_cast<uint64_t>(class_tag) < class_limit_
+                           ? static_cast<uint64_t>(class_tag) : 0;
+            uint32_t heap = static_cast<uint32_t>(heap_id) < kMaxHeaps
+                            ? static_cast<uint32_t>(heap_id) : 0;
+            Counter &counter = counters_[row * kMaxHeaps + heap];
+            counter.count++;
+            counter.bytes += static_cast<uint64_t>(size);
+        }
+
+        typedef jvmtiError (*IterateThroughHeapExt)(jvmtiEnv *, jint, jclass,
+                                                    const jvmtiHeapCallbacks *, const void *);
+
+        IterateThroughHeapExt iterate_ext_ = nullptr;
+        std::vector<std::string> heap_names_;
+        // [class tag * kMaxHeaps + heap]
+        std::vector<Counter> counters_;
+        uint64_t class_limit_ = 0;
+        uint64_t total_objects_ = 0;
+        uint64_t total_bytes_ = 0;
+        int64_t walk_ns_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // HEAP_HISTOGRAM_H
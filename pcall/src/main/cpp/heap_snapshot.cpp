@@ -0,0 +1,176 @@
+#include "heap_snapshot.h"
+#include "clock.h"
+#include "hash.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+#include "slicer/dex_leb128.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace profiler {
+
+    static const char kTriggerName[] = "pcall-snapshot";
+    static const int64_t kPollPeriodNs = 1000000000LL;
+    static const size_t kMaxLabelSize = 32;
+
+    static void PushFixed(std::vector<uint8_t> &out, uint64_t value, int size) {
+        for (int i = 0; i < size; ++i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    static void PushString(std::vector<uint8_t> &out, const std::string &value) {
+        dex::u1 tmp[5];
+        dex::u1 *end = dex::WriteULeb128(tmp, static_cast<uint32_t>(value.size()));
+        out.insert(out.end(), tmp, end);
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    // The first word of the trigger file, restricted to file name characters
+    static std::string ReadLabel(FILE *trigger) {
+        std::string label;
+        int c;
+        while ((c = fgetc(trigger)) != EOF && isspace(c)) {
+        }
+        while (c != EOF && (isalnum(c) || c == '-' || c == '_' || c == '.') &&
+               label.size() < kMaxLabelSize) {
+            label.push_back(static_cast<char>(c));
+            c = fgetc(trigger);
+        }
+        return label;
+    }
+
+    int64_t HeapSnapshotTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        std::string trigger_path = dir_ + kTriggerName;
+        FILE *trigger = fopen(trigger_path.c_str(), "r");
+        if (trigger == nullptr) {
+            return kPollPeriodNs;
+        }
+        std::string label = ReadLabel(trigger);
+        fclose(trigger);
+        unlink(trigger_path.c_str());
+
+        if (!initialized_) {
+            initialized_ = true;
+            histogram_.Init(jvmti);
+        }
+        captured_++;
+        if (label.empty()) {
+            label = std::to_string(captured_);
+        }
+        std::string path(dir_);
+        path.append("pcall-").append(std::to_string(getpid())).append("-").append(label)
+            .append(".snapshot");
+        Capture(jvmti, path);
+        return kPollPeriodNs;
+    }
+
+    void HeapSnapshotTask::WriteSection(std::vector<uint8_t> *out, SnapshotSectionKind kind,
+                                        std::vector<Record> *records) {
+        std::sort(records->begin(), records->end(),
+                  [](const Record &a, const Record &b) {
+                      return a.key < b.key;
+                  });
+        size_t unique = 0;
+        for (size_t i = 0; i < records->size(); ++i) {
+            Record &record = (*records)[i];
+            if (unique > 0 && (*records)[unique - 1].key == record.key) {
+                (*records)[unique - 1].count += record.count;
+                (*records)[unique - 1].bytes += record.bytes;
+            } else {
+                (*records)[unique++] = std::move(record);
+            }
+        }
+        records->resize(unique);
+
+        out->push_back(kind);
+        PushFixed(*out, records->size(), 4);
+        for (const Record &record : *records) {
+            PushFixed(*out, record.key, 8);
+            PushFixed(*out, record.count, 8);
+            PushFixed(*out, record.bytes, 8);
+            PushString(*out, record.name);
+        }
+    }
+
+    bool HeapSnapshotTask::Capture(jvmtiEnv *jvmti, const std::string &path) {
+        if (!histogram_.Collect(jvmti)) {
+            return false;
+        }
+        std::vector<Record> classes = ClassRecords();
+        std::vector<Record> sites = AllocSiteRecords();
+
+        std::vector<uint8_t> data;
+        PushFixed(data, kSnapshotMagic, 4);
+        PushFixed(data, kSnapshotVersion, 2);
+        PushFixed(data, 0, 2);
+        PushFixed(data, static_cast<uint64_t>(MonotonicNanos()), 8);
+        WriteSection(&data, kSnapshotClasses, &classes);
+        WriteSection(&data, kSnapshotAllocSites, &sites);
+
+        // renamed once complete, a snapshot is never read half written
+        std::string temp_path = path + ".tmp";
+        FILE *file = fopen(temp_path.c_str(), "wb");
+        bool written = file != nullptr &&
+                       fwrite(data.data(), 1, data.size(), file) == data.size();
+        written = file != nullptr && fclose(file) == 0 && written;
+        if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+            LOGE("HeapSnapshot: can't write %s", path.c_str());
+            unlink(temp_path.c_str());
+            return false;
+        }
+        LOGE("HeapSnapshot: %s, %zu classes, %zu allocation sites, walked in %.1f ms",
+             path.c_str(), classes.size(), sites.size(), histogram_.WalkNs() / 1e6);
+        return true;
+    }
+
+    std::vector<HeapSnapshotTask::Record> HeapSnapshotTask::ClassRecords() const {
+        SymbolCache &symbols = SymbolCache::Instance();
+        std::vector<Record> records;
+        for (const HeapClassCount &count : histogram_.GetCounts()) {
+            const ClassSymbol *klass = symbols.FindClass(count.class_id);
+            Record record;
+            record.name = klass != nullptr ? klass->signature : "<untagged>";
+            record.key = Hash64(record.name.data(), record.name.size());
+            record.count = count.count;
+            record.bytes = count.bytes;
+            records.push_back(std::move(record));
+        }
+        return records;
+    }
+
+    std::vector<HeapSnapshotTask::Record> HeapSnapshotTask::AllocSiteRecords() {
+        AllocationSites &allocation_sites = AllocationSites::Instance();
+        allocation_sites.GetSites(static_cast<uint32_t>(sites_.size()), &sites_);
+
+        SymbolCache &symbols = SymbolCache::Instance();
+        std::vector<Record> records;
+        for (size_t i = 0; i < sites_.size(); ++i) {
+            const AllocationSites::Site &site = sites_[i];
+            AllocationSites::Totals totals =
+                    allocation_sites.GetTotals(site, static_cast<uint32_t>(i + 1));
+            if (totals.count == 0) {
+                continue;
+            }
+            const MethodSymbol *method = symbols.FindProbeMethod(site.method_id);
+            const ClassSymbol *klass = method != nullptr ? symbols.FindClass(method->class_id)
+                                                         : nullptr;
+            Record record;
+            record.name.append(klass != nullptr ? klass->signature : "<unknown>").append("->");
+            if (method != nullptr) {
+                record.name.append(method->name).append(method->signature);
+            }
+            record.name.append(" @").append(std::to_string(site.dex_pc)).append(" ")
+                       .append(site.type);
+            record.key = Hash64(record.name.data(), record.name.size());
+            record.count = totals.count;
+            record.bytes = totals.bytes;
+            records.push_back(std::move(record));
+        }
+        return records;
+    }
+
+}  // namespace profiler
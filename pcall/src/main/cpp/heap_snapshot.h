@@ -0,0 +1,65 @@
+#ifndef HEAP_SNAPSHOT_H
+#define HEAP_SNAPSHOT_H
+
+#include "allocation_sites.h"
+#include "event_pipeline.h"
+#include "heap_histogram.h"
+#include "heap_snapshot_format.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Writes heap snapshots (see heap_snapshot_format.h) on request, to
+     * diff two points in time with pcall-snapdiff:
+     *
+     *   adb shell run-as <package> sh -c 'echo before > <agent dir>/pcall-snapshot'
+     *
+     * The agent thread polls for the trigger file in the agent directory,
+     * removes it and writes pcall-<pid>-<label>.snapshot next to it, the
+     * label being the first word of the trigger file (the snapshot number
+     * if there is none). A snapshot holds the live objects per class, from
+     * a HeapHistogram walk, and the allocation counts per site when there
+     * are alloc rules.
+     */
+    class HeapSnapshotTask : public PeriodicTask {
+    public:
+        explicit HeapSnapshotTask(const std::string &dir) : dir_(dir) {}
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct Record {
+            uint64_t key;
+            uint64_t count;
+            uint64_t bytes;
+            std::string name;
+        };
+
+        bool Capture(jvmtiEnv *jvmti, const std::string &path);
+
+        /**
+         * Sorts |records| by key, merging the duplicates (a class defined by
+         * two loaders), and appends them to |out| as a |kind| section.
+         */
+        static void WriteSection(std::vector<uint8_t> *out, SnapshotSectionKind kind,
+                                 std::vector<Record> *records);
+
+        std::vector<Record> ClassRecords() const;
+
+        std::vector<Record> AllocSiteRecords();
+
+        const std::string dir_;
+        bool initialized_ = false;
+        uint32_t captured_ = 0;
+        HeapHistogram histogram_;
+        std::vector<AllocationSites::Site> sites_;
+    };
+
+}  // namespace profiler
+
+#endif  // HEAP_SNAPSHOT_H
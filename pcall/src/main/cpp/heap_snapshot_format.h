@@ -0,0 +1,43 @@
+#ifndef HEAP_SNAPSHOT_FORMAT_H
+#define HEAP_SNAPSHOT_FORMAT_H
+
+#include <stdint.h>
+
+/**
+ * Heap snapshot file layout, shared by the agent (HeapSnapshotTask) and the
+ * host side diff (pcall-snapdiff). Little endian fixed-width integers, a
+ * "string" is a uleb byte length followed by the MUTF-8 bytes (see
+ * trace_format.h).
+ *
+ *   header   : u4 magic, u2 version, u2 reserved, u8 timestamp_ns
+ *   section* : u1 kind, u4 record_count, record*
+ *   record   : u8 key, u8 count, u8 bytes, string name
+ *
+ * kSnapshotClasses holds the live objects and their shallow size per class
+ * (the class signature as name), kSnapshotAllocSites the allocations since
+ * the agent started per allocation site (see AllocationSites), named
+ * "<class>-><method><signature> @<dex pc> <allocated type>", with the
+ * estimated array bytes. The sections are written in that order.
+ *
+ * The key of a record is the 64-bit hash of its name, so that it stays the
+ * same across snapshots and processes, and the records of a section are
+ * sorted by key without duplicates: two snapshots are diffed with a single
+ * merge pass over both files.
+ */
+
+namespace profiler {
+
+    static const uint32_t kSnapshotMagic = 0x4e534350;  // "PCSN"
+    static const uint16_t kSnapshotVersion = 1;
+
+    static const uint32_t kSnapshotHeaderSize = 16;
+    static const uint32_t kSnapshotSectionHeaderSize = 5;
+
+    enum SnapshotSectionKind : uint8_t {
+        kSnapshotClasses = 1,
+        kSnapshotAllocSites = 2,
+    };
+
+}  // namespace profiler
+
+#endif  // HEAP_SNAPSHOT_FORMAT_H
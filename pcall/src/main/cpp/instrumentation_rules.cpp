@@ -0,0 +1,273 @@
+#include "instrumentation_rules.h"
+#include "hash.h"
+#include "jvmti_helper.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <sstream>
+
+namespace profiler {
+
+    bool InstrumentationRule::MatchesMethod(const char *name,
+                                            const std::string &method_signature) const {
+        return (method_name.empty() || method_name == name) &&
+               (signature.empty() || signature == method_signature);
+    }
+
+    ClassMatcher::ClassMatcher() : nodes_(1) {
+        nodes_[0].label = '\0';
+        nodes_[0].first_child = 0;
+        nodes_[0].next_sibling = 0;
+    }
+
+    uint32_t ClassMatcher::FindChild(uint32_t node, char label) const {
+        for (uint32_t child = nodes_[node].first_child; child != 0;
+             child = nodes_[child].next_sibling) {
+            if (nodes_[child].label == label) {
+                return child;
+            }
+        }
+        return 0;
+    }
+
+    void ClassMatcher::Add(const std::string &pattern, bool prefix, uint32_t value) {
+        uint32_t node = 0;
+        for (char c : pattern) {
+            uint32_t child = FindChild(node, c);
+            if (child == 0) {
+                child = static_cast<uint32_t>(nodes_.size());
+                nodes_.emplace_back();
+                nodes_[child].label = c;
+                nodes_[child].first_child = 0;
+                nodes_[child].next_sibling = nodes_[node].first_child;
+                nodes_[node].first_child = child;
+            }
+            node = child;
+        }
+        (prefix ? nodes_[node].prefix_values : nodes_[node].exact_values).push_back(value);
+    }
+
+    bool ClassMatcher::Match(const char *name, size_t length, std::vector<uint32_t> *values) const {
+        size_t first = values->size();
+        uint32_t node = 0;
+        size_t i = 0;
+        for (;;) {
+            const Node &current = nodes_[node];
+            values->insert(values->end(), current.prefix_values.begin(), current.prefix_values.end());
+            if (i == length) {
+                values->insert(values->end(), current.exact_values.begin(),
+                               current.exact_values.end());
+                break;
+            }
+            node = FindChild(node, name[i++]);
+            if (node == 0) {
+                break;
+            }
+        }
+        // patterns nested in one another are found shortest first
+        std::sort(values->begin() + first, values->end());
+        return values->size() > first;
+    }
+
+    bool ClassMatcher::Matches(const char *name, size_t length) const {
+        uint32_t node = 0;
+        size_t i = 0;
+        for (;;) {
+            const Node &current = nodes_[node];
+            if (!current.prefix_values.empty()) {
+                return true;
+            }
+            if (i == length) {
+                return !current.exact_values.empty();
+            }
+            node = FindChild(node, name[i++]);
+            if (node == 0) {
+                return false;
+            }
+        }
+    }
+
+    // "com.example.Foo" -> "com/example/Foo"
+    static std::string InternalName(std::string name) {
+        std::replace(name.begin(), name.end(), '.', '/');
+        return name;
+    }
+
+    // Splits "<class>.<method>[<signature>]"
+    static bool ParseMethodRef(const std::string &text, bool with_signature, std::string *klass,
+                               std::string *method, std::string *signature) {
+        size_t paren = text.find('(');
+        if (with_signature != (paren != std::string::npos)) {
+            return false;
+        }
+        std::string qualified = text.substr(0, paren);
+        size_t dot = qualified.rfind('.');
+        if (dot == std::string::npos || dot == 0 || dot + 1 == qualified.size()) {
+            return false;
+        }
+        *klass = "L" + InternalName(qualified.substr(0, dot)) + ";";
+        *method = qualified.substr(dot + 1);
+        if (with_signature) {
+            *signature = text.substr(paren);
+        }
+        return true;
+    }
+
+    bool InstrumentationRules::Add(const std::string &text, std::string *error) {
+        std::string spaced(text);
+        std::replace(spaced.begin(), spaced.end(), ':', ' ');
+        std::istringstream stream(spaced);
+        std::vector<std::string> fields;
+        std::string field;
+        while (stream >> field) {
+            fields.push_back(field);
+        }
+
+        InstrumentationRule rule;
+        size_t expected;
+        if (fields.empty()) {
+            *error = "empty rule";
+            return false;
+        } else if (fields[0] == "entry") {
+            rule.action = kRuleEntryHook;
+            expected = fields.size() == 5 && fields[4] == "object_this" ? 5 : 4;
+            rule.object_this = expected == 5;
+        } else if (fields[0] == "exit") {
+            rule.action = kRuleExitHook;
+            expected = 4;
+        } else if (fields[0] == "detour") {
+            rule.action = kRuleDetour;
+            expected = 5;
+        } else if (fields[0] == "probe") {
+            rule.action = kRuleProbes;
+            expected = fields.size() == 2 ? 2 : 3;
+        } else if (fields[0] == "alloc") {
+            rule.action = kRuleAllocSites;
+            expected = fields.size() == 2 ? 2 : 3;
+        } else if (fields[0] == "clinit") {
+            rule.action = kRuleClinit;
+            expected = 2;
+        } else {
+            *error = "unknown action " + fields[0];
+            return false;
+        }
+        if (fields.size() != expected) {
+            *error = "wrong number of fields";
+            return false;
+        }
+        if (rule.action == kRuleProbes && !probes_enabled_) {
+            *error = "probe rules need mode=probe";
+            return false;
+        }
+        if (rule.action == kRuleAllocSites && !alloc_sites_enabled_) {
+            *error = "alloc rules need the Tracer natives";
+            return false;
+        }
+        if (rule.action == kRuleClinit && !clinit_enabled_) {
+            *error = "clinit rules need the Tracer natives";
+            return false;
+        }
+
+        std::string klass = InternalName(fields[1]);
+        if (!klass.empty() && klass.back() == '*') {
+            klass.pop_back();
+            rule.class_prefix = true;
+        }
+        if ((klass.empty() && !rule.class_prefix) || klass.find('*') != std::string::npos) {
+            *error = "invalid class " + fields[1];
+            return false;
+        }
+        rule.class_name = klass;
+        if (rule.action == kRuleClinit) {
+            rule.method_name = "<clinit>";
+            rule.signature = "()V";
+        }
+
+        if (fields.size() > 2 && fields[2] != "*") {
+            size_t paren = fields[2].find('(');
+            rule.method_name = fields[2].substr(0, paren);
+            if (paren != std::string::npos) {
+                rule.signature = fields[2].substr(paren);
+            }
+            if (rule.method_name.empty()) {
+                *error = "invalid method " + fields[2];
+                return false;
+            }
+        }
+
+        bool valid = true;
+        std::string unused;
+        switch (rule.action) {
+            case kRuleEntryHook:
+            case kRuleExitHook:
+                valid = ParseMethodRef(fields[3], false, &rule.hook_class, &rule.hook_method, &unused);
+                break;
+            case kRuleDetour:
+                valid = ParseMethodRef(fields[3], true, &rule.invoked_class, &rule.invoked_method,
+                                       &rule.invoked_signature) &&
+                        ParseMethodRef(fields[4], false, &rule.hook_class, &rule.hook_method, &unused);
+                break;
+            case kRuleProbes:
+            case kRuleAllocSites:
+            case kRuleClinit:
+                break;
+        }
+        if (!valid) {
+            *error = "invalid hook method";
+            return false;
+        }
+
+        std::string canonical;
+        for (const std::string &f : fields) {
+            canonical.append(f).push_back(' ');
+        }
+        fingerprint_ = Hash64(canonical.data(), canonical.size(), fingerprint_);
+
+        matcher_.Add(rule.class_name, rule.class_prefix, static_cast<uint32_t>(rules_.size()));
+        rules_.push_back(std::move(rule));
+        return true;
+    }
+
+    bool InstrumentationRules::AddFile(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "r");
+        if (file == nullptr) {
+            LOGE("InstrumentationRules: can't open %s", path.c_str());
+            return false;
+        }
+        char line[1024];
+        int line_number = 0;
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            ++line_number;
+            std::string text(line);
+            text = text.substr(0, text.find('#'));
+            if (text.find_first_not_of(" \t\r\n") == std::string::npos) {
+                continue;
+            }
+            std::string error;
+            if (!Add(text, &error)) {
+                LOGE("InstrumentationRules: %s:%d: %s", path.c_str(), line_number, error.c_str());
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    bool InstrumentationRules::HasAction(RuleAction action) const {
+        return std::any_of(rules_.begin(), rules_.end(), [action](const InstrumentationRule &rule) {
+            return rule.action == action;
+        });
+    }
+
+    bool InstrumentationRules::Match(const char *name, size_t length,
+                                     std::vector<const InstrumentationRule *> *rules) const {
+        std::vector<uint32_t> indexes;
+        if (!matcher_.Match(name, length, &indexes)) {
+            return false;
+        }
+        for (uint32_t index : indexes) {
+            rules->push_back(&rules_[index]);
+        }
+        return true;
+    }
+
+}  // namespace profiler
@@ -0,0 +1,175 @@
+#ifndef INSTRUMENTATION_RULES_H
+#define INSTRUMENTATION_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    enum RuleAction {
+        // calls a static hook with the arguments on method entry
+        kRuleEntryHook,
+        // calls a static hook with the return value on method exit
+        kRuleExitHook,
+        // redirects the invoke-virtual calls of a method to a static hook
+        kRuleDetour,
+        // Tracer.enter/exit probes (probe mode only)
+        kRuleProbes,
+        // Tracer.alloc/allocArray probes before the allocations
+        kRuleAllocSites,
+        // Tracer.clinitEnter/clinitExit probes around the static initializer
+        kRuleClinit,
+    };
+
+    /**
+     * One line of the rule set:
+     *
+     *   entry  <class> <method>  <hook>  [object_this]
+     *   exit   <class> <method>  <hook>
+     *   detour <class> <method>  <invoked method> <hook>
+     *   probe  <class> [<method>]
+     *   alloc  <class> [<method>]
+     *   clinit <class>
+     *
+     * <class> is an internal class name, a trailing '*' makes it a prefix
+     * ("com/example/Foo*"). <method> is a method name, optionally followed by
+     * its signature ("getString()Ljava/lang/String;"), or '*' for every
+     * method. <hook> is "<class>.<method>" and <invoked method> the same
+     * with a signature. '.' separated class names are accepted everywhere.
+     * Fields are separated by spaces or ':', the latter being the only
+     * choice in the Agent_OnAttach options.
+     */
+    struct InstrumentationRule {
+        RuleAction action;
+        std::string class_name;
+        bool class_prefix = false;
+        // empty for every method
+        std::string method_name;
+        // empty for any signature
+        std::string signature;
+        // class descriptor and name of the hook
+        std::string hook_class;
+        std::string hook_method;
+        // detour only: the invoked method being replaced
+        std::string invoked_class;
+        std::string invoked_method;
+        std::string invoked_signature;
+        // entry only: |this| is passed to the hook as a java.lang.Object
+        bool object_this = false;
+
+        bool MatchesMethod(const char *name, const std::string &method_signature) const;
+    };
+
+    /**
+     * Class name matcher compiled into a trie: a name is matched against
+     * every exact and prefix pattern in a single walk, in O(name length)
+     * whatever the number of patterns.
+     */
+    class ClassMatcher {
+    public:
+        ClassMatcher();
+
+        void Add(const std::string &pattern, bool prefix, uint32_t value);
+
+        /**
+         * Appends the values of the patterns matching name[0, length) to
+         * |values|, in the order they were added. Returns whether any matched.
+         */
+        bool Match(const char *name, size_t length, std::vector<uint32_t> *values) const;
+
+        /**
+         * Same as Match() without collecting the values.
+         */
+        bool Matches(const char *name, size_t length) const;
+
+    private:
+        struct Node {
+            char label;
+            uint32_t first_child;
+            uint32_t next_sibling;
+            std::vector<uint32_t> exact_values;
+            std::vector<uint32_t> prefix_values;
+        };
+
+        // 0 if there is no such child (the root is never a child)
+        uint32_t FindChild(uint32_t node, char label) const;
+
+        // nodes_[0] is the root
+        std::vector<Node> nodes_;
+    };
+
+    /**
+     * The instrumentation rules of the agent, from the Agent_OnAttach
+     * options and the rules file. Rules are added before the
+     * ClassFileLoadHook is enabled and only read after that.
+     */
+    class InstrumentationRules {
+    public:
+        /**
+         * Parses and adds one rule. Returns false, and sets |error|, if the
+         * rule is malformed or not allowed.
+         */
+        bool Add(const std::string &text, std::string *error);
+
+        /**
+         * Adds the rules of a file, one per line, '#' starting a comment.
+         * Malformed rules are logged and skipped. Returns false if the file
+         * can't be read.
+         */
+        bool AddFile(const std::string &path);
+
+        /**
+         * Probe rules are rejected unless enabled (probe mode with the
+         * Tracer natives bound).
+         */
+        void SetProbesEnabled(bool enabled) { probes_enabled_ = enabled; }
+
+        /**
+         * Allocation site rules are rejected unless enabled (the Tracer
+         * natives bound).
+         */
+        void SetAllocSitesEnabled(bool enabled) { alloc_sites_enabled_ = enabled; }
+
+        /**
+         * Static initializer rules are rejected unless enabled (the Tracer
+         * natives bound).
+         */
+        void SetClinitEnabled(bool enabled) { clinit_enabled_ = enabled; }
+
+        /**
+         * Appends the rules for the internal class name[0, length) to
+         * |rules|, in declaration order.
+         */
+        bool Match(const char *name, size_t length,
+                   std::vector<const InstrumentationRule *> *rules) const;
+
+        bool Matches(const char *name, size_t length) const {
+            return matcher_.Matches(name, length);
+        }
+
+        bool HasAction(RuleAction action) const;
+
+        bool empty() const { return rules_.empty(); }
+
+        size_t size() const { return rules_.size(); }
+
+        /**
+         * Hash of the rules added so far, in order. Transformed class
+         * images are only reusable with the same fingerprint.
+         */
+        uint64_t Fingerprint() const { return fingerprint_; }
+
+    private:
+        std::vector<InstrumentationRule> rules_;
+        ClassMatcher matcher_;
+        bool probes_enabled_ = false;
+        bool alloc_sites_enabled_ = false;
+        bool clinit_enabled_ = false;
+        uint64_t fingerprint_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // INSTRUMENTATION_RULES_H
@@ -16,6 +16,7 @@
 #include "jvmti_helper.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 
@@ -46,15 +47,6 @@ namespace profiler {
         return true;
     }
 
-    void SetAllCapabilities(jvmtiEnv *jvmti) {
-        jvmtiCapabilities caps;
-        jvmtiError error;
-        error = jvmti->GetPotentialCapabilities(&caps);
-        CheckJvmtiError(jvmti, error);
-        error = jvmti->AddCapabilities(&caps);
-        CheckJvmtiError(jvmti, error);
-    }
-
     void SetEventNotification(jvmtiEnv *jvmti, jvmtiEventMode mode,
                               jvmtiEvent event_type) {
         jvmtiError err = jvmti->SetEventNotificationMode(mode, event_type, nullptr);
@@ -117,6 +109,30 @@ namespace profiler {
         return klass_loader_id;
     }
 
+    jvmtiExtensionFunction FindExtensionFunction(jvmtiEnv *jvmti, const char *id) {
+        jvmtiExtensionFunctionInfo *func_info = nullptr;
+        jint func_count = 0;
+        if (CheckJvmtiError(jvmti, jvmti->GetExtensionFunctions(&func_count, &func_info))) {
+            return nullptr;
+        }
+        jvmtiExtensionFunction func = nullptr;
+        // every entry must be deallocated, not only the one looked for
+        for (jint i = 0; i < func_count; i++) {
+            if (strcmp(id, func_info[i].id) == 0) {
+                func = func_info[i].func;
+            }
+            Deallocate(jvmti, func_info[i].id);
+            Deallocate(jvmti, func_info[i].short_description);
+            for (jint j = 0; j < func_info[i].param_count; j++) {
+                Deallocate(jvmti, func_info[i].params[j].name);
+            }
+            Deallocate(jvmti, func_info[i].params);
+            Deallocate(jvmti, func_info[i].errors);
+        }
+        Deallocate(jvmti, func_info);
+        return func;
+    }
+
     void *Allocate(jvmtiEnv *jvmti, jlong size) {
         unsigned char *alloc = nullptr;
         jvmtiError err = jvmti->Allocate(size, &alloc);
@@ -45,11 +45,6 @@ namespace profiler {
     bool CheckJvmtiError(jvmtiEnv *jvmti, jvmtiError err_num,
                          const std::string &message = kEmpty);
 
-    /**
-     * Sets all available capabilities on the given JVMTI environment.
-     */
-    void SetAllCapabilities(jvmtiEnv *jvmti);
-
     /**
      * Helper to enable/disable an event via the SetEventNotificationMode API.
      */
@@ -81,6 +76,13 @@ namespace profiler {
      */
     int32_t GetClassLoaderId(jvmtiEnv *jvmti, JNIEnv *jni, jclass klass);
 
+    /**
+     * Returns the extension function |id| (e.g.
+     * "com.android.art.heap.iterate_through_heap_ext"), or nullptr if the
+     * runtime doesn't provide it.
+     */
+    jvmtiExtensionFunction FindExtensionFunction(jvmtiEnv *jvmti, const char *id);
+
     /**
      * Given a class signature and method name (in mutf8), returns the corresponding
      * mangled native method name according to the JNI spec.
@@ -0,0 +1,146 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+namespace profiler {
+
+    /**
+     * Log-linear histogram of durations in nanoseconds, shared by the agent
+     * and the host tools.
+     *
+     * Values below kSubBuckets have a bucket each; above, every power of two
+     * is split into kSubBuckets linear buckets, so a bucket is at most 1/8th
+     * of its lower bound wide from nanoseconds to minutes, in a fixed array
+     * of counters: adding a value is a shift and an increment. Values past
+     * 2^kMaxExponent ns (~18 minutes) go to the last bucket.
+     */
+    class LatencyHistogram {
+    public:
+        static const int kSubBucketBits = 3;
+        static const uint32_t kSubBuckets = 1 << kSubBucketBits;
+        static const int kMaxExponent = 40;
+        static const uint32_t kBucketCount = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+        static uint32_t BucketOf(uint64_t value) {
+            if (value < kSubBuckets) {
+                return static_cast<uint32_t>(value);
+            }
+            int exponent = 63 - __builtin_clzll(value);
+            if (exponent >= kMaxExponent) {
+                return kBucketCount - 1;
+            }
+            uint32_t sub_bucket = static_cast<uint32_t>(value >> (exponent - kSubBucketBits)) &
+                                  (kSubBuckets - 1);
+            return (exponent - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+        }
+
+        /**
+         * Smallest value of |bucket|.
+         */
+        static uint64_t LowerBound(uint32_t bucket) {
+            if (bucket < kSubBuckets) {
+                return bucket;
+            }
+            int exponent = static_cast<int>(bucket / kSubBuckets) + kSubBucketBits - 1;
+            uint64_t sub_bucket = bucket % kSubBuckets;
+            return (kSubBuckets + sub_bucket) << (exponent - kSubBucketBits);
+        }
+
+        /**
+         * Largest value of |bucket| (the last one is open ended, its lower
+         * bound doubled stands for it).
+         */
+        static uint64_t UpperBound(uint32_t bucket) {
+            return bucket + 1 < kBucketCount ? LowerBound(bucket + 1) - 1
+                                             : LowerBound(bucket) * 2;
+        }
+
+        LatencyHistogram() { Clear(); }
+
+        void Clear() {
+            memset(counts_, 0, sizeof(counts_));
+            count_ = 0;
+            sum_ = 0;
+            max_ = 0;
+        }
+
+        void Add(uint64_t value) {
+            counts_[BucketOf(value)]++;
+            count_++;
+            sum_ += value;
+            if (value > max_) {
+                max_ = value;
+            }
+        }
+
+        /**
+         * Adds |count| values of |bucket| whose exact values are unknown
+         * (a histogram read back from a trace), the sum and the max are
+         * estimated from the bucket bounds.
+         */
+        void AddToBucket(uint32_t bucket, uint64_t count) {
+            if (bucket >= kBucketCount || count == 0) {
+                return;
+            }
+            counts_[bucket] += count;
+            count_ += count;
+            sum_ += count * ((LowerBound(bucket) + UpperBound(bucket)) / 2);
+            if (UpperBound(bucket) > max_) {
+                max_ = UpperBound(bucket);
+            }
+        }
+
+        void Merge(const LatencyHistogram &other) {
+            for (uint32_t i = 0; i < kBucketCount; ++i) {
+                counts_[i] += other.counts_[i];
+            }
+            count_ += other.count_;
+            sum_ += other.sum_;
+            if (other.max_ > max_) {
+                max_ = other.max_;
+            }
+        }
+
+        /**
+         * Upper bound of the bucket holding the |fraction| quantile, at most
+         * the largest value.
+         */
+        uint64_t Percentile(double fraction) const {
+            if (count_ == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(fraction * count_);
+            if (rank >= count_) {
+                rank = count_ - 1;
+            }
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i < kBucketCount; ++i) {
+                seen += counts_[i];
+                if (seen > rank) {
+                    uint64_t bound = UpperBound(i);
+                    return bound < max_ ? bound : max_;
+                }
+            }
+            return max_;
+        }
+
+        uint64_t BucketCount(uint32_t bucket) const { return counts_[bucket]; }
+
+        uint64_t Count() const { return count_; }
+
+        uint64_t Sum() const { return sum_; }
+
+        uint64_t Max() const { return max_; }
+
+    private:
+        uint64_t counts_[kBucketCount];
+        uint64_t count_;
+        uint64_t sum_;
+        uint64_t max_;
+    };
+
+}  // namespace profiler
+
+#endif  // LATENCY_HISTOGRAM_H
@@ -0,0 +1,379 @@
+#include "monitor_contention.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // per-thread ring capacity (records), contention is rare next to calls
+    static const size_t kThreadRingCapacity = 256;
+    // frames looked at to find the caller of Object.wait
+    static const jint kMaxWaitFrames = 4;
+    // drain period while the events are on
+    static const int64_t kDrainPeriodNs = 100000000LL;
+    // trigger file poll period
+    static const int64_t kPollPeriodNs = 1000000000LL;
+    static const char kTriggerName[] = "pcall-monitors";
+    // entries per table in the log
+    static const size_t kLoggedEntries = 10;
+
+    static const jvmtiEvent kMonitorEvents[] = {
+            JVMTI_EVENT_MONITOR_CONTENDED_ENTER,
+            JVMTI_EVENT_MONITOR_CONTENDED_ENTERED,
+            JVMTI_EVENT_MONITOR_WAIT,
+            JVMTI_EVENT_MONITOR_WAITED,
+    };
+
+    static thread_local void *t_monitor_state = nullptr;
+
+    MonitorContention &MonitorContention::Instance() {
+        static MonitorContention *instance = new MonitorContention();
+        return *instance;
+    }
+
+    MonitorContention::ThreadState *MonitorContention::CurrentThread() {
+        auto state = static_cast<ThreadState *>(t_monitor_state);
+        if (state == nullptr) {
+            // slow path, once per thread
+            state = new ThreadState(kThreadRingCapacity);
+            std::lock_guard<std::mutex> lock(threads_mutex_);
+            threads_.emplace_back(state);
+            t_monitor_state = state;
+        }
+        return state;
+    }
+
+    void MonitorContention::OnContendedEnter() {
+        ThreadState *state = CurrentThread();
+        state->contended_since_ns = MonotonicNanos();
+        state->contended_generation = generation_.load(std::memory_order_relaxed);
+    }
+
+    void MonitorContention::OnContendedEntered(jvmtiEnv *jvmti, JNIEnv *jni, jobject object) {
+        ThreadState *state = CurrentThread();
+        // the events may have been switched on while the thread was blocked,
+        // or switched off and on again since the entry started
+        if (state->contended_since_ns != 0 &&
+            state->contended_generation == generation_.load(std::memory_order_relaxed)) {
+            Push(jvmti, jni, object, kMonitorContended,
+                 MonotonicNanos() - state->contended_since_ns);
+        }
+        state->contended_since_ns = 0;
+    }
+
+    void MonitorContention::OnWait() {
+        ThreadState *state = CurrentThread();
+        state->wait_since_ns = MonotonicNanos();
+        state->wait_generation = generation_.load(std::memory_order_relaxed);
+    }
+
+    void MonitorContention::OnWaited(jvmtiEnv *jvmti, JNIEnv *jni, jobject object) {
+        ThreadState *state = CurrentThread();
+        if (state->wait_since_ns != 0 &&
+            state->wait_generation == generation_.load(std::memory_order_relaxed)) {
+            Push(jvmti, jni, object, kMonitorWait, MonotonicNanos() - state->wait_since_ns);
+        }
+        state->wait_since_ns = 0;
+    }
+
+    void MonitorContention::Push(jvmtiEnv *jvmti, JNIEnv *jni, jobject object,
+                                 MonitorWaitKind kind, int64_t wait_ns) {
+        Record record;
+        record.wait_ns = wait_ns;
+        record.method = 0;
+        record.location = 0;
+        record.class_id = 0;
+        record.kind = kind;
+        record.reserved = 0;
+
+        // the waiting frame, past the Object.wait frames
+        jvmtiFrameInfo frames[kMaxWaitFrames];
+        jint frame_count = 0;
+        if (jvmti->GetStackTrace(nullptr, 0, kMaxWaitFrames, frames, &frame_count) ==
+            JVMTI_ERROR_NONE) {
+            for (jint i = 0; i < frame_count; ++i) {
+                if (std::find(wait_methods_, wait_methods_ + wait_method_count_,
+                              frames[i].method) == wait_methods_ + wait_method_count_) {
+                    record.method = reinterpret_cast<uintptr_t>(frames[i].method);
+                    record.location = frames[i].location;
+                    break;
+                }
+            }
+        }
+        // classes are tagged when prepared, an untagged one stays 0
+        jclass klass = jni->GetObjectClass(object);
+        if (klass != nullptr) {
+            jlong tag = 0;
+            if (jvmti->GetTag(klass, &tag) == JVMTI_ERROR_NONE) {
+                record.class_id = static_cast<uint32_t>(tag);
+            }
+            jni->DeleteLocalRef(klass);
+        }
+        CurrentThread()->ring.Push(record);
+    }
+
+    void MonitorContention::RetireCurrentThread() {
+        auto state = static_cast<ThreadState *>(t_monitor_state);
+        if (state != nullptr) {
+            state->retired.store(true, std::memory_order_release);
+            t_monitor_state = nullptr;
+        }
+    }
+
+    void MonitorContention::SetWaitMethods(const std::vector<jmethodID> &methods) {
+        wait_method_count_ = static_cast<int>(std::min<size_t>(methods.size(), kMaxWaitMethods));
+        std::copy(methods.begin(), methods.begin() + wait_method_count_, wait_methods_);
+    }
+
+    uint64_t MonitorContention::Drain(std::vector<Record> *records) {
+        Record batch[kThreadRingCapacity];
+        uint64_t new_drops = 0;
+        std::lock_guard<std::mutex> lock(threads_mutex_);
+        for (auto it = threads_.begin(); it != threads_.end();) {
+            ThreadState *state = it->get();
+            // sample the retired flag first, see EventPipeline::Drain
+            bool retired = state->retired.load(std::memory_order_acquire);
+            size_t count = state->ring.Pop(batch, kThreadRingCapacity);
+            records->insert(records->end(), batch, batch + count);
+            uint64_t dropped = state->ring.Dropped();
+            new_drops += dropped - state->reported_drops;
+            state->reported_drops = dropped;
+            if (retired && state->ring.Empty()) {
+                it = threads_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return new_drops;
+    }
+
+    bool MonitorContentionTask::Key::operator<(const Key &other) const {
+        if (kind != other.kind) {
+            return kind < other.kind;
+        }
+        if (class_id != other.class_id) {
+            return class_id < other.class_id;
+        }
+        if (method_id != other.method_id) {
+            return method_id < other.method_id;
+        }
+        return dex_pc < other.dex_pc;
+    }
+
+    MonitorContentionTask::MonitorContentionTask(CapabilityPlanner *capabilities,
+                                                 const std::string &dir, bool enabled,
+                                                 int64_t report_interval_ns)
+            : capabilities_(capabilities), dir_(dir), report_interval_ns_(report_interval_ns),
+              start_enabled_(enabled) {}
+
+    int64_t MonitorContentionTask::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (start_enabled_) {
+            start_enabled_ = false;
+            SetEnabled(jvmti, jni, true);
+        }
+        int64_t now = MonotonicNanos();
+        if (now >= next_poll_ns_) {
+            PollTrigger(jvmti, jni);
+            next_poll_ns_ = now + kPollPeriodNs;
+        }
+        Aggregate(jvmti, jni);
+        if (now >= next_report_ns_) {
+            Report();
+            next_report_ns_ = now + report_interval_ns_;
+        }
+        return enabled_ ? kDrainPeriodNs : kPollPeriodNs;
+    }
+
+    void MonitorContentionTask::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Aggregate(jvmti, jni);
+        Report();
+    }
+
+    void MonitorContentionTask::PollTrigger(jvmtiEnv *jvmti, JNIEnv *jni) {
+        std::string trigger_path = dir_ + kTriggerName;
+        FILE *trigger = fopen(trigger_path.c_str(), "r");
+        if (trigger == nullptr) {
+            return;
+        }
+        char word[8] = {};
+        bool parsed = fscanf(trigger, "%7s", word) == 1;
+        fclose(trigger);
+        unlink(trigger_path.c_str());
+        if (parsed && strcmp(word, "on") == 0) {
+            SetEnabled(jvmti, jni, true);
+        } else if (parsed && strcmp(word, "off") == 0) {
+            SetEnabled(jvmti, jni, false);
+        } else {
+            LOGE("MonitorContention: %s must hold on or off", trigger_path.c_str());
+        }
+    }
+
+    void MonitorContentionTask::SetEnabled(jvmtiEnv *jvmti, JNIEnv *jni, bool enabled) {
+        if (enabled == enabled_) {
+            return;
+        }
+        jvmtiEventMode mode = enabled ? JVMTI_ENABLE : JVMTI_DISABLE;
+        if (enabled) {
+            if (!capabilities_->Enable(jvmti, kFeatureMonitorEvents)) {
+                LOGE("MonitorContention: monitor events not available");
+                return;
+            }
+            if (!found_wait_methods_) {
+                found_wait_methods_ = true;
+                FindWaitMethods(jvmti, jni);
+            }
+        }
+        MonitorContention::Instance().NewGeneration();
+        for (jvmtiEvent event : kMonitorEvents) {
+            SetEventNotification(jvmti, mode, event);
+        }
+        if (!enabled) {
+            capabilities_->Disable(jvmti, kFeatureMonitorEvents);
+        }
+        enabled_ = enabled;
+        LOGE("MonitorContention: %s", enabled ? "on" : "off");
+    }
+
+    // Object.wait() calls the native wait(long, int) through wait(long)
+    void MonitorContentionTask::FindWaitMethods(jvmtiEnv *jvmti, JNIEnv *jni) {
+        ScopedLocalRef<jclass> object_class(jni, jni->FindClass("java/lang/Object"));
+        if (object_class.get() == nullptr) {
+            jni->ExceptionClear();
+            return;
+        }
+        jint method_count = 0;
+        jmethodID *methods = nullptr;
+        if (CheckJvmtiError(jvmti, jvmti->GetClassMethods(object_class.get(), &method_count,
+                                                          &methods))) {
+            return;
+        }
+        std::vector<jmethodID> wait_methods;
+        for (jint i = 0; i < method_count; ++i) {
+            char *name = nullptr;
+            if (jvmti->GetMethodName(methods[i], &name, nullptr, nullptr) == JVMTI_ERROR_NONE) {
+                if (name != nullptr && strcmp(name, "wait") == 0) {
+                    wait_methods.push_back(methods[i]);
+                }
+                Deallocate(jvmti, name);
+            }
+        }
+        Deallocate(jvmti, methods);
+        MonitorContention::Instance().SetWaitMethods(wait_methods);
+    }
+
+    void MonitorContentionTask::Aggregate(jvmtiEnv *jvmti, JNIEnv *jni) {
+        records_.clear();
+        uint64_t dropped = MonitorContention::Instance().Drain(&records_);
+        if (dropped > 0) {
+            LOGE("MonitorContention: dropped %" PRIu64 " records", dropped);
+        }
+        EventPipeline &pipeline = EventPipeline::Instance();
+        SymbolCache &symbols = SymbolCache::Instance();
+        bool traced = pipeline.Trace() != nullptr;
+        for (const MonitorContention::Record &record : records_) {
+            MonitorWaitKind kind = static_cast<MonitorWaitKind>(record.kind);
+            uint64_t wait_ns = record.wait_ns > 0 ? static_cast<uint64_t>(record.wait_ns) : 0;
+
+            Key class_key = {kind, record.class_id, 0, 0};
+            Entry &by_class = entries_[class_key];
+            by_class.histogram.Add(wait_ns);
+            by_class.dirty = true;
+            if (by_class.name.empty()) {
+                const ClassSymbol *klass = symbols.FindClass(record.class_id);
+                by_class.name = klass != nullptr ? klass->signature : "<untagged>";
+                if (traced && record.class_id != 0) {
+                    pipeline.TraceClass(record.class_id);
+                }
+            }
+
+            const MethodSymbol *method = record.method != 0
+                    ? symbols.LookupMethod(jvmti, jni, reinterpret_cast<jmethodID>(record.method))
+                    : nullptr;
+            if (method == nullptr) {
+                continue;
+            }
+            Key site_key = {kind, 0, method->id, static_cast<uint32_t>(record.location)};
+            Entry &by_site = entries_[site_key];
+            by_site.histogram.Add(wait_ns);
+            by_site.dirty = true;
+            if (by_site.name.empty()) {
+                const ClassSymbol *klass = symbols.FindClass(method->class_id);
+                by_site.name.append(klass != nullptr ? klass->signature : "<unknown>")
+                            .append("->").append(method->name).append(method->signature)
+                            .append(" @").append(std::to_string(record.location));
+                if (traced) {
+                    pipeline.TraceMethod(*method);
+                }
+            }
+        }
+        has_new_records_ = has_new_records_ || !records_.empty();
+    }
+
+    void MonitorContentionTask::Report() {
+        if (!has_new_records_) {
+            return;
+        }
+        has_new_records_ = false;
+        TraceWriter *trace = EventPipeline::Instance().Trace();
+        if (trace == nullptr) {
+            for (MonitorWaitKind kind : {kMonitorContended, kMonitorWait}) {
+                LogTop(kind, false);
+                LogTop(kind, true);
+            }
+            for (auto &entry : entries_) {
+                entry.second.dirty = false;
+            }
+            return;
+        }
+        std::vector<MonitorHistogramRow> rows;
+        for (auto &entry : entries_) {
+            if (!entry.second.dirty) {
+                continue;
+            }
+            entry.second.dirty = false;
+            const Key &key = entry.first;
+            rows.push_back(MonitorHistogramRow{key.kind, key.class_id, key.method_id, key.dex_pc,
+                                               &entry.second.histogram});
+        }
+        trace->AddMonitorHistograms(MonotonicNanos(), rows);
+    }
+
+    // Logs the entries of |kind| per call site or per class with the most
+    // wait time, when one of them was updated
+    void MonitorContentionTask::LogTop(MonitorWaitKind kind, bool sites) {
+        std::vector<const std::pair<const Key, Entry> *> top;
+        bool dirty = false;
+        for (const auto &entry : entries_) {
+            if (entry.first.kind == kind && (entry.first.method_id != 0) == sites) {
+                top.push_back(&entry);
+                dirty = dirty || entry.second.dirty;
+            }
+        }
+        if (!dirty) {
+            return;
+        }
+        size_t count = std::min(top.size(), kLoggedEntries);
+        std::partial_sort(top.begin(), top.begin() + count, top.end(),
+                          [](const std::pair<const Key, Entry> *a,
+                             const std::pair<const Key, Entry> *b) {
+                              return a->second.histogram.Sum() > b->second.histogram.Sum();
+                          });
+        const char *what = kind == kMonitorContended ? "contended" : "wait";
+        LOGE("MonitorContention: %s per %s, %zu entries", what, sites ? "site" : "class",
+             top.size());
+        for (size_t i = 0; i < count; ++i) {
+            const LatencyHistogram &histogram = top[i]->second.histogram;
+            LOGE("MonitorContention: %8" PRIu64 " %10.3f ms  p50 %.3f p99 %.3f max %.3f ms  %s",
+                 histogram.Count(), histogram.Sum() / 1e6, histogram.Percentile(0.5) / 1e6,
+                 histogram.Percentile(0.99) / 1e6, histogram.Max() / 1e6,
+                 top[i]->second.name.c_str());
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,191 @@
+#ifndef MONITOR_CONTENTION_H
+#define MONITOR_CONTENTION_H
+
+#include "capability_planner.h"
+#include "event_pipeline.h"
+#include "jvmti.h"
+#include "latency_histogram.h"
+#include "ring_buffer.h"
+#include "trace_format.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Wait times of the contended monitor entries and Object.wait calls,
+     * from the MonitorContendedEnter/Entered and MonitorWait/Waited events.
+     *
+     * The first event of a pair keeps its timestamp in the state of the
+     * calling thread, the second one pushes a fixed-size record (wait time,
+     * waiting frame, class tag of the monitor) to the thread's ring buffer:
+     * no allocation past the first event of a thread, no lock and no string
+     * lookup, a frame and a tag query only. The records are aggregated on
+     * the agent thread by MonitorContentionTask.
+     *
+     * The events are only enabled while the collector is on, the callbacks
+     * cost nothing otherwise.
+     */
+    class MonitorContention {
+    public:
+        struct Record {
+            int64_t wait_ns;
+            // jmethodID and location of the waiting frame, 0 if unknown
+            uint64_t method;
+            int64_t location;
+            // tag of the monitor's class, 0 if untagged
+            uint32_t class_id;
+            uint16_t kind;
+            uint16_t reserved;
+        };
+
+        static MonitorContention &Instance();
+
+        MonitorContention(const MonitorContention &) = delete;
+
+        MonitorContention &operator=(const MonitorContention &) = delete;
+
+        void OnContendedEnter();
+
+        void OnContendedEntered(jvmtiEnv *jvmti, JNIEnv *jni, jobject object);
+
+        void OnWait();
+
+        void OnWaited(jvmtiEnv *jvmti, JNIEnv *jni, jobject object);
+
+        /**
+         * Marks the calling thread's state as retired, released once drained.
+         * Called from ThreadEnd.
+         */
+        void RetireCurrentThread();
+
+        /**
+         * Called whenever the events are switched on or off: the pending
+         * entries and waits started before then are ignored, their second
+         * event may come long after (or never, while the events are off).
+         */
+        void NewGeneration() { generation_.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+         * Sets the methods of java.lang.Object whose frames are skipped to
+         * find the caller of Object.wait. Before the events are enabled.
+         */
+        void SetWaitMethods(const std::vector<jmethodID> &methods);
+
+        /**
+         * Appends the pending records of every thread to |records|, returns
+         * the number of records dropped on full buffers since the last call.
+         * Agent thread only.
+         */
+        uint64_t Drain(std::vector<Record> *records);
+
+    private:
+        static const int kMaxWaitMethods = 8;
+
+        struct ThreadState {
+            explicit ThreadState(size_t capacity) : ring(capacity) {}
+
+            SpscRingBuffer<Record> ring;
+            // start of the pending contended entry and wait, 0 if none,
+            // and the generation they were taken in
+            int64_t contended_since_ns = 0;
+            int64_t wait_since_ns = 0;
+            uint32_t contended_generation = 0;
+            uint32_t wait_generation = 0;
+            std::atomic<bool> retired{false};
+            // consumer-only
+            uint64_t reported_drops = 0;
+        };
+
+        MonitorContention() = default;
+
+        ThreadState *CurrentThread();
+
+        void Push(jvmtiEnv *jvmti, JNIEnv *jni, jobject object, MonitorWaitKind kind,
+                  int64_t wait_ns);
+
+        std::mutex threads_mutex_;
+        std::vector<std::unique_ptr<ThreadState>> threads_;
+
+        jmethodID wait_methods_[kMaxWaitMethods] = {};
+        int wait_method_count_ = 0;
+        std::atomic<uint32_t> generation_{0};
+    };
+
+    static_assert(sizeof(MonitorContention::Record) == 32, "Record must stay compact");
+
+    /**
+     * Switches the monitor events on and off at runtime and reports the
+     * wait time histograms per monitor class and per call site: to the
+     * trace (see kChunkMonitorHistograms), or the top entries to the log
+     * when there is no trace file.
+     *
+     * The agent thread polls the agent directory for a pcall-monitors file,
+     * whose first word is "on" or "off", and removes it:
+     *
+     *   adb shell run-as <package> sh -c 'echo on > <agent dir>/pcall-monitors'
+     *
+     * The capability of the monitor events is only held while they are on.
+     */
+    class MonitorContentionTask : public PeriodicTask {
+    public:
+        MonitorContentionTask(CapabilityPlanner *capabilities, const std::string &dir,
+                              bool enabled, int64_t report_interval_ns);
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct Key {
+            MonitorWaitKind kind;
+            uint32_t class_id;
+            uint32_t method_id;
+            uint32_t dex_pc;
+
+            bool operator<(const Key &other) const;
+        };
+
+        struct Entry {
+            LatencyHistogram histogram;
+            // updated since the last report
+            bool dirty = false;
+            // class signature or method, for the log
+            std::string name;
+        };
+
+        void PollTrigger(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void SetEnabled(jvmtiEnv *jvmti, JNIEnv *jni, bool enabled);
+
+        void FindWaitMethods(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Aggregate(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Report();
+
+        void LogTop(MonitorWaitKind kind, bool sites);
+
+        CapabilityPlanner *const capabilities_;
+        const std::string dir_;
+        const int64_t report_interval_ns_;
+        bool enabled_ = false;
+        bool start_enabled_;
+        bool found_wait_methods_ = false;
+        int64_t next_poll_ns_ = 0;
+        int64_t next_report_ns_ = 0;
+        bool has_new_records_ = false;
+
+        std::vector<MonitorContention::Record> records_;
+        std::map<Key, Entry> entries_;
+    };
+
+}  // namespace profiler
+
+#endif  // MONITOR_CONTENTION_H
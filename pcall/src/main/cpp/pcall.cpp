@@ -1,7 +1,30 @@
 #include "jvmti_helper.h"
 #include "jvmti.h"
+#include "agent_config.h"
+#include "allocation_sites.h"
+#include "apk_dex_files.h"
+#include "capability_planner.h"
+#include "class_image_cache.h"
+#include "class_timeline.h"
+#include "clock.h"
+#include "event_pipeline.h"
+#include "exception_hot_spots.h"
+#include "gc_timeline.h"
+#include "heap_graph.h"
+#include "heap_histogram.h"
+#include "heap_snapshot.h"
+#include "instrumentation_rules.h"
+#include "monitor_contention.h"
+#include "pretransformed_images.h"
+#include "sampling_profiler.h"
+#include "startup_jobs.h"
+#include "symbol_cache.h"
+#include "thread_cpu.h"
+#include "transform_context.h"
 #include <inttypes.h>
+#include <algorithm>
 #include <dlfcn.h>
+#include <unistd.h>
 
 #include "slicer/instrumentation.h"
 #include "slicer/reader.h"
@@ -17,6 +40,13 @@ namespace profiler {
         return so_path.substr(0, so_path.find_last_of('/') + 1);
     }
 
+    class MallocAllocator : public dex::Writer::Allocator {
+    public:
+        virtual void* Allocate(size_t size) { return malloc(size); }
+
+        virtual void Free(void* ptr) { free(ptr); }
+    };
+
     class JvmtiAllocator : public dex::Writer::Allocator {
     public:
         JvmtiAllocator(jvmtiEnv* jvmti_env) : jvmti_env_(jvmti_env) {}
@@ -33,15 +63,228 @@ namespace profiler {
 
     extern "C" {
 
-    // Method signature for IterateThroughHeap extension that includes heap id.
-    // Note that the signature is almost identical to IterateThroughHeap, with the
-    // heap_iteration_callback in jvmtiHeapCallbacks taking a function pointer with
-    // an additional int parameter.
-    using IterateThroughHeapExt = jvmtiError (*)(jvmtiEnv*, jint, jclass,
-                                                 const jvmtiHeapCallbacks*,
-                                                 const void*);
+    static AgentConfig g_config;
+
+    static CapabilityPlanner g_capabilities;
+
+    static InstrumentationRules g_rules;
+
+    static ClassImageCache g_class_cache;
+
+    // images built ahead of time waiting for their class, at most
+    static const size_t kPretransformBudget = 8 << 20;
+
+    static PretransformedImages g_pretransformed(kPretransformBudget);
+
+    // the demo app hooks, installed when the options have no rules
+    static const char *const kDefaultRules[] = {
+            "exit com/johnsoft/pcalldemo/SettingsActivity getString()Ljava/lang/String; "
+            "com/johnsoft/pcalla/Replacer.wrapGetString",
+            "entry com/johnsoft/pcalldemo/SettingsActivity doSomething()V "
+            "com/johnsoft/pcalla/Replacer.wrapDoSomething object_this",
+            "detour com/johnsoft/pcalldemo/SettingsActivity$1 onClick(Landroid/view/View;)V "
+            "com/johnsoft/pcalldemo/SettingsActivity.colorIt()V com/johnsoft/pcalla/Replacer.replaceColorIt",
+    };
+
+    // classes of the agent itself are never instrumented, the hooks and probes would recurse
+    static const char kAgentPackage[] = "com/johnsoft/pcalla/";
+
+    // Whether the class with the internal name[0, length) has instrumentation rules
+    static bool NeedsClassHook(const char *name, size_t length) {
+        return g_rules.Matches(name, length) &&
+               (length < sizeof(kAgentPackage) - 1 ||
+                strncmp(name, kAgentPackage, sizeof(kAgentPackage) - 1) != 0);
+    }
+
+    // Tracer.enter(int) and Tracer.exit(int), called by the injected probes
+    static void JNICALL TracerEnter(JNIEnv *jni_env, jclass klass, jint id) {
+        EventPipeline::Instance().Record(kEventProbeEntry, static_cast<uint32_t>(id));
+    }
+
+    static void JNICALL TracerExit(JNIEnv *jni_env, jclass klass, jint id) {
+        EventPipeline::Instance().Record(kEventProbeExit, static_cast<uint32_t>(id));
+    }
+
+    // Tracer.alloc(int) and Tracer.allocArray(int, int), called by the
+    // allocation probes
+    static void JNICALL TracerAlloc(JNIEnv *jni_env, jclass klass, jint site) {
+        AllocationSites::Instance().RecordInstance(static_cast<uint32_t>(site));
+    }
+
+    static void JNICALL TracerAllocArray(JNIEnv *jni_env, jclass klass, jint site, jint length) {
+        AllocationSites::Instance().RecordArray(static_cast<uint32_t>(site), length);
+    }
+
+    // the environment of the Tracer natives, set before they are bound
+    static jvmtiEnv *g_tracer_jvmti = nullptr;
+
+    // Tracer.clinitEnter(int) and Tracer.clinitExit(int), called by the
+    // static initializer probes
+    static void JNICALL TracerClinitEnter(JNIEnv *jni_env, jclass klass, jint class_id) {
+        // the stack depth tells the initializers still running from the
+        // ones an exception unwound
+        jint frame_depth = 0;
+        if (g_tracer_jvmti->GetFrameCount(nullptr, &frame_depth) != JVMTI_ERROR_NONE) {
+            frame_depth = 0;
+        }
+        ClassTimeline::Instance().OnClinitEnter(static_cast<uint32_t>(class_id), frame_depth);
+    }
+
+    static void JNICALL TracerClinitExit(JNIEnv *jni_env, jclass klass, jint class_id) {
+        ClassTimeline::Instance().OnClinitExit(static_cast<uint32_t>(class_id));
+    }
+
+    // Binds the natives of com.johnsoft.pcalla.Tracer, the targets of every probe
+    static bool RegisterTracerNatives(jvmtiEnv *jvmti_env, JNIEnv *jni_env) {
+        g_tracer_jvmti = jvmti_env;
+        ScopedLocalRef<jclass> tracer_class(jni_env, jni_env->FindClass("com/johnsoft/pcalla/Tracer"));
+        JNINativeMethod tracer_methods[] = {
+                {const_cast<char *>("enter"), const_cast<char *>("(I)V"), reinterpret_cast<void *>(TracerEnter)},
+                {const_cast<char *>("exit"), const_cast<char *>("(I)V"), reinterpret_cast<void *>(TracerExit)},
+                {const_cast<char *>("alloc"), const_cast<char *>("(I)V"), reinterpret_cast<void *>(TracerAlloc)},
+                {const_cast<char *>("allocArray"), const_cast<char *>("(II)V"), reinterpret_cast<void *>(TracerAllocArray)},
+                {const_cast<char *>("clinitEnter"), const_cast<char *>("(I)V"), reinterpret_cast<void *>(TracerClinitEnter)},
+                {const_cast<char *>("clinitExit"), const_cast<char *>("(I)V"), reinterpret_cast<void *>(TracerClinitExit)},
+        };
+        if (tracer_class.get() == nullptr ||
+                jni_env->RegisterNatives(tracer_class.get(), tracer_methods,
+                                         sizeof(tracer_methods) / sizeof(tracer_methods[0])) != JNI_OK) {
+            jni_env->ExceptionClear();
+            return false;
+        }
+        return true;
+    }
+
+    // Site callback of the allocation probes
+    static dex::u4 InternAllocSite(uint32_t method_id, const slicer::AllocationSite &site) {
+        AllocSiteKind kind = site.opcode == dex::OP_NEW_INSTANCE ? kAllocSiteInstance :
+                             site.opcode == dex::OP_NEW_ARRAY ? kAllocSiteArray : kAllocSiteFilledArray;
+        return AllocationSites::Instance().InternSite(method_id, site.offset, kind,
+                                                      site.type->descriptor->c_str(), site.length);
+    }
+
+    // Applies |rule| to the matching methods of the class being loaded
+    static void ApplyRule(std::shared_ptr<ir::DexFile> dex_ir, const std::string &desc,
+                          const InstrumentationRule &rule) {
+        SymbolCache &symbols = SymbolCache::Instance();
+        ir::MethodId entry_probe("Lcom/johnsoft/pcalla/Tracer;", "enter");
+        ir::MethodId exit_probe("Lcom/johnsoft/pcalla/Tracer;", "exit");
+        ir::MethodId alloc_probe("Lcom/johnsoft/pcalla/Tracer;", "alloc");
+        ir::MethodId alloc_array_probe("Lcom/johnsoft/pcalla/Tracer;", "allocArray");
+        ir::MethodId clinit_entry_probe("Lcom/johnsoft/pcalla/Tracer;", "clinitEnter");
+        ir::MethodId clinit_exit_probe("Lcom/johnsoft/pcalla/Tracer;", "clinitExit");
+        bool matched = false;
+        for (auto &ir_method : dex_ir->encoded_methods) {
+            ir::MethodDecl *decl = ir_method->decl;
+            if (ir_method->code == nullptr || desc != decl->parent->descriptor->c_str()) {
+                continue;
+            }
+            std::string signature = decl->prototype->Signature();
+            if (!rule.MatchesMethod(decl->name->c_str(), signature)) {
+                continue;
+            }
+            matched = true;
+            slicer::MethodInstrumenter mi(dex_ir);
+            switch (rule.action) {
+                case kRuleEntryHook:
+                    mi.AddTransformation<slicer::EntryHook>(
+                            ir::MethodId(rule.hook_class.c_str(), rule.hook_method.c_str()),
+                            rule.object_this);
+                    break;
+                case kRuleExitHook:
+                    mi.AddTransformation<slicer::ExitHook>(
+                            ir::MethodId(rule.hook_class.c_str(), rule.hook_method.c_str()));
+                    break;
+                case kRuleDetour:
+                    mi.AddTransformation<slicer::DetourVirtualInvoke>(
+                            ir::MethodId(rule.invoked_class.c_str(), rule.invoked_method.c_str(),
+                                         rule.invoked_signature.c_str()),
+                            ir::MethodId(rule.hook_class.c_str(), rule.hook_method.c_str()));
+                    break;
+                case kRuleProbes: {
+                    uint32_t probe_id = symbols.InternProbeMethod(desc, decl->name->c_str(), signature);
+                    if (probe_id == 0) {
+                        return;
+                    }
+                    mi.AddTransformation<slicer::CallTraceProbes>(entry_probe, exit_probe, probe_id);
+                    break;
+                }
+                case kRuleAllocSites: {
+                    // the sites are reported against the probe id of their method
+                    uint32_t method_id = symbols.InternProbeMethod(desc, decl->name->c_str(), signature);
+                    if (method_id == 0) {
+                        return;
+                    }
+                    mi.AddTransformation<slicer::AllocationSiteProbes>(
+                            alloc_probe, alloc_array_probe,
+                            [method_id](const slicer::AllocationSite &site) {
+                                return InternAllocSite(method_id, site);
+                            });
+                    break;
+                }
+                case kRuleClinit: {
+                    // a plain entry/exit hook couldn't tell the classes apart,
+                    // the probes pass the class id
+                    uint32_t class_id = ClassTimeline::Instance().InternClass(desc);
+                    if (class_id == 0) {
+                        return;
+                    }
+                    mi.AddTransformation<slicer::CallTraceProbes>(clinit_entry_probe,
+                                                                  clinit_exit_probe, class_id);
+                    break;
+                }
+            }
+            if (!mi.InstrumentMethod(ir_method.get())) {
+                LOGE("Error instrumenting %s->%s%s", desc.c_str(), decl->name->c_str(),
+                     signature.c_str());
+            }
+        }
+        // most classes have no static initializer, a clinit rule is no error there
+        if (!matched && !rule.method_name.empty() && rule.action != kRuleClinit) {
+            LOGE("No method %s%s in %s", rule.method_name.c_str(), rule.signature.c_str(),
+                 desc.c_str());
+        }
+    }
+
+    // Whether |rules| inject probes, whose ids are only valid in this process
+    static bool HasProbeRule(const std::vector<const InstrumentationRule *> &rules) {
+        return std::any_of(rules.begin(), rules.end(), [](const InstrumentationRule *rule) {
+            return rule->action == kRuleProbes || rule->action == kRuleAllocSites ||
+                   rule->action == kRuleClinit;
+        });
+    }
+
+    // Applies |rules| to the class |desc| of the dex image data[0, size), at
+    // |class_index| if known (dex::kNoIndex otherwise). Returns the new image,
+    // from |allocator|, or nullptr
+    static dex::u1 *TransformClass(const dex::u1 *data, size_t size, const std::string &desc,
+                                   dex::u4 class_index,
+                                   const std::vector<const InstrumentationRule *> &rules,
+                                   dex::Writer::Allocator *allocator, size_t *image_size) {
+        TransformContext &context = TransformContext::Current();
+        dex::u1 *image = nullptr;
+        {
+            dex::Reader reader(data, size, context.AcquireDexIr());
+            if (class_index == dex::kNoIndex) {
+                class_index = reader.FindClassIndex(desc.c_str());
+            }
+            if (class_index != dex::kNoIndex) {
+                reader.CreateClassIr(class_index);
+                auto dex_ir = reader.GetIr();
+                for (const InstrumentationRule *rule : rules) {
+                    ApplyRule(dex_ir, desc, *rule);
+                }
 
-    static IterateThroughHeapExt g_iterate_heap_ext_func = nullptr;
+                dex::Writer writer(dex_ir);
+                image = writer.CreateImage(allocator, image_size);
+            } else {
+                LOGE("Could not find class index for %s", desc.c_str());
+            }
+        }
+        // the reader and writer references are gone
+        context.TrimDexIr();
+        return image;
+    }
 
     // Reference to https://android.googlesource.com/platform/tools/base/+/studio-master-dev/profiler/native/perfa/perfa.cc
 
@@ -49,27 +292,15 @@ namespace profiler {
                              JNIEnv *jni_env,
                              jthread thread,
                              jclass klass) {
-        char *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetClassSignature(klass, &sig_mutf8, nullptr));
-        if (sig_mutf8 != nullptr) {
-            LOGE("OnClassLoad: %s\n", sig_mutf8);
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventClassLoad,
+                                         SymbolCache::Instance().ClassId(jvmti_env, klass));
     }
 
     void JNICALL OnMethodEntry(jvmtiEnv *jvmti_env,
                                JNIEnv *jni_env,
                                jthread thread,
                                jmethodID method) {
-        char *name_mutf8, *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetMethodName(method, &name_mutf8, &sig_mutf8, nullptr));
-        LOGE("OnMethodEntry: %s, %s\n", name_mutf8, sig_mutf8);
-        if (name_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) name_mutf8);
-        }
-        if (sig_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventMethodEntry, reinterpret_cast<uintptr_t>(method));
     }
 
     void JNICALL OnMethodExist(jvmtiEnv *jvmti_env,
@@ -78,15 +309,7 @@ namespace profiler {
                                jmethodID method,
                                jboolean was_popped_by_exception,
                                jvalue return_value) {
-        char *name_mutf8, *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetMethodName(method, &name_mutf8, &sig_mutf8, nullptr));
-        LOGE("OnMethodExist: %s, %s\n", name_mutf8, sig_mutf8);
-        if (name_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) name_mutf8);
-        }
-        if (sig_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventMethodExit, reinterpret_cast<uintptr_t>(method));
     }
 
     void JNICALL OnSingleStep(jvmtiEnv *jvmti_env,
@@ -94,15 +317,8 @@ namespace profiler {
                               jthread thread,
                               jmethodID method,
                               jlocation location) {
-        char *name_mutf8, *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetMethodName(method, &name_mutf8, &sig_mutf8, nullptr));
-        LOGE("OnSingleStep: %s, %s %" PRId64 "\n", name_mutf8, sig_mutf8, location);
-        if (name_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) name_mutf8);
-        }
-        if (sig_mutf8 != nullptr) {
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventSingleStep, reinterpret_cast<uintptr_t>(method),
+                                         location);
     }
 
     void JNICALL OnVMObjectAlloc(jvmtiEnv *jvmti_env,
@@ -111,26 +327,98 @@ namespace profiler {
                                  jobject object,
                                  jclass object_klass,
                                  jlong size) {
-        jint hash_code = 0;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetObjectHashCode(object, &hash_code));
-        char *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetClassSignature(object_klass, &sig_mutf8, nullptr));
-        if (sig_mutf8 != nullptr) {
-            LOGE("OnVMObjectAlloc: %s@%" PRId32 "\n", sig_mutf8, hash_code);
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventObjectAlloc,
+                                         SymbolCache::Instance().ClassId(jvmti_env, object_klass),
+                                         size);
     }
 
     void JNICALL OnClassPrepare(jvmtiEnv *jvmti_env,
                                 JNIEnv *jni_env,
                                 jthread thread,
                                 jclass klass) {
-        char *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetClassSignature(klass, &sig_mutf8, nullptr));
-        if (sig_mutf8 != nullptr) {
-            LOGE("OnClassPrepare: %s\n", sig_mutf8);
-            Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-        }
+        EventPipeline::Instance().Record(kEventClassPrepare,
+                                         SymbolCache::Instance().ClassId(jvmti_env, klass));
+    }
+
+    void JNICALL OnExceptionCatch(jvmtiEnv *jvmti_env,
+                                  JNIEnv *jni_env,
+                                  jthread thread,
+                                  jmethodID method,
+                                  jlocation location,
+                                  jobject exception) {
+        // the exit probes of the frames unwound up to here never ran
+        EventPipeline::Instance().Record(kEventExceptionCatch,
+                                         reinterpret_cast<uintptr_t>(method), location);
+    }
+
+    void JNICALL OnException(jvmtiEnv *jvmti_env,
+                             JNIEnv *jni_env,
+                             jthread thread,
+                             jmethodID method,
+                             jlocation location,
+                             jobject exception,
+                             jmethodID catch_method,
+                             jlocation catch_location) {
+        ExceptionHotSpots::Instance().OnException(jvmti_env, jni_env, method, location, exception);
+    }
+
+    void JNICALL OnMonitorContendedEnter(jvmtiEnv *jvmti_env,
+                                         JNIEnv *jni_env,
+                                         jthread thread,
+                                         jobject object) {
+        MonitorContention::Instance().OnContendedEnter();
+    }
+
+    void JNICALL OnMonitorContendedEntered(jvmtiEnv *jvmti_env,
+                                           JNIEnv *jni_env,
+                                           jthread thread,
+                                           jobject object) {
+        MonitorContention::Instance().OnContendedEntered(jvmti_env, jni_env, object);
+    }
+
+    void JNICALL OnMonitorWait(jvmtiEnv *jvmti_env,
+                               JNIEnv *jni_env,
+                               jthread thread,
+                               jobject object,
+                               jlong timeout) {
+        MonitorContention::Instance().OnWait();
+    }
+
+    void JNICALL OnMonitorWaited(jvmtiEnv *jvmti_env,
+                                 JNIEnv *jni_env,
+                                 jthread thread,
+                                 jobject object,
+                                 jboolean timed_out) {
+        MonitorContention::Instance().OnWaited(jvmti_env, jni_env, object);
+    }
+
+    // no JNI and almost no JVMTI while the heap is being collected
+    void JNICALL OnGarbageCollectionStart(jvmtiEnv *jvmti_env) {
+        GcEvents::Instance().OnStart();
+    }
+
+    void JNICALL OnGarbageCollectionFinish(jvmtiEnv *jvmti_env) {
+        GcEvents::Instance().OnFinish();
+    }
+
+    void JNICALL OnThreadEnd(jvmtiEnv *jvmti_env,
+                             JNIEnv *jni_env,
+                             jthread thread) {
+        EventPipeline::Instance().RetireCurrentThread();
+        MonitorContention::Instance().RetireCurrentThread();
+    }
+
+    void JNICALL OnObjectFree(jvmtiEnv *jvmti_env,
+                              jlong tag) {
+        SymbolCache::Instance().OnTagFreed(tag);
+    }
+
+    // Accounts for one ClassFileLoadHook call on the class |name| (internal
+    // name), in the cache statistics and in the class timeline
+    static void RecordClassHook(const char *name, ClassHookOutcome outcome, int64_t elapsed_ns) {
+        g_class_cache.RecordHook(outcome, elapsed_ns);
+        ClassTimeline &timeline = ClassTimeline::Instance();
+        timeline.RecordTransform(timeline.InternClass("L" + std::string(name) + ";"), elapsed_ns);
     }
 
     void JNICALL OnClassFileLoadHook(jvmtiEnv *jvmti_env,
@@ -143,98 +431,514 @@ namespace profiler {
                                      const unsigned char *class_data,
                                      jint *new_class_data_len,
                                      unsigned char **new_class_data) {
-        if (name != nullptr) {
-            LOGE("OnClassFileLoaded: %s\n", name);
+        // nothing is logged from here, this runs on every class load; the
+        // hook counts and latencies are reported by ClassImageCacheTask
+        if (name == nullptr || !NeedsClassHook(name, strlen(name))) {
+            return;
+        }
+        const int64_t hook_start_ns = MonotonicNanos();
+        JvmtiAllocator allocator(jvmti_env);
+        if (g_pretransformed.Take(name, class_data, class_data_len, &allocator,
+                                  new_class_data, new_class_data_len)) {
+            RecordClassHook(name, kClassHookPretransformed, MonotonicNanos() - hook_start_ns);
+            return;
         }
 
-        bool transformed = true;
-        bool a = strcmp(name, "com/johnsoft/pcalldemo/SettingsActivity") == 0;
-        bool b = strcmp(name, "com/johnsoft/pcalldemo/SettingsActivity$1") == 0;
-        if (a || b) {
-            dex::Reader reader(class_data, class_data_len);
-            std::string desc = "L" + std::string(name) + ";";
-            auto class_index = reader.FindClassIndex(desc.c_str());
-            if (class_index == dex::kNoIndex) {
-                LOGE("Could not find class index for %s", name);
-                return;
+        std::vector<const InstrumentationRule *> &rules = TransformContext::Current().Rules();
+        g_rules.Match(name, strlen(name), &rules);
+        // probe ids are assigned per process, probed classes are never cached
+        bool cacheable = g_class_cache.IsOpen() && !HasProbeRule(rules);
+        std::string desc = "L" + std::string(name) + ";";
+        if (cacheable && g_class_cache.Lookup(desc, class_data, class_data_len, &allocator,
+                                              new_class_data, new_class_data_len)) {
+            RecordClassHook(name, kClassHookCacheHit, MonotonicNanos() - hook_start_ns);
+            return;
+        }
+
+        size_t new_image_size = 0;
+        dex::u1* new_image = TransformClass(class_data, class_data_len, desc, dex::kNoIndex, rules,
+                                            &allocator, &new_image_size);
+        if (new_image == nullptr) {
+            RecordClassHook(name, kClassHookFailed, MonotonicNanos() - hook_start_ns);
+            return;
+        }
+        *new_class_data_len = new_image_size;
+        *new_class_data = new_image;
+        if (cacheable) {
+            g_class_cache.Store(desc, class_data, class_data_len, new_image,
+                                static_cast<jint>(new_image_size));
+        }
+        RecordClassHook(name, cacheable ? kClassHookCacheMiss : kClassHookUncached,
+                        MonotonicNanos() - hook_start_ns);
+    }
+
+    // loaded classes matched or tagged, and classes retransformed, per startup job step
+    static const jint kMatchChunk = 256;
+    static const size_t kRetransformChunk = 8;
+
+    // Retransforms the classes loaded before the attach that need the class
+    // hooks, matching and retransforming a few classes per step
+    class RetransformLoadedClassesJob : public StartupJob {
+    public:
+        RetransformLoadedClassesJob() : StartupJob("retransform", 30) {}
+
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            if (!listed_) {
+                listed_ = true;
+                bool failed = CheckJvmtiError(jvmti, jvmti->GetLoadedClasses(&class_count_,
+                                                                             &loaded_classes_));
+                listed_count_ = static_cast<size_t>(class_count_);
+                return failed;
+            }
+            if (next_match_ < class_count_) {
+                jint end = std::min(class_count_, next_match_ + kMatchChunk);
+                for (; next_match_ < end; ++next_match_) {
+                    char *sig_mutf8 = nullptr;
+                    CheckJvmtiError(jvmti, jvmti->GetClassSignature(loaded_classes_[next_match_],
+                                                                    &sig_mutf8, nullptr));
+                    // "Lname;" to the internal name
+                    size_t length = sig_mutf8 != nullptr ? strlen(sig_mutf8) : 0;
+                    if (length > 2 && sig_mutf8[0] == 'L' &&
+                            NeedsClassHook(sig_mutf8 + 1, length - 2)) {
+                        matched_.push_back(loaded_classes_[next_match_]);
+                    }
+                    Deallocate(jvmti, sig_mutf8);
+                }
+                matched_count_ = matched_.size();
+                return false;
             }
+            if (next_retransform_ < matched_.size()) {
+                size_t count = std::min(kRetransformChunk, matched_.size() - next_retransform_);
+                CheckJvmtiError(jvmti, jvmti->RetransformClasses(static_cast<jint>(count),
+                                                                 &matched_[next_retransform_]));
+                next_retransform_ += count;
+                return false;
+            }
+            LOGE("Retransformed %zu of %zu loaded classes", next_retransform_, listed_count_);
+            Release(jvmti, jni);
+            return true;
+        }
+
+        // the classes matched so far, then retransformed, out of the
+        // loaded ones plus the matched ones
+        void GetProgress(size_t *done, size_t *total) const override {
+            *done = static_cast<size_t>(next_match_) + next_retransform_;
+            *total = listed_ ? listed_count_ + matched_count_ : 0;
+        }
 
-            reader.CreateClassIr(class_index);
-            auto dex_ir = reader.GetIr();
+        void Abort(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            Release(jvmti, jni);
+        }
 
-            if (a) {
-                slicer::MethodInstrumenter mi1(dex_ir);
-                mi1.AddTransformation<slicer::ExitHook>(ir::MethodId("Lcom/johnsoft/pcalla/Replacer;", "wrapGetString"));
-                if (!mi1.InstrumentMethod(ir::MethodId(desc.c_str(), "getString", "()Ljava/lang/String;"))) {
-                    LOGE("Error instrumenting SettingsActivity.getString");
+    private:
+        void Release(jvmtiEnv *jvmti, JNIEnv *jni) {
+            for (jint i = 0; i < class_count_; ++i) {
+                jni->DeleteLocalRef(loaded_classes_[i]);
+            }
+            Deallocate(jvmti, loaded_classes_);
+            loaded_classes_ = nullptr;
+            class_count_ = 0;
+            matched_.clear();
+        }
+
+        bool listed_ = false;
+        jint class_count_ = 0;
+        jclass *loaded_classes_ = nullptr;
+        jint next_match_ = 0;
+        std::vector<jclass> matched_;
+        size_t next_retransform_ = 0;
+        // totals for the progress reports, kept past Release()
+        size_t listed_count_ = 0;
+        size_t matched_count_ = 0;
+    };
+
+    // Whether the slicer Reader accepts data[0, size) (it aborts on invalid headers)
+    static bool IsReadableDex(const uint8_t *data, size_t size) {
+        if (size <= sizeof(dex::Header)) {
+            return false;
+        }
+        const dex::Header *header = reinterpret_cast<const dex::Header *>(data);
+        return memcmp(header->magic, "dex\n", 4) == 0 && header->file_size <= size &&
+               header->header_size == sizeof(dex::Header) &&
+               header->endian_tag == dex::kEndianConstant && header->data_size % 4 == 0;
+    }
+
+    // Transforms the classes of the APK matching the rules before they are
+    // loaded, one class per step, so that their ClassFileLoadHook only has
+    // to copy a ready image
+    class PretransformJob : public StartupJob {
+    public:
+        // ahead of everything else, it races with the class loads
+        PretransformJob() : StartupJob("pretransform", 40) {}
+
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            if (!listed_) {
+                listed_ = true;
+                apks_ = FindMappedApks();
+                return apks_.empty();
+            }
+            if (scan_ == nullptr) {
+                return !OpenNextDex();
+            }
+
+            auto class_defs = scan_->ClassDefs();
+            auto types = scan_->TypeIds();
+            dex::u4 end = std::min<dex::u4>(class_defs.size(), next_class_ + kMatchChunk);
+            while (next_class_ < end) {
+                dex::u4 index = next_class_++;
+                const char *descriptor = scan_->GetStringMUTF8(
+                        types[class_defs[index].class_idx].descriptor_idx);
+                size_t length = strlen(descriptor);
+                if (length < 3 || descriptor[0] != 'L' || !NeedsClassHook(descriptor + 1, length - 2)) {
+                    continue;
+                }
+                std::vector<const InstrumentationRule *> &rules = TransformContext::Current().Rules();
+                g_rules.Match(descriptor + 1, length - 2, &rules);
+                if (HasProbeRule(rules) || g_pretransformed.Contains(descriptor)) {
+                    continue;
                 }
+                MallocAllocator allocator;
+                size_t image_size = 0;
+                dex::u1 *image = TransformClass(dex_, dex_size_, descriptor, index, rules,
+                                                &allocator, &image_size);
+                if (image == nullptr) {
+                    return false;
+                }
+                bool added = g_pretransformed.Add(descriptor, scan_->Header(),
+                                                  std::vector<dex::u1>(image, image + image_size));
+                free(image);
+                if (!added) {
+                    LOGE("Pretransform budget used up after %zu classes", transformed_);
+                    scan_.reset();
+                    return true;
+                }
+                transformed_++;
+                return false;
+            }
+            if (next_class_ == class_defs.size()) {
+                scanned_ += next_class_;
+                scan_.reset();
+            }
+            return false;
+        }
+
+        void GetProgress(size_t *done, size_t *total) const override {
+            size_t current = scan_ != nullptr ? scan_->ClassDefs().size() : 0;
+            *done = scanned_ + next_class_;
+            *total = scanned_ + current;
+        }
+
+        void Abort(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            scan_.reset();
+        }
 
-                slicer::MethodInstrumenter mi2(dex_ir);
-                mi2.AddTransformation<slicer::EntryHook>(ir::MethodId("Lcom/johnsoft/pcalla/Replacer;", "wrapDoSomething"), true);
-                if (!mi2.InstrumentMethod(ir::MethodId(desc.c_str(), "doSomething", "()V"))) {
-                    LOGE("Error instrumenting SettingsActivity.doSomething");
+    private:
+        // Moves to the next dex file, returns false once there are none left
+        bool OpenNextDex() {
+            for (;;) {
+                if (apk_ != nullptr && next_dex_ < apk_->DexCount()) {
+                    dex_ = apk_->ReadDex(next_dex_++, &dex_size_);
+                    if (dex_ != nullptr && IsReadableDex(dex_, dex_size_)) {
+                        scan_.reset(new dex::Reader(dex_, dex_size_));
+                        next_class_ = 0;
+                        return true;
+                    }
+                    continue;
+                }
+                if (next_apk_ == apks_.size()) {
+                    LOGE("Pretransformed %zu classes", transformed_);
+                    apk_.reset();
+                    return false;
+                }
+                apk_.reset(new ApkDexFiles());
+                if (!apk_->Open(apks_[next_apk_++])) {
+                    apk_.reset();
                 }
+                next_dex_ = 0;
+            }
+        }
+
+        bool listed_ = false;
+        std::vector<std::string> apks_;
+        size_t next_apk_ = 0;
+        std::unique_ptr<ApkDexFiles> apk_;
+        size_t next_dex_ = 0;
+        const uint8_t *dex_ = nullptr;
+        size_t dex_size_ = 0;
+        // iterates over the class defs of the current dex file
+        std::unique_ptr<dex::Reader> scan_;
+        dex::u4 next_class_ = 0;
+        size_t scanned_ = 0;
+        size_t transformed_ = 0;
+    };
+
+    // The agent thread keeps running native code, an exception thrown by a
+    // Java call must not stay pending
+    static void ClearException(JNIEnv *jni) {
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionDescribe();
+            jni->ExceptionClear();
+        }
+    }
+
+    // Starts the PCALL-Th handler thread
+    class HandlerThreadJob : public StartupJob {
+    public:
+        HandlerThreadJob() : StartupJob("handler-thread", 20) {}
+
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni_env) override {
+            // WindowManagerGlobal#getRootView(String)
+            // ActivityThread#mActivities#activity
+            // Application#registerActivityLifecycleCallbacks(ActivityLifecycleCallbacks)
+            ScopedLocalRef<jclass> klass(jni_env, jni_env->FindClass("android/os/HandlerThread"));
+            if (klass.get() == nullptr) {
+                LOGE("Failed to find Thread class.");
+                ClearException(jni_env);
+                return true;
+            }
+            jmethodID init = jni_env->GetMethodID(klass.get(), "<init>", "(Ljava/lang/String;)V");
+            if (init == nullptr) {
+                LOGE("Failed to find Thread.<init> method.");
+                return true;
+            }
+            ScopedLocalRef<jstring> name(jni_env, jni_env->NewStringUTF("PCALL-Th"));
+            ScopedLocalRef<jobject> thread(jni_env, jni_env->NewObject(klass.get(), init, name.get()));
+            if (thread.get() == nullptr) {
+                LOGE("Failed to create new Thread object.");
+                return true;
+            }
+            jmethodID start = jni_env->GetMethodID(klass.get(), "start", "()V");
+            if (start == nullptr) {
+                LOGE("Failed to find Thread.start method.");
+                return true;
+            }
+            jni_env->CallVoidMethod(thread.get(), start);
+            ClearException(jni_env);
+            return true;
+        }
+    };
+
+    // Calls com.johnsoft.pcalla.Finder.init()
+    class FinderInitJob : public StartupJob {
+    public:
+        FinderInitJob() : StartupJob("finder", 20) {}
+
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni_env) override {
+            ScopedLocalRef<jclass> finder_class(jni_env, jni_env->FindClass("com/johnsoft/pcalla/Finder"));
+            if (finder_class.get() == nullptr) {
+                LOGE("Failed to find Finder class.");
+                ClearException(jni_env);
+                return true;
+            }
+            jmethodID finder_init = jni_env->GetStaticMethodID(finder_class.get(), "init", "()V");
+            if (finder_init == nullptr) {
+                LOGE("Failed to find Finder.init method.");
+                return true;
             }
+            jni_env->CallStaticVoidMethod(finder_class.get(), finder_init);
+            ClearException(jni_env);
+            return true;
+        }
+    };
+
+    // Logs the name of every live thread
+    class ThreadDumpJob : public StartupJob {
+    public:
+        ThreadDumpJob() : StartupJob("thread-dump", 10) {}
 
-            if (b) {
-                slicer::MethodInstrumenter mi3(dex_ir);
-                mi3.AddTransformation<slicer::DetourVirtualInvoke>(ir::MethodId("Lcom/johnsoft/pcalldemo/SettingsActivity;",
-                                                                                "colorIt", "()V"),
-                                                                   ir::MethodId("Lcom/johnsoft/pcalla/Replacer;",
-                                                                                "replaceColorIt"));
-                if (!mi3.InstrumentMethod(ir::MethodId(desc.c_str(), "onClick", "(Landroid/view/View;)V"))) {
-                    LOGE("Error instrumenting SettingsActivity$1.onClick");
+        bool Step(jvmtiEnv *jvmti_env, JNIEnv *jni_env) override {
+            jint thread_count;
+            jthread *all_threads;
+            jvmtiThreadInfo thread_info;
+            if (CheckJvmtiError(jvmti_env, jvmti_env->GetAllThreads(&thread_count, &all_threads))) {
+                return true;
+            }
+            for (int i = 0; i < thread_count; ++i) {
+                if (!CheckJvmtiError(jvmti_env, jvmti_env->GetThreadInfo(all_threads[i], &thread_info))) {
+                    LOGE("Found thread %s\n", thread_info.name);
+                    Deallocate(jvmti_env, (unsigned char *) thread_info.name);
+                    jni_env->DeleteLocalRef(thread_info.thread_group);
+                    jni_env->DeleteLocalRef(thread_info.context_class_loader);
                 }
             }
 
-            size_t new_image_size = 0;
-            dex::u1* new_image = nullptr;
-            dex::Writer writer(dex_ir);
+            for (int i = 0; i < thread_count; ++i) {
+                jni_env->DeleteLocalRef(all_threads[i]);
+            }
+            Deallocate(jvmti_env, reinterpret_cast<unsigned char *>(all_threads));
+            return true;
+        }
+    };
 
-            JvmtiAllocator allocator(jvmti_env);
-            new_image = writer.CreateImage(&allocator, &new_image_size);
+    // Tags the classes loaded before the attach, a few per step, then walks
+    // the whole heap into a class histogram (a single JVMTI call, it can
+    // only be cancelled before it starts)
+    class HeapHistogramJob : public StartupJob {
+    public:
+        HeapHistogramJob() : StartupJob("heap-histogram", 0) {}
 
-            *new_class_data_len = new_image_size;
-            *new_class_data = new_image;
-        } else {
-            transformed = false;
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            if (!g_capabilities.IsEnabled(kFeatureObjectTags)) {
+                return true;
+            }
+            if (!listed_) {
+                listed_ = true;
+                histogram_.Init(jvmti);
+                return CheckJvmtiError(jvmti, jvmti->GetLoadedClasses(&class_count_,
+                                                                      &loaded_classes_));
+            }
+            if (next_tag_ < class_count_) {
+                jint count = std::min(kMatchChunk, class_count_ - next_tag_);
+                HeapHistogram::TagClasses(jvmti, loaded_classes_ + next_tag_, count);
+                next_tag_ += count;
+                return false;
+            }
+            Release(jvmti, jni);
+            if (histogram_.Collect(jvmti)) {
+                histogram_.Report();
+            }
+            return true;
         }
 
-        if (transformed) {
-            LOGE("Transformed class: %s", name);
+        void GetProgress(size_t *done, size_t *total) const override {
+            *done = next_tag_;
+            *total = listed_ ? class_count_ : 0;
         }
-    }
 
-    int JNICALL HeapIterationCallback(jlong class_tag,
-                                      jlong size,
-                                      jlong *tag_ptr,
-                                      jint length,
-                                      void *user_data) {
-        LOGE("heapIterationCallback: %" PRId64 ", %" PRId64 "\n", class_tag, size);
-        return JVMTI_VISIT_OBJECTS;
-    }
+        void Abort(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            Release(jvmti, jni);
+        }
 
-    jvmtiIterationControl JNICALL HeapObjectCallback(jlong class_tag,
-                                                     jlong size,
-                                                     jlong *tag_ptr,
-                                                     void *user_data) {
-        LOGE("heapObjectCallback: %" PRId64 ", %" PRId64 "\n", class_tag, size);
-        return JVMTI_ITERATION_CONTINUE;
-    }
+    private:
+        void Release(jvmtiEnv *jvmti, JNIEnv *jni) {
+            if (loaded_classes_ == nullptr) {
+                return;
+            }
+            for (jint i = 0; i < class_count_; ++i) {
+                jni->DeleteLocalRef(loaded_classes_[i]);
+            }
+            Deallocate(jvmti, loaded_classes_);
+            loaded_classes_ = nullptr;
+        }
+
+        HeapHistogram histogram_;
+        bool listed_ = false;
+        jint class_count_ = 0;
+        jclass *loaded_classes_ = nullptr;
+        jint next_tag_ = 0;
+    };
+
+    // Writes the heap reference graph (a single JVMTI call), after the
+    // histogram job has tagged the classes
+    class HeapGraphJob : public StartupJob {
+    public:
+        explicit HeapGraphJob(const std::string &path) : StartupJob("heap-graph", 0), path_(path) {}
+
+        bool Step(jvmtiEnv *jvmti, JNIEnv *jni) override {
+            if (g_capabilities.IsEnabled(kFeatureObjectTags)) {
+                HeapGraphCapture capture;
+                capture.Capture(jvmti, path_);
+            }
+            return true;
+        }
+
+    private:
+        const std::string path_;
+    };
 
     void JNICALL StartAgentThreadFunc(jvmtiEnv* jvmti,
                                       JNIEnv* jni,
                                       void* ptr) {
         LOGE("StartAgentThreadFunc running ... ... ... ... ... ...");
+        EventPipeline::Instance().RunDrainLoop(jvmti, jni);
     }
 
     JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM *vm, char *options, void *reserved) {
+        const int64_t attach_start_ns = MonotonicNanos();
         jvmtiEnv *jvmti_env = CreateJvmtiEnv(vm);
         if (jvmti_env == nullptr) {
             return JNI_ERR;
         }
-        SetAllCapabilities(jvmti_env);
         JNIEnv *jni_env = GetThreadLocalJNI(vm);
+        g_config = AgentConfig::Parse(options);
+        const AgentConfig &config = g_config;
+
+        // only ask for the capabilities of the features in use, some of the
+        // others would keep the whole app out of compiled code. Each base
+        // feature is added on its own, a missing one only turns off what
+        // depends on it
+        if (!g_capabilities.Enable(jvmti_env, kFeatureClassHooks)) {
+            LOGE("Class hook capabilities not available, instrumentation disabled.");
+        }
+        if (!g_capabilities.Enable(jvmti_env, kFeatureAllocEvents)) {
+            LOGE("VMObjectAlloc events not available.");
+        }
+        if (!g_capabilities.Enable(jvmti_env, kFeatureObjectTags)) {
+            LOGE("Object tags not available, heap walks disabled.");
+        }
+        uint32_t call_trace_feature = 0;
+        switch (config.call_trace_mode) {
+            case kCallTraceMethodEvents:
+                call_trace_feature = kFeatureMethodEvents;
+                break;
+            case kCallTraceSampling:
+                call_trace_feature = kFeatureSampling;
+                break;
+            case kCallTraceProbes:
+                call_trace_feature = kFeatureExceptionEvents;
+                break;
+            case kCallTraceNone:
+                break;
+        }
+        if (call_trace_feature != 0 && !g_capabilities.Enable(jvmti_env, call_trace_feature)) {
+            LOGE("Call tracing capabilities not available, call tracing disabled.");
+            g_config.call_trace_mode = kCallTraceNone;
+        }
+
+        // Load in pcall.dex.jar which should be in to data/data. The probe
+        // natives must be bound before the first probed class is loaded.
+        std::string agent_lib_path(GetAppDataPath());
+        agent_lib_path.append("pcall.dex.jar");
+        CheckJvmtiError(jvmti_env, jvmti_env->AddToBootstrapClassLoaderSearch(agent_lib_path.c_str()));
+        bool tracer_bound = RegisterTracerNatives(jvmti_env, jni_env);
+        if (config.call_trace_mode == kCallTraceProbes && !tracer_bound) {
+            LOGE("Failed to register the Tracer natives, probes disabled.");
+            g_config.call_trace_mode = kCallTraceNone;
+            g_capabilities.Disable(jvmti_env, kFeatureExceptionEvents);
+        }
+
+        // the rules must be in place before the ClassFileLoadHook is enabled
+        g_rules.SetProbesEnabled(config.call_trace_mode == kCallTraceProbes);
+        g_rules.SetAllocSitesEnabled(tracer_bound);
+        g_rules.SetClinitEnabled(tracer_bound);
+        std::string rule_error;
+        for (const std::string &rule : config.rules) {
+            if (!g_rules.Add(rule, &rule_error)) {
+                LOGE("Invalid rule %s: %s", rule.c_str(), rule_error.c_str());
+            }
+        }
+        if (!config.rules_file.empty()) {
+            g_rules.AddFile(config.rules_file);
+        }
+        if (config.rules.empty() && config.rules_file.empty()) {
+            for (const char *rule : kDefaultRules) {
+                g_rules.Add(rule, &rule_error);
+            }
+        }
+        if (config.call_trace_mode == kCallTraceProbes) {
+            g_rules.Add("probe " + config.probe_filter + "*", &rule_error);
+        }
+        LOGE("%zu instrumentation rules", g_rules.size());
+        if (g_rules.HasAction(kRuleAllocSites)) {
+            AllocationSites::Instance().SetSampleInterval(
+                    static_cast<uint32_t>(config.alloc_sample_interval));
+        }
+        if (config.class_cache_mb > 0) {
+            std::string cache_dir(GetAppDataPath());
+            cache_dir.append("pcall-cache");
+            g_class_cache.Open(cache_dir, g_rules.Fingerprint(),
+                               static_cast<int64_t>(config.class_cache_mb) << 20);
+        }
 
         jvmtiEventCallbacks callbacks;
         memset(&callbacks, 0, sizeof(callbacks));
@@ -245,154 +949,112 @@ namespace profiler {
         callbacks.VMObjectAlloc = OnVMObjectAlloc;
         callbacks.ClassFileLoadHook = OnClassFileLoadHook; // use platform/tools/dexter
         callbacks.ClassPrepare = OnClassPrepare;
+        callbacks.ExceptionCatch = OnExceptionCatch;
+        // enabled by ExceptionHotSpotTask
+        callbacks.Exception = OnException;
+        callbacks.ThreadEnd = OnThreadEnd;
+        callbacks.ObjectFree = OnObjectFree;
+        // enabled at runtime by MonitorContentionTask
+        callbacks.MonitorContendedEnter = OnMonitorContendedEnter;
+        callbacks.MonitorContendedEntered = OnMonitorContendedEntered;
+        callbacks.MonitorWait = OnMonitorWait;
+        callbacks.MonitorWaited = OnMonitorWaited;
+        // enabled by GcTimelineTask
+        callbacks.GarbageCollectionStart = OnGarbageCollectionStart;
+        callbacks.GarbageCollectionFinish = OnGarbageCollectionFinish;
         CheckJvmtiError(jvmti_env, jvmti_env->SetEventCallbacks(&callbacks, sizeof(callbacks)));
         SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_CLASS_LOAD);
-        SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_METHOD_ENTRY);
-        SetEventNotification(jvmti_env, JVMTI_DISABLE, JVMTI_EVENT_METHOD_EXIT); // not need yet
-        SetEventNotification(jvmti_env, JVMTI_DISABLE, JVMTI_EVENT_SINGLE_STEP); // too many
-        SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_VM_OBJECT_ALLOC);
-        SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK);
+        // sampling and probes replace MethodEntry, which forces every call through the interpreter
+        if (config.call_trace_mode == kCallTraceMethodEvents) {
+            SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_METHOD_ENTRY);
+        }
+        // MethodExit (not need yet) and SingleStep (too many) stay off, their
+        // capabilities are never added
+        if (g_capabilities.IsEnabled(kFeatureAllocEvents)) {
+            SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_VM_OBJECT_ALLOC);
+        }
+        if (g_capabilities.IsEnabled(kFeatureClassHooks)) {
+            SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK);
+        }
         SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE);
-
-        // WindowManagerGlobal#getRootView(String)
-        // ActivityThread#mActivities#activity
-        // Application#registerActivityLifecycleCallbacks(ActivityLifecycleCallbacks)
-        ScopedLocalRef<jclass> klass(jni_env, jni_env->FindClass("android/os/HandlerThread"));
-        if (klass.get() == nullptr) {
-            LOGE("Failed to find Thread class.");
-        } else {
-            jmethodID init = jni_env->GetMethodID(klass.get(), "<init>", "(Ljava/lang/String;)V");
-            if (init == nullptr) {
-                LOGE("Failed to find Thread.<init> method.");
-            } else {
-                jthread thread = jni_env->NewObject(klass.get(), init, jni_env->NewStringUTF("PCALL-Th"));
-                if (thread == nullptr) {
-                    LOGE("Failed to create new Thread object.");
-                } else {
-                    jmethodID start = jni_env->GetMethodID(klass.get(), "start", "()V");
-                    if (start == nullptr) {
-                        LOGE("Failed to find Thread.start method.");
-                    } else {
-                        jni_env->CallVoidMethod(thread, start);
-                    }
-                }
-            }
+        if (config.call_trace_mode == kCallTraceProbes) {
+            SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_EXCEPTION_CATCH);
         }
-
-        // run agent thread
-        CheckJvmtiError(jvmti_env, jvmti_env->RunAgentThread(AllocateJavaThread(jvmti_env, jni_env),
-                                                             StartAgentThreadFunc,
-                                                             nullptr,
-                                                             JVMTI_THREAD_NORM_PRIORITY));
-
-        // dump loaded classes
-        std::vector<jclass> classes;
-        jint class_count;
-        jclass *loaded_classes;
-        char *sig_mutf8;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetLoadedClasses(&class_count, &loaded_classes));
-        for (int i = 0; i < class_count; ++i) {
-            CheckJvmtiError(jvmti_env, jvmti_env->GetClassSignature(loaded_classes[i], &sig_mutf8, nullptr));
-            if (sig_mutf8 != nullptr) {
-                LOGE("Loaded class %s\n", sig_mutf8);
-                if (strcmp(sig_mutf8, "Lcom/johnsoft/pcalldemo/SettingsActivity;") == 0
-                        ||strcmp(sig_mutf8, "Lcom/johnsoft/pcalldemo/SettingsActivity$1;") == 0) {
-                    classes.push_back(loaded_classes[i]);
-                }
-                Deallocate(jvmti_env, (unsigned char *) sig_mutf8);
-            }
+        SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_THREAD_END);
+        if (g_capabilities.IsEnabled(kFeatureObjectTags)) {
+            SetEventNotification(jvmti_env, JVMTI_ENABLE, JVMTI_EVENT_OBJECT_FREE);
         }
 
-        // instrumentation
-        if (classes.size() > 0) {
-            CheckJvmtiError(jvmti_env, jvmti_env->RetransformClasses(classes.size(), &classes[0]));
+        // stream events to a trace file next to the agent (app data dir)
+        std::string trace_path(GetAppDataPath());
+        trace_path.append("pcall-").append(std::to_string(getpid())).append(".trace");
+        EventPipeline::Instance().OpenTrace(trace_path);
+        if (config.call_trace_mode == kCallTraceSampling) {
+            EventPipeline::Instance().AddPeriodicTask(
+                    std::unique_ptr<PeriodicTask>(new SamplingProfiler(config)));
         }
 
-        jvmti_env->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE,
-                                            nullptr);
-
-        for (int i = 0; i < class_count; ++i) {
-            jni_env->DeleteLocalRef(loaded_classes[i]);
+        EventPipeline::Instance().AddPeriodicTask(
+                std::unique_ptr<PeriodicTask>(new ClassImageCacheTask(&g_class_cache)));
+        if (g_rules.HasAction(kRuleAllocSites)) {
+            EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                    new AllocationSiteTask(config.sample_report_ms * 1000000LL)));
         }
-        Deallocate(jvmti_env, reinterpret_cast<unsigned char *>(loaded_classes));
-
-        // dump all threads
-        jint thread_count;
-        jthread *all_threads;
-        jvmtiThreadInfo thread_info;
-        CheckJvmtiError(jvmti_env, jvmti_env->GetAllThreads(&thread_count, &all_threads));
-        for (int i = 0; i < thread_count; ++i) {
-            CheckJvmtiError(jvmti_env, jvmti_env->GetThreadInfo(all_threads[i], &thread_info));
-            LOGE("Found thread %s\n", thread_info.name);
-            Deallocate(jvmti_env, (unsigned char *) thread_info.name);
+        EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                new MonitorContentionTask(&g_capabilities, GetAppDataPath(), config.monitors != 0,
+                                          config.sample_report_ms * 1000000LL)));
+        if (config.gc) {
+            // created before the events can fire
+            GcEvents::Instance();
+            EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                    new GcTimelineTask(&g_capabilities, config.sample_report_ms * 1000000LL)));
         }
-
-        for (int i = 0; i < thread_count; ++i) {
-            jni_env->DeleteLocalRef(all_threads[i]);
+        if (config.thread_cpu_ms > 0) {
+            EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                    new ThreadCpuSampler(&g_capabilities, config.thread_cpu_ms * 1000000LL)));
+        }
+        if (config.exceptions) {
+            // created before the events can fire
+            ExceptionHotSpots::Instance().SetStackInterval(
+                    static_cast<uint32_t>(config.exception_stack_interval));
+            EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                    new ExceptionHotSpotTask(&g_capabilities, config.sample_report_ms * 1000000LL)));
+        }
+        if (g_capabilities.IsEnabled(kFeatureClassHooks) && !g_rules.empty()) {
+            EventPipeline::Instance().AddPeriodicTask(std::unique_ptr<PeriodicTask>(
+                    new ClassTimelineTask(config.sample_report_ms * 1000000LL)));
+        }
+        if (config.snapshot && g_capabilities.IsEnabled(kFeatureObjectTags)) {
+            EventPipeline::Instance().AddPeriodicTask(
+                    std::unique_ptr<PeriodicTask>(new HeapSnapshotTask(GetAppDataPath())));
         }
-        Deallocate(jvmti_env, reinterpret_cast<unsigned char *>(all_threads));
-
-        // dump heap objects
-
-        ScopedLocalRef<jclass> activity_lass(jni_env, jni_env->FindClass("android/app/Activity"));
-        if (activity_lass.get() == nullptr) {
-            LOGE("Failed to find Activity class.");
-        } else {
-            // JVMTI error: 98(JVMTI_ERROR_NOT_AVAILABLE)
-            /* CheckJvmtiError(jvmti_env,
-                            jvmti_env->IterateOverInstancesOfClass(activity_lass.get(),
-                                                                   JVMTI_HEAP_OBJECT_EITHER,
-                                                                   heapObjectCallback,
-                                                                   nullptr)); */
-
-            jvmtiHeapCallbacks heap_callbacks;
-            memset(&heap_callbacks, 0, sizeof(heap_callbacks));
-            heap_callbacks.heap_iteration_callback = HeapIterationCallback;
-            // JVMTI error: 98(JVMTI_ERROR_NOT_AVAILABLE)
-            /* CheckJvmtiError(jvmti_env,
-                            jvmti_env->IterateThroughHeap(0, activity_lass.get(), &heap_callbacks, nullptr)); */
-
-
-            // Locate heap extension functions
-            jvmtiExtensionFunctionInfo* func_info;
-            jint func_count = 0;
-            CheckJvmtiError(jvmti_env, jvmti_env->GetExtensionFunctions(&func_count, &func_info));
 
-            // Go through all extension functions as we need to deallocate
-            for (int i = 0; i < func_count; i++) {
-                if (strcmp("com.android.art.heap.iterate_through_heap_ext", func_info[i].id) == 0) {
-                    g_iterate_heap_ext_func =
-                            reinterpret_cast<IterateThroughHeapExt>(func_info[i].func);
-                }
-                Deallocate(jvmti_env, func_info[i].id);
-                Deallocate(jvmti_env, func_info[i].short_description);
-                for (int j = 0; j < func_info[i].param_count; j++) {
-                    Deallocate(jvmti_env, func_info[i].params[j].name);
-                }
-                Deallocate(jvmti_env, func_info[i].params);
-                Deallocate(jvmti_env, func_info[i].errors);
+        // the expensive stages run on the agent thread, attach returns right away
+        std::unique_ptr<StartupJobs> startup(new StartupJobs(GetAppDataPath()));
+        if (g_capabilities.IsEnabled(kFeatureClassHooks)) {
+            startup->Add(std::unique_ptr<StartupJob>(new RetransformLoadedClassesJob()));
+            if (config.pretransform && !g_rules.empty()) {
+                startup->Add(std::unique_ptr<StartupJob>(new PretransformJob()));
             }
-            Deallocate(jvmti_env, func_info);
-            assert(g_iterate_heap_ext_func != nullptr);
-            g_iterate_heap_ext_func(jvmti_env, 0, nullptr/* activity_lass.get() */, &heap_callbacks, nullptr);
         }
+        startup->Add(std::unique_ptr<StartupJob>(new HandlerThreadJob()));
+        startup->Add(std::unique_ptr<StartupJob>(new FinderInitJob()));
+        startup->Add(std::unique_ptr<StartupJob>(new ThreadDumpJob()));
+        startup->Add(std::unique_ptr<StartupJob>(new HeapHistogramJob()));
+        if (config.heap_graph) {
+            std::string graph_path(GetAppDataPath());
+            graph_path.append("pcall-").append(std::to_string(getpid())).append(".heapgraph");
+            startup->Add(std::unique_ptr<StartupJob>(new HeapGraphJob(graph_path)));
+        }
+        EventPipeline::Instance().AddPeriodicTask(std::move(startup));
 
-        // Load in pcall.dex.jar which should be in to data/data.
-        std::string agent_lib_path(GetAppDataPath());
-        agent_lib_path.append("pcall.dex.jar");
+        // run agent thread
+        CheckJvmtiError(jvmti_env, jvmti_env->RunAgentThread(AllocateJavaThread(jvmti_env, jni_env),
+                                                             StartAgentThreadFunc,
+                                                             nullptr,
+                                                             JVMTI_THREAD_NORM_PRIORITY));
 
-        CheckJvmtiError(jvmti_env, jvmti_env->AddToBootstrapClassLoaderSearch(agent_lib_path.c_str()));
-        ScopedLocalRef<jclass> finder_class(jni_env, jni_env->FindClass("com/johnsoft/pcalla/Finder"));
-        if (finder_class.get() == nullptr) {
-            LOGE("Failed to find Finder class.");
-        } else {
-            jmethodID finder_init = jni_env->GetStaticMethodID(finder_class.get(), "init", "()V");
-            if (finder_init == nullptr) {
-                LOGE("Failed to find Finder.init method.");
-            } else {
-                jni_env->CallStaticVoidMethod(finder_class.get(), finder_init);
-            }
-        }
+        LOGE("Agent_OnAttach returned in %.2f ms", (MonotonicNanos() - attach_start_ns) / 1e6);
 
         /*
          * NOTE:
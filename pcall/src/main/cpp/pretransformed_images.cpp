@@ -0,0 +1,56 @@
+#include "pretransformed_images.h"
+
+#include <string.h>
+
+namespace profiler {
+
+    bool PretransformedImages::Add(const std::string &descriptor, const dex::Header *dex_header,
+                                   std::vector<dex::u1> image) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (total_bytes_ + image.size() > budget_bytes_) {
+            return false;
+        }
+        Entry &entry = images_[descriptor];
+        total_bytes_ += image.size() - entry.image.size();
+        memcpy(entry.dex_signature, dex_header->signature, sizeof(entry.dex_signature));
+        entry.image = std::move(image);
+        return true;
+    }
+
+    bool PretransformedImages::Contains(const std::string &descriptor) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return images_.count(descriptor) != 0;
+    }
+
+    bool PretransformedImages::Take(const char *name, const unsigned char *class_data,
+                                    jint class_data_len, dex::Writer::Allocator *allocator,
+                                    unsigned char **image, jint *image_len) {
+        if (class_data_len < static_cast<jint>(sizeof(dex::Header))) {
+            return false;
+        }
+        const dex::Header *header = reinterpret_cast<const dex::Header *>(class_data);
+        std::string descriptor = "L" + std::string(name) + ";";
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = images_.find(descriptor);
+        if (it == images_.end()) {
+            return false;
+        }
+        Entry &entry = it->second;
+        bool taken = false;
+        if (memcmp(entry.dex_signature, header->signature, sizeof(entry.dex_signature)) == 0) {
+            void *copy = allocator->Allocate(entry.image.size());
+            if (copy != nullptr) {
+                memcpy(copy, entry.image.data(), entry.image.size());
+                *image = static_cast<unsigned char *>(copy);
+                *image_len = static_cast<jint>(entry.image.size());
+                taken = true;
+            }
+        }
+        // a mismatch means another version of the class, the image is useless too
+        total_bytes_ -= entry.image.size();
+        images_.erase(it);
+        return taken;
+    }
+
+}  // namespace profiler
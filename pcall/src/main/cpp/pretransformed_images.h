@@ -0,0 +1,62 @@
+#ifndef PRETRANSFORMED_IMAGES_H
+#define PRETRANSFORMED_IMAGES_H
+
+#include "jvmti.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "slicer/dex_format.h"
+#include "slicer/writer.h"
+
+namespace profiler {
+
+    /**
+     * Class images transformed ahead of time by the agent thread, from the
+     * dex files of the APK, waiting for the ClassFileLoadHook of their
+     * class.
+     *
+     * An image is only handed out if the class data of the hook comes from
+     * the same dex file (same header signature) as the image, and only
+     * once: later loads and retransformations go through the regular path.
+     */
+    class PretransformedImages {
+    public:
+        explicit PretransformedImages(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+        /**
+         * Adds the image of the class |descriptor| built from the dex file
+         * with the header |dex_header|. Returns false, and drops the image,
+         * once the budget is used up.
+         */
+        bool Add(const std::string &descriptor, const dex::Header *dex_header,
+                 std::vector<dex::u1> image);
+
+        bool Contains(const std::string &descriptor) const;
+
+        /**
+         * Takes the image of the class with the internal |name| if there is
+         * one matching |class_data|, copied to memory from |allocator|.
+         */
+        bool Take(const char *name, const unsigned char *class_data, jint class_data_len,
+                  dex::Writer::Allocator *allocator, unsigned char **image, jint *image_len);
+
+    private:
+        struct Entry {
+            dex::u1 dex_signature[dex::kSHA1DigestLen];
+            std::vector<dex::u1> image;
+        };
+
+        const size_t budget_bytes_;
+        mutable std::mutex mutex_;
+        std::unordered_map<std::string, Entry> images_;
+        size_t total_bytes_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // PRETRANSFORMED_IMAGES_H
@@ -0,0 +1,102 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace profiler {
+
+    /**
+     * A bounded, lock-free, single-producer / single-consumer ring buffer of
+     * trivially copyable records.
+     *
+     * The producer never blocks: when the buffer is full the record is dropped
+     * and counted, so a slow consumer can never stall an application thread.
+     * Capacity is rounded up to a power of two.
+     */
+    template<typename T>
+    class SpscRingBuffer {
+    public:
+        explicit SpscRingBuffer(size_t capacity)
+                : capacity_(RoundUpToPowerOfTwo(capacity)),
+                  mask_(capacity_ - 1),
+                  slots_(new T[capacity_]) {}
+
+        SpscRingBuffer(const SpscRingBuffer &) = delete;
+
+        SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+        /**
+         * Producer side. Returns false (and counts a drop) if the buffer is full.
+         */
+        bool Push(const T &record) {
+            const uint64_t head = head_.load(std::memory_order_relaxed);
+            if (head - cached_tail_ >= capacity_) {
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                if (head - cached_tail_ >= capacity_) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            slots_[head & mask_] = record;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Consumer side. Copies up to |max_count| records into |out| and
+         * returns the number of records copied.
+         */
+        size_t Pop(T *out, size_t max_count) {
+            const uint64_t tail = tail_.load(std::memory_order_relaxed);
+            const uint64_t head = head_.load(std::memory_order_acquire);
+            size_t count = static_cast<size_t>(head - tail);
+            if (count > max_count) {
+                count = max_count;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = slots_[(tail + i) & mask_];
+            }
+            tail_.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        bool Empty() const {
+            return head_.load(std::memory_order_acquire) ==
+                   tail_.load(std::memory_order_acquire);
+        }
+
+        size_t Capacity() const { return capacity_; }
+
+        uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        static size_t RoundUpToPowerOfTwo(size_t value) {
+            size_t result = 1;
+            while (result < value) {
+                result <<= 1;
+            }
+            return result;
+        }
+
+        const size_t capacity_;
+        const size_t mask_;
+        std::unique_ptr<T[]> slots_;
+
+        // padding keeps the producer and consumer indexes on separate cache
+        // lines (plain padding rather than alignas, which needs aligned new)
+        static const size_t kCacheLineSize = 64;
+        char pad0_[kCacheLineSize];
+        std::atomic<uint64_t> head_{0};
+        uint64_t cached_tail_ = 0;
+        std::atomic<uint64_t> dropped_{0};
+        char pad1_[kCacheLineSize];
+        std::atomic<uint64_t> tail_{0};
+        char pad2_[kCacheLineSize];
+    };
+
+}  // namespace profiler
+
+#endif  // RING_BUFFER_H
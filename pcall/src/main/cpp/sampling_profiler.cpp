@@ -0,0 +1,176 @@
+#include "sampling_profiler.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+#include "symbol_cache.h"
+
+#include <inttypes.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // upper bound of the trie, stacks beyond it are cut at the last known node
+    static const size_t kMaxNodes = 1 << 20;
+    // the back off never goes beyond one sample per second
+    static const int64_t kMaxPeriodNs = 1000000000LL;
+    // methods listed per report when there is no trace file
+    static const size_t kLoggedMethods = 10;
+
+    SamplingProfiler::SamplingProfiler(const AgentConfig &config)
+            : period_ns_(config.sample_period_ms * 1000000LL),
+              max_depth_(config.sample_max_depth),
+              budget_percent_(config.sample_budget_percent),
+              report_interval_ns_(config.sample_report_ms * 1000000LL),
+              current_period_ns_(period_ns_) {
+        Node root = {0, 0, 0};
+        nodes_.push_back(root);
+    }
+
+    int64_t SamplingProfiler::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        int64_t start = MonotonicNanos();
+        Sample(jvmti, jni);
+        int64_t end = MonotonicNanos();
+        int64_t cost = end - start;
+        total_sample_ns_ += cost;
+
+        // keep the sampling cost under budget_percent_ of the period
+        int64_t min_period = cost * 100 / budget_percent_;
+        if (min_period > current_period_ns_) {
+            current_period_ns_ = std::min(min_period, kMaxPeriodNs);
+        } else if (current_period_ns_ > period_ns_) {
+            current_period_ns_ = std::max(std::max(min_period, period_ns_),
+                                          current_period_ns_ * 3 / 4);
+        }
+
+        if (end >= next_report_ns_) {
+            if (next_report_ns_ != 0) {
+                Report();
+            }
+            next_report_ns_ = end + report_interval_ns_;
+        }
+        return current_period_ns_;
+    }
+
+    void SamplingProfiler::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        Report();
+    }
+
+    uint32_t SamplingProfiler::Child(uint32_t parent, uint32_t method_id) {
+        uint64_t key = (static_cast<uint64_t>(parent) << 32) | method_id;
+        auto it = children_.find(key);
+        if (it != children_.end()) {
+            return it->second;
+        }
+        if (nodes_.size() >= kMaxNodes) {
+            return parent;
+        }
+        uint32_t index = static_cast<uint32_t>(nodes_.size());
+        Node node = {parent, method_id, 0};
+        nodes_.push_back(node);
+        children_.emplace(key, index);
+        return index;
+    }
+
+    void SamplingProfiler::Sample(jvmtiEnv *jvmti, JNIEnv *jni) {
+        jint thread_count = 0;
+        jthread *threads = nullptr;
+        if (CheckJvmtiError(jvmti, jvmti->GetAllThreads(&thread_count, &threads))) {
+            return;
+        }
+
+        jvmtiStackInfo *stacks = nullptr;
+        if (!CheckJvmtiError(jvmti, jvmti->GetThreadListStackTraces(thread_count, threads,
+                                                                    max_depth_, &stacks))) {
+            EventPipeline &pipeline = EventPipeline::Instance();
+            bool tracing = pipeline.Trace() != nullptr;
+            SymbolCache &symbols = SymbolCache::Instance();
+            for (jint i = 0; i < thread_count; ++i) {
+                const jvmtiStackInfo &stack = stacks[i];
+                // CPU profile: threads blocked or waiting are not sampled
+                if ((stack.state & JVMTI_THREAD_STATE_RUNNABLE) == 0 || stack.frame_count == 0) {
+                    continue;
+                }
+                // frame 0 is the innermost call
+                uint32_t node = 0;
+                const MethodSymbol *leaf = nullptr;
+                for (jint depth = stack.frame_count - 1; depth >= 0; --depth) {
+                    const MethodSymbol *method = symbols.LookupMethod(
+                            jvmti, jni, stack.frame_buffer[depth].method);
+                    if (method == nullptr) {
+                        continue;
+                    }
+                    if (tracing) {
+                        pipeline.TraceMethod(*method);
+                    }
+                    node = Child(node, method->id);
+                    leaf = method;
+                }
+                if (node == 0) {
+                    continue;
+                }
+                if (nodes_[node].pending++ == 0) {
+                    dirty_nodes_.push_back(node);
+                }
+                ++total_samples_;
+                if (!tracing) {
+                    MethodSamples &samples = self_samples_[leaf->id];
+                    if (samples.count++ == 0) {
+                        const ClassSymbol *klass = symbols.FindClass(leaf->class_id);
+                        samples.name = (klass != nullptr ? klass->signature : "<unknown>") +
+                                       "->" + leaf->name + leaf->signature;
+                    }
+                }
+            }
+            // a single allocation holds the infos and their frame buffers
+            Deallocate(jvmti, stacks);
+        }
+
+        for (jint i = 0; i < thread_count; ++i) {
+            jni->DeleteLocalRef(threads[i]);
+        }
+        Deallocate(jvmti, threads);
+    }
+
+    void SamplingProfiler::Report() {
+        TraceWriter *trace = EventPipeline::Instance().Trace();
+        if (trace != nullptr) {
+            for (size_t i = reported_nodes_; i < nodes_.size(); ++i) {
+                trace->DefineStackNode(static_cast<uint32_t>(i), nodes_[i].parent,
+                                       nodes_[i].method_id);
+            }
+            reported_nodes_ = nodes_.size();
+
+            std::vector<std::pair<uint32_t, uint32_t>> counts;
+            counts.reserve(dirty_nodes_.size());
+            for (uint32_t node : dirty_nodes_) {
+                counts.push_back(std::make_pair(node, nodes_[node].pending));
+            }
+            if (!counts.empty()) {
+                trace->AddStackSamples(MonotonicNanos(), counts);
+            }
+        } else {
+            std::vector<std::pair<uint64_t, const std::string *>> top;
+            for (const auto &entry : self_samples_) {
+                top.push_back(std::make_pair(entry.second.count, &entry.second.name));
+            }
+            size_t count = std::min(top.size(), kLoggedMethods);
+            std::partial_sort(top.begin(), top.begin() + count, top.end(),
+                              [](const std::pair<uint64_t, const std::string *> &a,
+                                 const std::pair<uint64_t, const std::string *> &b) {
+                                  return a.first > b.first;
+                              });
+            LOGE("SamplingProfiler: %" PRIu64 " samples, %zu stacks, period %" PRId64 " us, "
+                 "%" PRIu64 " us spent sampling",
+                 total_samples_, nodes_.size() - 1, current_period_ns_ / 1000,
+                 total_sample_ns_ / 1000);
+            for (size_t i = 0; i < count; ++i) {
+                LOGE("SamplingProfiler: %8" PRIu64 " %s", top[i].first, top[i].second->c_str());
+            }
+        }
+
+        for (uint32_t node : dirty_nodes_) {
+            nodes_[node].pending = 0;
+        }
+        dirty_nodes_.clear();
+    }
+
+}  // namespace profiler
@@ -0,0 +1,75 @@
+#ifndef SAMPLING_PROFILER_H
+#define SAMPLING_PROFILER_H
+
+#include "agent_config.h"
+#include "event_pipeline.h"
+#include "jvmti.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Call profiler that samples the Java stacks of the runnable threads from
+     * the agent thread, instead of observing every call through MethodEntry.
+     *
+     * Stacks are deduplicated into a trie of method symbol ids and only the
+     * number of samples per leaf is kept, so memory grows with the number of
+     * distinct stacks and the cost of a sample with the number of threads and
+     * the stack depth, never with the call rate. The sampling period backs off
+     * when a sample takes more than the configured share of the period.
+     */
+    class SamplingProfiler : public PeriodicTask {
+    public:
+        explicit SamplingProfiler(const AgentConfig &config);
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct Node {
+            uint32_t parent;
+            uint32_t method_id;
+            // samples with this node as the leaf, since the last report
+            uint32_t pending;
+        };
+
+        void Sample(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Report();
+
+        uint32_t Child(uint32_t parent, uint32_t method_id);
+
+        const int64_t period_ns_;
+        const int32_t max_depth_;
+        const int32_t budget_percent_;
+        const int64_t report_interval_ns_;
+
+        int64_t current_period_ns_;
+        int64_t next_report_ns_ = 0;
+        uint64_t total_samples_ = 0;
+        uint64_t total_sample_ns_ = 0;
+
+        // nodes_[0] is the root
+        std::vector<Node> nodes_;
+        // (parent << 32 | method id) -> node
+        std::unordered_map<uint64_t, uint32_t> children_;
+        // nodes_[reported_nodes_..] haven't been written to the trace yet
+        size_t reported_nodes_ = 1;
+        std::vector<uint32_t> dirty_nodes_;
+        // self samples per method id, only kept when there is no trace file
+        struct MethodSamples {
+            uint64_t count = 0;
+            std::string name;
+        };
+        std::unordered_map<uint32_t, MethodSamples> self_samples_;
+    };
+
+}  // namespace profiler
+
+#endif  // SAMPLING_PROFILER_H
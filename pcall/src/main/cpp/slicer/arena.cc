@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "arena.h"
+
+#include <algorithm>
+
+namespace slicer {
+
+// Blocks released by the arenas of the current thread, up to
+// kMaxCachedBytes. Plain data, so that it can still be used (as a no-op)
+// by arenas destroyed after the thread's cache was emptied on exit.
+struct BlockCache {
+  static constexpr int kMaxBlocks = 8;
+  static constexpr size_t kMaxCachedBytes = 2 * 1024 * 1024;
+
+  uint8_t* memory[kMaxBlocks];
+  size_t size[kMaxBlocks];
+  int count;
+  size_t cached_bytes;
+  bool closed;
+};
+
+static thread_local BlockCache block_cache;
+
+// Frees the cached blocks on thread exit
+struct BlockCacheCleaner {
+  ~BlockCacheCleaner() {
+    for (int i = 0; i < block_cache.count; ++i) {
+      ::free(block_cache.memory[i]);
+    }
+    block_cache.count = 0;
+    block_cache.cached_bytes = 0;
+    block_cache.closed = true;
+  }
+};
+
+static thread_local BlockCacheCleaner block_cache_cleaner;
+
+void Arena::Reset() {
+  if (blocks_.empty()) {
+    return;
+  }
+  auto largest = std::max_element(blocks_.begin(), blocks_.end(),
+      [](const Block& a, const Block& b) { return a.size < b.size; });
+  Block kept = *largest;
+  for (const Block& block : blocks_) {
+    if (block.memory != kept.memory) {
+      ReleaseBlock(block.memory, block.size);
+    }
+  }
+  blocks_.clear();
+  blocks_.push_back(kept);
+  ptr_ = kept.memory;
+  end_ = kept.memory + kept.size;
+}
+
+void Arena::NewBlock(size_t min_size) {
+  size_t block_size = next_block_size_;
+  while (block_size < min_size) {
+    block_size *= 2;
+  }
+  if (next_block_size_ < kMaxBlockSize) {
+    next_block_size_ *= 2;
+  }
+  auto block = TakeBlock(block_size, &block_size);
+  if (block == nullptr) {
+    block = static_cast<uint8_t*>(::malloc(block_size));
+    CHECK(block != nullptr);
+  }
+  blocks_.push_back({ block, block_size });
+  ptr_ = block;
+  end_ = block + block_size;
+}
+
+// Returns the smallest cached block of at least min_size bytes
+uint8_t* Arena::TakeBlock(size_t min_size, size_t* size) {
+  BlockCache& cache = block_cache;
+  int best = -1;
+  for (int i = 0; i < cache.count; ++i) {
+    if (cache.size[i] >= min_size && (best < 0 || cache.size[i] < cache.size[best])) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return nullptr;
+  }
+  uint8_t* memory = cache.memory[best];
+  *size = cache.size[best];
+  cache.cached_bytes -= cache.size[best];
+  --cache.count;
+  cache.memory[best] = cache.memory[cache.count];
+  cache.size[best] = cache.size[cache.count];
+  return memory;
+}
+
+void Arena::ReleaseBlock(uint8_t* memory, size_t size) {
+  BlockCache& cache = block_cache;
+  if (cache.closed || cache.count == BlockCache::kMaxBlocks ||
+      cache.cached_bytes + size > BlockCache::kMaxCachedBytes) {
+    ::free(memory);
+    return;
+  }
+  // odr-use of the cleaner, which registers its destructor for this thread
+  (void)&block_cache_cleaner;
+  cache.memory[cache.count] = memory;
+  cache.size[cache.count] = size;
+  ++cache.count;
+  cache.cached_bytes += size;
+}
+
+}  // namespace slicer
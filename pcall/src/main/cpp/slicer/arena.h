@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+namespace slicer {
+
+// A bump pointer allocator: allocations are carved out of large blocks
+// and the memory is only released, all at once, when the arena is
+// destroyed or reset (the callers are responsible for running any
+// destructors)
+//
+// The block sizes start small, so short lived arenas (ex. a single
+// method's code IR) stay cheap, and double up to kMaxBlockSize.
+//
+// Released blocks go to a small per-thread cache which the next arenas
+// created on the same thread draw from, so transforming one class after
+// another doesn't go back to malloc for every code IR.
+//
+class Arena {
+ public:
+  explicit Arena(size_t initial_block_size = 4 * 1024)
+      : next_block_size_(initial_block_size) {}
+
+  ~Arena() {
+    for (const Block& block : blocks_) {
+      ReleaseBlock(block.memory, block.size);
+    }
+  }
+
+  // No copy/move semantics
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t size, size_t alignment) {
+    CHECK(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    uintptr_t p = (reinterpret_cast<uintptr_t>(ptr_) + alignment - 1) & ~(alignment - 1);
+    if (ptr_ == nullptr || p + size > reinterpret_cast<uintptr_t>(end_)) {
+      NewBlock(size + alignment);
+      p = (reinterpret_cast<uintptr_t>(ptr_) + alignment - 1) & ~(alignment - 1);
+    }
+    ptr_ = reinterpret_cast<uint8_t*>(p + size);
+    return reinterpret_cast<void*>(p);
+  }
+
+  // Makes all the memory available again, keeping only the largest block
+  // (all the objects allocated from the arena must be destroyed first)
+  void Reset();
+
+  // The total size of the blocks currently held
+  size_t Capacity() const {
+    size_t capacity = 0;
+    for (const Block& block : blocks_) {
+      capacity += block.size;
+    }
+    return capacity;
+  }
+
+ private:
+  static constexpr size_t kMaxBlockSize = 1024 * 1024;
+
+  struct Block {
+    uint8_t* memory;
+    size_t size;
+  };
+
+  void NewBlock(size_t min_size);
+
+  // The per-thread block cache (see arena.cc)
+  static uint8_t* TakeBlock(size_t min_size, size_t* size);
+  static void ReleaseBlock(uint8_t* memory, size_t size);
+
+ private:
+  std::vector<Block> blocks_;
+  uint8_t* ptr_ = nullptr;
+  uint8_t* end_ = nullptr;
+  size_t next_block_size_;
+};
+
+}  // namespace slicer
@@ -37,8 +37,15 @@
 
 namespace lir {
 
+// The nodes are allocated from their CodeIr's arena, so owning
+// a node only means running its destructor
 template <class T>
-using own = std::unique_ptr<T>;
+struct NodeDestroyer {
+  void operator()(T* p) const { p->~T(); }
+};
+
+template <class T>
+using own = std::unique_ptr<T, NodeDestroyer<T>>;
 
 constexpr dex::u4 kInvalidOffset = dex::u4(-1);
 
@@ -362,8 +369,8 @@ struct CodeIr {
 
   template <class T, class... Args>
   T* Alloc(Args&&... args) {
-    auto p = new T(std::forward<Args>(args)...);
-    nodes_.push_back(own<T>(p));
+    auto p = new (arena_.Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    nodes_.push_back(own<Node>(p));
     return p;
   }
 
@@ -393,6 +400,10 @@ struct CodeIr {
   Operand* GetRegC(const dex::Instruction& dex_instr);
 
  private:
+  // backing memory for the LIR nodes (declared before nodes_,
+  // so it's released after the node destructors ran)
+  slicer::Arena arena_;
+
   // the "master index" of all the LIR owned nodes
   std::vector<own<Node>> nodes_;
 
@@ -111,9 +111,16 @@ std::string Proto::Signature() const {
 
 // Helper for IR normalization
 // (it sorts items and update the numeric idexes to match)
+//
+// NOTE: the items are usually already sorted (the IR was read from
+//  a valid .dex image and new items, if any, are few) so checking
+//  first is cheaper than an unconditional sort
+//
 template <class T, class C>
 static void IndexItems(std::vector<T>& items, C comp) {
-  std::sort(items.begin(), items.end(), comp);
+  if (!std::is_sorted(items.begin(), items.end(), comp)) {
+    std::sort(items.begin(), items.end(), comp);
+  }
   for (size_t i = 0; i < items.size(); ++i) {
     items[i]->index = i;
   }
@@ -315,5 +322,59 @@ void DexFile::Normalize() {
   }
 }
 
+// Helper for DexFile::Reset()
+// (the maps are sized by the whole source .dex, which can be much larger
+// than the IR, so only the entries of the existing nodes are cleared)
+template <class T>
+static void ClearIndexedNodes(std::vector<own<T>>* nodes, DenseIndexMap<T>* map) {
+  for (const auto& node : *nodes) {
+    map->Erase(node->orig_index);
+  }
+  nodes->clear();
+}
+
+void DexFile::Reset() {
+  ClearIndexedNodes(&strings, &strings_map);
+  ClearIndexedNodes(&types, &types_map);
+  ClearIndexedNodes(&protos, &protos_map);
+  ClearIndexedNodes(&fields, &fields_map);
+  ClearIndexedNodes(&methods, &methods_map);
+  ClearIndexedNodes(&classes, &classes_map);
+
+  encoded_fields.clear();
+  encoded_methods.clear();
+  type_lists.clear();
+  code.clear();
+  debug_info.clear();
+  encoded_values.clear();
+  encoded_arrays.clear();
+  annotations.clear();
+  annotation_elements.clear();
+  annotation_sets.clear();
+  annotation_set_ref_lists.clear();
+  annotations_directories.clear();
+  field_annotations.clear();
+  method_annotations.clear();
+  param_annotations.clear();
+
+  magic = slicer::MemView();
+
+  strings_indexes.Clear();
+  types_indexes.Clear();
+  protos_indexes.Clear();
+  fields_indexes.Clear();
+  methods_indexes.Clear();
+  classes_indexes.Clear();
+
+  strings_lookup.Clear();
+  methods_lookup.Clear();
+  prototypes_lookup.Clear();
+
+  buffers_.clear();
+
+  // the nodes are all destroyed, the arena memory can be reused
+  arena_.Reset();
+}
+
 } // namespace ir
 
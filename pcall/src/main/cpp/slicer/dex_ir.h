@@ -17,6 +17,7 @@
 #pragma once
 
 #include "common.h"
+#include "arena.h"
 #include "memview.h"
 #include "arrayview.h"
 #include "dex_format.h"
@@ -26,7 +27,6 @@
 #include "hash_table.h"
 
 #include <stdlib.h>
-#include <map>
 #include <memory>
 #include <vector>
 #include <string>
@@ -50,9 +50,16 @@
 
 namespace ir {
 
+// The nodes are allocated from their DexFile's arena, so owning
+// a node only means running its destructor
+template <class T>
+struct NodeDestroyer {
+  void operator()(T* p) const { p->~T(); }
+};
+
 // convenience notation
 template <class T>
-using own = std::unique_ptr<T>;
+using own = std::unique_ptr<T, NodeDestroyer<T>>;
 
 struct Node;
 struct IndexedNode;
@@ -84,21 +91,12 @@ struct DexFile;
 //   a way to constrain the allocation and ownership
 //   of .dex IR nodes.
 struct Node {
-  void* operator new(size_t size) {
-    return ::calloc(1, size);
-  }
-
-  void* operator new[](size_t size) {
-    return ::calloc(1, size);
-  }
-
-  void operator delete(void* ptr) {
-    ::free(ptr);
-  }
+  // nodes can only be created through DexFile::Alloc()
+  void* operator new(size_t size) = delete;
+  void* operator new[](size_t size) = delete;
 
-  void operator delete[](void* ptr) {
-    ::free(ptr);
-  }
+  void* operator new(size_t size, void* place) { return place; }
+  void operator delete(void* ptr, void* place) {}
 
  public:
   Node(const Node&) = delete;
@@ -358,6 +356,12 @@ using MethodsLookup = slicer::HashTable<const MethodKey&, EncodedMethod, Methods
 
 // The main container/root for a .dex IR
 struct DexFile {
+ private:
+  // backing memory for all the nodes (declared first,
+  // so it's released after the node destructors ran)
+  slicer::Arena arena_{64 * 1024};
+
+ public:
   // indexed structures
   std::vector<own<String>> strings;
   std::vector<own<Type>> types;
@@ -388,12 +392,12 @@ struct DexFile {
   // CONSIDER: we only need to carry around
   //   the relocation for the referenced items
   //
-  std::map<dex::u4, Type*> types_map;
-  std::map<dex::u4, String*> strings_map;
-  std::map<dex::u4, Proto*> protos_map;
-  std::map<dex::u4, FieldDecl*> fields_map;
-  std::map<dex::u4, MethodDecl*> methods_map;
-  std::map<dex::u4, Class*> classes_map;
+  DenseIndexMap<Type> types_map;
+  DenseIndexMap<String> strings_map;
+  DenseIndexMap<Proto> protos_map;
+  DenseIndexMap<FieldDecl> fields_map;
+  DenseIndexMap<MethodDecl> methods_map;
+  DenseIndexMap<Class> classes_map;
 
   // original .dex header "magic" signature
   slicer::MemView magic;
@@ -421,7 +425,7 @@ struct DexFile {
 
   template <class T>
   T* Alloc() {
-    T* p = new T();
+    T* p = new (arena_.Allocate(sizeof(T), alignof(T))) T();
     Track(p);
     return p;
   }
@@ -432,6 +436,14 @@ struct DexFile {
 
   void Normalize();
 
+  // Destroys all the nodes and empties the tables, but keeps their memory
+  // (arena blocks, vectors, index maps) so that a Reader can build the
+  // next IR in it without allocating everything again
+  void Reset();
+
+  // The memory held by the node arena
+  size_t ArenaCapacity() const { return arena_.Capacity(); }
+
  private:
   void TopSortClassIndex(Class* irClass, dex::u4* nextIndex);
   void SortClassIndexes();
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace slicer {
+
+// A Key -> T map for integer or pointer keys, implemented as an open
+// addressing hash table with linear probing over a single flat array
+// (no per-entry allocations, unlike std::map / std::unordered_map)
+//
+// NOTES:
+// - the default value of Key (zero / nullptr) marks the empty slots,
+//   so it can't be used as a key
+// - there's no erase, and references returned by operator[] are only
+//   valid until the next insertion
+//
+template <class Key, class T>
+class FlatMap {
+ public:
+  explicit FlatMap(size_t expected_size = 0) { Reserve(expected_size); }
+
+  // Make room for at least count entries without rehashing
+  void Reserve(size_t count) {
+    size_t capacity = kMinCapacity;
+    while (capacity < count * 2) {
+      capacity *= 2;
+    }
+    if (capacity > slots_.size()) {
+      Rehash(capacity);
+    }
+  }
+
+  // Returns the value for key, inserting a value-initialized one if needed
+  T& operator[](Key key) {
+    CHECK(key != Key());
+    if ((size_ + 1) * 2 > slots_.size()) {
+      Rehash(slots_.size() * 2);
+    }
+    Slot& slot = slots_[Probe(key)];
+    if (slot.key == Key()) {
+      slot.key = key;
+      ++size_;
+    }
+    return slot.value;
+  }
+
+  // Returns the value for key, or nullptr if there's no such entry
+  const T* Find(Key key) const {
+    CHECK(key != Key());
+    const Slot& slot = slots_[Probe(key)];
+    return slot.key == key ? &slot.value : nullptr;
+  }
+
+  // Removes all the entries (keeping the capacity)
+  void Clear() {
+    for (Slot& slot : slots_) {
+      slot = Slot();
+    }
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr size_t kMinCapacity = 16;
+
+  struct Slot {
+    Key key = Key();
+    T value = T();
+  };
+
+  static uint64_t KeyBits(uint64_t key) { return key; }
+  static uint64_t KeyBits(const void* key) { return reinterpret_cast<uintptr_t>(key); }
+
+  // Returns the slot holding key, or the empty slot where it belongs
+  size_t Probe(Key key) const {
+    // Fibonacci hashing spreads both sequential offsets and aligned pointers
+    const size_t mask = slots_.size() - 1;
+    size_t i = static_cast<size_t>((KeyBits(key) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (slots_[i].key != key && slots_[i].key != Key()) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<Slot> old_slots(capacity);
+    old_slots.swap(slots_);
+    for (const Slot& slot : old_slots) {
+      if (slot.key != Key()) {
+        slots_[Probe(slot.key)] = slot;
+      }
+    }
+  }
+
+ private:
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+};
+
+}  // namespace slicer
@@ -67,6 +67,7 @@ class HashTable {
     T* Lookup(const Key& key, uint32_t hash_value) const;
     Index HashBuckets() const { return hash_buckets_; }
     void InsertAll(const Partition& src);
+    void Clear();
     void PrintStats(const char* name, bool verbose);
 
    private:
@@ -96,6 +97,9 @@ class HashTable {
   // (returns nullptr if the value is not found)
   T* Lookup(const Key& key) const;
 
+  // Removes all the values, keeping the largest partition
+  void Clear();
+
   void PrintStats(const char* name, bool verbose);
 
  private:
@@ -168,6 +172,12 @@ void HashTable<Key, T, Hash>::Partition::InsertAll(const Partition& src) {
   }
 }
 
+template<class Key, class T, class Hash>
+void HashTable<Key, T, Hash>::Partition::Clear() {
+  // the capacity reserved for the collision chains is kept too
+  buckets_.assign(hash_buckets_, Bucket());
+}
+
 // Try to insert into the "insertion table". If that overflows,
 // we allocate a new, larger hash table, move "full table" value to it
 // and "insertion table" becomes the new "full table".
@@ -186,6 +196,12 @@ void HashTable<Key, T, Hash>::Insert(T* value) {
   }
 }
 
+template<class Key, class T, class Hash>
+void HashTable<Key, T, Hash>::Clear() {
+  full_table_.reset();
+  insertion_table_->Clear();
+}
+
 // First look into the "full table" and if the value is
 // not found there look into the "insertion table" next
 template<class Key, class T, class Hash>
@@ -43,9 +43,61 @@ class IndexMap {
     indexes_map_[index] = true;
   }
 
+  // Forgets all the indexes, keeping the allocated memory
+  void Clear() {
+    indexes_map_.clear();
+    alloc_pos_ = 0;
+  }
+
  private:
   std::vector<bool> indexes_map_;
   dex::u4 alloc_pos_ = 0;
 };
 
+// Original .dex index -> IR node mapping
+//
+// The .dex indexes are dense (bounded by the header's xxx_ids_size) so the
+// nodes are simply stored in a vector addressed by index. Entries are
+// nullptr until the node is created, and indexes beyond the current size
+// (allocated after the reader) grow the vector.
+//
+// NOTE: references returned by operator[] are only valid until the map
+//   grows, which can't happen while Reserve() covers all the indexes used.
+//
+template <class T>
+class DenseIndexMap {
+ public:
+  void Reserve(dex::u4 size) {
+    if (size > nodes_.size()) {
+      nodes_.resize(size, nullptr);
+    }
+  }
+
+  T*& operator[](dex::u4 index) {
+    CHECK(index != dex::kNoIndex);
+    if (index >= nodes_.size()) {
+      nodes_.resize(index + 1, nullptr);
+    }
+    return nodes_[index];
+  }
+
+  // Unmaps an index (a no-op if it was never mapped)
+  void Erase(dex::u4 index) {
+    if (index < nodes_.size()) {
+      nodes_[index] = nullptr;
+    }
+  }
+
+  // The node for an index which must be mapped
+  T* at(dex::u4 index) const {
+    CHECK(index < nodes_.size());
+    T* node = nodes_[index];
+    CHECK(node != nullptr);
+    return node;
+  }
+
+ private:
+  std::vector<T*> nodes_;
+};
+
 }  // namespace ir
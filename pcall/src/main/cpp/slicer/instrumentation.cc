@@ -158,6 +158,195 @@ bool ExitHook::Apply(lir::CodeIr* code_ir) {
   return true;
 }
 
+lir::Method* CallTraceProbes::ProbeMethod(lir::CodeIr* code_ir,
+                                          const ir::MethodId& probe_id) {
+  ir::Builder builder(code_ir->dex_ir);
+  std::vector<ir::Type*> param_types;
+  param_types.push_back(builder.GetType("I"));
+  auto ir_proto = builder.GetProto(builder.GetType("V"),
+                                   builder.GetTypeList(param_types));
+  auto ir_method_decl = builder.GetMethodDecl(
+      builder.GetAsciiString(probe_id.method_name), ir_proto,
+      builder.GetType(probe_id.class_descriptor));
+  return code_ir->Alloc<lir::Method>(ir_method_decl, ir_method_decl->orig_index);
+}
+
+// const vReg, #probe_id
+// invoke-static/range {vReg}, probe
+void CallTraceProbes::InsertProbe(lir::CodeIr* code_ir, lir::Instruction* before,
+                                  lir::Method* probe, dex::u4 reg) {
+  auto load_id = code_ir->Alloc<lir::Bytecode>();
+  load_id->opcode = dex::OP_CONST;
+  load_id->operands.push_back(code_ir->Alloc<lir::VReg>(reg));
+  load_id->operands.push_back(code_ir->Alloc<lir::Const32>(probe_id_));
+  code_ir->instructions.InsertBefore(before, load_id);
+
+  auto probe_invoke = code_ir->Alloc<lir::Bytecode>();
+  probe_invoke->opcode = dex::OP_INVOKE_STATIC_RANGE;
+  probe_invoke->operands.push_back(code_ir->Alloc<lir::VRegRange>(reg, 1));
+  probe_invoke->operands.push_back(probe);
+  code_ir->instructions.InsertBefore(before, probe_invoke);
+}
+
+bool CallTraceProbes::Apply(lir::CodeIr* code_ir) {
+  // the scratch register will be at most the current register count,
+  // check before AllocateScratchRegs starts mutating the method
+  if (code_ir->ir_method->code->registers > 255) {
+    return false;
+  }
+
+  // the entry probe must follow the prologue which AllocateScratchRegs
+  // may generate to shift the params (the scratch register can alias
+  // one of the incoming param registers until then), so remember the
+  // original first instruction
+  lir::Instruction* first_instr = *code_ir->instructions.begin();
+
+  AllocateScratchRegs alloc_regs(1);
+  if (!alloc_regs.Apply(code_ir)) {
+    return false;
+  }
+  const dex::u4 reg = *alloc_regs.ScratchRegs().begin();
+  CHECK(reg <= 255);
+
+  auto entry_probe = ProbeMethod(code_ir, entry_probe_id_);
+  auto exit_probe = ProbeMethod(code_ir, exit_probe_id_);
+
+  // exit probes first, so the entry probe isn't mistaken for a return
+  for (auto instr : code_ir->instructions) {
+    auto bytecode = dynamic_cast<lir::Bytecode*>(instr);
+    if (bytecode == nullptr) {
+      continue;
+    }
+    switch (bytecode->opcode) {
+      case dex::OP_RETURN_VOID:
+      case dex::OP_RETURN:
+      case dex::OP_RETURN_OBJECT:
+      case dex::OP_RETURN_WIDE:
+        InsertProbe(code_ir, bytecode, exit_probe, reg);
+        break;
+      default:
+        break;
+    }
+  }
+
+  InsertProbe(code_ir, first_instr, entry_probe, reg);
+  return true;
+}
+
+lir::Method* AllocationSiteProbes::ProbeMethod(lir::CodeIr* code_ir,
+                                               const ir::MethodId& probe_id,
+                                               int param_count) {
+  ir::Builder builder(code_ir->dex_ir);
+  std::vector<ir::Type*> param_types(param_count, builder.GetType("I"));
+  auto ir_proto = builder.GetProto(builder.GetType("V"),
+                                   builder.GetTypeList(param_types));
+  auto ir_method_decl = builder.GetMethodDecl(
+      builder.GetAsciiString(probe_id.method_name), ir_proto,
+      builder.GetType(probe_id.class_descriptor));
+  return code_ir->Alloc<lir::Method>(ir_method_decl, ir_method_decl->orig_index);
+}
+
+// Before each allocation site:
+//
+//   const vReg, #site_id
+//   invoke-static/range {vReg}, instance_probe
+//
+// or, for new-array vA, vB (vB = length):
+//
+//   const vReg, #site_id
+//   move/from16 vReg+1, vB
+//   invoke-static/range {vReg .. vReg+1}, array_probe
+//
+bool AllocationSiteProbes::Apply(lir::CodeIr* code_ir) {
+  // the scratch registers will be at most the current register count + 1,
+  // check before AllocateScratchRegs starts mutating the method
+  if (code_ir->ir_method->code->registers > 254) {
+    return false;
+  }
+
+  std::vector<std::pair<lir::Bytecode*, dex::u4>> sites;
+  bool has_array_sites = false;
+  for (auto instr : code_ir->instructions) {
+    auto bytecode = dynamic_cast<lir::Bytecode*>(instr);
+    if (bytecode == nullptr) {
+      continue;
+    }
+    AllocationSite site = {bytecode->opcode, bytecode->offset, nullptr, 0};
+    switch (bytecode->opcode) {
+      case dex::OP_NEW_INSTANCE:
+        site.type = bytecode->CastOperand<lir::Type>(1)->ir_type;
+        break;
+      case dex::OP_NEW_ARRAY:
+        site.type = bytecode->CastOperand<lir::Type>(2)->ir_type;
+        break;
+      case dex::OP_FILLED_NEW_ARRAY:
+        site.type = bytecode->CastOperand<lir::Type>(1)->ir_type;
+        site.length = bytecode->CastOperand<lir::VRegList>(0)->registers.size();
+        break;
+      case dex::OP_FILLED_NEW_ARRAY_RANGE:
+        site.type = bytecode->CastOperand<lir::Type>(1)->ir_type;
+        site.length = bytecode->CastOperand<lir::VRegRange>(0)->count;
+        break;
+      default:
+        continue;
+    }
+    dex::u4 site_id = site_id_callback_(site);
+    if (site_id == 0) {
+      continue;
+    }
+    has_array_sites |= bytecode->opcode == dex::OP_NEW_ARRAY;
+    sites.push_back(std::make_pair(bytecode, site_id));
+  }
+  if (sites.empty()) {
+    return true;
+  }
+
+  // invoke-static/range needs consecutive registers; renumbering only
+  // guarantees that if all the scratch registers fit below v16
+  const int scratch_count = has_array_sites ? 2 : 1;
+  const bool allow_renumbering =
+      code_ir->ir_method->code->registers + scratch_count <= 16;
+  AllocateScratchRegs alloc_regs(scratch_count, allow_renumbering);
+  if (!alloc_regs.Apply(code_ir)) {
+    return false;
+  }
+  const dex::u4 reg = *alloc_regs.ScratchRegs().begin();
+  CHECK(*alloc_regs.ScratchRegs().rbegin() == reg + scratch_count - 1);
+  CHECK(reg + scratch_count - 1 <= 255);
+
+  auto instance_probe = ProbeMethod(code_ir, instance_probe_id_, 1);
+  auto array_probe = has_array_sites ? ProbeMethod(code_ir, array_probe_id_, 2) : nullptr;
+
+  for (const auto& site : sites) {
+    lir::Bytecode* alloc = site.first;
+
+    auto load_id = code_ir->Alloc<lir::Bytecode>();
+    load_id->opcode = dex::OP_CONST;
+    load_id->operands.push_back(code_ir->Alloc<lir::VReg>(reg));
+    load_id->operands.push_back(code_ir->Alloc<lir::Const32>(site.second));
+    code_ir->instructions.InsertBefore(alloc, load_id);
+
+    auto probe_invoke = code_ir->Alloc<lir::Bytecode>();
+    probe_invoke->opcode = dex::OP_INVOKE_STATIC_RANGE;
+    if (alloc->opcode == dex::OP_NEW_ARRAY) {
+      // the length register was renumbered by AllocateScratchRegs if needed
+      auto copy_length = code_ir->Alloc<lir::Bytecode>();
+      copy_length->opcode = dex::OP_MOVE_FROM16;
+      copy_length->operands.push_back(code_ir->Alloc<lir::VReg>(reg + 1));
+      copy_length->operands.push_back(
+          code_ir->Alloc<lir::VReg>(alloc->CastOperand<lir::VReg>(1)->reg));
+      code_ir->instructions.InsertBefore(alloc, copy_length);
+      probe_invoke->operands.push_back(code_ir->Alloc<lir::VRegRange>(reg, 2));
+      probe_invoke->operands.push_back(array_probe);
+    } else {
+      probe_invoke->operands.push_back(code_ir->Alloc<lir::VRegRange>(reg, 1));
+      probe_invoke->operands.push_back(instance_probe);
+    }
+    code_ir->instructions.InsertBefore(alloc, probe_invoke);
+  }
+  return true;
+}
+
 bool DetourVirtualInvoke::Apply(lir::CodeIr* code_ir) {
   ir::Builder builder(code_ir->dex_ir);
 
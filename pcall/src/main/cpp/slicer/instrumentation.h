@@ -21,6 +21,7 @@
 #include "dex_ir.h"
 #include "dex_ir_builder.h"
 
+#include <functional>
 #include <memory>
 #include <vector>
 #include <utility>
@@ -75,6 +76,91 @@ class ExitHook : public Transformation {
   ir::MethodId hook_method_id_;
 };
 
+// Insert "probe" calls which pass a compact integer id instead of the
+// method arguments: a call to the static "entry probe" at the start of the
+// instrumented method and a call to the static "exit probe" before every
+// return. Both probes have the (I)V signature and receive |probe_id|.
+//
+// The id is materialized in a scratch register, so methods which
+// already use more than 255 registers can't be instrumented (const/31i
+// only addresses v0..v255) and are left untouched.
+class CallTraceProbes : public Transformation {
+ public:
+  CallTraceProbes(const ir::MethodId& entry_probe_id,
+                  const ir::MethodId& exit_probe_id,
+                  dex::u4 probe_id)
+      : entry_probe_id_(entry_probe_id),
+        exit_probe_id_(exit_probe_id),
+        probe_id_(probe_id) {
+    // probe method signatures are fixed to (I)V
+    CHECK(entry_probe_id_.signature == nullptr);
+    CHECK(exit_probe_id_.signature == nullptr);
+  }
+
+  virtual bool Apply(lir::CodeIr* code_ir) override;
+
+ private:
+  lir::Method* ProbeMethod(lir::CodeIr* code_ir, const ir::MethodId& probe_id);
+  void InsertProbe(lir::CodeIr* code_ir, lir::Instruction* before,
+                   lir::Method* probe, dex::u4 reg);
+
+ private:
+  ir::MethodId entry_probe_id_;
+  ir::MethodId exit_probe_id_;
+  dex::u4 probe_id_;
+};
+
+// An allocation instruction found by AllocationSiteProbes
+struct AllocationSite {
+  dex::Opcode opcode;
+  // offset of the allocation in the original method (in 16-bit code units)
+  dex::u4 offset;
+  // the allocated class, or array type
+  ir::Type* type;
+  // filled-new-array[/range] only: the number of elements
+  dex::u4 length;
+};
+
+// Insert a call to a static "allocation probe" before every new-instance,
+// new-array and filled-new-array[/range] of the instrumented method.
+// Each site is identified by the compact id returned by the site callback,
+// which is invoked once per site before the method is modified (returning
+// 0 leaves the site alone):
+//
+//   new-instance, filled-new-array[/range] : instance probe (I)V, site id
+//   new-array                              : array probe (II)V, site id and
+//                                            the requested array length
+//
+// The id and the length are materialized in scratch registers, so, like
+// CallTraceProbes, methods which already use more than 254 registers
+// can't be instrumented and are left untouched.
+class AllocationSiteProbes : public Transformation {
+ public:
+  typedef std::function<dex::u4(const AllocationSite&)> SiteIdCallback;
+
+  AllocationSiteProbes(const ir::MethodId& instance_probe_id,
+                       const ir::MethodId& array_probe_id,
+                       const SiteIdCallback& site_id_callback)
+      : instance_probe_id_(instance_probe_id),
+        array_probe_id_(array_probe_id),
+        site_id_callback_(site_id_callback) {
+    // probe method signatures are fixed to (I)V and (II)V
+    CHECK(instance_probe_id_.signature == nullptr);
+    CHECK(array_probe_id_.signature == nullptr);
+  }
+
+  virtual bool Apply(lir::CodeIr* code_ir) override;
+
+ private:
+  lir::Method* ProbeMethod(lir::CodeIr* code_ir, const ir::MethodId& probe_id,
+                           int param_count);
+
+ private:
+  ir::MethodId instance_probe_id_;
+  ir::MethodId array_probe_id_;
+  SiteIdCallback site_id_callback_;
+};
+
 // Replace every invoke-virtual[/range] to the a specified method with
 // a invoke-static[/range] to the detour method. The detour is a static
 // method which takes the same arguments as the original method plus
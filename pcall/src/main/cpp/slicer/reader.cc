@@ -26,14 +26,29 @@
 
 namespace dex {
 
-Reader::Reader(const dex::u1* image, size_t size) : image_(image), size_(size) {
+Reader::Reader(const dex::u1* image, size_t size)
+    : Reader(image, size, std::make_shared<ir::DexFile>()) {
+}
+
+Reader::Reader(const dex::u1* image, size_t size, std::shared_ptr<ir::DexFile> dex_ir)
+    : image_(image), size_(size) {
   // init the header reference
   header_ = ptr<dex::Header>(0);
   ValidateHeader();
 
   // start with an "empty" .dex IR
-  dex_ir_ = std::make_shared<ir::DexFile>();
+  CHECK(dex_ir != nullptr);
+  dex_ir->Reset();
+  dex_ir_ = std::move(dex_ir);
   dex_ir_->magic = slicer::MemView(header_, sizeof(dex::Header::magic));
+
+  // the index -> node maps are addressed by the original .dex indexes
+  dex_ir_->strings_map.Reserve(header_->string_ids_size);
+  dex_ir_->types_map.Reserve(header_->type_ids_size);
+  dex_ir_->protos_map.Reserve(header_->proto_ids_size);
+  dex_ir_->fields_map.Reserve(header_->field_ids_size);
+  dex_ir_->methods_map.Reserve(header_->method_ids_size);
+  dex_ir_->classes_map.Reserve(header_->class_defs_size);
 }
 
 slicer::ArrayView<const dex::ClassDef> Reader::ClassDefs() const {
@@ -19,10 +19,10 @@
 #include "common.h"
 #include "dex_format.h"
 #include "dex_ir.h"
+#include "flat_map.h"
 
 #include <assert.h>
 #include <stdlib.h>
-#include <map>
 #include <memory>
 
 namespace dex {
@@ -37,6 +37,10 @@ namespace dex {
 class Reader {
  public:
   Reader(const dex::u1* image, size_t size);
+
+  // Builds the IR in |dex_ir|, which is reset first: an IR no longer
+  // referenced by anyone else can be recycled this way (see ir::DexFile::Reset())
+  Reader(const dex::u1* image, size_t size, std::shared_ptr<ir::DexFile> dex_ir);
   ~Reader() = default;
 
   // No copy/move semantics
@@ -142,11 +146,11 @@ class Reader {
   std::shared_ptr<ir::DexFile> dex_ir_;
 
   // maps for de-duplicating items identified by file pointers
-  std::map<dex::u4, ir::TypeList*> type_lists_;
-  std::map<dex::u4, ir::Annotation*> annotations_;
-  std::map<dex::u4, ir::AnnotationSet*> annotation_sets_;
-  std::map<dex::u4, ir::AnnotationsDirectory*> annotations_directories_;
-  std::map<dex::u4, ir::EncodedArray*> encoded_arrays_;
+  slicer::FlatMap<dex::u4, ir::TypeList*> type_lists_;
+  slicer::FlatMap<dex::u4, ir::Annotation*> annotations_;
+  slicer::FlatMap<dex::u4, ir::AnnotationSet*> annotation_sets_;
+  slicer::FlatMap<dex::u4, ir::AnnotationsDirectory*> annotations_directories_;
+  slicer::FlatMap<dex::u4, ir::EncodedArray*> encoded_arrays_;
 };
 
 }  // namespace dex
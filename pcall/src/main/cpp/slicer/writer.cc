@@ -176,7 +176,7 @@ static void WriteEncodedValue(const ir::EncodedValue* ir_value, Section& data) {
 
   // optionally check the encoding against the original one
   // (if possible, some of the values contain relocated indexes)
-  EXTRA({
+  EXTRA(if (!data.IsSizing()) {
     switch (type) {
       case dex::kEncodedByte:
       case dex::kEncodedShort:
@@ -215,21 +215,22 @@ static void WriteEncodedArray(const ir::EncodedArray* ir_array, Section& data) {
   }
 }
 
-// helper for concatenating .dex sections into the final image
+// helper for detecting if the IR normalization assigned
+// new indexes
+//
+// NOTE: only a full IR (Reader::CreateFullIr()) can keep its indexes:
+//  an IR built for a few classes holds a subset of the items, which
+//  Normalize() numbers from 0, so every index moves and the writer
+//  always relocates (the ClassFileLoadHook transformations included)
+//
 template <class T>
-static void CopySection(const T& section, dex::u1* image, dex::u4 image_size) {
-  if (section.size() == 0) {
-    CHECK(section.ItemsCount() == 0);
-    return;
+static bool IsReindexed(const std::vector<ir::own<T>>& items) {
+  for (const auto& item : items) {
+    if (item->index != item->orig_index) {
+      return true;
+    }
   }
-
-  CHECK(section.ItemsCount() > 0);
-  dex::u4 offset = section.SectionOffset();
-  dex::u4 size = section.size();
-  CHECK(offset >= sizeof(dex::Header));
-  CHECK(offset + size <= image_size);
-
-  ::memcpy(image + offset, section.data(), size);
+  return false;
 }
 
 // This is the main interface for the .dex writer
@@ -246,53 +247,36 @@ dex::u1* Writer::CreateImage(Allocator* allocator, size_t* new_image_size) {
   // (ideally we shouldn't change the IR while generating an image)
   dex_ir_->Normalize();
 
-  // track the current offset within the .dex image
-  dex::u4 offset = 0;
+  remap_strings_ = IsReindexed(dex_ir_->strings);
+  remap_types_ = IsReindexed(dex_ir_->types);
+  remap_fields_ = IsReindexed(dex_ir_->fields);
+  remap_methods_ = IsReindexed(dex_ir_->methods);
 
-  // allocate the image and index sections
-  // (they will be back-filled)
-  offset += sizeof(dex::Header);
-  offset += dex_->string_ids.Init(offset, dex_ir_->strings.size());
-  offset += dex_->type_ids.Init(offset, dex_ir_->types.size());
-  offset += dex_->proto_ids.Init(offset, dex_ir_->protos.size());
-  offset += dex_->field_ids.Init(offset, dex_ir_->fields.size());
-  offset += dex_->method_ids.Init(offset, dex_ir_->methods.size());
-  offset += dex_->class_defs.Init(offset, dex_ir_->classes.size());
+  // size the node -> file pointer map for the data items up front
+  node_offset_.Reserve(dex_ir_->type_lists.size() + dex_ir_->code.size() +
+                       dex_ir_->debug_info.size() + dex_ir_->encoded_arrays.size() +
+                       dex_ir_->annotations.size() + dex_ir_->annotation_sets.size() +
+                       dex_ir_->annotation_set_ref_lists.size() +
+                       dex_ir_->annotations_directories.size());
 
-  // the base offset for the "data" meta-section
-  CHECK(offset % 4 == 0);
-  const dex::u4 data_offset = offset;
-
-  // we must create the sections in a very specific
-  // order due to file pointers across sections
-  offset += CreateStringDataSection(offset);
-  offset += CreateTypeListsSection(offset);
-  offset += CreateDebugInfoSection(offset);
-  offset += CreateEncodedArrayItemSection(offset);
-  offset += CreateCodeItemSection(offset);
-  offset += CreateClassDataSection(offset);
-  offset += CreateAnnItemSection(offset);
-  offset += CreateAnnSetsSection(offset);
-  offset += CreateAnnSetRefListsSection(offset);
-  offset += CreateAnnDirectoriesSection(offset);
-  offset += CreateMapSection(offset);
-
-  // back-fill the indexes
-  FillTypes();
-  FillFields();
-  FillProtos();
-  FillMethods();
-  FillClassDefs();
+  // first pass: size the sections and assign the file offsets
+  dex::u4 data_offset = 0;
+  const dex::u4 image_size = CreateSections(&data_offset);
 
   // allocate the final buffer for the .dex image
-  CHECK(offset % 4 == 0);
-  const dex::u4 image_size = offset;
   dex::u1* image = static_cast<dex::u1*>(allocator->Allocate(image_size));
   if (image == nullptr) {
     // memory allocation failed, bailing out...
     return nullptr;
   }
-  memset(image, 0, image_size);
+
+  // second pass: write the sections directly into the image
+  // (the sections cover the whole image, including the alignment
+  // padding, so only the header needs to be cleared)
+  memset(image, 0, sizeof(dex::Header));
+  dex_->Attach(image);
+  node_offset_.Clear();
+  CHECK(CreateSections(&data_offset) == image_size);
 
   // finally, back-fill the header
   CHECK(image_size > sizeof(dex::Header));
@@ -325,25 +309,6 @@ dex::u1* Writer::CreateImage(Allocator* allocator, size_t* new_image_size) {
   header->data_size = image_size - data_offset;
   header->data_off = data_offset;
 
-  // copy the individual sections to the final image
-  CopySection(dex_->string_ids, image, image_size);
-  CopySection(dex_->type_ids, image, image_size);
-  CopySection(dex_->proto_ids, image, image_size);
-  CopySection(dex_->field_ids, image, image_size);
-  CopySection(dex_->method_ids, image, image_size);
-  CopySection(dex_->class_defs, image, image_size);
-  CopySection(dex_->string_data, image, image_size);
-  CopySection(dex_->type_lists, image, image_size);
-  CopySection(dex_->debug_info, image, image_size);
-  CopySection(dex_->encoded_arrays, image, image_size);
-  CopySection(dex_->code, image, image_size);
-  CopySection(dex_->class_data, image, image_size);
-  CopySection(dex_->ann_directories, image, image_size);
-  CopySection(dex_->ann_set_ref_lists, image, image_size);
-  CopySection(dex_->ann_sets, image, image_size);
-  CopySection(dex_->ann_items, image, image_size);
-  CopySection(dex_->map_list, image, image_size);
-
   // checksum
   header->checksum = dex::ComputeChecksum(header);
 
@@ -351,6 +316,51 @@ dex::u1* Writer::CreateImage(Allocator* allocator, size_t* new_image_size) {
   return image;
 }
 
+// Creates all the .dex sections, in the final image layout
+// (returns the total image size)
+dex::u4 Writer::CreateSections(dex::u4* data_offset) {
+  // track the current offset within the .dex image
+  dex::u4 offset = 0;
+
+  // the index sections are back-filled
+  offset += sizeof(dex::Header);
+  offset += dex_->string_ids.Init(offset, dex_ir_->strings.size());
+  offset += dex_->type_ids.Init(offset, dex_ir_->types.size());
+  offset += dex_->proto_ids.Init(offset, dex_ir_->protos.size());
+  offset += dex_->field_ids.Init(offset, dex_ir_->fields.size());
+  offset += dex_->method_ids.Init(offset, dex_ir_->methods.size());
+  offset += dex_->class_defs.Init(offset, dex_ir_->classes.size());
+
+  // the base offset for the "data" meta-section
+  CHECK(offset % 4 == 0);
+  *data_offset = offset;
+
+  // we must create the sections in a very specific
+  // order due to file pointers across sections
+  offset += CreateStringDataSection(offset);
+  offset += CreateTypeListsSection(offset);
+  offset += CreateDebugInfoSection(offset);
+  offset += CreateEncodedArrayItemSection(offset);
+  offset += CreateCodeItemSection(offset);
+  offset += CreateClassDataSection(offset);
+  offset += CreateAnnItemSection(offset);
+  offset += CreateAnnSetsSection(offset);
+  offset += CreateAnnSetRefListsSection(offset);
+  offset += CreateAnnDirectoriesSection(offset);
+  offset += CreateMapSection(offset);
+
+  // back-fill the indexes
+  FillTypes();
+  FillFields();
+  FillProtos();
+  FillMethods();
+  FillClassDefs();
+
+  CHECK(offset % 4 == 0);
+  CHECK(offset > sizeof(dex::Header));
+  return offset;
+}
+
 // "string_id_item" + string data section
 dex::u4 Writer::CreateStringDataSection(dex::u4 section_offset) {
   auto& section = dex_->string_data;
@@ -753,6 +763,11 @@ dex::u4 Writer::WriteDebugInfo(const ir::DebugInfo* ir_debug_info) {
   }
 
   // debug info "state machine bytecodes"
+  if (!remap_strings_ && !remap_types_) {
+    data.Push(ir_debug_info->data);
+    return data.AbsoluteOffset(offset);
+  }
+
   const dex::u1* src = ir_debug_info->data.ptr<dex::u1>();
   dex::u1 opcode = 0;
   while ((opcode = *src++) != dex::DBG_END_SEQUENCE) {
@@ -816,6 +831,15 @@ void Writer::WriteInstructions(slicer::ArrayView<const dex::u2> instructions) {
   CHECK(!instructions.empty());
 
   auto offset = dex_->code.Push(instructions);
+  if (dex_->code.IsSizing()) {
+    // the relocation doesn't change the size
+    return;
+  }
+  if (!remap_strings_ && !remap_types_ && !remap_fields_ && !remap_methods_) {
+    // no index changes, nothing to relocate
+    return;
+  }
+
   dex::u2* ptr = dex_->code.ptr<dex::u2>(offset);
   dex::u2* const end = ptr + instructions.size();
 
@@ -897,6 +921,15 @@ void Writer::WriteInstructions(slicer::ArrayView<const dex::u2> instructions) {
 void Writer::WriteTryBlocks(const ir::Code* irCode) {
   CHECK(!irCode->try_blocks.empty());
 
+  auto& data = dex_->code;
+  if (!remap_types_) {
+    // the handler offsets are relative to the start of the
+    // "encoded_catch_handler_list", so it can be copied as is
+    data.Push(irCode->try_blocks);
+    data.Push(irCode->catch_handlers);
+    return;
+  }
+
   // use a temporary buffer to build the "encoded_catch_handler_list"
   slicer::Buffer handlers_list;
   auto original_list = irCode->catch_handlers.ptr<dex::u1>();
@@ -932,10 +965,12 @@ void Writer::WriteTryBlocks(const ir::Code* irCode) {
   handlers_list.Seal(1);
 
   // now write everything (try_item[] and encoded_catch_handler_list)
-  auto& data = dex_->code;
   dex::u4 tries_offset = data.size();
   data.Push(irCode->try_blocks);
   data.Push(handlers_list);
+  if (data.IsSizing()) {
+    return;
+  }
 
   // finally relocate the offsets to handlers
   for (dex::TryBlock& dex_try : slicer::ArrayView<dex::TryBlock>(
@@ -1099,11 +1134,9 @@ dex::u4 Writer::FilePointer(const ir::Node* ir_node) const {
   if (ir_node == nullptr) {
     return 0;
   }
-  auto it = node_offset_.find(ir_node);
-  CHECK(it != node_offset_.end());
-  dex::u4 offset = it->second;
-  CHECK(offset > 0);
-  return offset;
+  auto offset = node_offset_.Find(ir_node);
+  CHECK(offset != nullptr && *offset > 0);
+  return *offset;
 }
 
 }  // namespace dex
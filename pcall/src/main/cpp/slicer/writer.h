@@ -19,18 +19,30 @@
 #include "common.h"
 #include "buffer.h"
 #include "arrayview.h"
+#include "memview.h"
 #include "dex_format.h"
+#include "dex_leb128.h"
 #include "dex_ir.h"
+#include "flat_map.h"
 
+#include <assert.h>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <vector>
 
 namespace dex {
 
-// Specialized buffer for creating a .dex image section
+// Specialized writer for a .dex image section
 // (tracking the section offset, section type, ...)
-class Section : public slicer::Buffer {
+//
+// The image is created in two passes over the same code: first the
+// sections are only sized (there's no backing memory), then, once the
+// final image is allocated, each section is attached to it and the
+// content is written directly in place. The second pass must produce
+// exactly the same layout as the first one.
+//
+class Section {
  public:
   Section(dex::u2 mapEntryType) : map_entry_type_(mapEntryType) {}
   ~Section() = default;
@@ -38,6 +50,18 @@ class Section : public slicer::Buffer {
   Section(const Section&) = delete;
   Section& operator=(const Section&) = delete;
 
+  // Switch from sizing to writing into the final image
+  void Attach(dex::u1* image) {
+    CHECK(image_ == nullptr && image != nullptr);
+    image_ = image;
+    capacity_ = size_;
+    size_ = 0;
+    count_ = 0;
+    sealed_ = false;
+  }
+
+  bool IsSizing() const { return image_ == nullptr; }
+
   void SetOffset(dex::u4 offset) {
     CHECK(offset > 0 && offset % 4 == 0);
     offset_ = offset;
@@ -65,14 +89,114 @@ class Section : public slicer::Buffer {
 
   dex::u2 MapEntryType() const { return map_entry_type_; }
 
+  // Align the total size and prevent further changes
+  dex::u4 Seal(dex::u4 alignment) {
+    CHECK(!sealed_);
+    Align(alignment);
+    sealed_ = true;
+    CHECK(IsSizing() || size_ == capacity_);
+    return size();
+  }
+
+  // Returns a pointer within the section
+  // (only available after the section is attached to the image)
+  template <class T>
+  T* ptr(dex::u4 offset) {
+    CHECK(!IsSizing());
+    CHECK(offset + sizeof(T) <= size_);
+    return reinterpret_cast<T*>(image_ + offset_ + offset);
+  }
+
+  // Align the section size to the specified alignment
+  void Align(dex::u4 alignment) {
+    assert(alignment > 0);
+    dex::u4 rem = size_ % alignment;
+    if (rem != 0) {
+      dex::u1* dst = Expand(alignment - rem);
+      if (dst != nullptr) {
+        std::memset(dst, 0, alignment - rem);
+      }
+    }
+  }
+
+  dex::u4 Push(const void* ptr, dex::u4 size) {
+    dex::u4 offset = size_;
+    dex::u1* dst = Expand(size);
+    // ptr may be null for an empty view, memcpy() requires valid pointers
+    if (dst != nullptr && size != 0) {
+      std::memcpy(dst, ptr, size);
+    }
+    return offset;
+  }
+
+  dex::u4 Push(const slicer::MemView& memView) {
+    return Push(memView.ptr(), memView.size());
+  }
+
+  template <class T>
+  dex::u4 Push(const slicer::ArrayView<T>& a) {
+    return Push(a.data(), a.size() * sizeof(T));
+  }
+
+  template <class T>
+  dex::u4 Push(const std::vector<T>& v) {
+    return Push(v.data(), v.size() * sizeof(T));
+  }
+
+  dex::u4 Push(const slicer::Buffer& buff) {
+    return Push(buff.data(), buff.size());
+  }
+
+  template <class T>
+  dex::u4 Push(const T& value) {
+    return Push(&value, sizeof(value));
+  }
+
+  dex::u4 PushULeb128(dex::u4 value) {
+    dex::u1 tmp[5];
+    dex::u1* end = dex::WriteULeb128(tmp, value);
+    return Push(tmp, end - tmp);
+  }
+
+  dex::u4 PushSLeb128(dex::s4 value) {
+    dex::u1 tmp[5];
+    dex::u1* end = dex::WriteSLeb128(tmp, value);
+    return Push(tmp, end - tmp);
+  }
+
+  dex::u4 size() const { return size_; }
+
+ private:
+  // Grows the section, returns where the new bytes go
+  // (or nullptr while sizing)
+  dex::u1* Expand(dex::u4 size) {
+    CHECK(!sealed_);
+    dex::u4 offset = size_;
+    size_ += size;
+    if (image_ == nullptr) {
+      return nullptr;
+    }
+    CHECK(size_ <= capacity_);
+    return image_ + offset_ + offset;
+  }
+
  private:
+  dex::u1* image_ = nullptr;
   dex::u4 offset_ = 0;
+  dex::u4 size_ = 0;
+  dex::u4 capacity_ = 0;
   dex::u4 count_ = 0;
+  bool sealed_ = false;
   const dex::u2 map_entry_type_;
 };
 
 // A specialized container for an .dex index section
 // (strings, types, fields, methods, ...)
+//
+// Like Section, there's no backing memory while the image is sized
+// (the items are written to a scratch value) and the items are written
+// in place once attached to the final image.
+//
 template <class T>
 class Index {
  public:
@@ -82,44 +206,41 @@ class Index {
   Index(const Index&) = delete;
   Index& operator=(const Index&) = delete;
 
+  void Attach(dex::u1* image) {
+    CHECK(image_ == nullptr && image != nullptr);
+    image_ = image;
+  }
+
   dex::u4 Init(dex::u4 offset, dex::u4 count) {
-    values_.reset(new T[count]);
+    values_ = image_ != nullptr ? reinterpret_cast<T*>(image_ + offset) : nullptr;
     offset_ = offset;
     count_ = count;
     return size();
   }
 
-  void Free() {
-    values_.reset();
-    offset_ = 0;
-    count_ = 0;
-  }
-
   dex::u4 SectionOffset() const {
     CHECK(offset_ > 0 && offset_ % 4 == 0);
     return ItemsCount() > 0 ? offset_ : 0;
   }
 
-  T* begin() { return values_.get(); }
-  T* end() { return begin() + count_; }
-
   bool empty() const { return count_ == 0; }
 
   dex::u4 ItemsCount() const { return count_; }
-  const T* data() const { return values_.get(); }
   dex::u4 size() const { return count_ * sizeof(T); }
 
   T& operator[](int i) {
     CHECK(i >= 0 && i < count_);
-    return values_[i];
+    return values_ != nullptr ? values_[i] : scratch_;
   }
 
   dex::u2 MapEntryType() const { return map_entry_type_; }
 
  private:
+  dex::u1* image_ = nullptr;
   dex::u4 offset_ = 0;
   dex::u4 count_ = 0;
-  std::unique_ptr<T[]> values_;
+  T* values_ = nullptr;
+  T scratch_ = {};
   const dex::u2 map_entry_type_;
 };
 
@@ -165,6 +286,27 @@ class Writer {
     Section ann_sets;
     Section ann_items;
     Section map_list;
+
+    // switch all the sections from sizing to writing in place
+    void Attach(dex::u1* image) {
+      string_ids.Attach(image);
+      type_ids.Attach(image);
+      proto_ids.Attach(image);
+      field_ids.Attach(image);
+      method_ids.Attach(image);
+      class_defs.Attach(image);
+      string_data.Attach(image);
+      type_lists.Attach(image);
+      debug_info.Attach(image);
+      encoded_arrays.Attach(image);
+      code.Attach(image);
+      class_data.Attach(image);
+      ann_directories.Attach(image);
+      ann_set_ref_lists.Attach(image);
+      ann_sets.Attach(image);
+      ann_items.Attach(image);
+      map_list.Attach(image);
+    }
   };
 
  public:
@@ -186,6 +328,10 @@ class Writer {
   dex::u1* CreateImage(Allocator* allocator, size_t* new_image_size);
 
  private:
+  // lays out (or writes, once attached to the image) all the
+  // sections, returns the image size
+  dex::u4 CreateSections(dex::u4* data_offset);
+
   // helpers for creating various .dex sections
   dex::u4 CreateStringDataSection(dex::u4 section_offset);
   dex::u4 CreateMapSection(dex::u4 section_offset);
@@ -233,12 +379,21 @@ class Writer {
   dex::u4 FilePointer(const ir::Node* ir_node) const;
 
  private:
+  // set when normalizing the IR moved at least one item of the
+  // corresponding index, otherwise the references embedded in code,
+  // try blocks and debug info can be copied verbatim (full IRs only,
+  // see IsReindexed())
+  bool remap_strings_ = true;
+  bool remap_types_ = true;
+  bool remap_fields_ = true;
+  bool remap_methods_ = true;
+
   std::shared_ptr<ir::DexFile> dex_ir_;
   std::unique_ptr<DexImage> dex_;
 
   // CONSIDER: we can have multiple maps per IR node type
   //  (that's what the reader does)
-  std::map<const ir::Node*, dex::u4> node_offset_;
+  slicer::FlatMap<const ir::Node*, dex::u4> node_offset_;
 };
 
 }  // namespace dex
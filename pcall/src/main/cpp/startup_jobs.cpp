@@ -0,0 +1,118 @@
+#include "startup_jobs.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace profiler {
+
+    // time the jobs may use per drain loop pass
+    static const int64_t kSliceNs = 2000000LL;
+
+    // progress of a long job is logged at most this often
+    static const int64_t kReportIntervalNs = 1000000000LL;
+
+    // nothing left to run
+    static const int64_t kIdleDelayNs = 60 * 1000000000LL;
+
+    // trigger file poll period
+    static const int64_t kPollPeriodNs = 1000000000LL;
+    static const char kTriggerName[] = "pcall-cancel";
+
+    void StartupJobs::Add(std::unique_ptr<StartupJob> job) {
+        int priority = job->Priority();
+        auto pos = std::find_if(jobs_.begin(), jobs_.end(), [priority](const Entry &entry) {
+            return entry.job->Priority() < priority;
+        });
+        Entry entry;
+        entry.job = std::move(job);
+        entry.started_ns = 0;
+        entry.last_report_ns = 0;
+        jobs_.insert(pos, std::move(entry));
+    }
+
+    int64_t StartupJobs::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        const int64_t start = MonotonicNanos();
+        const int64_t deadline = start + kSliceNs;
+        if (!jobs_.empty() && start >= next_poll_ns_) {
+            PollTrigger();
+            next_poll_ns_ = start + kPollPeriodNs;
+        }
+        while (!jobs_.empty()) {
+            Entry &entry = jobs_.front();
+            int64_t now = MonotonicNanos();
+            if (entry.started_ns == 0) {
+                entry.started_ns = now;
+                entry.last_report_ns = now;
+            }
+            if (entry.job->IsCancelled()) {
+                entry.job->Abort(jvmti, jni);
+                Report(entry, "cancelled", MonotonicNanos());
+                jobs_.erase(jobs_.begin());
+                continue;
+            }
+            if (entry.job->Step(jvmti, jni)) {
+                Report(entry, "done", MonotonicNanos());
+                jobs_.erase(jobs_.begin());
+                continue;
+            }
+            now = MonotonicNanos();
+            if (now - entry.last_report_ns >= kReportIntervalNs) {
+                Report(entry, "running", now);
+                entry.last_report_ns = now;
+            }
+            if (now >= deadline) {
+                return 0;
+            }
+        }
+        return kIdleDelayNs;
+    }
+
+    void StartupJobs::Finish(jvmtiEnv *jvmti, JNIEnv *jni) {
+        for (Entry &entry : jobs_) {
+            entry.job->Abort(jvmti, jni);
+            Report(entry, "cancelled", MonotonicNanos());
+        }
+        jobs_.clear();
+    }
+
+    void StartupJobs::PollTrigger() {
+        std::string trigger_path = dir_ + kTriggerName;
+        FILE *trigger = fopen(trigger_path.c_str(), "r");
+        if (trigger == nullptr) {
+            return;
+        }
+        char name[32] = {};
+        while (fscanf(trigger, "%31s", name) == 1) {
+            bool found = false;
+            for (Entry &entry : jobs_) {
+                if (strcmp(name, "all") == 0 || strcmp(name, entry.job->Name()) == 0) {
+                    entry.job->Cancel();
+                    found = true;
+                }
+            }
+            if (!found) {
+                LOGE("startup job %s: not pending, not cancelled", name);
+            }
+        }
+        fclose(trigger);
+        unlink(trigger_path.c_str());
+    }
+
+    void StartupJobs::Report(const Entry &entry, const char *state, int64_t now) {
+        size_t done = 0;
+        size_t total = 0;
+        entry.job->GetProgress(&done, &total);
+        double elapsed_ms = entry.started_ns != 0 ? (now - entry.started_ns) / 1e6 : 0.0;
+        if (total > 0) {
+            LOGE("startup job %s %s: %zu/%zu (%d%%) in %.1f ms", entry.job->Name(), state,
+                 done, total, static_cast<int>(done * 100 / total), elapsed_ms);
+        } else {
+            LOGE("startup job %s %s in %.1f ms", entry.job->Name(), state, elapsed_ms);
+        }
+    }
+
+}  // namespace profiler
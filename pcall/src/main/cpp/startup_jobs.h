@@ -0,0 +1,119 @@
+#ifndef STARTUP_JOBS_H
+#define STARTUP_JOBS_H
+
+#include "event_pipeline.h"
+#include "jvmti.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * A piece of attach work deferred to the agent thread. The work is split
+     * in steps short enough (about a millisecond) to keep the event buffers
+     * drained while the job runs.
+     */
+    class StartupJob {
+    public:
+        /**
+         * Jobs with a higher |priority| run first, equal priorities run in
+         * the order they were added.
+         */
+        StartupJob(const char *name, int priority) : name_(name), priority_(priority) {}
+
+        virtual ~StartupJob() = default;
+
+        /**
+         * Runs the next step; returns true once the job is complete.
+         */
+        virtual bool Step(jvmtiEnv *jvmti, JNIEnv *jni) = 0;
+
+        /**
+         * Work done so far out of |total|, in job specific units
+         * (|total| is 0 while unknown).
+         */
+        virtual void GetProgress(size_t *done, size_t *total) const {
+            *done = 0;
+            *total = 0;
+        }
+
+        /**
+         * Called instead of the remaining steps when the job is cancelled,
+         * to release what the steps done so far hold.
+         */
+        virtual void Abort(jvmtiEnv *jvmti, JNIEnv *jni) {}
+
+        /**
+         * Stops the job before its next step. Can be called from any thread.
+         */
+        void Cancel() { cancelled_.store(true); }
+
+        bool IsCancelled() const { return cancelled_.load(); }
+
+        const char *Name() const { return name_; }
+
+        int Priority() const { return priority_; }
+
+    private:
+        const char *const name_;
+        const int priority_;
+        std::atomic<bool> cancelled_{false};
+    };
+
+    /**
+     * Runs the expensive attach stages (retransformation of the loaded
+     * classes, heap walks, dumps, ...) on the agent thread, so that
+     * Agent_OnAttach returns as soon as the callbacks are set.
+     *
+     * Each run executes steps of the highest priority job for at most a
+     * time slice, then yields back to the drain loop. Progress is logged
+     * periodically and when a job completes or is cancelled.
+     *
+     * While jobs are pending, the agent thread polls the agent directory
+     * for a pcall-cancel file, holding the names of the jobs to cancel or
+     * "all", and removes it:
+     *
+     *   adb shell run-as <package> sh -c 'echo heap-graph > <agent dir>/pcall-cancel'
+     */
+    class StartupJobs : public PeriodicTask {
+    public:
+        explicit StartupJobs(const std::string &dir) : dir_(dir) {}
+
+        /**
+         * Queues |job|. Must be called before the agent thread starts draining.
+         */
+        void Add(std::unique_ptr<StartupJob> job);
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+        /**
+         * Aborts the jobs still pending.
+         */
+        void Finish(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct Entry {
+            std::unique_ptr<StartupJob> job;
+            int64_t started_ns;
+            int64_t last_report_ns;
+        };
+
+        void Report(const Entry &entry, const char *state, int64_t now);
+
+        // Cancels the jobs named in the trigger file, if there is one
+        void PollTrigger();
+
+        const std::string dir_;
+        int64_t next_poll_ns_ = 0;
+        // sorted by decreasing priority
+        std::vector<Entry> jobs_;
+    };
+
+}  // namespace profiler
+
+#endif  // STARTUP_JOBS_H
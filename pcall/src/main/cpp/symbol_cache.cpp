@@ -0,0 +1,230 @@
+#include "symbol_cache.h"
+#include "jvmti_helper.h"
+
+#include <stdint.h>
+
+namespace profiler {
+
+    SymbolCache &SymbolCache::Instance() {
+        static SymbolCache *instance = new SymbolCache();
+        return *instance;
+    }
+
+    jlong SymbolCache::ClassId(jvmtiEnv *jvmti, jclass klass) {
+        jlong tag = 0;
+        if (jvmti->GetTag(klass, &tag) != JVMTI_ERROR_NONE) {
+            return 0;
+        }
+        if (tag != 0) {
+            class_hits_.fetch_add(1, std::memory_order_relaxed);
+            return tag;
+        }
+
+        // slow path, once per class
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        // another thread may have won the race for this class
+        if (jvmti->GetTag(klass, &tag) != JVMTI_ERROR_NONE) {
+            return 0;
+        }
+        if (tag != 0) {
+            class_hits_.fetch_add(1, std::memory_order_relaxed);
+            return tag;
+        }
+        class_misses_.fetch_add(1, std::memory_order_relaxed);
+
+        char *sig_mutf8 = nullptr;
+        if (CheckJvmtiError(jvmti, jvmti->GetClassSignature(klass, &sig_mutf8, nullptr))) {
+            return 0;
+        }
+        std::string signature(sig_mutf8 != nullptr ? sig_mutf8 : "");
+        Deallocate(jvmti, sig_mutf8);
+        ClassIdEntry &entry = class_ids_[signature];
+        // the id reserved by the probes of the class, if any, unless another
+        // class with the same signature (another loader) holds it
+        bool reserved = entry.id != 0 && !entry.tagged;
+        tag = reserved ? entry.id : next_class_tag_++;
+        if (CheckJvmtiError(jvmti, jvmti->SetTag(klass, tag))) {
+            if (entry.id == 0) {
+                class_ids_.erase(signature);
+            }
+            return 0;
+        }
+        if (reserved) {
+            // the symbol was interned with the id
+            entry.tagged = true;
+            return tag;
+        }
+        if (entry.id == 0) {
+            entry.id = tag;
+            entry.tagged = true;
+        }
+        ClassSymbol *symbol = new ClassSymbol();
+        symbol->id = tag;
+        symbol->signature = signature;
+        classes_.Put(static_cast<uint64_t>(tag), symbol);
+        return tag;
+    }
+
+    jlong SymbolCache::ClassTagLimit() {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return next_class_tag_;
+    }
+
+    const MethodSymbol *SymbolCache::LookupMethod(jvmtiEnv *jvmti, JNIEnv *jni,
+                                                  jmethodID method) {
+        const uint64_t key = reinterpret_cast<uintptr_t>(method);
+        const MethodSymbol *symbol = methods_.Find(key);
+        if (symbol != nullptr) {
+            method_hits_.fetch_add(1, std::memory_order_relaxed);
+            return symbol;
+        }
+        method_misses_.fetch_add(1, std::memory_order_relaxed);
+
+        // resolve outside the writer lock, the JVMTI calls are the slow part
+        char *name_mutf8 = nullptr;
+        char *sig_mutf8 = nullptr;
+        if (jvmti->GetMethodName(method, &name_mutf8, &sig_mutf8, nullptr) != JVMTI_ERROR_NONE) {
+            // the declaring class may have been unloaded meanwhile
+            return nullptr;
+        }
+        jclass klass = nullptr;
+        jlong class_id = 0;
+        if (jvmti->GetMethodDeclaringClass(method, &klass) == JVMTI_ERROR_NONE) {
+            class_id = ClassId(jvmti, klass);
+            jni->DeleteLocalRef(klass);
+        }
+        MethodSymbol *resolved = new MethodSymbol();
+        resolved->class_id = class_id;
+        resolved->name = name_mutf8 != nullptr ? name_mutf8 : "";
+        resolved->signature = sig_mutf8 != nullptr ? sig_mutf8 : "";
+        Deallocate(jvmti, name_mutf8);
+        Deallocate(jvmti, sig_mutf8);
+
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        MethodSymbol *existing = methods_.Find(key);
+        if (existing != nullptr && existing->class_id == class_id) {
+            delete resolved;
+            return existing;
+        }
+        resolved->id = next_method_id_++;
+        MethodSymbol *previous = methods_.Put(key, resolved);
+        if (previous != nullptr) {
+            // jmethodID reused before the free of its old class was reclaimed
+            dead_methods_.push_back(previous);
+        }
+        class_methods_[class_id].push_back(method);
+        return resolved;
+    }
+
+    uint32_t SymbolCache::InternProbeMethod(const std::string &class_signature,
+                                            const std::string &name,
+                                            const std::string &signature) {
+        std::string key(class_signature);
+        key.append("->").append(name).append(signature);
+
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto it = probe_ids_.find(key);
+        if (it != probe_ids_.end()) {
+            return it->second;
+        }
+        // the probes pass the id as a signed int
+        if (next_method_id_ > INT32_MAX) {
+            return 0;
+        }
+
+        ClassIdEntry &entry = class_ids_[class_signature];
+        if (entry.id == 0) {
+            // not tagged yet, the class takes this id when it is
+            entry.id = next_class_tag_++;
+            entry.tagged = false;
+            ClassSymbol *klass = new ClassSymbol();
+            klass->id = entry.id;
+            klass->signature = class_signature;
+            classes_.Put(static_cast<uint64_t>(entry.id), klass);
+        }
+        const jlong class_id = entry.id;
+        probe_classes_.insert(class_id);
+        MethodSymbol *symbol = new MethodSymbol();
+        symbol->id = next_method_id_++;
+        symbol->class_id = class_id;
+        symbol->name = name;
+        symbol->signature = signature;
+        probe_methods_.Put(symbol->id, symbol);
+        probe_ids_.emplace(key, symbol->id);
+        return symbol->id;
+    }
+
+    void SymbolCache::OnTagFreed(jlong tag) {
+        std::lock_guard<std::mutex> lock(freed_mutex_);
+        freed_tags_.push_back(tag);
+    }
+
+    void SymbolCache::Reclaim() {
+        // nobody can still hold these: they were unreachable a whole period ago
+        for (ClassSymbol *symbol : reclaimable_classes_) {
+            delete symbol;
+        }
+        for (MethodSymbol *symbol : reclaimable_methods_) {
+            delete symbol;
+        }
+        reclaimable_classes_.clear();
+        reclaimable_methods_.clear();
+
+        std::vector<jlong> freed_tags;
+        {
+            std::lock_guard<std::mutex> lock(freed_mutex_);
+            freed_tags.swap(freed_tags_);
+        }
+
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        for (jlong tag : freed_tags) {
+            ClassSymbol *klass = classes_.Find(static_cast<uint64_t>(tag));
+            if (klass == nullptr) {
+                // not a class tag
+                continue;
+            }
+            unloaded_classes_.fetch_add(1, std::memory_order_relaxed);
+            auto entry = class_ids_.find(klass->signature);
+            bool owns_id = entry != class_ids_.end() && entry->second.id == tag;
+            if (probe_classes_.count(tag) != 0) {
+                // the probe ids refer to it, the next class loaded with this
+                // signature takes the id again
+                if (owns_id) {
+                    entry->second.tagged = false;
+                }
+            } else {
+                if (owns_id) {
+                    class_ids_.erase(entry);
+                }
+                dead_classes_.push_back(classes_.Remove(static_cast<uint64_t>(tag)));
+            }
+
+            auto it = class_methods_.find(tag);
+            if (it == class_methods_.end()) {
+                continue;
+            }
+            for (jmethodID method : it->second) {
+                const uint64_t key = reinterpret_cast<uintptr_t>(method);
+                MethodSymbol *symbol = methods_.Find(key);
+                // leave the entry alone if the id was already reused
+                if (symbol != nullptr && symbol->class_id == tag) {
+                    dead_methods_.push_back(methods_.Remove(key));
+                }
+            }
+            class_methods_.erase(it);
+        }
+        reclaimable_classes_.swap(dead_classes_);
+        reclaimable_methods_.swap(dead_methods_);
+    }
+
+    SymbolCache::Stats SymbolCache::GetStats() const {
+        Stats stats;
+        stats.class_hits = class_hits_.load(std::memory_order_relaxed);
+        stats.class_misses = class_misses_.load(std::memory_order_relaxed);
+        stats.method_hits = method_hits_.load(std::memory_order_relaxed);
+        stats.method_misses = method_misses_.load(std::memory_order_relaxed);
+        stats.unloaded_classes = unloaded_classes_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+}  // namespace profiler
@@ -0,0 +1,297 @@
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+#include "jvmti.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace profiler {
+
+    struct ClassSymbol {
+        // the class tag, stable for the lifetime of the class
+        jlong id;
+        std::string signature;
+    };
+
+    struct MethodSymbol {
+        // dense id handed out in resolution order, never reused
+        uint32_t id;
+        // tag of the declaring class (see ClassSymbol::id)
+        jlong class_id;
+        std::string name;
+        std::string signature;
+    };
+
+    /**
+     * Open addressing hash table from non-zero 64-bit keys to pointers.
+     *
+     * Readers never lock: a slot's value is published before its key, so a
+     * reader that sees the key also sees the value. Writers must be serialized
+     * by the caller. Removal keeps the key and clears the value, so the slot is
+     * reused if the same key comes back. Grown tables are kept until the table
+     * is destroyed (at most as much memory again as the live table), so a
+     * reader can never touch freed slots.
+     */
+    template<typename V>
+    class ConcurrentPtrTable {
+    public:
+        ConcurrentPtrTable() : table_(new Slots(kInitialCapacity)) {
+            tables_.emplace_back(table_.load());
+        }
+
+        ConcurrentPtrTable(const ConcurrentPtrTable &) = delete;
+
+        ConcurrentPtrTable &operator=(const ConcurrentPtrTable &) = delete;
+
+        V *Find(uint64_t key) const {
+            const Slots *slots = table_.load(std::memory_order_acquire);
+            for (size_t i = Hash(key) & slots->mask;; i = (i + 1) & slots->mask) {
+                uint64_t k = slots->keys[i].load(std::memory_order_acquire);
+                if (k == key) {
+                    return slots->values[i].load(std::memory_order_acquire);
+                }
+                if (k == 0) {
+                    return nullptr;
+                }
+            }
+        }
+
+        // Writer side, caller holds the writer lock. Returns the previous value.
+        V *Put(uint64_t key, V *value) {
+            Slots *slots = table_.load(std::memory_order_relaxed);
+            if ((slots->used + 1) * 2 > slots->capacity) {
+                slots = Grow(slots);
+            }
+            size_t i = Probe(slots, key);
+            V *previous = slots->values[i].load(std::memory_order_relaxed);
+            slots->values[i].store(value, std::memory_order_release);
+            if (slots->keys[i].load(std::memory_order_relaxed) == 0) {
+                slots->keys[i].store(key, std::memory_order_release);
+                ++slots->used;
+            }
+            return previous;
+        }
+
+        // Writer side, caller holds the writer lock. Returns the removed value.
+        V *Remove(uint64_t key) {
+            Slots *slots = table_.load(std::memory_order_relaxed);
+            size_t i = Probe(slots, key);
+            if (slots->keys[i].load(std::memory_order_relaxed) == 0) {
+                return nullptr;
+            }
+            return slots->values[i].exchange(nullptr, std::memory_order_acq_rel);
+        }
+
+    private:
+        static const size_t kInitialCapacity = 1024;
+
+        struct Slots {
+            explicit Slots(size_t cap)
+                    : capacity(cap), mask(cap - 1), used(0),
+                      keys(new std::atomic<uint64_t>[cap]),
+                      values(new std::atomic<V *>[cap]) {
+                for (size_t i = 0; i < cap; ++i) {
+                    keys[i].store(0, std::memory_order_relaxed);
+                    values[i].store(nullptr, std::memory_order_relaxed);
+                }
+            }
+
+            const size_t capacity;
+            const size_t mask;
+            size_t used;
+            std::unique_ptr<std::atomic<uint64_t>[]> keys;
+            std::unique_ptr<std::atomic<V *>[]> values;
+        };
+
+        static size_t Hash(uint64_t key) {
+            // Fibonacci hashing; pointers and sequential tags both spread well
+            return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 17);
+        }
+
+        static size_t Probe(const Slots *slots, uint64_t key) {
+            size_t i = Hash(key) & slots->mask;
+            for (;;) {
+                uint64_t k = slots->keys[i].load(std::memory_order_relaxed);
+                if (k == key || k == 0) {
+                    return i;
+                }
+                i = (i + 1) & slots->mask;
+            }
+        }
+
+        Slots *Grow(Slots *old_slots) {
+            size_t live = 0;
+            for (size_t i = 0; i < old_slots->capacity; ++i) {
+                if (old_slots->values[i].load(std::memory_order_relaxed) != nullptr) {
+                    ++live;
+                }
+            }
+            // removed entries are dropped, so the new table may not need to grow
+            size_t capacity = old_slots->capacity;
+            while ((live + 1) * 4 > capacity) {
+                capacity <<= 1;
+            }
+            Slots *slots = new Slots(capacity);
+            for (size_t i = 0; i < old_slots->capacity; ++i) {
+                V *value = old_slots->values[i].load(std::memory_order_relaxed);
+                if (value != nullptr) {
+                    uint64_t key = old_slots->keys[i].load(std::memory_order_relaxed);
+                    size_t j = Probe(slots, key);
+                    slots->values[j].store(value, std::memory_order_relaxed);
+                    slots->keys[j].store(key, std::memory_order_relaxed);
+                    ++slots->used;
+                }
+            }
+            tables_.emplace_back(slots);
+            table_.store(slots, std::memory_order_release);
+            return slots;
+        }
+
+        std::atomic<Slots *> table_;
+        // owns every table ever published, see the class comment
+        std::vector<std::unique_ptr<Slots>> tables_;
+    };
+
+    /**
+     * Process-wide table of resolved class and method symbols.
+     *
+     * Classes are identified by their JVMTI tag, assigned the first time a class
+     * is seen; methods are keyed by jmethodID. Names and signatures are resolved
+     * through JVMTI once and interned, after which a lookup is a single lock-free
+     * hash probe. Entries are invalidated when their class is freed (reported
+     * through the ObjectFree event), since the runtime may reuse a jmethodID
+     * afterwards.
+     */
+    class SymbolCache {
+    public:
+        struct Stats {
+            uint64_t class_hits;
+            uint64_t class_misses;
+            uint64_t method_hits;
+            uint64_t method_misses;
+            uint64_t unloaded_classes;
+        };
+
+        static SymbolCache &Instance();
+
+        SymbolCache(const SymbolCache &) = delete;
+
+        SymbolCache &operator=(const SymbolCache &) = delete;
+
+        /**
+         * Returns the id (tag) of |klass|, tagging and interning it the first
+         * time it is seen. Safe to call from any JVMTI callback that may use JNI.
+         * Returns 0 on failure.
+         */
+        jlong ClassId(jvmtiEnv *jvmti, jclass klass);
+
+        /**
+         * Returns one past the highest class id handed out so far.
+         */
+        jlong ClassTagLimit();
+
+        /**
+         * Returns the interned class for |class_id|, or nullptr if unknown.
+         */
+        const ClassSymbol *FindClass(jlong class_id) const {
+            return classes_.Find(static_cast<uint64_t>(class_id));
+        }
+
+        /**
+         * Returns the interned symbol of |method|, resolving it on a miss.
+         * Returns nullptr if the method can't be resolved (e.g. its class has
+         * been unloaded). The pointer stays valid until the next Reclaim().
+         */
+        const MethodSymbol *LookupMethod(jvmtiEnv *jvmti, JNIEnv *jni, jmethodID method);
+
+        /**
+         * Returns the id of a method instrumented with bytecode probes (see
+         * slicer::CallTraceProbes), interning it the first time. The id is
+         * taken from the same space as LookupMethod(), so probe events can be
+         * traced as method events. Probed methods are identified by name only:
+         * a class retransformed or loaded twice keeps the same ids, and the
+         * symbols are never reclaimed. Returns 0 once the ids are exhausted.
+         *
+         * The class id of the probes is the one of the class: its tag if the
+         * class is already tagged, otherwise the id is reserved and becomes
+         * the tag when ClassId() first sees a class with that signature, so
+         * a class never shows up in the trace under two ids.
+         */
+        uint32_t InternProbeMethod(const std::string &class_signature,
+                                   const std::string &name, const std::string &signature);
+
+        /**
+         * Returns the symbol of a probe id, or nullptr if unknown. Lock-free.
+         */
+        const MethodSymbol *FindProbeMethod(uint32_t probe_id) const {
+            return probe_methods_.Find(probe_id);
+        }
+
+        /**
+         * ObjectFree hook. Only queues the tag: JVMTI forbids almost every call
+         * from that callback, so the actual invalidation happens in Reclaim().
+         */
+        void OnTagFreed(jlong tag);
+
+        /**
+         * Invalidates the classes freed since the last call together with their
+         * methods, and deletes the symbols invalidated before the previous call.
+         * Must be called periodically from a single thread (the agent thread).
+         */
+        void Reclaim();
+
+        Stats GetStats() const;
+
+    private:
+        struct ClassIdEntry {
+            jlong id;
+            // a live class is tagged with |id|
+            bool tagged;
+        };
+
+        SymbolCache() = default;
+
+        ConcurrentPtrTable<ClassSymbol> classes_;
+        ConcurrentPtrTable<MethodSymbol> methods_;
+        ConcurrentPtrTable<MethodSymbol> probe_methods_;
+
+        // serializes writers of both tables and guards the fields below
+        std::mutex write_mutex_;
+        jlong next_class_tag_ = 1;
+        uint32_t next_method_id_ = 1;
+        // jmethodIDs interned per class, to invalidate them when it is freed
+        std::unordered_map<jlong, std::vector<jmethodID>> class_methods_;
+        // class ids by signature, the first class with a signature takes
+        // the id (see InternProbeMethod())
+        std::unordered_map<std::string, ClassIdEntry> class_ids_;
+        // ids of the classes with probed methods, their symbols are kept
+        std::unordered_set<jlong> probe_classes_;
+        // probed methods by name
+        std::unordered_map<std::string, uint32_t> probe_ids_;
+        // symbols removed from the tables, deleted by the next Reclaim()
+        std::vector<ClassSymbol *> dead_classes_;
+        std::vector<MethodSymbol *> dead_methods_;
+        // Reclaim()-only: symbols dead for a full Reclaim() period
+        std::vector<ClassSymbol *> reclaimable_classes_;
+        std::vector<MethodSymbol *> reclaimable_methods_;
+
+        std::mutex freed_mutex_;
+        std::vector<jlong> freed_tags_;
+
+        std::atomic<uint64_t> class_hits_{0};
+        std::atomic<uint64_t> class_misses_{0};
+        std::atomic<uint64_t> method_hits_{0};
+        std::atomic<uint64_t> method_misses_{0};
+        std::atomic<uint64_t> unloaded_classes_{0};
+    };
+
+}  // namespace profiler
+
+#endif  // SYMBOL_CACHE_H
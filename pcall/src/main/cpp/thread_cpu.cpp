@@ -0,0 +1,237 @@
+#include "thread_cpu.h"
+#include "clock.h"
+#include "jvmti_helper.h"
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // run period once the thread CPU times turned out to be unavailable
+    static const int64_t kIdlePeriodNs = 3600000000000LL;
+    static const char kTaskDir[] = "/proc/self/task";
+    static const size_t kLogTopCount = 5;
+
+    ThreadCpuSampler::ThreadCpuSampler(CapabilityPlanner *capabilities, int64_t period_ns)
+            : capabilities_(capabilities), period_ns_(period_ns) {}
+
+    int64_t ThreadCpuSampler::Run(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (!initialized_) {
+            initialized_ = true;
+            enabled_ = Init(jvmti, jni);
+        }
+        if (!enabled_) {
+            return kIdlePeriodNs;
+        }
+        int64_t now_ns = MonotonicNanos();
+        Sample(jvmti, jni);
+        Report(now_ns);
+        last_sample_ns_ = now_ns;
+        return period_ns_;
+    }
+
+    bool ThreadCpuSampler::Init(jvmtiEnv *jvmti, JNIEnv *jni) {
+        DIR *dir = opendir(kTaskDir);
+        if (dir != nullptr) {
+            closedir(dir);
+            return true;
+        }
+        use_jvmti_ = true;
+        return InitJvmti(jvmti, jni);
+    }
+
+    bool ThreadCpuSampler::InitJvmti(jvmtiEnv *jvmti, JNIEnv *jni) {
+        if (!capabilities_->Enable(jvmti, kFeatureThreadCpuTime)) {
+            LOGE("ThreadCpu: %s not readable and thread CPU time not available", kTaskDir);
+            return false;
+        }
+        ScopedLocalRef<jclass> thread_class(jni, jni->FindClass("java/lang/Thread"));
+        if (thread_class.get() != nullptr) {
+            get_id_ = jni->GetMethodID(thread_class.get(), "getId", "()J");
+        }
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionClear();
+        }
+        if (get_id_ == nullptr) {
+            LOGE("ThreadCpu: Thread.getId not found");
+            return false;
+        }
+        return true;
+    }
+
+    void ThreadCpuSampler::Sample(jvmtiEnv *jvmti, JNIEnv *jni) {
+        deltas_.clear();
+        // the threads running at the first sample have no previous one, it
+        // only sets their baseline; the later ones started since the
+        // previous sample and all of their time counts
+        bool baseline = generation_ == 0;
+        generation_++;
+        if (use_jvmti_) {
+            SampleJvmti(jvmti, jni, baseline);
+        } else if (!SampleTasks(baseline)) {
+            return;
+        }
+
+        for (auto it = threads_.begin(); it != threads_.end();) {
+            if (it->second.generation != generation_) {
+                it = threads_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool ThreadCpuSampler::SampleTasks(bool baseline) {
+        DIR *dir = opendir(kTaskDir);
+        if (dir == nullptr) {
+            return false;
+        }
+        char path[64];
+        char line[128];
+        struct dirent *task;
+        while ((task = readdir(dir)) != nullptr) {
+            char *end = nullptr;
+            long tid = strtol(task->d_name, &end, 10);
+            if (end == task->d_name || *end != '\0') {
+                continue;
+            }
+            // a thread that ended since the directory was read is just skipped
+            snprintf(path, sizeof(path), "%s/%ld/schedstat", kTaskDir, tid);
+            FILE *schedstat = fopen(path, "r");
+            if (schedstat == nullptr) {
+                continue;
+            }
+            bool read = fgets(line, sizeof(line), schedstat) != nullptr;
+            fclose(schedstat);
+            long long cpu_ns = 0;
+            if (read && sscanf(line, "%lld", &cpu_ns) == 1) {
+                ThreadEntry *entry = FindOrAddTask(tid);
+                if (cpu_ns < entry->cpu_ns) {
+                    // the tid of a thread gone since the previous sample, reused
+                    threads_.erase(tid);
+                    entry = FindOrAddTask(tid);
+                }
+                Account(entry, tid, cpu_ns, baseline);
+            }
+        }
+        closedir(dir);
+        return true;
+    }
+
+    void ThreadCpuSampler::SampleJvmti(jvmtiEnv *jvmti, JNIEnv *jni, bool baseline) {
+        jint thread_count = 0;
+        jthread *all_threads = nullptr;
+        if (CheckJvmtiError(jvmti, jvmti->GetAllThreads(&thread_count, &all_threads))) {
+            return;
+        }
+        for (jint i = 0; i < thread_count; ++i) {
+            jthread thread = all_threads[i];
+            jlong thread_id = jni->CallLongMethod(thread, get_id_);
+            jlong cpu_ns = 0;
+            // a thread that ended since GetAllThreads is just skipped
+            if (jni->ExceptionCheck()) {
+                jni->ExceptionClear();
+            } else if (jvmti->GetThreadCpuTime(thread, &cpu_ns) == JVMTI_ERROR_NONE) {
+                Account(FindOrAdd(jvmti, jni, thread, thread_id), thread_id, cpu_ns, baseline);
+            }
+            jni->DeleteLocalRef(thread);
+        }
+        Deallocate(jvmti, all_threads);
+    }
+
+    void ThreadCpuSampler::Account(ThreadEntry *entry, jlong thread_id, int64_t cpu_ns,
+                                   bool baseline) {
+        entry->generation = generation_;
+        int64_t delta_us = (cpu_ns - entry->cpu_ns) / 1000;
+        if (baseline) {
+            entry->cpu_ns = cpu_ns;
+        } else if (delta_us > 0) {
+            // the sub-microsecond rest is left for the next sample
+            entry->cpu_ns += delta_us * 1000;
+            deltas_.push_back({static_cast<uint32_t>(thread_id),
+                               static_cast<uint32_t>(std::min<int64_t>(
+                                       delta_us, std::numeric_limits<uint32_t>::max()))});
+        }
+    }
+
+    ThreadCpuSampler::ThreadEntry *ThreadCpuSampler::FindOrAdd(jvmtiEnv *jvmti, JNIEnv *jni,
+                                                               jthread thread, jlong thread_id) {
+        auto it = threads_.find(thread_id);
+        if (it != threads_.end()) {
+            return &it->second;
+        }
+        ThreadEntry &entry = threads_[thread_id];
+        entry.cpu_ns = 0;
+        jvmtiThreadInfo thread_info;
+        if (!CheckJvmtiError(jvmti, jvmti->GetThreadInfo(thread, &thread_info))) {
+            if (thread_info.name != nullptr) {
+                entry.name = thread_info.name;
+            }
+            Deallocate(jvmti, thread_info.name);
+            jni->DeleteLocalRef(thread_info.thread_group);
+            jni->DeleteLocalRef(thread_info.context_class_loader);
+        }
+        DefineThread(thread_id, entry);
+        return &entry;
+    }
+
+    ThreadCpuSampler::ThreadEntry *ThreadCpuSampler::FindOrAddTask(jlong tid) {
+        auto it = threads_.find(tid);
+        if (it != threads_.end()) {
+            return &it->second;
+        }
+        ThreadEntry &entry = threads_[tid];
+        entry.cpu_ns = 0;
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%lld/comm", kTaskDir, static_cast<long long>(tid));
+        FILE *comm = fopen(path, "r");
+        if (comm != nullptr) {
+            char name[32] = {};
+            if (fgets(name, sizeof(name), comm) != nullptr) {
+                entry.name.assign(name, strcspn(name, "\n"));
+            }
+            fclose(comm);
+        }
+        DefineThread(tid, entry);
+        return &entry;
+    }
+
+    void ThreadCpuSampler::DefineThread(jlong thread_id, const ThreadEntry &entry) {
+        TraceWriter *trace = EventPipeline::Instance().Trace();
+        if (trace != nullptr) {
+            trace->DefineThread(static_cast<uint32_t>(thread_id), entry.name);
+        }
+    }
+
+    void ThreadCpuSampler::Report(int64_t timestamp_ns) {
+        TraceWriter *trace = EventPipeline::Instance().Trace();
+        if (trace != nullptr) {
+            // written even when empty, the first one marks where the
+            // deltas of the next one start
+            trace->AddThreadCpu(timestamp_ns, deltas_);
+        } else if (last_sample_ns_ != 0) {
+            LogTop(timestamp_ns - last_sample_ns_);
+        }
+    }
+
+    void ThreadCpuSampler::LogTop(int64_t elapsed_ns) {
+        size_t count = std::min(deltas_.size(), kLogTopCount);
+        std::partial_sort(deltas_.begin(), deltas_.begin() + count, deltas_.end(),
+                          [](const ThreadCpuTime &a, const ThreadCpuTime &b) {
+                              return a.cpu_us > b.cpu_us;
+                          });
+        for (size_t i = 0; i < count; ++i) {
+            const ThreadCpuTime &delta = deltas_[i];
+            auto it = threads_.find(delta.thread_id);
+            LOGE("ThreadCpu: %5.1f%% %.2f ms thread %" PRIu32 " %s",
+                 delta.cpu_us * 1e5 / elapsed_ns, delta.cpu_us / 1e3, delta.thread_id,
+                 it != threads_.end() ? it->second.name.c_str() : "?");
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,96 @@
+#ifndef THREAD_CPU_H
+#define THREAD_CPU_H
+
+#include "capability_planner.h"
+#include "event_pipeline.h"
+#include "jvmti.h"
+#include "trace_writer.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Samples the CPU time of every live thread on the agent thread, every
+     * |period_ns|. The CPU time consumed since the previous sample goes to
+     * the trace (see kChunkThreadCpu), or the busiest threads to the log
+     * when there is no trace file.
+     *
+     * ART doesn't offer can_get_thread_cpu_time (its GetThreadCpuTime
+     * isn't implemented), so the times are read from the kernel: the first
+     * field of /proc/self/task/<tid>/schedstat, the nanoseconds the thread
+     * ran, for every task of the process (native threads included). Threads
+     * are then keyed by their kernel id, the one of the event records, and
+     * named after /proc/self/task/<tid>/comm (the runtime copies the Java
+     * name there, truncated to 15 characters). A tid whose time went
+     * backwards was reused by a new thread and starts over.
+     *
+     * Where /proc/self/task can't be read, the JVMTI functions are the
+     * fallback: GetAllThreads, then Thread.getId() and GetThreadCpuTime for
+     * each of them, keyed by Java id, and named with GetThreadInfo.
+     *
+     * Either way the name is fetched the first time a thread is seen (a
+     * later rename is not picked up) and the entries of the threads gone
+     * since the previous sample are dropped, so a sample costs a few calls
+     * per live thread and no allocation past the first one of a thread.
+     */
+    class ThreadCpuSampler : public PeriodicTask {
+    public:
+        ThreadCpuSampler(CapabilityPlanner *capabilities, int64_t period_ns);
+
+        int64_t Run(jvmtiEnv *jvmti, JNIEnv *jni) override;
+
+    private:
+        struct ThreadEntry {
+            std::string name;
+            int64_t cpu_ns;
+            // sample that last saw the thread alive
+            uint64_t generation;
+        };
+
+        bool Init(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        bool InitJvmti(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        void Sample(jvmtiEnv *jvmti, JNIEnv *jni);
+
+        // Samples from /proc/self/task, returns false if it can't be read
+        bool SampleTasks(bool baseline);
+
+        void SampleJvmti(jvmtiEnv *jvmti, JNIEnv *jni, bool baseline);
+
+        // Accounts for the CPU time |cpu_ns| of the thread |entry|
+        void Account(ThreadEntry *entry, jlong thread_id, int64_t cpu_ns, bool baseline);
+
+        ThreadEntry *FindOrAdd(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jlong thread_id);
+
+        ThreadEntry *FindOrAddTask(jlong tid);
+
+        // Declares the thread to the trace, if there is one
+        static void DefineThread(jlong thread_id, const ThreadEntry &entry);
+
+        void Report(int64_t timestamp_ns);
+
+        void LogTop(int64_t elapsed_ns);
+
+        CapabilityPlanner *const capabilities_;
+        const int64_t period_ns_;
+        bool initialized_ = false;
+        bool enabled_ = false;
+        // the times come from GetThreadCpuTime instead of /proc/self/task
+        bool use_jvmti_ = false;
+        jmethodID get_id_ = nullptr;
+
+        std::unordered_map<jlong, ThreadEntry> threads_;
+        uint64_t generation_ = 0;
+        int64_t last_sample_ns_ = 0;
+        // CPU time of the threads since the previous sample, reused
+        std::vector<ThreadCpuTime> deltas_;
+    };
+
+}  // namespace profiler
+
+#endif  // THREAD_CPU_H
@@ -0,0 +1,158 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+
+/**
+ * Binary trace file layout, shared by the agent (TraceWriter) and the host
+ * side decoder. All fixed-width integers are little endian, "uleb"/"sleb" are
+ * the dex LEB128 encodings (32-bit, see slicer/dex_leb128.h) and a "string"
+ * is a uleb byte length followed by the MUTF-8 bytes, without terminator.
+ *
+ *   header : u4 magic, u2 version, u2 ts_shift, u8 start_ns
+ *   chunk* : u1 type, u4 payload size, payload
+ *
+ * Chunk payloads:
+ *
+ *   kChunkClasses : { uleb class_id, string signature }*
+ *   kChunkMethods : { uleb method_id, uleb class_id, string name, string signature }*
+ *   kChunkEvents  : uleb thread_id, u8 base_ticks, record*
+ *   kChunkStacks  : { uleb node_id, uleb parent_node_id, uleb method_id }*
+ *   kChunkSamples : u8 ticks, { uleb node_id, uleb count }*
+ *   kChunkAllocSites  : { uleb site_id, uleb method_id, uleb dex_pc, string type }*
+ *   kChunkAllocCounts : u8 ticks, { uleb site_id, uleb count, uleb bytes }*
+ *   kChunkHeapHistogram : u8 ticks, uleb heap_count, string heap_name*,
+ *                         { uleb class_id, uleb heap, uleb count, uleb bytes }*
+ *   kChunkMonitorHistograms : u8 ticks, uleb sub_bucket_bits,
+ *                             { uleb monitor_kind, uleb class_id, uleb method_id,
+ *                               uleb dex_pc, uleb bucket_count,
+ *                               { uleb bucket, uleb count }* }*
+ *   kChunkGcPauses : u8 base_ticks,
+ *                    { uleb start_delta_ticks, uleb pause_us, uleb heap_before_kb,
+ *                      uleb heap_after_kb }*
+ *   kChunkThreadNames : { uleb thread_id, string name }*
+ *   kChunkThreadCpu   : u8 ticks, { uleb thread_id, uleb cpu_us }*
+ *   kChunkExceptionSites  : { uleb site_id, uleb class_id, uleb method_id, uleb location }*
+ *   kChunkExceptionCounts : u8 ticks, { uleb site_id, uleb count }*
+ *   kChunkExceptionStacks : u8 ticks, { uleb site_id, uleb count, uleb depth,
+ *                                       uleb method_id* }*
+ *   kChunkClassTimes : u8 ticks, { string signature, uleb transform_us, uleb clinit_us,
+ *                                  uleb clinit_self_us }*
+ *
+ * Timestamps are stored in ticks of (1 << ts_shift) nanoseconds relative to
+ * start_ns. Within an events chunk every record starts with the uleb tick delta
+ * to the previous record (the first one is relative to base_ticks), followed by
+ * a uleb tag:
+ *
+ *   tag != 0 : method event, method_id = tag >> 1, exit = tag & 1
+ *   tag == 0 : extended event, followed by uleb kind, uleb id, sleb arg
+ *
+ * Sampled stacks are deduplicated into a trie whose nodes are defined by stack
+ * chunks; node ids start at 1 and parent 0 is the root. A samples chunk holds
+ * the number of samples taken since the previous one, per leaf node, as of
+ * |ticks|.
+ *
+ * Allocation sites (see AllocationSites) are the allocating instructions of
+ * the methods instrumented with allocation probes: the method, the dex pc of
+ * the instruction and the descriptor of the allocated type. An allocation
+ * counts chunk holds, per site, the allocations and the estimated array
+ * bytes since the previous one, as of |ticks|.
+ *
+ * A heap histogram holds the live objects and their shallow size, per class
+ * and heap (an index in the heap names of the chunk), from a walk of the
+ * whole heap at |ticks|. Class 0 counts the objects of untagged classes.
+ *
+ * A monitor histograms chunk holds wait time histograms (see
+ * LatencyHistogram, the bucket layout follows from sub_bucket_bits) of
+ * contended monitor entries and Object.wait calls, per monitor class
+ * (method_id 0) and per call site (class_id 0), cumulative since the agent
+ * started. Only the histograms updated since the previous chunk are
+ * written, the latest row of a key supersedes the earlier ones.
+ *
+ * A GC pauses chunk lists collections in start order, each start relative
+ * to the previous one (the first to base_ticks), with the heap usage the
+ * agent sampled before and after it.
+ *
+ * The thread CPU chunks hold the CPU time each thread used since the
+ * previous chunk (the threads that used none are left out), as of |ticks|;
+ * the first one has no previous chunk and is empty. Their thread ids are
+ * java.lang.Thread ids, named by the thread names chunks, unrelated to the
+ * kernel thread ids of the events chunks.
+ *
+ * An exception site is where exceptions were thrown: the class of the
+ * exception (0 if untagged), the throwing method (0 if it couldn't be
+ * resolved) and its location. An exception counts chunk holds, per site,
+ * the exceptions thrown since the previous one. An exception stacks chunk
+ * holds the stacks sampled since the previous one (see ExceptionHotSpots),
+ * innermost frame first, with the number of times each was captured.
+ *
+ * A class times chunk holds, per instrumented class (see ClassTimeline),
+ * the time spent transforming it in the ClassFileLoadHook and in its static
+ * initializer, nested initializers included and not (self), cumulative
+ * since the agent started. Only the classes updated since the previous
+ * chunk are written, the latest row of a class supersedes the earlier ones.
+ * The load to prepare interval of a class follows from its ClassLoad and
+ * ClassPrepare events.
+ *
+ * Every id used by an events chunk is defined by a table chunk placed before
+ * it. A reader must tolerate a truncated last chunk (the process may die
+ * while the trace is being written) and skip chunk types it doesn't know.
+ */
+
+namespace profiler {
+
+    // Event kinds are persisted by the extended trace records, so their values
+    // must never change; new kinds go at the end.
+    enum EventKind : uint16_t {
+        kEventNone = 0,
+        kEventMethodEntry,
+        kEventMethodExit,
+        kEventSingleStep,
+        kEventClassLoad,
+        kEventClassPrepare,
+        kEventObjectAlloc,
+        // bytecode probes (see slicer::CallTraceProbes), traced as method events
+        kEventProbeEntry,
+        kEventProbeExit,
+        // id = method id of the catching frame, arg = catch location
+        kEventExceptionCatch,
+    };
+
+    // Monitor wait kinds, persisted by the monitor histograms chunks
+    enum MonitorWaitKind : uint8_t {
+        // blocked entering a monitor held by another thread
+        kMonitorContended = 1,
+        // Object.wait, until notified or timed out
+        kMonitorWait = 2,
+    };
+
+    static const uint32_t kTraceMagic = 0x52544350;  // "PCTR"
+    static const uint16_t kTraceVersion = 1;
+    // ~1us ticks keep most deltas in a single LEB128 byte
+    static const uint16_t kTraceDefaultTsShift = 10;
+
+    static const uint32_t kTraceHeaderSize = 16;
+    static const uint32_t kTraceChunkHeaderSize = 5;
+
+    enum TraceChunkType : uint8_t {
+        kChunkClasses = 1,
+        kChunkMethods = 2,
+        kChunkEvents = 3,
+        kChunkStacks = 4,
+        kChunkSamples = 5,
+        kChunkAllocSites = 6,
+        kChunkAllocCounts = 7,
+        kChunkHeapHistogram = 8,
+        kChunkMonitorHistograms = 9,
+        kChunkGcPauses = 10,
+        kChunkThreadNames = 11,
+        kChunkThreadCpu = 12,
+        kChunkExceptionSites = 13,
+        kChunkExceptionCounts = 14,
+        kChunkExceptionStacks = 15,
+        kChunkClassTimes = 16,
+    };
+
+}  // namespace profiler
+
+#endif  // TRACE_FORMAT_H
@@ -0,0 +1,419 @@
+#include "trace_writer.h"
+#include "slicer/dex_leb128.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace profiler {
+
+    // a thread's pending chunk is written out once it reaches this size
+    static const size_t kMaxChunkSize = 32 * 1024;
+    // room for the largest record: two tags, a kind, an id and an arg
+    static const size_t kMaxRecordSize = 5 * 5;
+
+    static void PushFixed(std::vector<uint8_t> &out, uint64_t value, int size) {
+        for (int i = 0; i < size; ++i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void TraceWriter::PushULeb128(std::vector<uint8_t> &out, uint32_t value) {
+        dex::u1 tmp[5];
+        dex::u1 *end = dex::WriteULeb128(tmp, value);
+        out.insert(out.end(), tmp, end);
+    }
+
+    void TraceWriter::PushSLeb128(std::vector<uint8_t> &out, int32_t value) {
+        dex::u1 tmp[5];
+        dex::u1 *end = dex::WriteSLeb128(tmp, value);
+        out.insert(out.end(), tmp, end);
+    }
+
+    void TraceWriter::PushString(std::vector<uint8_t> &out, const std::string &value) {
+        PushULeb128(out, static_cast<uint32_t>(value.size()));
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    bool TraceWriter::Open(const std::string &path, int64_t start_ns, uint16_t ts_shift) {
+        Close();
+        file_ = fopen(path.c_str(), "wb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        start_ns_ = start_ns;
+        ts_shift_ = ts_shift;
+        bytes_written_ = 0;
+
+        std::vector<uint8_t> header;
+        PushFixed(header, kTraceMagic, 4);
+        PushFixed(header, kTraceVersion, 2);
+        PushFixed(header, ts_shift, 2);
+        PushFixed(header, static_cast<uint64_t>(start_ns), 8);
+        fwrite(header.data(), 1, header.size(), file_);
+        bytes_written_ += header.size();
+        return true;
+    }
+
+    bool TraceWriter::HasClass(uint32_t class_id) const {
+        return class_id < defined_classes_.size() && defined_classes_[class_id];
+    }
+
+    bool TraceWriter::HasMethod(uint32_t method_id) const {
+        return method_id < defined_methods_.size() && defined_methods_[method_id];
+    }
+
+    void TraceWriter::DefineClass(uint32_t class_id, const std::string &signature) {
+        if (class_id >= defined_classes_.size()) {
+            defined_classes_.resize(class_id + 1);
+        }
+        defined_classes_[class_id] = true;
+        PushULeb128(pending_classes_, class_id);
+        PushString(pending_classes_, signature);
+    }
+
+    void TraceWriter::DefineMethod(uint32_t method_id, uint32_t class_id,
+                                   const std::string &name, const std::string &signature) {
+        if (method_id >= defined_methods_.size()) {
+            defined_methods_.resize(method_id + 1);
+        }
+        defined_methods_[method_id] = true;
+        PushULeb128(pending_methods_, method_id);
+        PushULeb128(pending_methods_, class_id);
+        PushString(pending_methods_, name);
+        PushString(pending_methods_, signature);
+    }
+
+    void TraceWriter::DefineStackNode(uint32_t node_id, uint32_t parent_id, uint32_t method_id) {
+        PushULeb128(pending_stacks_, node_id);
+        PushULeb128(pending_stacks_, parent_id);
+        PushULeb128(pending_stacks_, method_id);
+    }
+
+    void TraceWriter::AddStackSamples(int64_t timestamp_ns,
+                                      const std::vector<std::pair<uint32_t, uint32_t>> &counts) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const auto &count : counts) {
+            PushULeb128(payload, count.first);
+            PushULeb128(payload, count.second);
+        }
+        WriteChunk(kChunkSamples, payload);
+    }
+
+    void TraceWriter::DefineAllocSite(uint32_t site_id, uint32_t method_id, uint32_t dex_pc,
+                                      const std::string &type) {
+        PushULeb128(pending_alloc_sites_, site_id);
+        PushULeb128(pending_alloc_sites_, method_id);
+        PushULeb128(pending_alloc_sites_, dex_pc);
+        PushString(pending_alloc_sites_, type);
+    }
+
+    void TraceWriter::AddAllocCounts(int64_t timestamp_ns,
+                                     const std::vector<AllocSiteCount> &counts) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const AllocSiteCount &count : counts) {
+            PushULeb128(payload, count.site_id);
+            PushULeb128(payload, count.count);
+            PushULeb128(payload, count.bytes);
+        }
+        WriteChunk(kChunkAllocCounts, payload);
+    }
+
+    void TraceWriter::AddHeapHistogram(int64_t timestamp_ns,
+                                       const std::vector<std::string> &heap_names,
+                                       const std::vector<HeapClassCount> &counts) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        PushULeb128(payload, static_cast<uint32_t>(heap_names.size()));
+        for (const std::string &name : heap_names) {
+            PushString(payload, name);
+        }
+        for (const HeapClassCount &count : counts) {
+            PushULeb128(payload, count.class_id);
+            PushULeb128(payload, count.heap);
+            // a single class never holds 4G objects or bytes on a device
+            PushULeb128(payload, static_cast<uint32_t>(
+                    std::min<uint64_t>(count.count, std::numeric_limits<uint32_t>::max())));
+            PushULeb128(payload, static_cast<uint32_t>(
+                    std::min<uint64_t>(count.bytes, std::numeric_limits<uint32_t>::max())));
+        }
+        WriteChunk(kChunkHeapHistogram, payload);
+    }
+
+    void TraceWriter::AddMonitorHistograms(int64_t timestamp_ns,
+                                           const std::vector<MonitorHistogramRow> &rows) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        PushULeb128(payload, LatencyHistogram::kSubBucketBits);
+        for (const MonitorHistogramRow &row : rows) {
+            PushULeb128(payload, row.kind);
+            PushULeb128(payload, row.class_id);
+            PushULeb128(payload, row.method_id);
+            PushULeb128(payload, row.dex_pc);
+            uint32_t bucket_count = 0;
+            for (uint32_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+                bucket_count += row.histogram->BucketCount(i) != 0;
+            }
+            PushULeb128(payload, bucket_count);
+            for (uint32_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+                uint64_t count = row.histogram->BucketCount(i);
+                if (count != 0) {
+                    PushULeb128(payload, i);
+                    PushULeb128(payload, static_cast<uint32_t>(
+                            std::min<uint64_t>(count, std::numeric_limits<uint32_t>::max())));
+                }
+            }
+        }
+        WriteChunk(kChunkMonitorHistograms, payload);
+    }
+
+    void TraceWriter::AddGcPauses(const GcPause *pauses, size_t count) {
+        if (file_ == nullptr || count == 0) {
+            return;
+        }
+        std::vector<uint8_t> payload;
+        uint64_t last_ticks = Ticks(pauses[0].start_ns);
+        PushFixed(payload, last_ticks, 8);
+        for (size_t i = 0; i < count; ++i) {
+            const GcPause &pause = pauses[i];
+            uint64_t ticks = std::max(Ticks(pause.start_ns), last_ticks);
+            PushULeb128(payload, static_cast<uint32_t>(
+                    std::min<uint64_t>(ticks - last_ticks, std::numeric_limits<uint32_t>::max())));
+            last_ticks = ticks;
+            PushULeb128(payload, pause.pause_us);
+            PushULeb128(payload, pause.heap_before_kb);
+            PushULeb128(payload, pause.heap_after_kb);
+        }
+        WriteChunk(kChunkGcPauses, payload);
+    }
+
+    void TraceWriter::DefineThread(uint32_t thread_id, const std::string &name) {
+        PushULeb128(pending_threads_, thread_id);
+        PushString(pending_threads_, name);
+    }
+
+    void TraceWriter::AddThreadCpu(int64_t timestamp_ns,
+                                   const std::vector<ThreadCpuTime> &times) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const ThreadCpuTime &time : times) {
+            PushULeb128(payload, time.thread_id);
+            PushULeb128(payload, time.cpu_us);
+        }
+        WriteChunk(kChunkThreadCpu, payload);
+    }
+
+    void TraceWriter::DefineExceptionSite(uint32_t site_id, uint32_t class_id, uint32_t method_id,
+                                          uint32_t location) {
+        PushULeb128(pending_exception_sites_, site_id);
+        PushULeb128(pending_exception_sites_, class_id);
+        PushULeb128(pending_exception_sites_, method_id);
+        PushULeb128(pending_exception_sites_, location);
+    }
+
+    void TraceWriter::AddExceptionCounts(int64_t timestamp_ns,
+                                         const std::vector<ExceptionSiteCount> &counts) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const ExceptionSiteCount &count : counts) {
+            PushULeb128(payload, count.site_id);
+            PushULeb128(payload, count.count);
+        }
+        WriteChunk(kChunkExceptionCounts, payload);
+    }
+
+    void TraceWriter::AddExceptionStacks(int64_t timestamp_ns,
+                                         const std::vector<ExceptionStackCount> &stacks) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const ExceptionStackCount &stack : stacks) {
+            PushULeb128(payload, stack.site_id);
+            PushULeb128(payload, stack.count);
+            PushULeb128(payload, static_cast<uint32_t>(stack.frames->size()));
+            for (uint32_t method_id : *stack.frames) {
+                PushULeb128(payload, method_id);
+            }
+        }
+        WriteChunk(kChunkExceptionStacks, payload);
+    }
+
+    void TraceWriter::AddClassTimes(int64_t timestamp_ns, const std::vector<ClassTimesRow> &rows) {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        std::vector<uint8_t> payload;
+        PushFixed(payload, Ticks(timestamp_ns), 8);
+        for (const ClassTimesRow &row : rows) {
+            PushString(payload, *row.signature);
+            PushULeb128(payload, row.transform_us);
+            PushULeb128(payload, row.clinit_us);
+            PushULeb128(payload, row.clinit_self_us);
+        }
+        WriteChunk(kChunkClassTimes, payload);
+    }
+
+    uint64_t TraceWriter::Ticks(int64_t timestamp_ns) const {
+        return timestamp_ns > start_ns_
+               ? static_cast<uint64_t>(timestamp_ns - start_ns_) >> ts_shift_ : 0;
+    }
+
+    TraceWriter::ThreadChunk &TraceWriter::BeginRecord(int32_t thread_id, int64_t timestamp_ns) {
+        ThreadChunk &chunk = threads_[thread_id];
+        uint64_t ticks = Ticks(timestamp_ns);
+        if (chunk.has_base && ticks > chunk.last_ticks &&
+            ticks - chunk.last_ticks > std::numeric_limits<uint32_t>::max()) {
+            // the delta doesn't fit a 32-bit LEB128, restart from a new base
+            FlushThread(thread_id, chunk);
+        }
+        if (!chunk.has_base) {
+            chunk.data.reserve(kMaxChunkSize + kMaxRecordSize);
+            PushULeb128(chunk.data, static_cast<uint32_t>(thread_id));
+            PushFixed(chunk.data, ticks, 8);
+            chunk.last_ticks = ticks;
+            chunk.has_base = true;
+        }
+        // records of a thread are in order, only clamp clock skew at start_ns
+        uint64_t delta = ticks > chunk.last_ticks ? ticks - chunk.last_ticks : 0;
+        PushULeb128(chunk.data, static_cast<uint32_t>(delta));
+        chunk.last_ticks += delta;
+        return chunk;
+    }
+
+    void TraceWriter::EndRecord(int32_t thread_id, ThreadChunk &chunk) {
+        if (chunk.data.size() >= kMaxChunkSize) {
+            FlushThread(thread_id, chunk);
+        }
+    }
+
+    void TraceWriter::AddMethodEvent(int32_t thread_id, int64_t timestamp_ns,
+                                     uint32_t method_id, bool exit) {
+        if (file_ == nullptr) {
+            return;
+        }
+        ThreadChunk &chunk = BeginRecord(thread_id, timestamp_ns);
+        PushULeb128(chunk.data, (method_id << 1) | (exit ? 1 : 0));
+        EndRecord(thread_id, chunk);
+    }
+
+    void TraceWriter::AddEvent(int32_t thread_id, int64_t timestamp_ns,
+                               EventKind kind, uint32_t id, int32_t arg) {
+        if (file_ == nullptr) {
+            return;
+        }
+        ThreadChunk &chunk = BeginRecord(thread_id, timestamp_ns);
+        PushULeb128(chunk.data, 0);
+        PushULeb128(chunk.data, kind);
+        PushULeb128(chunk.data, id);
+        PushSLeb128(chunk.data, arg);
+        EndRecord(thread_id, chunk);
+    }
+
+    void TraceWriter::FlushThread(int32_t thread_id, ThreadChunk &chunk) {
+        if (!chunk.has_base) {
+            return;
+        }
+        // the tables must precede any chunk that references them
+        FlushTables();
+        WriteChunk(kChunkEvents, chunk.data);
+        chunk.data.clear();
+        chunk.has_base = false;
+    }
+
+    void TraceWriter::FlushTables() {
+        if (!pending_classes_.empty()) {
+            WriteChunk(kChunkClasses, pending_classes_);
+            pending_classes_.clear();
+        }
+        if (!pending_methods_.empty()) {
+            WriteChunk(kChunkMethods, pending_methods_);
+            pending_methods_.clear();
+        }
+        // stack nodes reference methods
+        if (!pending_stacks_.empty()) {
+            WriteChunk(kChunkStacks, pending_stacks_);
+            pending_stacks_.clear();
+        }
+        // so do allocation sites
+        if (!pending_alloc_sites_.empty()) {
+            WriteChunk(kChunkAllocSites, pending_alloc_sites_);
+            pending_alloc_sites_.clear();
+        }
+        if (!pending_threads_.empty()) {
+            WriteChunk(kChunkThreadNames, pending_threads_);
+            pending_threads_.clear();
+        }
+        // exception sites reference classes and methods
+        if (!pending_exception_sites_.empty()) {
+            WriteChunk(kChunkExceptionSites, pending_exception_sites_);
+            pending_exception_sites_.clear();
+        }
+    }
+
+    void TraceWriter::WriteChunk(TraceChunkType type, const std::vector<uint8_t> &payload) {
+        uint8_t header[kTraceChunkHeaderSize];
+        header[0] = type;
+        uint32_t size = static_cast<uint32_t>(payload.size());
+        for (int i = 0; i < 4; ++i) {
+            header[1 + i] = static_cast<uint8_t>(size >> (8 * i));
+        }
+        fwrite(header, 1, sizeof(header), file_);
+        fwrite(payload.data(), 1, payload.size(), file_);
+        bytes_written_ += sizeof(header) + payload.size();
+    }
+
+    void TraceWriter::Flush() {
+        if (file_ == nullptr) {
+            return;
+        }
+        FlushTables();
+        for (auto &entry : threads_) {
+            FlushThread(entry.first, entry.second);
+        }
+        // forget the threads seen so far, most of them are probably gone
+        threads_.clear();
+        fflush(file_);
+    }
+
+    void TraceWriter::Close() {
+        if (file_ == nullptr) {
+            return;
+        }
+        Flush();
+        fclose(file_);
+        file_ = nullptr;
+        threads_.clear();
+        defined_classes_.clear();
+        defined_methods_.clear();
+    }
+
+}  // namespace profiler
@@ -0,0 +1,237 @@
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include "latency_histogram.h"
+#include "trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace profiler {
+
+    struct AllocSiteCount {
+        uint32_t site_id;
+        uint32_t count;
+        uint32_t bytes;
+    };
+
+    struct HeapClassCount {
+        uint32_t class_id;
+        uint32_t heap;
+        uint64_t count;
+        uint64_t bytes;
+    };
+
+    struct GcPause {
+        int64_t start_ns;
+        uint32_t pause_us;
+        // heap usage sampled around the collection, in KB (see GcTimelineTask)
+        uint32_t heap_before_kb;
+        uint32_t heap_after_kb;
+    };
+
+    struct ThreadCpuTime {
+        // kernel thread id, or java.lang.Thread id when the sampler falls
+        // back to JVMTI (see ThreadCpuSampler)
+        uint32_t thread_id;
+        uint32_t cpu_us;
+    };
+
+    struct ExceptionSiteCount {
+        uint32_t site_id;
+        uint32_t count;
+    };
+
+    struct ExceptionStackCount {
+        uint32_t site_id;
+        uint32_t count;
+        // method ids, innermost frame first
+        const std::vector<uint32_t> *frames;
+    };
+
+    struct ClassTimesRow {
+        const std::string *signature;
+        uint32_t transform_us;
+        uint32_t clinit_us;
+        uint32_t clinit_self_us;
+    };
+
+    struct MonitorHistogramRow {
+        MonitorWaitKind kind;
+        // per monitor class rows have no method, per call site rows no class
+        uint32_t class_id;
+        uint32_t method_id;
+        uint32_t dex_pc;
+        const LatencyHistogram *histogram;
+    };
+
+    /**
+     * Streaming writer for the binary trace format (see trace_format.h).
+     *
+     * Events are appended to one pending chunk per thread; a chunk is written
+     * out, preceded by the classes and methods it references, once it grows
+     * past a size threshold or on Flush(). Not thread safe: owned by the
+     * agent thread.
+     */
+    class TraceWriter {
+    public:
+        TraceWriter() = default;
+
+        ~TraceWriter() { Close(); }
+
+        TraceWriter(const TraceWriter &) = delete;
+
+        TraceWriter &operator=(const TraceWriter &) = delete;
+
+        /**
+         * Creates |path| and writes the file header. Event timestamps earlier
+         * than |start_ns| are clamped to it.
+         */
+        bool Open(const std::string &path, int64_t start_ns,
+                  uint16_t ts_shift = kTraceDefaultTsShift);
+
+        bool IsOpen() const { return file_ != nullptr; }
+
+        /**
+         * Returns true if the class/method id has already been defined.
+         */
+        bool HasClass(uint32_t class_id) const;
+
+        bool HasMethod(uint32_t method_id) const;
+
+        void DefineClass(uint32_t class_id, const std::string &signature);
+
+        void DefineMethod(uint32_t method_id, uint32_t class_id,
+                          const std::string &name, const std::string &signature);
+
+        void AddMethodEvent(int32_t thread_id, int64_t timestamp_ns,
+                            uint32_t method_id, bool exit);
+
+        void AddEvent(int32_t thread_id, int64_t timestamp_ns,
+                      EventKind kind, uint32_t id, int32_t arg);
+
+        void DefineStackNode(uint32_t node_id, uint32_t parent_id, uint32_t method_id);
+
+        /**
+         * Writes a samples chunk with |counts| as (leaf node, samples) pairs,
+         * preceded by the pending definitions.
+         */
+        void AddStackSamples(int64_t timestamp_ns,
+                             const std::vector<std::pair<uint32_t, uint32_t>> &counts);
+
+        void DefineAllocSite(uint32_t site_id, uint32_t method_id, uint32_t dex_pc,
+                             const std::string &type);
+
+        /**
+         * Writes an allocation counts chunk, preceded by the pending
+         * definitions.
+         */
+        void AddAllocCounts(int64_t timestamp_ns, const std::vector<AllocSiteCount> &counts);
+
+        /**
+         * Writes a heap histogram chunk, preceded by the pending definitions.
+         * |counts| reference the heaps by index in |heap_names|.
+         */
+        void AddHeapHistogram(int64_t timestamp_ns, const std::vector<std::string> &heap_names,
+                              const std::vector<HeapClassCount> &counts);
+
+        /**
+         * Writes a monitor histograms chunk, preceded by the pending
+         * definitions.
+         */
+        void AddMonitorHistograms(int64_t timestamp_ns,
+                                  const std::vector<MonitorHistogramRow> &rows);
+
+        /**
+         * Writes a GC pauses chunk with |count| pauses from |pauses|, in
+         * start order.
+         */
+        void AddGcPauses(const GcPause *pauses, size_t count);
+
+        void DefineThread(uint32_t thread_id, const std::string &name);
+
+        void DefineExceptionSite(uint32_t site_id, uint32_t class_id, uint32_t method_id,
+                                 uint32_t location);
+
+        /**
+         * Writes an exception counts chunk, preceded by the pending
+         * definitions.
+         */
+        void AddExceptionCounts(int64_t timestamp_ns, const std::vector<ExceptionSiteCount> &counts);
+
+        /**
+         * Writes an exception stacks chunk, preceded by the pending
+         * definitions.
+         */
+        void AddExceptionStacks(int64_t timestamp_ns,
+                                const std::vector<ExceptionStackCount> &stacks);
+
+        /**
+         * Writes a thread CPU chunk with the CPU time of |times| since the
+         * previous one, preceded by the pending definitions.
+         */
+        void AddThreadCpu(int64_t timestamp_ns, const std::vector<ThreadCpuTime> &times);
+
+        /**
+         * Writes a class times chunk, preceded by the pending definitions.
+         */
+        void AddClassTimes(int64_t timestamp_ns, const std::vector<ClassTimesRow> &rows);
+
+        /**
+         * Writes every pending chunk.
+         */
+        void Flush();
+
+        void Close();
+
+        uint64_t BytesWritten() const { return bytes_written_; }
+
+    private:
+        struct ThreadChunk {
+            std::vector<uint8_t> data;
+            uint64_t last_ticks = 0;
+            bool has_base = false;
+        };
+
+        uint64_t Ticks(int64_t timestamp_ns) const;
+
+        ThreadChunk &BeginRecord(int32_t thread_id, int64_t timestamp_ns);
+
+        void EndRecord(int32_t thread_id, ThreadChunk &chunk);
+
+        void FlushThread(int32_t thread_id, ThreadChunk &chunk);
+
+        void FlushTables();
+
+        void WriteChunk(TraceChunkType type, const std::vector<uint8_t> &payload);
+
+        static void PushULeb128(std::vector<uint8_t> &out, uint32_t value);
+
+        static void PushSLeb128(std::vector<uint8_t> &out, int32_t value);
+
+        static void PushString(std::vector<uint8_t> &out, const std::string &value);
+
+        FILE *file_ = nullptr;
+        int64_t start_ns_ = 0;
+        uint16_t ts_shift_ = kTraceDefaultTsShift;
+        uint64_t bytes_written_ = 0;
+
+        std::vector<bool> defined_classes_;
+        std::vector<bool> defined_methods_;
+        std::vector<uint8_t> pending_classes_;
+        std::vector<uint8_t> pending_methods_;
+        std::vector<uint8_t> pending_stacks_;
+        std::vector<uint8_t> pending_alloc_sites_;
+        std::vector<uint8_t> pending_threads_;
+        std::vector<uint8_t> pending_exception_sites_;
+        std::unordered_map<int32_t, ThreadChunk> threads_;
+    };
+
+}  // namespace profiler
+
+#endif  // TRACE_WRITER_H
@@ -0,0 +1,26 @@
+#include "transform_context.h"
+
+namespace profiler {
+
+    TransformContext &TransformContext::Current() {
+        // released when the thread exits
+        static thread_local TransformContext context;
+        return context;
+    }
+
+    std::shared_ptr<ir::DexFile> TransformContext::AcquireDexIr() {
+        // still referenced after a transformation means someone kept the
+        // IR around, it can't be recycled
+        if (dex_ir_ == nullptr || dex_ir_.use_count() != 1) {
+            dex_ir_ = std::make_shared<ir::DexFile>();
+        }
+        return dex_ir_;
+    }
+
+    void TransformContext::TrimDexIr() {
+        if (dex_ir_ != nullptr && dex_ir_->ArenaCapacity() > kMaxRecycledArenaBytes) {
+            dex_ir_.reset();
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,62 @@
+#ifndef TRANSFORM_CONTEXT_H
+#define TRANSFORM_CONTEXT_H
+
+#include "instrumentation_rules.h"
+
+#include <memory>
+#include <vector>
+
+#include "slicer/dex_ir.h"
+
+namespace profiler {
+
+    /**
+     * Per-thread state reused from one class transformation to the next.
+     *
+     * The ClassFileLoadHook can run on several threads at once, so nothing
+     * in here is shared: each thread recycles the IR of its previous
+     * transformation (arena blocks, node vectors, index maps and lookup
+     * tables are reset, not freed) and its rule match buffer. The slicer
+     * itself keeps no global mutable state, its WEAK_CHECK bookkeeping is
+     * thread_local too.
+     */
+    class TransformContext {
+    public:
+        static TransformContext &Current();
+
+        /**
+         * An IR for a new dex::Reader: the one of the previous
+         * transformation if nothing references it anymore, a new one
+         * otherwise.
+         */
+        std::shared_ptr<ir::DexFile> AcquireDexIr();
+
+        /**
+         * Called once a transformation is done with its IR: an IR which
+         * grew past kMaxRecycledArenaBytes (a large dex parsed by the
+         * retransform job, say) is released instead of being kept for the
+         * next one, so a thread never holds more than that between
+         * transformations.
+         */
+        void TrimDexIr();
+
+        /**
+         * The match buffer, emptied.
+         */
+        std::vector<const InstrumentationRule *> &Rules() {
+            rules_.clear();
+            return rules_;
+        }
+
+    private:
+        static const size_t kMaxRecycledArenaBytes = 2 * 1024 * 1024;
+
+        TransformContext() = default;
+
+        std::shared_ptr<ir::DexFile> dex_ir_;
+        std::vector<const InstrumentationRule *> rules_;
+    };
+
+}  // namespace profiler
+
+#endif  // TRANSFORM_CONTEXT_H
@@ -0,0 +1,440 @@
+#include "heap_dominators.h"
+#include "slicer/dex_leb128.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace profiler {
+
+    const uint32_t HeapGraph::kNoNode;
+
+    static uint64_t ReadFixed(const uint8_t *ptr, int size) {
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i) {
+            value |= static_cast<uint64_t>(ptr[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // The dex decoders trust their input, so make sure the value ends in bounds
+    static bool HasLeb128(const uint8_t *ptr, const uint8_t *end) {
+        for (int i = 0; i < 5 && ptr + i < end; ++i) {
+            if ((ptr[i] & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool ReadULeb128(const uint8_t **ptr, const uint8_t *end, uint32_t *value) {
+        if (!HasLeb128(*ptr, end)) {
+            return false;
+        }
+        *value = dex::ReadULeb128(ptr);
+        return true;
+    }
+
+    static bool ReadSLeb128(const uint8_t **ptr, const uint8_t *end, int32_t *value) {
+        if (!HasLeb128(*ptr, end)) {
+            return false;
+        }
+        *value = dex::ReadSLeb128(ptr);
+        return true;
+    }
+
+    bool HeapGraph::Read(const std::string &path, std::string *error) {
+        GrowNodes(0);
+        if (!ReadBlocks(path, true, error)) {
+            return false;
+        }
+
+        // edge counts to offsets: n starts at offsets[n]
+        uint64_t succ_total = 0;
+        uint64_t pred_total = 0;
+        for (size_t n = 0; n < succ_offsets_.size(); ++n) {
+            uint32_t succ_count = succ_offsets_[n];
+            uint32_t pred_count = pred_offsets_[n];
+            succ_offsets_[n] = static_cast<uint32_t>(succ_total);
+            pred_offsets_[n] = static_cast<uint32_t>(pred_total);
+            succ_total += succ_count;
+            pred_total += pred_count;
+        }
+        if (succ_total > std::numeric_limits<uint32_t>::max()) {
+            *error = "too many edges";
+            return false;
+        }
+        succ_.resize(succ_total);
+        pred_.resize(pred_total);
+        if (!ReadBlocks(path, false, error)) {
+            return false;
+        }
+        // the second pass left offsets[n] at the end of n, that is the start of n + 1
+        for (size_t n = succ_offsets_.size() - 1; n > 0; --n) {
+            succ_offsets_[n] = succ_offsets_[n - 1];
+            pred_offsets_[n] = pred_offsets_[n - 1];
+        }
+        succ_offsets_[0] = 0;
+        pred_offsets_[0] = 0;
+        return true;
+    }
+
+    bool HeapGraph::ReadBlocks(const std::string &path, bool count_pass, std::string *error) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            *error = "can't open " + path;
+            return false;
+        }
+        bool ok = true;
+        uint8_t header[kHeapGraphHeaderSize];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            ReadFixed(header, 4) != kHeapGraphMagic) {
+            *error = path + " is not a heap graph file";
+            ok = false;
+        } else if (ReadFixed(header + 4, 2) != kHeapGraphVersion) {
+            *error = "unsupported heap graph version " + std::to_string(ReadFixed(header + 4, 2));
+            ok = false;
+        }
+
+        bool complete = false;
+        std::vector<uint8_t> payload;
+        while (ok) {
+            uint8_t block_header[kHeapGraphBlockHeaderSize];
+            size_t read = fread(block_header, 1, sizeof(block_header), file);
+            if (read == 0) {
+                break;
+            }
+            uint32_t size = static_cast<uint32_t>(ReadFixed(block_header + 1, 4));
+            payload.resize(size);
+            if (read != sizeof(block_header) || fread(payload.data(), 1, size, file) != size) {
+                complete = false;
+                break;
+            }
+            const uint8_t *ptr = payload.data();
+            const uint8_t *end = ptr + size;
+            switch (block_header[0]) {
+                case kGraphNodes:
+                    ok = !count_pass || ReadNodes(ptr, end);
+                    break;
+
+                case kGraphEdges:
+                    ok = ReadEdges(ptr, end, count_pass);
+                    break;
+
+                case kGraphClasses:
+                    ok = !count_pass || ReadClasses(ptr, end);
+                    break;
+
+                case kGraphClassNodes:
+                    ok = !count_pass || ReadClassNodes(ptr, end);
+                    // the last block
+                    complete = true;
+                    break;
+
+                default:
+                    // written by a newer agent, skip
+                    break;
+            }
+            if (!ok) {
+                *error = "malformed block in " + path;
+            }
+        }
+        fclose(file);
+        if (ok && !complete) {
+            *error = path + " is truncated";
+            ok = false;
+        }
+        return ok;
+    }
+
+    void HeapGraph::GrowNodes(uint32_t node) {
+        if (node >= sizes_.size()) {
+            class_ids_.resize(node + 1);
+            sizes_.resize(node + 1);
+            succ_offsets_.resize(node + 2);
+            pred_offsets_.resize(node + 2);
+        }
+    }
+
+    bool HeapGraph::ReadNodes(const uint8_t *ptr, const uint8_t *end) {
+        if (end - ptr < 4 || (end - ptr - 4) % 8 != 0) {
+            return false;
+        }
+        uint32_t node = static_cast<uint32_t>(ReadFixed(ptr, 4));
+        ptr += 4;
+        if (node == 0) {
+            return false;
+        }
+        for (; ptr < end; ptr += 8, ++node) {
+            GrowNodes(node);
+            class_ids_[node] = static_cast<uint32_t>(ReadFixed(ptr, 4));
+            sizes_[node] = static_cast<uint32_t>(ReadFixed(ptr + 4, 4));
+        }
+        return true;
+    }
+
+    bool HeapGraph::ReadEdges(const uint8_t *ptr, const uint8_t *end, bool count_pass) {
+        uint32_t from = 0;
+        while (ptr < end) {
+            int32_t delta = 0;
+            uint32_t to = 0;
+            if (!ReadSLeb128(&ptr, end, &delta) || !ReadULeb128(&ptr, end, &to)) {
+                return false;
+            }
+            from += static_cast<uint32_t>(delta);
+            if (from == kNoNode || to == kNoNode) {
+                return false;
+            }
+            if (count_pass) {
+                GrowNodes(std::max(from, to));
+                succ_offsets_[from]++;
+                pred_offsets_[to]++;
+            } else {
+                succ_[succ_offsets_[from]++] = to;
+                pred_[pred_offsets_[to]++] = from;
+            }
+        }
+        return true;
+    }
+
+    bool HeapGraph::ReadClasses(const uint8_t *ptr, const uint8_t *end) {
+        while (ptr < end) {
+            uint32_t class_id = 0;
+            uint32_t size = 0;
+            if (!ReadULeb128(&ptr, end, &class_id) || !ReadULeb128(&ptr, end, &size) ||
+                size > static_cast<size_t>(end - ptr)) {
+                return false;
+            }
+            classes_[class_id].assign(reinterpret_cast<const char *>(ptr), size);
+            ptr += size;
+        }
+        return true;
+    }
+
+    bool HeapGraph::ReadClassNodes(const uint8_t *ptr, const uint8_t *end) {
+        while (ptr < end) {
+            uint32_t node = 0;
+            uint32_t class_id = 0;
+            if (!ReadULeb128(&ptr, end, &node) || !ReadULeb128(&ptr, end, &class_id)) {
+                return false;
+            }
+            class_objects_[node] = class_id;
+        }
+        return true;
+    }
+
+    void HeapGraph::ComputeDominators() {
+        const uint32_t node_count = NodeCount();
+
+        // depth first numbering from the root, the nodes by DFS number in |vertex|
+        std::vector<uint32_t> dfs_number(node_count, kNoNode);
+        std::vector<uint32_t> vertex;
+        std::vector<uint32_t> parent;
+        vertex.reserve(node_count);
+        parent.reserve(node_count);
+        // (node, next successor offset)
+        std::vector<std::pair<uint32_t, uint32_t>> stack;
+        dfs_number[0] = 0;
+        vertex.push_back(0);
+        parent.push_back(kNoNode);
+        stack.push_back(std::make_pair(0u, succ_offsets_[0]));
+        while (!stack.empty()) {
+            uint32_t node = stack.back().first;
+            uint32_t offset = stack.back().second;
+            if (offset == succ_offsets_[node + 1]) {
+                stack.pop_back();
+                continue;
+            }
+            stack.back().second++;
+            uint32_t next = succ_[offset];
+            if (dfs_number[next] == kNoNode) {
+                dfs_number[next] = static_cast<uint32_t>(vertex.size());
+                vertex.push_back(next);
+                parent.push_back(dfs_number[node]);
+                stack.push_back(std::make_pair(next, succ_offsets_[next]));
+            }
+        }
+        stack.clear();
+        stack.shrink_to_fit();
+        const uint32_t n = static_cast<uint32_t>(vertex.size());
+        reachable_ = n;
+
+        // the predecessors by DFS number, so that the main loop reads them in
+        // order; unreachable referrers are dropped
+        std::vector<uint32_t> dfs_pred_offsets(n + 1, 0);
+        std::vector<uint32_t> dfs_pred;
+        dfs_pred.reserve(pred_.size());
+        for (uint32_t w = 0; w < n; ++w) {
+            uint32_t node = vertex[w];
+            for (uint32_t i = pred_offsets_[node]; i < pred_offsets_[node + 1]; ++i) {
+                uint32_t v = dfs_number[pred_[i]];
+                if (v != kNoNode) {
+                    dfs_pred.push_back(v);
+                }
+            }
+            dfs_pred_offsets[w + 1] = static_cast<uint32_t>(dfs_pred.size());
+        }
+        // only the analysis needs them
+        pred_ = std::vector<uint32_t>();
+        pred_offsets_ = std::vector<uint32_t>();
+        dfs_number = std::vector<uint32_t>();
+
+        semi_.resize(n);
+        label_.resize(n);
+        ancestor_.assign(n, kNoNode);
+        for (uint32_t v = 0; v < n; ++v) {
+            semi_[v] = v;
+            label_[v] = v;
+        }
+        // dom[w] ends as the immediate dominator of w, by DFS number
+        std::vector<uint32_t> dom(n, 0);
+        // the vertices whose semidominator is v, as linked lists
+        std::vector<uint32_t> bucket_head(n, kNoNode);
+        std::vector<uint32_t> bucket_next(n, kNoNode);
+        for (uint32_t w = n - 1; w > 0; --w) {
+            for (uint32_t i = dfs_pred_offsets[w]; i < dfs_pred_offsets[w + 1]; ++i) {
+                uint32_t u = Eval(dfs_pred[i]);
+                if (semi_[u] < semi_[w]) {
+                    semi_[w] = semi_[u];
+                }
+            }
+            bucket_next[w] = bucket_head[semi_[w]];
+            bucket_head[semi_[w]] = w;
+            uint32_t p = parent[w];
+            ancestor_[w] = p;
+            for (uint32_t v = bucket_head[p]; v != kNoNode; v = bucket_next[v]) {
+                uint32_t u = Eval(v);
+                dom[v] = semi_[u] < semi_[v] ? u : p;
+            }
+            bucket_head[p] = kNoNode;
+        }
+        for (uint32_t w = 1; w < n; ++w) {
+            if (dom[w] != semi_[w]) {
+                dom[w] = dom[dom[w]];
+            }
+        }
+        semi_ = std::vector<uint32_t>();
+        label_ = std::vector<uint32_t>();
+        ancestor_ = std::vector<uint32_t>();
+        compress_stack_ = std::vector<uint32_t>();
+
+        idom_.assign(node_count, kNoNode);
+        retained_.resize(node_count);
+        for (uint32_t node = 0; node < node_count; ++node) {
+            retained_[node] = sizes_[node];
+        }
+        // a dominator comes before the nodes it dominates in DFS order
+        for (uint32_t w = n - 1; w > 0; --w) {
+            idom_[vertex[w]] = vertex[dom[w]];
+            retained_[vertex[dom[w]]] += retained_[vertex[w]];
+        }
+    }
+
+    void HeapGraph::Compress(uint32_t v) {
+        // the recursive version compresses from the top of the path down
+        compress_stack_.clear();
+        while (ancestor_[ancestor_[v]] != kNoNode) {
+            compress_stack_.push_back(v);
+            v = ancestor_[v];
+        }
+        while (!compress_stack_.empty()) {
+            uint32_t x = compress_stack_.back();
+            compress_stack_.pop_back();
+            uint32_t a = ancestor_[x];
+            if (semi_[label_[a]] < semi_[label_[x]]) {
+                label_[x] = label_[a];
+            }
+            ancestor_[x] = ancestor_[a];
+        }
+    }
+
+    std::vector<HeapGraph::ClassSummary> HeapGraph::SummarizeClasses() const {
+        const uint32_t node_count = NodeCount();
+        // dominator tree children, as CSR
+        std::vector<uint32_t> child_offsets(node_count + 1, 0);
+        uint32_t max_class = 0;
+        for (uint32_t node = 1; node < node_count; ++node) {
+            if (idom_[node] != kNoNode) {
+                child_offsets[idom_[node]]++;
+            }
+            max_class = std::max(max_class, class_ids_[node]);
+        }
+        uint32_t total = 0;
+        for (uint32_t node = 0; node <= node_count; ++node) {
+            uint32_t count = child_offsets[node];
+            child_offsets[node] = total;
+            total += count;
+        }
+        std::vector<uint32_t> children(total);
+        for (uint32_t node = 1; node < node_count; ++node) {
+            if (idom_[node] != kNoNode) {
+                children[child_offsets[idom_[node]]++] = node;
+            }
+        }
+        for (uint32_t node = node_count; node > 0; --node) {
+            child_offsets[node] = child_offsets[node - 1];
+        }
+        child_offsets[0] = 0;
+
+        std::vector<ClassSummary> summaries(max_class + 1);
+        for (uint32_t class_id = 0; class_id <= max_class; ++class_id) {
+            summaries[class_id] = ClassSummary{class_id, 0, 0, 0};
+        }
+        // instances of each class on the current dominator tree path
+        std::vector<uint32_t> active(max_class + 1, 0);
+        std::vector<std::pair<uint32_t, uint32_t>> stack;
+        stack.push_back(std::make_pair(0u, child_offsets[0]));
+        while (!stack.empty()) {
+            uint32_t node = stack.back().first;
+            uint32_t offset = stack.back().second;
+            if (offset == child_offsets[node + 1]) {
+                if (node != 0) {
+                    active[class_ids_[node]]--;
+                }
+                stack.pop_back();
+                continue;
+            }
+            stack.back().second++;
+            uint32_t child = children[offset];
+            ClassSummary &summary = summaries[class_ids_[child]];
+            summary.count++;
+            summary.shallow += sizes_[child];
+            if (active[class_ids_[child]]++ == 0) {
+                summary.retained += retained_[child];
+            }
+            stack.push_back(std::make_pair(child, child_offsets[child]));
+        }
+
+        std::vector<ClassSummary> result;
+        for (const ClassSummary &summary : summaries) {
+            if (summary.count > 0) {
+                result.push_back(summary);
+            }
+        }
+        return result;
+    }
+
+    uint32_t HeapGraph::ClassObjectOf(uint32_t node) const {
+        auto it = class_objects_.find(node);
+        return it != class_objects_.end() ? it->second : 0;
+    }
+
+    const std::string &HeapGraph::ClassName(uint32_t class_id) const {
+        static const std::string kUnknown = "<unknown>";
+        auto it = classes_.find(class_id);
+        return it != classes_.end() ? it->second : kUnknown;
+    }
+
+    std::string HeapGraph::NodeName(uint32_t node) const {
+        if (node == 0) {
+            return "<roots>";
+        }
+        uint32_t class_object = ClassObjectOf(node);
+        if (class_object != 0) {
+            return "class " + ClassName(class_object);
+        }
+        return ClassName(class_ids_[node]);
+    }
+
+}  // namespace profiler
@@ -0,0 +1,133 @@
+#include "heap_dominators.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+// Dominator and retained size analysis of the heap graphs written by the
+// pcall agent (heap_graph=1):
+//
+//   adb shell run-as <package> cat pcall-<pid>.heapgraph > app.heapgraph
+//   pcall-heap [--classes] [--dominators] [--limit N] [--depth D] app.heapgraph
+
+static void PrintUsage() {
+    fprintf(stderr,
+            "usage: pcall-heap [options] <heap graph file>\n"
+            "  --classes         classes sorted by retained size (default)\n"
+            "  --dominators      objects sorted by retained size, with their dominators\n"
+            "  --limit N         rows per table (default 30)\n"
+            "  --depth D         dominators listed per object (default 8)\n");
+}
+
+static double NowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintClasses(const profiler::HeapGraph &graph, size_t limit, uint64_t total) {
+    std::vector<profiler::HeapGraph::ClassSummary> classes = graph.SummarizeClasses();
+    std::sort(classes.begin(), classes.end(),
+              [](const profiler::HeapGraph::ClassSummary &a,
+                 const profiler::HeapGraph::ClassSummary &b) {
+                  return a.retained > b.retained;
+              });
+    printf("%8s %14s %14s %12s  %s\n", "retain%", "retained", "shallow", "objects", "class");
+    for (size_t i = 0; i < classes.size() && i < limit; ++i) {
+        const profiler::HeapGraph::ClassSummary &summary = classes[i];
+        printf("%7.2f%% %14" PRIu64 " %14" PRIu64 " %12" PRIu64 "  %s\n",
+               total > 0 ? 100.0 * summary.retained / total : 0.0, summary.retained,
+               summary.shallow, summary.count, graph.ClassName(summary.class_id).c_str());
+    }
+}
+
+static void PrintDominators(const profiler::HeapGraph &graph, size_t limit, size_t depth,
+                            uint64_t total) {
+    std::vector<uint32_t> nodes;
+    for (uint32_t node = 1; node < graph.NodeCount(); ++node) {
+        if (graph.Dominator(node) != profiler::HeapGraph::kNoNode) {
+            nodes.push_back(node);
+        }
+    }
+    size_t count = std::min(nodes.size(), limit);
+    std::partial_sort(nodes.begin(), nodes.begin() + count, nodes.end(),
+                      [&graph](uint32_t a, uint32_t b) {
+                          return graph.Retained(a) > graph.Retained(b);
+                      });
+    printf("%8s %14s %10s  %s\n", "retain%", "retained", "node", "object <- dominators");
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t node = nodes[i];
+        printf("%7.2f%% %14" PRIu64 " %10u  %s",
+               total > 0 ? 100.0 * graph.Retained(node) / total : 0.0, graph.Retained(node),
+               node, graph.NodeName(node).c_str());
+        uint32_t dominator = graph.Dominator(node);
+        for (size_t level = 0; level < depth && dominator != profiler::HeapGraph::kNoNode;
+             ++level) {
+            printf(" <- %s", graph.NodeName(dominator).c_str());
+            dominator = graph.Dominator(dominator);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    bool classes = false;
+    bool dominators = false;
+    size_t limit = 30;
+    size_t depth = 8;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--classes") == 0) {
+            classes = true;
+        } else if (strcmp(argv[i], "--dominators") == 0) {
+            dominators = true;
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            limit = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-' && path == nullptr) {
+            path = argv[i];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (path == nullptr) {
+        PrintUsage();
+        return 1;
+    }
+    if (!classes && !dominators) {
+        classes = true;
+    }
+
+    profiler::HeapGraph graph;
+    std::string error;
+    double start = NowSeconds();
+    if (!graph.Read(path, &error)) {
+        fprintf(stderr, "pcall-heap: %s\n", error.c_str());
+        return 1;
+    }
+    double read = NowSeconds();
+    graph.ComputeDominators();
+    double computed = NowSeconds();
+
+    // everything reachable is retained by the roots
+    uint64_t total = graph.Retained(0);
+    printf("%u objects (%u reachable), %" PRIu64 " references, %" PRIu64 " bytes reachable\n",
+           graph.NodeCount() - 1, graph.ReachableCount() - 1, graph.EdgeCount(), total);
+    printf("read in %.2f s, dominators in %.2f s\n\n", read - start, computed - read);
+    if (classes) {
+        PrintClasses(graph, limit, total);
+    }
+    if (dominators) {
+        if (classes) {
+            printf("\n");
+        }
+        PrintDominators(graph, limit, depth, total);
+    }
+    return 0;
+}
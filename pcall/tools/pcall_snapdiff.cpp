@@ -0,0 +1,87 @@
+#include "snapshot_diff.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Growth between two heap snapshots written by the pcall agent (snapshot=1),
+// to find what leaks between two points of a scenario:
+//
+//   adb shell run-as <package> sh -c 'echo before > pcall-snapshot'
+//   ... run the scenario ...
+//   adb shell run-as <package> sh -c 'echo after > pcall-snapshot'
+//   adb shell run-as <package> cat pcall-<pid>-before.snapshot > before.snapshot
+//   adb shell run-as <package> cat pcall-<pid>-after.snapshot > after.snapshot
+//   pcall-snapdiff [--limit N] [--count] before.snapshot after.snapshot
+
+static void PrintUsage() {
+    fprintf(stderr,
+            "usage: pcall-snapdiff [options] <before snapshot> <after snapshot>\n"
+            "  --limit N         rows per table (default 30)\n"
+            "  --count           rank the classes by object count instead of bytes\n");
+}
+
+static const char *SectionTitle(uint8_t kind) {
+    switch (kind) {
+        case profiler::kSnapshotClasses:
+            return "live objects per class";
+        case profiler::kSnapshotAllocSites:
+            return "allocations per site";
+        default:
+            return "unknown section";
+    }
+}
+
+static void PrintSection(const profiler::SnapshotDiff::Section &section) {
+    printf("%s: %" PRIu64 " -> %" PRIu64 " objects (%+" PRId64 "), %" PRIu64 " -> %" PRIu64
+           " bytes (%+" PRId64 ")\n",
+           SectionTitle(section.kind), section.before_count, section.after_count,
+           static_cast<int64_t>(section.after_count - section.before_count),
+           section.before_bytes, section.after_bytes,
+           static_cast<int64_t>(section.after_bytes - section.before_bytes));
+    printf("%u grown, %u new, %u gone, ranked by %s\n", section.grown, section.added,
+           section.removed, section.by_bytes ? "bytes" : "count");
+    printf("%12s %14s %12s %14s  %s\n", "+count", "+bytes", "count", "bytes", "name");
+    for (const profiler::SnapshotDiff::Entry &entry : section.top) {
+        printf("%+12" PRId64 " %+14" PRId64 " %12" PRIu64 " %14" PRIu64 "  %s%s\n",
+               entry.count_delta, entry.bytes_delta, entry.count, entry.bytes,
+               entry.name.c_str(), entry.added ? " (new)" : "");
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t limit = 30;
+    bool by_count = false;
+    const char *paths[2] = {nullptr, nullptr};
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            limit = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--count") == 0) {
+            by_count = true;
+        } else if (argv[i][0] != '-' && paths[1] == nullptr) {
+            paths[paths[0] == nullptr ? 0 : 1] = argv[i];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (paths[1] == nullptr) {
+        PrintUsage();
+        return 1;
+    }
+
+    profiler::SnapshotDiff diff;
+    std::string error;
+    if (!diff.Compute(paths[0], paths[1], limit, by_count, &error)) {
+        fprintf(stderr, "pcall-snapdiff: %s\n", error.c_str());
+        return 1;
+    }
+    printf("%.3f s between the snapshots\n", diff.ElapsedNs() / 1e9);
+    for (const profiler::SnapshotDiff::Section &section : diff.Sections()) {
+        printf("\n");
+        PrintSection(section);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "trace_profile.h"
+#include "trace_reader.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host side decoder for the traces written by the pcall agent:
+//
+//   adb shell run-as <package> cat pcall-<pid>.trace > app.trace
+//   pcall-trace [--flat] [--tree] [--alloc] [--heap] [--monitors] [--gc] [--threads] [--exceptions] [--classes] [--stats] [--limit N] [--min-percent P] app.trace
+
+static void PrintUsage() {
+    fprintf(stderr,
+            "usage: pcall-trace [options] <trace file>\n"
+            "  --flat            flat profile sorted by self time (default)\n"
+            "  --tree            per-thread call trees\n"
+            "  --alloc           allocation sites sorted by count (default with --flat)\n"
+            "  --heap            last heap histogram sorted by size (default with --flat)\n"
+            "  --monitors        monitor wait times per class and call site (default with --flat)\n"
+            "  --gc              collection pauses, the longest ones in time order (default with --flat)\n"
+            "  --threads         CPU time per thread (default with --flat)\n"
+            "  --exceptions      exceptions per throw site, with sampled stacks (default with --flat)\n"
+            "  --classes         classes sorted by transform, load and static initializer time (default with --flat)\n"
+            "  --stats           trace size and encoding statistics\n"
+            "  --limit N         flat profile rows (default 50)\n"
+            "  --min-percent P   hide call tree nodes under P%% of their thread (default 0.5)\n");
+}
+
+int main(int argc, char **argv) {
+    bool flat = false;
+    bool tree = false;
+    bool alloc = false;
+    bool heap = false;
+    bool monitors = false;
+    bool gc = false;
+    bool threads = false;
+    bool exceptions = false;
+    bool classes = false;
+    bool stats = false;
+    size_t limit = 50;
+    double min_percent = 0.5;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--flat") == 0) {
+            flat = true;
+        } else if (strcmp(argv[i], "--tree") == 0) {
+            tree = true;
+        } else if (strcmp(argv[i], "--alloc") == 0) {
+            alloc = true;
+        } else if (strcmp(argv[i], "--heap") == 0) {
+            heap = true;
+        } else if (strcmp(argv[i], "--monitors") == 0) {
+            monitors = true;
+        } else if (strcmp(argv[i], "--gc") == 0) {
+            gc = true;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            threads = true;
+        } else if (strcmp(argv[i], "--exceptions") == 0) {
+            exceptions = true;
+        } else if (strcmp(argv[i], "--classes") == 0) {
+            classes = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            limit = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--min-percent") == 0 && i + 1 < argc) {
+            min_percent = strtod(argv[++i], nullptr);
+        } else if (argv[i][0] != '-' && path == nullptr) {
+            path = argv[i];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (path == nullptr) {
+        PrintUsage();
+        return 1;
+    }
+    if (!flat && !tree && !alloc && !heap && !monitors && !gc && !threads && !exceptions &&
+        !classes && !stats) {
+        flat = true;
+    }
+
+    profiler::TraceReader reader;
+    profiler::TraceProfile profile;
+    std::string error;
+    if (!reader.Read(path, &profile, &error)) {
+        fprintf(stderr, "pcall-trace: %s\n", error.c_str());
+        return 1;
+    }
+    profile.Finish();
+
+    const profiler::TraceReader::Stats &reader_stats = reader.GetStats();
+    if (reader_stats.truncated) {
+        fprintf(stderr, "pcall-trace: warning: the last chunk is truncated\n");
+    }
+    if (stats) {
+        uint64_t events = reader_stats.method_events + reader_stats.other_events;
+        printf("file size      : %" PRIu64 " bytes in %" PRIu64 " chunks\n",
+               reader_stats.file_size, reader_stats.chunks);
+        printf("method events  : %" PRIu64 "\n", reader_stats.method_events);
+        printf("stack samples  : %" PRIu64 "\n", reader_stats.stack_samples);
+        printf("other events   : %" PRIu64 "\n", reader_stats.other_events);
+        printf("bytes / event  : %.2f (event chunks only)\n",
+               events > 0 ? static_cast<double>(reader_stats.event_bytes) / events : 0.0);
+    }
+    // a trace holds method events, stack samples or both, depending on the mode
+    if (flat) {
+        if (profile.HasMethodEvents() || !profile.HasSamples()) {
+            profile.PrintFlatProfile(stdout, limit);
+        }
+        if (profile.HasSamples()) {
+            profile.PrintSampledFlatProfile(stdout, limit);
+        }
+    }
+    if ((alloc || flat) && profile.HasAllocSites()) {
+        profile.PrintAllocSites(stdout, limit);
+    }
+    if ((heap || flat) && profile.HasHeapHistogram()) {
+        profile.PrintHeapHistogram(stdout, limit);
+    }
+    if ((monitors || flat) && profile.HasMonitorHistograms()) {
+        profile.PrintMonitors(stdout, limit);
+    }
+    if ((gc || flat) && profile.HasGcPauses()) {
+        profile.PrintGcTimeline(stdout, limit, reader.GetStartNs());
+    }
+    if ((threads || flat) && profile.HasThreadCpu()) {
+        profile.PrintThreadCpu(stdout, limit);
+    }
+    if ((exceptions || flat) && profile.HasExceptions()) {
+        profile.PrintExceptions(stdout, limit);
+    }
+    if ((classes || flat) && profile.HasClassTimes()) {
+        profile.PrintClassTimeline(stdout, limit, reader.GetStartNs());
+    }
+    if (tree) {
+        profile.PrintCallTrees(stdout, min_percent);
+        if (profile.HasSamples()) {
+            profile.PrintSampledTree(stdout, min_percent);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "snapshot_diff.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace profiler {
+
+    static const uint32_t kMaxNameSize = 1 << 20;
+
+    static int64_t Growth(const SnapshotDiff::Entry &entry, bool by_bytes) {
+        return by_bytes ? entry.bytes_delta : entry.count_delta;
+    }
+
+    SnapshotReader::~SnapshotReader() {
+        if (file_ != nullptr) {
+            fclose(file_);
+        }
+    }
+
+    bool SnapshotReader::Open(const std::string &path, std::string *error) {
+        path_ = path;
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == nullptr) {
+            *error = "can't open " + path;
+            return false;
+        }
+        uint64_t magic = 0;
+        uint64_t version = 0;
+        uint64_t reserved = 0;
+        if (!ReadFixed(4, &magic) || !ReadFixed(2, &version) || !ReadFixed(2, &reserved) ||
+            !ReadFixed(8, &timestamp_ns_)) {
+            Fail("truncated header");
+        } else if (magic != kSnapshotMagic) {
+            Fail("not a heap snapshot");
+        } else if (version != kSnapshotVersion) {
+            Fail("unsupported snapshot version");
+        }
+        if (Failed()) {
+            *error = error_;
+            return false;
+        }
+        return true;
+    }
+
+    bool SnapshotReader::NextSection() {
+        Record skipped;
+        while (NextRecord(&skipped)) {
+        }
+        if (Failed()) {
+            return false;
+        }
+        int kind = fgetc(file_);
+        if (kind == EOF) {
+            section_kind_ = 0;
+            return false;
+        }
+        uint64_t count = 0;
+        if (!ReadFixed(4, &count)) {
+            Fail("truncated section header");
+            return false;
+        }
+        if (kind <= section_kind_) {
+            Fail("sections out of order");
+            return false;
+        }
+        section_kind_ = static_cast<uint8_t>(kind);
+        section_left_ = static_cast<uint32_t>(count);
+        has_last_key_ = false;
+        return true;
+    }
+
+    bool SnapshotReader::NextRecord(Record *record) {
+        if (section_left_ == 0 || Failed()) {
+            return false;
+        }
+        uint32_t size = 0;
+        if (!ReadFixed(8, &record->key) || !ReadFixed(8, &record->count) ||
+            !ReadFixed(8, &record->bytes) || !ReadULeb128(&size) || size > kMaxNameSize) {
+            Fail("truncated record");
+            return false;
+        }
+        record->name.resize(size);
+        if (size > 0 && fread(&record->name[0], 1, size, file_) != size) {
+            Fail("truncated record");
+            return false;
+        }
+        if (has_last_key_ && record->key <= last_key_) {
+            Fail("records not sorted by key");
+            return false;
+        }
+        has_last_key_ = true;
+        last_key_ = record->key;
+        section_left_--;
+        return true;
+    }
+
+    bool SnapshotReader::ReadFixed(int size, uint64_t *value) {
+        uint8_t bytes[8];
+        if (fread(bytes, 1, size, file_) != static_cast<size_t>(size)) {
+            return false;
+        }
+        *value = 0;
+        for (int i = 0; i < size; ++i) {
+            *value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return true;
+    }
+
+    bool SnapshotReader::ReadULeb128(uint32_t *value) {
+        *value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            int byte = fgetc(file_);
+            if (byte == EOF) {
+                return false;
+            }
+            *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void SnapshotReader::Fail(const char *what) {
+        error_ = path_ + ": " + what;
+        section_left_ = 0;
+    }
+
+    bool SnapshotDiff::Compute(const std::string &before_path, const std::string &after_path,
+                               size_t limit, bool by_count, std::string *error) {
+        limit_ = limit;
+        sections_.clear();
+        SnapshotReader before;
+        SnapshotReader after;
+        if (!before.Open(before_path, error) || !after.Open(after_path, error)) {
+            return false;
+        }
+        elapsed_ns_ = static_cast<int64_t>(after.Timestamp() - before.Timestamp());
+
+        // both files list their sections by increasing kind, one may lack some
+        bool has_before = before.NextSection();
+        bool has_after = after.NextSection();
+        while (has_before || has_after) {
+            Section section;
+            bool take_before = has_before &&
+                               (!has_after || before.SectionKind() <= after.SectionKind());
+            bool take_after = has_after &&
+                              (!has_before || after.SectionKind() <= before.SectionKind());
+            section.kind = take_before ? before.SectionKind() : after.SectionKind();
+            section.by_bytes = section.kind == kSnapshotClasses && !by_count;
+            MergeSection(take_before ? &before : nullptr, take_after ? &after : nullptr,
+                         &section);
+            if (before.Failed() || after.Failed()) {
+                break;
+            }
+            std::sort_heap(section.top.begin(), section.top.end(),
+                           [&section](const Entry &a, const Entry &b) {
+                               return Growth(a, section.by_bytes) > Growth(b, section.by_bytes);
+                           });
+            sections_.push_back(std::move(section));
+            if (take_before) {
+                has_before = before.NextSection();
+            }
+            if (take_after) {
+                has_after = after.NextSection();
+            }
+        }
+        if (before.Failed() || after.Failed()) {
+            *error = before.Failed() ? before.Error() : after.Error();
+            return false;
+        }
+        return true;
+    }
+
+    void SnapshotDiff::MergeSection(SnapshotReader *before, SnapshotReader *after,
+                                    Section *section) {
+        SnapshotReader::Record old_record;
+        SnapshotReader::Record new_record;
+        bool has_old = before != nullptr && before->NextRecord(&old_record);
+        bool has_new = after != nullptr && after->NextRecord(&new_record);
+        while (has_old || has_new) {
+            if (has_old && (!has_new || old_record.key < new_record.key)) {
+                // gone, it can only have shrunk
+                section->before_count += old_record.count;
+                section->before_bytes += old_record.bytes;
+                section->removed++;
+                has_old = before->NextRecord(&old_record);
+                continue;
+            }
+            bool matched = has_old && old_record.key == new_record.key;
+            Entry entry;
+            entry.count = new_record.count;
+            entry.bytes = new_record.bytes;
+            entry.count_delta = static_cast<int64_t>(new_record.count);
+            entry.bytes_delta = static_cast<int64_t>(new_record.bytes);
+            if (matched) {
+                section->before_count += old_record.count;
+                section->before_bytes += old_record.bytes;
+                entry.count_delta -= static_cast<int64_t>(old_record.count);
+                entry.bytes_delta -= static_cast<int64_t>(old_record.bytes);
+            } else {
+                entry.added = true;
+                section->added++;
+            }
+            section->after_count += new_record.count;
+            section->after_bytes += new_record.bytes;
+            if (Growth(entry, section->by_bytes) > 0) {
+                section->grown++;
+                entry.name = std::move(new_record.name);
+                Offer(section, std::move(entry));
+            }
+            if (matched) {
+                has_old = before->NextRecord(&old_record);
+            }
+            has_new = after->NextRecord(&new_record);
+        }
+    }
+
+    void SnapshotDiff::Offer(Section *section, Entry &&entry) {
+        if (limit_ == 0) {
+            return;
+        }
+        // min-heap on the growth, the front is the first entry to give up
+        bool by_bytes = section->by_bytes;
+        auto greater = [by_bytes](const Entry &a, const Entry &b) {
+            return Growth(a, by_bytes) > Growth(b, by_bytes);
+        };
+        std::vector<Entry> &top = section->top;
+        if (top.size() < limit_) {
+            top.push_back(std::move(entry));
+            std::push_heap(top.begin(), top.end(), greater);
+        } else if (Growth(entry, by_bytes) > Growth(top.front(), by_bytes)) {
+            std::pop_heap(top.begin(), top.end(), greater);
+            top.back() = std::move(entry);
+            std::push_heap(top.begin(), top.end(), greater);
+        }
+    }
+
+}  // namespace profiler
@@ -0,0 +1,131 @@
+#ifndef SNAPSHOT_DIFF_H
+#define SNAPSHOT_DIFF_H
+
+#include "heap_snapshot_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Sequential reader of a heap snapshot (see heap_snapshot_format.h):
+     * one record in memory at a time, whatever the size of the file.
+     */
+    class SnapshotReader {
+    public:
+        struct Record {
+            uint64_t key = 0;
+            uint64_t count = 0;
+            uint64_t bytes = 0;
+            std::string name;
+        };
+
+        SnapshotReader() = default;
+
+        ~SnapshotReader();
+
+        SnapshotReader(const SnapshotReader &) = delete;
+
+        SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+        bool Open(const std::string &path, std::string *error);
+
+        uint64_t Timestamp() const { return timestamp_ns_; }
+
+        /**
+         * Skips what is left of the current section and moves to the next
+         * one, false at the end of the file or on error.
+         */
+        bool NextSection();
+
+        uint8_t SectionKind() const { return section_kind_; }
+
+        /**
+         * Reads the next record of the current section, false once the
+         * section is exhausted or on error. The keys are checked to be
+         * strictly increasing.
+         */
+        bool NextRecord(Record *record);
+
+        bool Failed() const { return !error_.empty(); }
+
+        const std::string &Error() const { return error_; }
+
+    private:
+        bool ReadFixed(int size, uint64_t *value);
+
+        bool ReadULeb128(uint32_t *value);
+
+        void Fail(const char *what);
+
+        FILE *file_ = nullptr;
+        std::string path_;
+        std::string error_;
+        uint64_t timestamp_ns_ = 0;
+        uint8_t section_kind_ = 0;
+        uint32_t section_left_ = 0;
+        bool has_last_key_ = false;
+        uint64_t last_key_ = 0;
+    };
+
+    /**
+     * Delta of two snapshots, computed by merging the sorted sections of
+     * both files in a single pass. Only the totals and the |limit| entries
+     * that grew the most are kept per section, memory doesn't depend on the
+     * snapshot sizes.
+     */
+    class SnapshotDiff {
+    public:
+        struct Entry {
+            std::string name;
+            int64_t count_delta = 0;
+            int64_t bytes_delta = 0;
+            uint64_t count = 0;
+            uint64_t bytes = 0;
+            // only in the second snapshot
+            bool added = false;
+        };
+
+        struct Section {
+            uint8_t kind = 0;
+            // the entries are ranked by bytes_delta when set, by count_delta otherwise
+            bool by_bytes = false;
+            uint64_t before_count = 0;
+            uint64_t before_bytes = 0;
+            uint64_t after_count = 0;
+            uint64_t after_bytes = 0;
+            uint32_t added = 0;
+            uint32_t removed = 0;
+            uint32_t grown = 0;
+            // sorted by decreasing growth
+            std::vector<Entry> top;
+        };
+
+        /**
+         * Compares |before| to |after|, keeping up to |limit| entries per
+         * section. |by_count| ranks the classes by count too, instead of
+         * bytes (sites are always ranked by count).
+         */
+        bool Compute(const std::string &before, const std::string &after, size_t limit,
+                     bool by_count, std::string *error);
+
+        const std::vector<Section> &Sections() const { return sections_; }
+
+        int64_t ElapsedNs() const { return elapsed_ns_; }
+
+    private:
+        void MergeSection(SnapshotReader *before, SnapshotReader *after, Section *section);
+
+        void Offer(Section *section, Entry &&entry);
+
+        size_t limit_ = 0;
+        std::vector<Section> sections_;
+        int64_t elapsed_ns_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // SNAPSHOT_DIFF_H
@@ -0,0 +1,694 @@
+#include "trace_profile.h"
+
+#include <inttypes.h>
+#include <algorithm>
+
+namespace profiler {
+
+    static const uint32_t kRootNode = 0;
+
+    void TraceProfile::OnClass(uint32_t class_id, const std::string &signature) {
+        classes_[class_id] = signature;
+    }
+
+    void TraceProfile::OnMethod(uint32_t method_id, uint32_t class_id,
+                                const std::string &name, const std::string &signature) {
+        MethodInfo &info = methods_[method_id];
+        info.class_id = class_id;
+        info.name = name;
+        info.signature = signature;
+    }
+
+    void TraceProfile::OnMethodEvent(int32_t thread_id, int64_t timestamp_ns,
+                                     uint32_t method_id, bool exit) {
+        Thread &thread = threads_[thread_id];
+        if (thread.nodes.empty()) {
+            Node root = {};
+            thread.nodes.push_back(root);
+        }
+        thread.last_ns = std::max(thread.last_ns, timestamp_ns);
+
+        if (!exit) {
+            uint32_t parent = thread.stack.empty() ? kRootNode : thread.stack.back().node;
+            auto it = thread.nodes[parent].children.find(method_id);
+            uint32_t index;
+            if (it != thread.nodes[parent].children.end()) {
+                index = it->second;
+            } else {
+                index = static_cast<uint32_t>(thread.nodes.size());
+                Node node = {};
+                node.method_id = method_id;
+                node.parent = parent;
+                thread.nodes.push_back(node);
+                thread.nodes[parent].children[method_id] = index;
+            }
+            thread.nodes[index].calls++;
+            Frame frame = {index, timestamp_ns};
+            thread.stack.push_back(frame);
+            return;
+        }
+
+        for (size_t depth = thread.stack.size(); depth > 0; --depth) {
+            if (thread.nodes[thread.stack[depth - 1].node].method_id == method_id) {
+                // the frames above were left without an exit event
+                while (thread.stack.size() >= depth) {
+                    PopFrame(thread, timestamp_ns);
+                }
+                return;
+            }
+        }
+    }
+
+    void TraceProfile::OnEvent(int32_t thread_id, int64_t timestamp_ns,
+                               EventKind kind, uint32_t id, int32_t arg) {
+        if (kind == kEventClassLoad || kind == kEventClassPrepare) {
+            OnClassEvent(thread_id, timestamp_ns, kind, id);
+            return;
+        }
+        if (kind != kEventExceptionCatch) {
+            return;
+        }
+        auto it = threads_.find(thread_id);
+        if (it == threads_.end()) {
+            return;
+        }
+        Thread &thread = it->second;
+        thread.last_ns = std::max(thread.last_ns, timestamp_ns);
+        for (size_t depth = thread.stack.size(); depth > 0; --depth) {
+            if (thread.nodes[thread.stack[depth - 1].node].method_id == id) {
+                while (thread.stack.size() > depth) {
+                    PopFrame(thread, timestamp_ns);
+                }
+                return;
+            }
+        }
+    }
+
+    void TraceProfile::PopFrame(Thread &thread, int64_t timestamp_ns) {
+        const Frame &frame = thread.stack.back();
+        thread.nodes[frame.node].total_ns += std::max<int64_t>(0, timestamp_ns - frame.entry_ns);
+        thread.stack.pop_back();
+    }
+
+    void TraceProfile::Finish() {
+        for (auto &entry : threads_) {
+            Thread &thread = entry.second;
+            while (!thread.stack.empty()) {
+                PopFrame(thread, thread.last_ns);
+            }
+            // the root spans the top-level calls
+            Node &root = thread.nodes[kRootNode];
+            root.total_ns = 0;
+            for (const auto &child : root.children) {
+                root.total_ns += thread.nodes[child.second].total_ns;
+            }
+        }
+    }
+
+    int64_t TraceProfile::SelfTime(const Thread &thread, const Node &node) const {
+        int64_t self_ns = node.total_ns;
+        for (const auto &child : node.children) {
+            self_ns -= thread.nodes[child.second].total_ns;
+        }
+        return std::max<int64_t>(0, self_ns);
+    }
+
+    std::vector<TraceProfile::FlatEntry> TraceProfile::FlatProfile() const {
+        std::unordered_map<uint32_t, FlatEntry> flat;
+        std::unordered_map<uint32_t, int> on_path;
+        for (const auto &entry : threads_) {
+            const Thread &thread = entry.second;
+            if (thread.nodes.empty()) {
+                continue;
+            }
+            // iterative DFS so that deep recursion can't blow the stack
+            std::vector<std::pair<uint32_t, bool>> work;
+            for (const auto &child : thread.nodes[kRootNode].children) {
+                work.push_back(std::make_pair(child.second, false));
+            }
+            while (!work.empty()) {
+                std::pair<uint32_t, bool> item = work.back();
+                work.pop_back();
+                const Node &node = thread.nodes[item.first];
+                if (item.second) {
+                    on_path[node.method_id]--;
+                    continue;
+                }
+                FlatEntry &flat_entry = flat[node.method_id];
+                flat_entry.method_id = node.method_id;
+                flat_entry.calls += node.calls;
+                flat_entry.self_ns += SelfTime(thread, node);
+                if (on_path[node.method_id]++ == 0) {
+                    flat_entry.total_ns += node.total_ns;
+                }
+                work.push_back(std::make_pair(item.first, true));
+                for (const auto &child : node.children) {
+                    work.push_back(std::make_pair(child.second, false));
+                }
+            }
+        }
+
+        std::vector<FlatEntry> result;
+        result.reserve(flat.size());
+        for (const auto &entry : flat) {
+            result.push_back(entry.second);
+        }
+        std::sort(result.begin(), result.end(), [](const FlatEntry &a, const FlatEntry &b) {
+            return a.self_ns != b.self_ns ? a.self_ns > b.self_ns : a.method_id < b.method_id;
+        });
+        return result;
+    }
+
+    std::string TraceProfile::MethodName(uint32_t method_id) const {
+        auto it = methods_.find(method_id);
+        if (it == methods_.end()) {
+            return "<method " + std::to_string(method_id) + ">";
+        }
+        auto class_it = classes_.find(it->second.class_id);
+        std::string name = class_it != classes_.end() ? class_it->second : "<unknown>";
+        return name + "->" + it->second.name + it->second.signature;
+    }
+
+    void TraceProfile::PrintFlatProfile(FILE *out, size_t limit) const {
+        std::vector<FlatEntry> flat = FlatProfile();
+        int64_t total_ns = 0;
+        for (const FlatEntry &entry : flat) {
+            total_ns += entry.self_ns;
+        }
+        fprintf(out, "%7s %12s %12s %10s  %s\n", "self%", "self(ms)", "total(ms)", "calls", "method");
+        for (size_t i = 0; i < flat.size() && i < limit; ++i) {
+            const FlatEntry &entry = flat[i];
+            fprintf(out, "%6.2f%% %12.3f %12.3f %10" PRIu64 "  %s\n",
+                    total_ns > 0 ? 100.0 * entry.self_ns / total_ns : 0.0,
+                    entry.self_ns / 1e6, entry.total_ns / 1e6, entry.calls,
+                    MethodName(entry.method_id).c_str());
+        }
+    }
+
+    void TraceProfile::PrintCallTrees(FILE *out, double min_percent) const {
+        for (const auto &entry : threads_) {
+            const Thread &thread = entry.second;
+            if (thread.nodes.empty()) {
+                continue;
+            }
+            int64_t total_ns = thread.nodes[kRootNode].total_ns;
+            fprintf(out, "thread %d (%.3f ms)\n", entry.first, total_ns / 1e6);
+            int64_t min_ns = static_cast<int64_t>(total_ns * min_percent / 100.0);
+            for (const auto &child : thread.nodes[kRootNode].children) {
+                PrintNode(out, thread, child.second, 1, min_ns);
+            }
+        }
+    }
+
+    void TraceProfile::PrintNode(FILE *out, const Thread &thread, uint32_t index, int depth,
+                                 int64_t min_ns) const {
+        const Node &node = thread.nodes[index];
+        if (node.total_ns < min_ns) {
+            return;
+        }
+        fprintf(out, "%*s%.3f ms (self %.3f) x%" PRIu64 " %s\n", depth * 2, "",
+                node.total_ns / 1e6, SelfTime(thread, node) / 1e6, node.calls,
+                MethodName(node.method_id).c_str());
+        // heaviest children first
+        std::vector<uint32_t> children;
+        for (const auto &child : node.children) {
+            children.push_back(child.second);
+        }
+        std::sort(children.begin(), children.end(), [&thread](uint32_t a, uint32_t b) {
+            return thread.nodes[a].total_ns > thread.nodes[b].total_ns;
+        });
+        for (uint32_t child : children) {
+            PrintNode(out, thread, child, depth + 1, min_ns);
+        }
+    }
+
+    void TraceProfile::OnStackNode(uint32_t node_id, uint32_t parent_id, uint32_t method_id) {
+        if (node_id == 0) {
+            return;
+        }
+        if (sample_nodes_.size() <= std::max(node_id, parent_id)) {
+            sample_nodes_.resize(std::max(node_id, parent_id) + 1);
+        }
+        SampleNode &node = sample_nodes_[node_id];
+        node.parent = parent_id;
+        node.method_id = method_id;
+        sample_nodes_[parent_id].children.push_back(node_id);
+        samples_accumulated_ = false;
+    }
+
+    void TraceProfile::OnStackSamples(int64_t timestamp_ns, uint32_t node_id, uint32_t count) {
+        if (node_id == 0 || node_id >= sample_nodes_.size()) {
+            return;
+        }
+        sample_nodes_[node_id].self_samples += count;
+        total_samples_ += count;
+        samples_accumulated_ = false;
+    }
+
+    void TraceProfile::AccumulateSamples() const {
+        if (samples_accumulated_) {
+            return;
+        }
+        // a node is always defined after its parent, so children have higher ids
+        for (SampleNode &node : sample_nodes_) {
+            node.total_samples = node.self_samples;
+        }
+        for (size_t i = sample_nodes_.size(); i-- > 1;) {
+            sample_nodes_[sample_nodes_[i].parent].total_samples += sample_nodes_[i].total_samples;
+        }
+        samples_accumulated_ = true;
+    }
+
+    std::vector<TraceProfile::FlatEntry> TraceProfile::SampledFlatProfile() const {
+        AccumulateSamples();
+        std::unordered_map<uint32_t, FlatEntry> flat;
+        std::unordered_map<uint32_t, int> on_path;
+        std::vector<std::pair<uint32_t, bool>> work;
+        if (!sample_nodes_.empty()) {
+            for (uint32_t child : sample_nodes_[0].children) {
+                work.push_back(std::make_pair(child, false));
+            }
+        }
+        while (!work.empty()) {
+            std::pair<uint32_t, bool> item = work.back();
+            work.pop_back();
+            const SampleNode &node = sample_nodes_[item.first];
+            if (item.second) {
+                on_path[node.method_id]--;
+                continue;
+            }
+            FlatEntry &flat_entry = flat[node.method_id];
+            flat_entry.method_id = node.method_id;
+            flat_entry.calls += node.self_samples;
+            flat_entry.self_ns += node.self_samples;
+            if (on_path[node.method_id]++ == 0) {
+                flat_entry.total_ns += node.total_samples;
+            }
+            work.push_back(std::make_pair(item.first, true));
+            for (uint32_t child : node.children) {
+                work.push_back(std::make_pair(child, false));
+            }
+        }
+
+        std::vector<FlatEntry> result;
+        result.reserve(flat.size());
+        for (const auto &entry : flat) {
+            result.push_back(entry.second);
+        }
+        std::sort(result.begin(), result.end(), [](const FlatEntry &a, const FlatEntry &b) {
+            return a.self_ns != b.self_ns ? a.self_ns > b.self_ns : a.method_id < b.method_id;
+        });
+        return result;
+    }
+
+    void TraceProfile::PrintSampledFlatProfile(FILE *out, size_t limit) const {
+        std::vector<FlatEntry> flat = SampledFlatProfile();
+        fprintf(out, "%7s %10s %10s  %s\n", "self%", "self", "total", "method (samples)");
+        for (size_t i = 0; i < flat.size() && i < limit; ++i) {
+            const FlatEntry &entry = flat[i];
+            fprintf(out, "%6.2f%% %10" PRId64 " %10" PRId64 "  %s\n",
+                    100.0 * entry.self_ns / total_samples_, entry.self_ns, entry.total_ns,
+                    MethodName(entry.method_id).c_str());
+        }
+    }
+
+    void TraceProfile::PrintSampledTree(FILE *out, double min_percent) const {
+        AccumulateSamples();
+        if (sample_nodes_.empty()) {
+            return;
+        }
+        fprintf(out, "sampled stacks (%" PRIu64 " samples)\n", total_samples_);
+        uint64_t min_samples = static_cast<uint64_t>(total_samples_ * min_percent / 100.0);
+        PrintSampleNode(out, 0, 0, min_samples);
+    }
+
+    void TraceProfile::PrintSampleNode(FILE *out, uint32_t index, int depth,
+                                       uint64_t min_samples) const {
+        const SampleNode &node = sample_nodes_[index];
+        if (index != 0) {
+            if (node.total_samples < min_samples || node.total_samples == 0) {
+                return;
+            }
+            fprintf(out, "%*s%.2f%% (self %.2f%%) %s\n", depth * 2, "",
+                    100.0 * node.total_samples / total_samples_,
+                    100.0 * node.self_samples / total_samples_,
+                    MethodName(node.method_id).c_str());
+        }
+        std::vector<uint32_t> children(node.children);
+        std::sort(children.begin(), children.end(), [this](uint32_t a, uint32_t b) {
+            return sample_nodes_[a].total_samples > sample_nodes_[b].total_samples;
+        });
+        for (uint32_t child : children) {
+            PrintSampleNode(out, child, depth + 1, min_samples);
+        }
+    }
+
+    void TraceProfile::OnAllocSite(uint32_t site_id, uint32_t method_id, uint32_t dex_pc,
+                                   const std::string &type) {
+        AllocSite &site = alloc_sites_[site_id];
+        site.method_id = method_id;
+        site.dex_pc = dex_pc;
+        site.type = type;
+    }
+
+    void TraceProfile::OnAllocCounts(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                                     uint32_t bytes) {
+        AllocSite &site = alloc_sites_[site_id];
+        site.count += count;
+        site.bytes += bytes;
+    }
+
+    void TraceProfile::PrintAllocSites(FILE *out, size_t limit) const {
+        std::vector<const AllocSite *> sites;
+        uint64_t total = 0;
+        for (const auto &entry : alloc_sites_) {
+            if (entry.second.count > 0) {
+                sites.push_back(&entry.second);
+                total += entry.second.count;
+            }
+        }
+        std::sort(sites.begin(), sites.end(), [](const AllocSite *a, const AllocSite *b) {
+            return a->count > b->count;
+        });
+        // array bytes only, instance sizes are unknown to the probes
+        fprintf(out, "%7s %12s %14s  %s\n", "allocs%", "allocs", "array bytes", "type @ site");
+        for (size_t i = 0; i < sites.size() && i < limit; ++i) {
+            const AllocSite &site = *sites[i];
+            fprintf(out, "%6.2f%% %12" PRIu64 " %14" PRIu64 "  %s @ %s:%u\n",
+                    100.0 * site.count / total, site.count, site.bytes, site.type.c_str(),
+                    MethodName(site.method_id).c_str(), site.dex_pc);
+        }
+    }
+
+    void TraceProfile::OnHeapHistogram(int64_t timestamp_ns,
+                                       const std::vector<std::string> &heap_names) {
+        heap_names_ = heap_names;
+        heap_classes_.clear();
+    }
+
+    void TraceProfile::OnHeapClassCount(uint32_t class_id, uint32_t heap, uint32_t count,
+                                        uint32_t bytes) {
+        heap_classes_.push_back({class_id, heap, count, bytes});
+    }
+
+    void TraceProfile::PrintHeapHistogram(FILE *out, size_t limit) const {
+        std::vector<const HeapClass *> classes;
+        uint64_t objects = 0;
+        uint64_t total = 0;
+        for (const HeapClass &heap_class : heap_classes_) {
+            classes.push_back(&heap_class);
+            objects += heap_class.count;
+            total += heap_class.bytes;
+        }
+        std::sort(classes.begin(), classes.end(), [](const HeapClass *a, const HeapClass *b) {
+            return a->bytes > b->bytes;
+        });
+        fprintf(out, "heap: %" PRIu64 " objects, %" PRIu64 " bytes\n", objects, total);
+        fprintf(out, "%7s %12s %12s  %s\n", "bytes%", "bytes", "objects", "class (heap)");
+        for (size_t i = 0; i < classes.size() && i < limit; ++i) {
+            const HeapClass &heap_class = *classes[i];
+            auto class_it = classes_.find(heap_class.class_id);
+            fprintf(out, "%6.2f%% %12" PRIu64 " %12" PRIu64 "  %s (%s)\n",
+                    total > 0 ? 100.0 * heap_class.bytes / total : 0.0, heap_class.bytes,
+                    heap_class.count,
+                    class_it != classes_.end() ? class_it->second.c_str() : "<unknown>",
+                    heap_names_[heap_class.heap].c_str());
+        }
+    }
+
+    void TraceProfile::OnMonitorHistogram(int64_t timestamp_ns, MonitorWaitKind kind,
+                                          uint32_t class_id, uint32_t method_id, uint32_t dex_pc,
+                                          const LatencyHistogram &histogram) {
+        monitors_[std::make_tuple(static_cast<uint8_t>(kind), class_id, method_id, dex_pc)] =
+                histogram;
+    }
+
+    void TraceProfile::PrintMonitors(FILE *out, size_t limit) const {
+        for (MonitorWaitKind kind : {kMonitorContended, kMonitorWait}) {
+            PrintMonitorTable(out, kind, false, limit);
+            PrintMonitorTable(out, kind, true, limit);
+        }
+    }
+
+    void TraceProfile::PrintMonitorTable(FILE *out, MonitorWaitKind kind, bool sites,
+                                         size_t limit) const {
+        std::vector<std::pair<std::string, const LatencyHistogram *>> rows;
+        for (const auto &entry : monitors_) {
+            uint32_t class_id = std::get<1>(entry.first);
+            uint32_t method_id = std::get<2>(entry.first);
+            if (std::get<0>(entry.first) != kind || (method_id != 0) != sites) {
+                continue;
+            }
+            std::string name;
+            if (sites) {
+                name = MethodName(method_id) + ":" + std::to_string(std::get<3>(entry.first));
+            } else {
+                auto class_it = classes_.find(class_id);
+                name = class_it != classes_.end() ? class_it->second : "<untagged>";
+            }
+            rows.push_back(std::make_pair(name, &entry.second));
+        }
+        if (rows.empty()) {
+            return;
+        }
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<std::string, const LatencyHistogram *> &a,
+                     const std::pair<std::string, const LatencyHistogram *> &b) {
+                      return a.second->Sum() > b.second->Sum();
+                  });
+        fprintf(out, "%s per %s (ms, totals estimated from the buckets)\n",
+                kind == kMonitorContended ? "contended monitor entries" : "Object.wait calls",
+                sites ? "call site" : "monitor class");
+        fprintf(out, "%10s %12s %10s %10s %10s %10s  %s\n", "waits", "total", "p50", "p90", "p99",
+                "max", sites ? "site" : "class");
+        for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+            const LatencyHistogram &histogram = *rows[i].second;
+            fprintf(out, "%10" PRIu64 " %12.3f %10.3f %10.3f %10.3f %10.3f  %s\n",
+                    histogram.Count(), histogram.Sum() / 1e6, histogram.Percentile(0.5) / 1e6,
+                    histogram.Percentile(0.9) / 1e6, histogram.Percentile(0.99) / 1e6,
+                    histogram.Max() / 1e6, rows[i].first.c_str());
+        }
+    }
+
+    void TraceProfile::OnGcPause(int64_t start_ns, uint32_t pause_us, uint32_t heap_before_kb,
+                                 uint32_t heap_after_kb) {
+        gc_pauses_.push_back({start_ns, pause_us, heap_before_kb, heap_after_kb});
+    }
+
+    void TraceProfile::PrintGcTimeline(FILE *out, size_t limit, int64_t start_ns) const {
+        LatencyHistogram pauses;
+        for (const GcPause &pause : gc_pauses_) {
+            pauses.Add(pause.pause_us * 1000ULL);
+        }
+        double span_s = (gc_pauses_.back().start_ns - gc_pauses_.front().start_ns) / 1e9;
+        fprintf(out, "%" PRIu64 " collections in %.1f s, %.2f ms paused, "
+                "p50 %.2f p90 %.2f p99 %.2f max %.2f ms\n",
+                pauses.Count(), span_s, pauses.Sum() / 1e6, pauses.Percentile(0.5) / 1e6,
+                pauses.Percentile(0.9) / 1e6, pauses.Percentile(0.99) / 1e6, pauses.Max() / 1e6);
+
+        std::vector<size_t> longest(gc_pauses_.size());
+        for (size_t i = 0; i < longest.size(); ++i) {
+            longest[i] = i;
+        }
+        size_t count = std::min(longest.size(), limit);
+        std::partial_sort(longest.begin(), longest.begin() + count, longest.end(),
+                          [this](size_t a, size_t b) {
+                              return gc_pauses_[a].pause_us > gc_pauses_[b].pause_us;
+                          });
+        std::sort(longest.begin(), longest.begin() + count);
+        // the heap grows by the allocations between two collections
+        fprintf(out, "%10s %10s %12s %12s %10s\n", "start s", "pause ms", "before KB",
+                "after KB", "alloc MB/s");
+        for (size_t i = 0; i < count; ++i) {
+            const GcPause &pause = gc_pauses_[longest[i]];
+            fprintf(out, "%10.3f %10.3f %12u %12u", (pause.start_ns - start_ns) / 1e9,
+                    pause.pause_us / 1e3, pause.heap_before_kb, pause.heap_after_kb);
+            if (longest[i] > 0) {
+                const GcPause &previous = gc_pauses_[longest[i] - 1];
+                double elapsed_s = (pause.start_ns - previous.start_ns) / 1e9;
+                uint32_t grown_kb = pause.heap_before_kb > previous.heap_after_kb
+                                    ? pause.heap_before_kb - previous.heap_after_kb : 0;
+                fprintf(out, " %10.1f", elapsed_s > 0 ? grown_kb / 1024.0 / elapsed_s : 0.0);
+            }
+            fprintf(out, "\n");
+        }
+    }
+
+    void TraceProfile::OnThreadName(uint32_t thread_id, const std::string &name) {
+        thread_cpu_[thread_id].name = name;
+    }
+
+    void TraceProfile::OnThreadCpuSample(int64_t timestamp_ns) {
+        if (thread_cpu_samples_++ == 0) {
+            first_cpu_sample_ns_ = timestamp_ns;
+        }
+        last_cpu_sample_ns_ = timestamp_ns;
+    }
+
+    void TraceProfile::OnThreadCpu(uint32_t thread_id, uint32_t cpu_us) {
+        thread_cpu_[thread_id].cpu_us += cpu_us;
+    }
+
+    void TraceProfile::PrintThreadCpu(FILE *out, size_t limit) const {
+        std::vector<std::pair<uint32_t, const ThreadCpu *>> rows;
+        uint64_t total_us = 0;
+        for (const auto &entry : thread_cpu_) {
+            if (entry.second.cpu_us > 0) {
+                rows.push_back(std::make_pair(entry.first, &entry.second));
+                total_us += entry.second.cpu_us;
+            }
+        }
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<uint32_t, const ThreadCpu *> &a,
+                     const std::pair<uint32_t, const ThreadCpu *> &b) {
+                      return a.second->cpu_us > b.second->cpu_us;
+                  });
+        double span_us = (last_cpu_sample_ns_ - first_cpu_sample_ns_) / 1e3;
+        fprintf(out, "thread CPU time over %.1f s, %.1f ms in %zu threads\n", span_us / 1e6,
+                total_us / 1e3, rows.size());
+        fprintf(out, "%12s %8s %8s %10s  %s\n", "cpu ms", "core %", "share %", "thread", "name");
+        for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+            const ThreadCpu &thread = *rows[i].second;
+            fprintf(out, "%12.3f %8.1f %8.1f %10" PRIu32 "  %s\n", thread.cpu_us / 1e3,
+                    span_us > 0 ? thread.cpu_us * 100.0 / span_us : 0.0,
+                    thread.cpu_us * 100.0 / total_us, rows[i].first, thread.name.c_str());
+        }
+    }
+
+    void TraceProfile::OnExceptionSite(uint32_t site_id, uint32_t class_id, uint32_t method_id,
+                                       uint32_t location) {
+        ExceptionSite &site = exception_sites_[site_id];
+        site.class_id = class_id;
+        site.method_id = method_id;
+        site.location = location;
+    }
+
+    void TraceProfile::OnExceptionCount(int64_t timestamp_ns, uint32_t site_id, uint32_t count) {
+        exception_sites_[site_id].count += count;
+    }
+
+    void TraceProfile::OnExceptionStack(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                                        const std::vector<uint32_t> &method_ids) {
+        exception_sites_[site_id].stacks[method_ids] += count;
+    }
+
+    void TraceProfile::PrintExceptions(FILE *out, size_t limit) const {
+        // sampled stacks printed per site
+        static const size_t kStacksPerSite = 3;
+        std::vector<const ExceptionSite *> sites;
+        uint64_t total = 0;
+        for (const auto &entry : exception_sites_) {
+            sites.push_back(&entry.second);
+            total += entry.second.count;
+        }
+        std::sort(sites.begin(), sites.end(), [](const ExceptionSite *a, const ExceptionSite *b) {
+            return a->count > b->count;
+        });
+        fprintf(out, "%" PRIu64 " exceptions thrown at %zu sites\n", total, sites.size());
+        fprintf(out, "%10s %8s  %s\n", "count", "share %", "exception at throw site");
+        for (size_t i = 0; i < sites.size() && i < limit; ++i) {
+            const ExceptionSite &site = *sites[i];
+            auto class_it = classes_.find(site.class_id);
+            fprintf(out, "%10" PRIu64 " %8.1f  %s at %s:%u\n", site.count,
+                    total > 0 ? site.count * 100.0 / total : 0.0,
+                    class_it != classes_.end() ? class_it->second.c_str() : "<untagged>",
+                    site.method_id != 0 ? MethodName(site.method_id).c_str() : "<unknown>",
+                    site.location);
+
+            std::vector<std::pair<uint64_t, const std::vector<uint32_t> *>> stacks;
+            uint64_t sampled = 0;
+            for (const auto &stack : site.stacks) {
+                stacks.push_back(std::make_pair(stack.second, &stack.first));
+                sampled += stack.second;
+            }
+            size_t count = std::min(stacks.size(), kStacksPerSite);
+            std::partial_sort(stacks.begin(), stacks.begin() + count, stacks.end(),
+                              [](const std::pair<uint64_t, const std::vector<uint32_t> *> &a,
+                                 const std::pair<uint64_t, const std::vector<uint32_t> *> &b) {
+                                  return a.first > b.first;
+                              });
+            for (size_t j = 0; j < count; ++j) {
+                fprintf(out, "%21s%" PRIu64 "/%" PRIu64 " sampled stacks\n", "", stacks[j].first,
+                        sampled);
+                for (uint32_t method_id : *stacks[j].second) {
+                    fprintf(out, "%23s%s\n", "",
+                            method_id != 0 ? MethodName(method_id).c_str() : "<unknown>");
+                }
+            }
+        }
+    }
+
+    void TraceProfile::OnClassEvent(int32_t thread_id, int64_t timestamp_ns, EventKind kind,
+                                    uint32_t class_id) {
+        auto key = std::make_pair(thread_id, class_id);
+        if (kind == kEventClassLoad) {
+            pending_class_loads_[key] = timestamp_ns;
+            return;
+        }
+        auto load_it = pending_class_loads_.find(key);
+        if (load_it == pending_class_loads_.end()) {
+            return;
+        }
+        int64_t load_ns = load_it->second;
+        pending_class_loads_.erase(load_it);
+        auto class_it = classes_.find(class_id);
+        if (class_it == classes_.end()) {
+            return;
+        }
+        ClassTimes &times = class_times_[class_it->second];
+        if (times.first_load_ns == 0 || load_ns < times.first_load_ns) {
+            times.first_load_ns = load_ns;
+        }
+        times.load_to_prepare_ns += std::max<int64_t>(0, timestamp_ns - load_ns);
+    }
+
+    void TraceProfile::OnClassTimes(int64_t timestamp_ns, const std::string &signature,
+                                    uint32_t transform_us, uint32_t clinit_us,
+                                    uint32_t clinit_self_us) {
+        ClassTimes &times = class_times_[signature];
+        times.transform_us = transform_us;
+        times.clinit_us = clinit_us;
+        times.clinit_self_us = clinit_self_us;
+    }
+
+    void TraceProfile::PrintClassTimeline(FILE *out, size_t limit, int64_t start_ns) const {
+        auto cost_ns = [](const ClassTimes &times) {
+            return times.load_to_prepare_ns +
+                   (static_cast<int64_t>(times.transform_us) + times.clinit_self_us) * 1000;
+        };
+        std::vector<std::map<std::string, ClassTimes>::const_iterator> classes;
+        int64_t transform_ns = 0;
+        int64_t load_ns = 0;
+        int64_t clinit_ns = 0;
+        for (auto it = class_times_.begin(); it != class_times_.end(); ++it) {
+            classes.push_back(it);
+            transform_ns += static_cast<int64_t>(it->second.transform_us) * 1000;
+            load_ns += it->second.load_to_prepare_ns;
+            clinit_ns += static_cast<int64_t>(it->second.clinit_self_us) * 1000;
+        }
+        size_t count = std::min(classes.size(), limit);
+        std::partial_sort(classes.begin(), classes.begin() + count, classes.end(),
+                          [&cost_ns](std::map<std::string, ClassTimes>::const_iterator a,
+                                     std::map<std::string, ClassTimes>::const_iterator b) {
+                              return cost_ns(a->second) > cost_ns(b->second);
+                          });
+        fprintf(out, "%zu classes: %.2f ms transforming, %.2f ms load to prepare, "
+                     "%.2f ms in static initializers\n",
+                classes.size(), transform_ns / 1e6, load_ns / 1e6, clinit_ns / 1e6);
+        fprintf(out, "%10s %10s %10s %10s %10s %10s  %s\n", "total ms", "transform", "load-prep",
+                "clinit", "self", "loaded at", "class");
+        for (size_t i = 0; i < count; ++i) {
+            const ClassTimes &times = classes[i]->second;
+            char loaded_at[32] = "-";
+            if (times.first_load_ns != 0) {
+                snprintf(loaded_at, sizeof(loaded_at), "%.1f",
+                         (times.first_load_ns - start_ns) / 1e6);
+            }
+            fprintf(out, "%10.2f %10.2f %10.2f %10.2f %10.2f %10s  %s\n", cost_ns(times) / 1e6,
+                    times.transform_us / 1e3, times.load_to_prepare_ns / 1e6,
+                    times.clinit_us / 1e3, times.clinit_self_us / 1e3, loaded_at,
+                    classes[i]->first.c_str());
+        }
+    }
+
+}  // namespace profiler
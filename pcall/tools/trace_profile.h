@@ -0,0 +1,322 @@
+#ifndef TRACE_PROFILE_H
+#define TRACE_PROFILE_H
+
+#include "trace_reader.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Rebuilds per-thread call trees from the method entry/exit events of a
+     * trace and derives a flat profile from them.
+     *
+     * Traces can start in the middle of a call stack and lose events when a
+     * ring buffer overflows, so an exit is matched with the closest entry of
+     * the same method on the stack, frames above it are closed at the same
+     * time, and unmatched exits are ignored. Frames still open at the end of
+     * the trace are closed at the thread's last timestamp. With bytecode
+     * probes an exception skips the exit probes of the frames it unwinds,
+     * so an exception catch event closes every frame above the innermost
+     * one of the catching method.
+     *
+     * Sampled stacks (see SamplingProfiler) are kept as a separate trie with
+     * sample counts instead of times, allocation counts (see
+     * AllocationSites) are summed per site, only the last heap histogram
+     * (see HeapHistogram) is kept, and so is the last monitor wait time
+     * histogram of each class and call site (see MonitorContention).
+     * Collections (see GcTimelineTask) are kept in start order and the
+     * CPU time of each thread (see ThreadCpuSampler) is summed, as are the
+     * exceptions and the sampled stacks of each throw site (see
+     * ExceptionHotSpots). The class load events are paired with the class
+     * prepare events of the same thread and class into the load to prepare
+     * time of each class, next to its last transform and static initializer
+     * times (see ClassTimeline).
+     */
+    class TraceProfile : public TraceVisitor {
+    public:
+        struct Node {
+            uint32_t method_id;
+            uint32_t parent;
+            uint64_t calls;
+            int64_t total_ns;
+            // child nodes by method id
+            std::map<uint32_t, uint32_t> children;
+        };
+
+        struct FlatEntry {
+            uint32_t method_id;
+            uint64_t calls;
+            int64_t self_ns;
+            // recursive calls are only counted once
+            int64_t total_ns;
+        };
+
+        void OnClass(uint32_t class_id, const std::string &signature) override;
+
+        void OnMethod(uint32_t method_id, uint32_t class_id,
+                      const std::string &name, const std::string &signature) override;
+
+        void OnMethodEvent(int32_t thread_id, int64_t timestamp_ns,
+                           uint32_t method_id, bool exit) override;
+
+        void OnEvent(int32_t thread_id, int64_t timestamp_ns,
+                     EventKind kind, uint32_t id, int32_t arg) override;
+
+        void OnStackNode(uint32_t node_id, uint32_t parent_id, uint32_t method_id) override;
+
+        void OnStackSamples(int64_t timestamp_ns, uint32_t node_id, uint32_t count) override;
+
+        void OnAllocSite(uint32_t site_id, uint32_t method_id, uint32_t dex_pc,
+                         const std::string &type) override;
+
+        void OnAllocCounts(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                           uint32_t bytes) override;
+
+        void OnHeapHistogram(int64_t timestamp_ns,
+                             const std::vector<std::string> &heap_names) override;
+
+        void OnHeapClassCount(uint32_t class_id, uint32_t heap, uint32_t count,
+                              uint32_t bytes) override;
+
+        void OnMonitorHistogram(int64_t timestamp_ns, MonitorWaitKind kind, uint32_t class_id,
+                                uint32_t method_id, uint32_t dex_pc,
+                                const LatencyHistogram &histogram) override;
+
+        void OnGcPause(int64_t start_ns, uint32_t pause_us, uint32_t heap_before_kb,
+                       uint32_t heap_after_kb) override;
+
+        void OnThreadName(uint32_t thread_id, const std::string &name) override;
+
+        void OnThreadCpuSample(int64_t timestamp_ns) override;
+
+        void OnThreadCpu(uint32_t thread_id, uint32_t cpu_us) override;
+
+        void OnExceptionSite(uint32_t site_id, uint32_t class_id, uint32_t method_id,
+                             uint32_t location) override;
+
+        void OnExceptionCount(int64_t timestamp_ns, uint32_t site_id, uint32_t count) override;
+
+        void OnExceptionStack(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                              const std::vector<uint32_t> &method_ids) override;
+
+        void OnClassTimes(int64_t timestamp_ns, const std::string &signature, uint32_t transform_us,
+                          uint32_t clinit_us, uint32_t clinit_self_us) override;
+
+        /**
+         * Closes the frames still open. Call once the whole trace has been read.
+         */
+        void Finish();
+
+        std::vector<FlatEntry> FlatProfile() const;
+
+        /**
+         * Prints one call tree per thread, skipping nodes under |min_percent|
+         * of their thread's total time.
+         */
+        void PrintCallTrees(FILE *out, double min_percent) const;
+
+        void PrintFlatProfile(FILE *out, size_t limit) const;
+
+        bool HasMethodEvents() const { return !threads_.empty(); }
+
+        bool HasSamples() const { return total_samples_ > 0; }
+
+        /**
+         * Same as FlatProfile() for the sampled stacks, with the times
+         * replaced by sample counts.
+         */
+        std::vector<FlatEntry> SampledFlatProfile() const;
+
+        void PrintSampledFlatProfile(FILE *out, size_t limit) const;
+
+        void PrintSampledTree(FILE *out, double min_percent) const;
+
+        bool HasAllocSites() const { return !alloc_sites_.empty(); }
+
+        /**
+         * Prints the allocation sites sorted by allocation count.
+         */
+        void PrintAllocSites(FILE *out, size_t limit) const;
+
+        bool HasHeapHistogram() const { return !heap_names_.empty(); }
+
+        /**
+         * Prints the classes of the last heap histogram sorted by size.
+         */
+        void PrintHeapHistogram(FILE *out, size_t limit) const;
+
+        bool HasMonitorHistograms() const { return !monitors_.empty(); }
+
+        /**
+         * Prints the monitor classes and call sites sorted by total wait time,
+         * contended entries first, then Object.wait calls.
+         */
+        void PrintMonitors(FILE *out, size_t limit) const;
+
+        bool HasGcPauses() const { return !gc_pauses_.empty(); }
+
+        /**
+         * Prints the pause distribution and the |limit| longest collections
+         * in time order, with their start relative to |start_ns| and the
+         * allocation rate since the previous one.
+         */
+        void PrintGcTimeline(FILE *out, size_t limit, int64_t start_ns) const;
+
+        bool HasThreadCpu() const { return thread_cpu_samples_ > 1; }
+
+        /**
+         * Prints the threads sorted by CPU time, with their average use of a
+         * core between the first and the last sample.
+         */
+        void PrintThreadCpu(FILE *out, size_t limit) const;
+
+        bool HasExceptions() const { return !exception_sites_.empty(); }
+
+        /**
+         * Prints the throw sites sorted by exception count, each with its
+         * most sampled stacks.
+         */
+        void PrintExceptions(FILE *out, size_t limit) const;
+
+        bool HasClassTimes() const { return !class_times_.empty(); }
+
+        /**
+         * Prints the classes sorted by their startup cost: transform, load to
+         * prepare and static initializer self time, with their first load
+         * relative to |start_ns|.
+         */
+        void PrintClassTimeline(FILE *out, size_t limit, int64_t start_ns) const;
+
+        std::string MethodName(uint32_t method_id) const;
+
+    private:
+        struct Frame {
+            uint32_t node;
+            int64_t entry_ns;
+        };
+
+        struct Thread {
+            // nodes_[0] is a synthetic root
+            std::vector<Node> nodes;
+            std::vector<Frame> stack;
+            int64_t last_ns = 0;
+        };
+
+        struct MethodInfo {
+            uint32_t class_id;
+            std::string name;
+            std::string signature;
+        };
+
+        void PopFrame(Thread &thread, int64_t timestamp_ns);
+
+        int64_t SelfTime(const Thread &thread, const Node &node) const;
+
+        void PrintNode(FILE *out, const Thread &thread, uint32_t index, int depth,
+                       int64_t min_ns) const;
+
+        struct SampleNode {
+            uint32_t parent;
+            uint32_t method_id;
+            uint64_t self_samples;
+            uint64_t total_samples;
+            std::vector<uint32_t> children;
+        };
+
+        void AccumulateSamples() const;
+
+        void PrintSampleNode(FILE *out, uint32_t index, int depth, uint64_t min_samples) const;
+
+        std::map<int32_t, Thread> threads_;
+        std::unordered_map<uint32_t, std::string> classes_;
+        std::unordered_map<uint32_t, MethodInfo> methods_;
+        // indexed by node id, [0] is the root; totals are filled lazily
+        mutable std::vector<SampleNode> sample_nodes_;
+        mutable bool samples_accumulated_ = false;
+        uint64_t total_samples_ = 0;
+
+        struct AllocSite {
+            uint32_t method_id = 0;
+            uint32_t dex_pc = 0;
+            std::string type;
+            uint64_t count = 0;
+            uint64_t bytes = 0;
+        };
+
+        std::map<uint32_t, AllocSite> alloc_sites_;
+
+        struct HeapClass {
+            uint32_t class_id;
+            uint32_t heap;
+            uint64_t count;
+            uint64_t bytes;
+        };
+
+        std::vector<std::string> heap_names_;
+        std::vector<HeapClass> heap_classes_;
+
+        void PrintMonitorTable(FILE *out, MonitorWaitKind kind, bool sites, size_t limit) const;
+
+        // (kind, class id, method id, dex pc) -> wait times
+        std::map<std::tuple<uint8_t, uint32_t, uint32_t, uint32_t>, LatencyHistogram> monitors_;
+
+        struct GcPause {
+            int64_t start_ns;
+            uint32_t pause_us;
+            uint32_t heap_before_kb;
+            uint32_t heap_after_kb;
+        };
+
+        std::vector<GcPause> gc_pauses_;
+
+        struct ThreadCpu {
+            std::string name;
+            uint64_t cpu_us = 0;
+        };
+
+        // by java.lang.Thread id, unrelated to the ids of threads_
+        std::map<uint32_t, ThreadCpu> thread_cpu_;
+        uint64_t thread_cpu_samples_ = 0;
+        int64_t first_cpu_sample_ns_ = 0;
+        int64_t last_cpu_sample_ns_ = 0;
+
+        struct ExceptionSite {
+            uint32_t class_id = 0;
+            uint32_t method_id = 0;
+            uint32_t location = 0;
+            uint64_t count = 0;
+            // method ids, innermost first -> samples
+            std::map<std::vector<uint32_t>, uint64_t> stacks;
+        };
+
+        std::map<uint32_t, ExceptionSite> exception_sites_;
+
+        struct ClassTimes {
+            // 0 until a load event is seen
+            int64_t first_load_ns = 0;
+            int64_t load_to_prepare_ns = 0;
+            uint32_t transform_us = 0;
+            uint32_t clinit_us = 0;
+            uint32_t clinit_self_us = 0;
+        };
+
+        void OnClassEvent(int32_t thread_id, int64_t timestamp_ns, EventKind kind,
+                          uint32_t class_id);
+
+        // by class signature, the class ids of the events are resolved first
+        std::map<std::string, ClassTimes> class_times_;
+        // (thread id, class id) -> load event not paired yet
+        std::map<std::pair<int32_t, uint32_t>, int64_t> pending_class_loads_;
+    };
+
+}  // namespace profiler
+
+#endif  // TRACE_PROFILE_H
@@ -0,0 +1,515 @@
+#include "trace_reader.h"
+#include "slicer/dex_leb128.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace profiler {
+
+    static uint64_t ReadFixed(const uint8_t *ptr, int size) {
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i) {
+            value |= static_cast<uint64_t>(ptr[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // The dex decoders trust their input, so make sure the value ends in bounds
+    static bool HasLeb128(const uint8_t *ptr, const uint8_t *end) {
+        for (int i = 0; i < 5 && ptr + i < end; ++i) {
+            if ((ptr[i] & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool ReadULeb128(const uint8_t **ptr, const uint8_t *end, uint32_t *value) {
+        if (!HasLeb128(*ptr, end)) {
+            return false;
+        }
+        *value = dex::ReadULeb128(ptr);
+        return true;
+    }
+
+    static bool ReadSLeb128(const uint8_t **ptr, const uint8_t *end, int32_t *value) {
+        if (!HasLeb128(*ptr, end)) {
+            return false;
+        }
+        *value = dex::ReadSLeb128(ptr);
+        return true;
+    }
+
+    static bool ReadString(const uint8_t **ptr, const uint8_t *end, std::string *value) {
+        uint32_t size = 0;
+        if (!ReadULeb128(ptr, end, &size) || size > static_cast<size_t>(end - *ptr)) {
+            return false;
+        }
+        value->assign(reinterpret_cast<const char *>(*ptr), size);
+        *ptr += size;
+        return true;
+    }
+
+    bool TraceReader::Read(const std::string &path, TraceVisitor *visitor, std::string *error) {
+        stats_ = Stats();
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            *error = "can't open " + path;
+            return false;
+        }
+
+        bool ok = true;
+        uint8_t header[kTraceHeaderSize];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            ReadFixed(header, 4) != kTraceMagic) {
+            *error = path + " is not a trace file";
+            ok = false;
+        } else if (ReadFixed(header + 4, 2) != kTraceVersion) {
+            *error = "unsupported trace version " + std::to_string(ReadFixed(header + 4, 2));
+            ok = false;
+        } else {
+            ts_shift_ = static_cast<uint16_t>(ReadFixed(header + 6, 2));
+            start_ns_ = static_cast<int64_t>(ReadFixed(header + 8, 8));
+        }
+        stats_.file_size = sizeof(header);
+
+        std::vector<uint8_t> payload;
+        while (ok) {
+            uint8_t chunk_header[kTraceChunkHeaderSize];
+            size_t read = fread(chunk_header, 1, sizeof(chunk_header), file);
+            if (read == 0) {
+                break;
+            }
+            uint32_t size = static_cast<uint32_t>(ReadFixed(chunk_header + 1, 4));
+            payload.resize(size);
+            if (read != sizeof(chunk_header) || fread(payload.data(), 1, size, file) != size) {
+                // the agent was killed while writing this chunk
+                stats_.truncated = true;
+                break;
+            }
+            stats_.file_size += sizeof(chunk_header) + size;
+            ++stats_.chunks;
+
+            const uint8_t *ptr = payload.data();
+            const uint8_t *end = ptr + size;
+            switch (chunk_header[0]) {
+                case kChunkClasses:
+                case kChunkMethods:
+                    ok = ReadTables(static_cast<TraceChunkType>(chunk_header[0]), ptr, end, visitor);
+                    break;
+
+                case kChunkEvents:
+                    stats_.event_bytes += size;
+                    ok = ReadEvents(ptr, end, visitor);
+                    break;
+
+                case kChunkStacks:
+                    ok = ReadStacks(ptr, end, visitor);
+                    break;
+
+                case kChunkSamples:
+                    ok = ReadSamples(ptr, end, visitor);
+                    break;
+
+                case kChunkAllocSites:
+                    ok = ReadAllocSites(ptr, end, visitor);
+                    break;
+
+                case kChunkAllocCounts:
+                    ok = ReadAllocCounts(ptr, end, visitor);
+                    break;
+
+                case kChunkHeapHistogram:
+                    ok = ReadHeapHistogram(ptr, end, visitor);
+                    break;
+
+                case kChunkMonitorHistograms:
+                    ok = ReadMonitorHistograms(ptr, end, visitor);
+                    break;
+
+                case kChunkGcPauses:
+                    ok = ReadGcPauses(ptr, end, visitor);
+                    break;
+
+                case kChunkThreadNames:
+                    ok = ReadThreadNames(ptr, end, visitor);
+                    break;
+
+                case kChunkThreadCpu:
+                    ok = ReadThreadCpu(ptr, end, visitor);
+                    break;
+
+                case kChunkExceptionSites:
+                    ok = ReadExceptionSites(ptr, end, visitor);
+                    break;
+
+                case kChunkExceptionCounts:
+                    ok = ReadExceptionCounts(ptr, end, visitor);
+                    break;
+
+                case kChunkExceptionStacks:
+                    ok = ReadExceptionStacks(ptr, end, visitor);
+                    break;
+
+                case kChunkClassTimes:
+                    ok = ReadClassTimes(ptr, end, visitor);
+                    break;
+
+                default:
+                    // written by a newer agent, skip
+                    break;
+            }
+            if (!ok) {
+                *error = "malformed chunk at offset " +
+                         std::to_string(stats_.file_size - sizeof(chunk_header) - size);
+            }
+        }
+        fclose(file);
+        return ok;
+    }
+
+    bool TraceReader::ReadTables(TraceChunkType type, const uint8_t *ptr, const uint8_t *end,
+                                 TraceVisitor *visitor) {
+        std::string name;
+        std::string signature;
+        while (ptr < end) {
+            uint32_t id = 0;
+            uint32_t class_id = 0;
+            if (!ReadULeb128(&ptr, end, &id)) {
+                return false;
+            }
+            if (type == kChunkClasses) {
+                if (!ReadString(&ptr, end, &signature)) {
+                    return false;
+                }
+                visitor->OnClass(id, signature);
+            } else {
+                if (!ReadULeb128(&ptr, end, &class_id) ||
+                    !ReadString(&ptr, end, &name) ||
+                    !ReadString(&ptr, end, &signature)) {
+                    return false;
+                }
+                visitor->OnMethod(id, class_id, name, signature);
+            }
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadEvents(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor) {
+        uint32_t thread_id = 0;
+        if (!ReadULeb128(&ptr, end, &thread_id) || end - ptr < 8) {
+            return false;
+        }
+        uint64_t ticks = ReadFixed(ptr, 8);
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t delta = 0;
+            uint32_t tag = 0;
+            if (!ReadULeb128(&ptr, end, &delta) || !ReadULeb128(&ptr, end, &tag)) {
+                return false;
+            }
+            ticks += delta;
+            int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ticks << ts_shift_);
+            if (tag != 0) {
+                ++stats_.method_events;
+                visitor->OnMethodEvent(static_cast<int32_t>(thread_id), timestamp_ns,
+                                       tag >> 1, (tag & 1) != 0);
+                continue;
+            }
+            uint32_t kind = 0;
+            uint32_t id = 0;
+            int32_t arg = 0;
+            if (!ReadULeb128(&ptr, end, &kind) || !ReadULeb128(&ptr, end, &id) ||
+                !ReadSLeb128(&ptr, end, &arg)) {
+                return false;
+            }
+            ++stats_.other_events;
+            visitor->OnEvent(static_cast<int32_t>(thread_id), timestamp_ns,
+                             static_cast<EventKind>(kind), id, arg);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadStacks(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor) {
+        while (ptr < end) {
+            uint32_t node_id = 0;
+            uint32_t parent_id = 0;
+            uint32_t method_id = 0;
+            if (!ReadULeb128(&ptr, end, &node_id) || !ReadULeb128(&ptr, end, &parent_id) ||
+                !ReadULeb128(&ptr, end, &method_id)) {
+                return false;
+            }
+            visitor->OnStackNode(node_id, parent_id, method_id);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadSamples(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t node_id = 0;
+            uint32_t count = 0;
+            if (!ReadULeb128(&ptr, end, &node_id) || !ReadULeb128(&ptr, end, &count)) {
+                return false;
+            }
+            stats_.stack_samples += count;
+            visitor->OnStackSamples(timestamp_ns, node_id, count);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadAllocSites(const uint8_t *ptr, const uint8_t *end,
+                                     TraceVisitor *visitor) {
+        std::string type;
+        while (ptr < end) {
+            uint32_t site_id = 0;
+            uint32_t method_id = 0;
+            uint32_t dex_pc = 0;
+            if (!ReadULeb128(&ptr, end, &site_id) || !ReadULeb128(&ptr, end, &method_id) ||
+                !ReadULeb128(&ptr, end, &dex_pc) || !ReadString(&ptr, end, &type)) {
+                return false;
+            }
+            visitor->OnAllocSite(site_id, method_id, dex_pc, type);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadAllocCounts(const uint8_t *ptr, const uint8_t *end,
+                                      TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t site_id = 0;
+            uint32_t count = 0;
+            uint32_t bytes = 0;
+            if (!ReadULeb128(&ptr, end, &site_id) || !ReadULeb128(&ptr, end, &count) ||
+                !ReadULeb128(&ptr, end, &bytes)) {
+                return false;
+            }
+            visitor->OnAllocCounts(timestamp_ns, site_id, count, bytes);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadHeapHistogram(const uint8_t *ptr, const uint8_t *end,
+                                        TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        uint32_t heap_count = 0;
+        if (!ReadULeb128(&ptr, end, &heap_count)) {
+            return false;
+        }
+        std::vector<std::string> heap_names(heap_count);
+        for (std::string &name : heap_names) {
+            if (!ReadString(&ptr, end, &name)) {
+                return false;
+            }
+        }
+        visitor->OnHeapHistogram(timestamp_ns, heap_names);
+        while (ptr < end) {
+            uint32_t class_id = 0;
+            uint32_t heap = 0;
+            uint32_t count = 0;
+            uint32_t bytes = 0;
+            if (!ReadULeb128(&ptr, end, &class_id) || !ReadULeb128(&ptr, end, &heap) ||
+                !ReadULeb128(&ptr, end, &count) || !ReadULeb128(&ptr, end, &bytes) ||
+                heap >= heap_count) {
+                return false;
+            }
+            visitor->OnHeapClassCount(class_id, heap, count, bytes);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadMonitorHistograms(const uint8_t *ptr, const uint8_t *end,
+                                            TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        uint32_t sub_bucket_bits = 0;
+        if (!ReadULeb128(&ptr, end, &sub_bucket_bits)) {
+            return false;
+        }
+        if (sub_bucket_bits != LatencyHistogram::kSubBucketBits) {
+            // another bucket layout, skip
+            return true;
+        }
+        LatencyHistogram histogram;
+        while (ptr < end) {
+            uint32_t kind = 0;
+            uint32_t class_id = 0;
+            uint32_t method_id = 0;
+            uint32_t dex_pc = 0;
+            uint32_t bucket_count = 0;
+            if (!ReadULeb128(&ptr, end, &kind) || !ReadULeb128(&ptr, end, &class_id) ||
+                !ReadULeb128(&ptr, end, &method_id) || !ReadULeb128(&ptr, end, &dex_pc) ||
+                !ReadULeb128(&ptr, end, &bucket_count)) {
+                return false;
+            }
+            histogram.Clear();
+            for (uint32_t i = 0; i < bucket_count; ++i) {
+                uint32_t bucket = 0;
+                uint32_t count = 0;
+                if (!ReadULeb128(&ptr, end, &bucket) || !ReadULeb128(&ptr, end, &count) ||
+                    bucket >= LatencyHistogram::kBucketCount) {
+                    return false;
+                }
+                histogram.AddToBucket(bucket, count);
+            }
+            visitor->OnMonitorHistogram(timestamp_ns, static_cast<MonitorWaitKind>(kind),
+                                        class_id, method_id, dex_pc, histogram);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadGcPauses(const uint8_t *ptr, const uint8_t *end,
+                                   TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        uint64_t ticks = ReadFixed(ptr, 8);
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t delta = 0;
+            uint32_t pause_us = 0;
+            uint32_t heap_before_kb = 0;
+            uint32_t heap_after_kb = 0;
+            if (!ReadULeb128(&ptr, end, &delta) || !ReadULeb128(&ptr, end, &pause_us) ||
+                !ReadULeb128(&ptr, end, &heap_before_kb) ||
+                !ReadULeb128(&ptr, end, &heap_after_kb)) {
+                return false;
+            }
+            ticks += delta;
+            visitor->OnGcPause(start_ns_ + static_cast<int64_t>(ticks << ts_shift_), pause_us,
+                               heap_before_kb, heap_after_kb);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadThreadNames(const uint8_t *ptr, const uint8_t *end,
+                                      TraceVisitor *visitor) {
+        std::string name;
+        while (ptr < end) {
+            uint32_t thread_id = 0;
+            if (!ReadULeb128(&ptr, end, &thread_id) || !ReadString(&ptr, end, &name)) {
+                return false;
+            }
+            visitor->OnThreadName(thread_id, name);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadThreadCpu(const uint8_t *ptr, const uint8_t *end,
+                                    TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        visitor->OnThreadCpuSample(start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_));
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t thread_id = 0;
+            uint32_t cpu_us = 0;
+            if (!ReadULeb128(&ptr, end, &thread_id) || !ReadULeb128(&ptr, end, &cpu_us)) {
+                return false;
+            }
+            visitor->OnThreadCpu(thread_id, cpu_us);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadExceptionSites(const uint8_t *ptr, const uint8_t *end,
+                                         TraceVisitor *visitor) {
+        while (ptr < end) {
+            uint32_t site_id = 0;
+            uint32_t class_id = 0;
+            uint32_t method_id = 0;
+            uint32_t location = 0;
+            if (!ReadULeb128(&ptr, end, &site_id) || !ReadULeb128(&ptr, end, &class_id) ||
+                !ReadULeb128(&ptr, end, &method_id) || !ReadULeb128(&ptr, end, &location)) {
+                return false;
+            }
+            visitor->OnExceptionSite(site_id, class_id, method_id, location);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadExceptionCounts(const uint8_t *ptr, const uint8_t *end,
+                                          TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        while (ptr < end) {
+            uint32_t site_id = 0;
+            uint32_t count = 0;
+            if (!ReadULeb128(&ptr, end, &site_id) || !ReadULeb128(&ptr, end, &count)) {
+                return false;
+            }
+            visitor->OnExceptionCount(timestamp_ns, site_id, count);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadExceptionStacks(const uint8_t *ptr, const uint8_t *end,
+                                          TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        std::vector<uint32_t> method_ids;
+        while (ptr < end) {
+            uint32_t site_id = 0;
+            uint32_t count = 0;
+            uint32_t depth = 0;
+            // a frame takes at least a byte
+            if (!ReadULeb128(&ptr, end, &site_id) || !ReadULeb128(&ptr, end, &count) ||
+                !ReadULeb128(&ptr, end, &depth) || depth > static_cast<uint32_t>(end - ptr)) {
+                return false;
+            }
+            method_ids.resize(depth);
+            for (uint32_t i = 0; i < depth; ++i) {
+                if (!ReadULeb128(&ptr, end, &method_ids[i])) {
+                    return false;
+                }
+            }
+            visitor->OnExceptionStack(timestamp_ns, site_id, count, method_ids);
+        }
+        return true;
+    }
+
+    bool TraceReader::ReadClassTimes(const uint8_t *ptr, const uint8_t *end,
+                                     TraceVisitor *visitor) {
+        if (end - ptr < 8) {
+            return false;
+        }
+        int64_t timestamp_ns = start_ns_ + static_cast<int64_t>(ReadFixed(ptr, 8) << ts_shift_);
+        ptr += 8;
+        std::string signature;
+        while (ptr < end) {
+            uint32_t transform_us = 0;
+            uint32_t clinit_us = 0;
+            uint32_t clinit_self_us = 0;
+            if (!ReadString(&ptr, end, &signature) || !ReadULeb128(&ptr, end, &transform_us) ||
+                !ReadULeb128(&ptr, end, &clinit_us) || !ReadULeb128(&ptr, end, &clinit_self_us)) {
+                return false;
+            }
+            visitor->OnClassTimes(timestamp_ns, signature, transform_us, clinit_us, clinit_self_us);
+        }
+        return true;
+    }
+
+}  // namespace profiler
@@ -0,0 +1,163 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include "latency_histogram.h"
+#include "trace_format.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+    /**
+     * Receives the decoded content of a trace, in file order.
+     * Timestamps are absolute monotonic nanoseconds.
+     */
+    class TraceVisitor {
+    public:
+        virtual ~TraceVisitor() = default;
+
+        virtual void OnClass(uint32_t class_id, const std::string &signature) {}
+
+        virtual void OnMethod(uint32_t method_id, uint32_t class_id,
+                              const std::string &name, const std::string &signature) {}
+
+        virtual void OnMethodEvent(int32_t thread_id, int64_t timestamp_ns,
+                                   uint32_t method_id, bool exit) {}
+
+        virtual void OnEvent(int32_t thread_id, int64_t timestamp_ns,
+                             EventKind kind, uint32_t id, int32_t arg) {}
+
+        virtual void OnStackNode(uint32_t node_id, uint32_t parent_id, uint32_t method_id) {}
+
+        virtual void OnStackSamples(int64_t timestamp_ns, uint32_t node_id, uint32_t count) {}
+
+        virtual void OnAllocSite(uint32_t site_id, uint32_t method_id, uint32_t dex_pc,
+                                 const std::string &type) {}
+
+        virtual void OnAllocCounts(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                                   uint32_t bytes) {}
+
+        /**
+         * Starts a heap histogram, followed by its counts.
+         */
+        virtual void OnHeapHistogram(int64_t timestamp_ns,
+                                     const std::vector<std::string> &heap_names) {}
+
+        virtual void OnHeapClassCount(uint32_t class_id, uint32_t heap, uint32_t count,
+                                      uint32_t bytes) {}
+
+        /**
+         * A monitor wait time histogram, per class when |method_id| is 0,
+         * per call site otherwise. Supersedes the earlier ones of the key.
+         */
+        virtual void OnMonitorHistogram(int64_t timestamp_ns, MonitorWaitKind kind,
+                                        uint32_t class_id, uint32_t method_id, uint32_t dex_pc,
+                                        const LatencyHistogram &histogram) {}
+
+        /**
+         * A collection, with the heap usage sampled before and after it.
+         */
+        virtual void OnGcPause(int64_t start_ns, uint32_t pause_us, uint32_t heap_before_kb,
+                               uint32_t heap_after_kb) {}
+
+        virtual void OnThreadName(uint32_t thread_id, const std::string &name) {}
+
+        /**
+         * Starts a thread CPU sample, followed by the CPU time of each thread
+         * since the previous one.
+         */
+        virtual void OnThreadCpuSample(int64_t timestamp_ns) {}
+
+        virtual void OnThreadCpu(uint32_t thread_id, uint32_t cpu_us) {}
+
+        virtual void OnExceptionSite(uint32_t site_id, uint32_t class_id, uint32_t method_id,
+                                     uint32_t location) {}
+
+        virtual void OnExceptionCount(int64_t timestamp_ns, uint32_t site_id, uint32_t count) {}
+
+        /**
+         * A stack sampled |count| times at |site_id|, innermost frame first.
+         */
+        virtual void OnExceptionStack(int64_t timestamp_ns, uint32_t site_id, uint32_t count,
+                                      const std::vector<uint32_t> &method_ids) {}
+
+        /**
+         * The transform and static initializer times of a class, cumulative.
+         * Supersedes the earlier ones of the class.
+         */
+        virtual void OnClassTimes(int64_t timestamp_ns, const std::string &signature,
+                                  uint32_t transform_us, uint32_t clinit_us,
+                                  uint32_t clinit_self_us) {}
+    };
+
+    /**
+     * Streaming decoder for the binary trace format (see trace_format.h).
+     * Reads one chunk at a time, so the memory use doesn't depend on the
+     * trace size.
+     */
+    class TraceReader {
+    public:
+        struct Stats {
+            uint64_t file_size;
+            uint64_t chunks;
+            uint64_t event_bytes;
+            uint64_t method_events;
+            uint64_t other_events;
+            uint64_t stack_samples;
+            bool truncated;
+        };
+
+        /**
+         * Decodes |path| into |visitor|. Returns false, with a message in
+         * |error|, if the file is not a readable trace. A truncated last chunk
+         * is not an error, it is reported through GetStats().
+         */
+        bool Read(const std::string &path, TraceVisitor *visitor, std::string *error);
+
+        const Stats &GetStats() const { return stats_; }
+
+        int64_t GetStartNs() const { return start_ns_; }
+
+    private:
+        bool ReadTables(TraceChunkType type, const uint8_t *ptr, const uint8_t *end,
+                        TraceVisitor *visitor);
+
+        bool ReadEvents(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadStacks(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadSamples(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadAllocSites(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadAllocCounts(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadHeapHistogram(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadMonitorHistograms(const uint8_t *ptr, const uint8_t *end,
+                                   TraceVisitor *visitor);
+
+        bool ReadGcPauses(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadThreadNames(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadThreadCpu(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadExceptionSites(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadExceptionCounts(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadExceptionStacks(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        bool ReadClassTimes(const uint8_t *ptr, const uint8_t *end, TraceVisitor *visitor);
+
+        Stats stats_ = {};
+        int64_t start_ns_ = 0;
+        uint16_t ts_shift_ = 0;
+    };
+
+}  // namespace profiler
+
+#endif  // TRACE_READER_H
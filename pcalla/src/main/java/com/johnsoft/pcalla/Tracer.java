@@ -0,0 +1,26 @@
+package com.johnsoft.pcalla;
+
+/**
+ * Targets of the probes injected by the pcall agent: the entry/exit probes of
+ * probe mode, the allocation probes of the alloc rules and the static
+ * initializer probes of the clinit rules. The ids identify the instrumented
+ * method, allocation site or class, they are assigned by the agent
+ * when the class is transformed. The methods are registered by the agent
+ * itself.
+ */
+public final class Tracer {
+    private Tracer() {
+    }
+
+    public static native void enter(int id);
+
+    public static native void exit(int id);
+
+    public static native void alloc(int site);
+
+    public static native void allocArray(int site, int length);
+
+    public static native void clinitEnter(int classId);
+
+    public static native void clinitExit(int classId);
+}